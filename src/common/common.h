@@ -165,6 +165,47 @@ struct Value {
 
 enum CompOp { OP_INVALID, OP_IN, OP_EQ, OP_NE, OP_LT, OP_LE, OP_GT, OP_GE };
 
+// 按列类型比较两个字段值，执行器和下推到 RmScan 的过滤条件共用
+static inline int compare(const char* a, const char* b, int col_len,
+                          ColType col_type) {
+  switch (col_type) {
+    case TYPE_INT: {
+      const int ai = *reinterpret_cast<const int*>(a);
+      const int bi = *reinterpret_cast<const int*>(b);
+      return (ai > bi) - (ai < bi);
+    }
+    case TYPE_FLOAT: {
+      const float af = *reinterpret_cast<const float*>(a);
+      const float bf = *reinterpret_cast<const float*>(b);
+      return (af > bf) - (af < bf);
+    }
+    case TYPE_STRING:
+      return memcmp(a, b, col_len);
+    default:
+      throw InternalError("Unexpected data type！");
+  }
+}
+
+// 比较结果是否满足比较运算符
+static inline bool cmp_op(int cmp, CompOp op) {
+  switch (op) {
+    case OP_EQ:
+      return cmp == 0;
+    case OP_NE:
+      return cmp != 0;
+    case OP_LT:
+      return cmp < 0;
+    case OP_GT:
+      return cmp > 0;
+    case OP_LE:
+      return cmp <= 0;
+    case OP_GE:
+      return cmp >= 0;
+    default:
+      throw InternalError("Unexpected op type！");
+  }
+}
+
 struct Condition {
   AggType agg_type;
   TabCol lhs_col;     // left-hand side column
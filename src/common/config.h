@@ -44,19 +44,61 @@ static constexpr int BUFFER_POOL_INSTANCE_SIZE =
 static constexpr int LOG_BUFFER_SIZE =
     (1024 * PAGE_SIZE / 4);             // size of a log buffer in byte
 static constexpr int BUCKET_SIZE = 50;  // size of extendible hash bucket
+// 环形日志缓冲区的大小，由两个 LOG_BUFFER_SIZE 组成，必须是 2 的幂
+static constexpr uint32_t LOG_RING_SIZE = 2 * LOG_BUFFER_SIZE;
+// 环形日志缓冲区的槽位数，日志按起始位置每 16 字节对应一个槽位，必须是 2 的幂
+static constexpr uint32_t LOG_RING_SLOTS = LOG_RING_SIZE / 16;
+// 日志段文件的大小，lsn 的高位是段号，低 LOG_SEGMENT_BITS 位是段内偏移
+static constexpr int LOG_SEGMENT_BITS = 24;
+static constexpr int64_t LOG_SEGMENT_SIZE = int64_t{1} << LOG_SEGMENT_BITS;
+// 检查点之后不再需要的日志段最多留下这么多个，改名后作为之后的日志段重用
+static constexpr int LOG_SPARE_SEGMENTS = 4;
+
+// 共享线程池的最大线程数，也是查询内并行的最大并行度
+static constexpr int MAX_PARALLEL_DEGREE = 16;
+// 聚合算子每批交给工作线程的元组数，输入少于一批时不开启并行
+static constexpr int AGG_BATCH_SIZE = 2048;
+// 并行聚合的分区数，按分组键哈希值的高位分区
+static constexpr int AGG_PARTITION_BITS = 4;
+static constexpr int AGG_PARTITIONS = 1 << AGG_PARTITION_BITS;
+// 并行扫描每个任务块（morsel）包含的页面数
+static constexpr int MORSEL_PAGES = 16;
+// 表的页面数达到该值才使用并行扫描
+static constexpr int PARALLEL_SCAN_MIN_PAGES = 4 * MORSEL_PAGES;
+// 并行扫描经 exchange 每批交给调用线程的元组数
+static constexpr int EXCHANGE_BATCH_SIZE = 1024;
+// 锁表的分片数，每个分片有自己的 latch
+static constexpr int LOCK_TABLE_SHARD_BITS = 6;
+static constexpr int LOCK_TABLE_SHARDS = 1 << LOCK_TABLE_SHARD_BITS;
+// 多版本存储中版本链表的分片数
+static constexpr int VERSION_TABLE_SHARD_BITS = 6;
+static constexpr int VERSION_TABLE_SHARDS = 1 << VERSION_TABLE_SHARD_BITS;
+// 后台回收旧版本的间隔（毫秒）
+static constexpr int VERSION_GC_INTERVAL_MS = 100;
+// 组提交的等待窗口（微秒），日志写线程被提交唤醒后等这么久再刷盘，
+// 让并发提交的事务合并成一次 write + fdatasync
+static constexpr int GROUP_COMMIT_WAIT_US = 200;
+// 等待刷盘的提交达到该数量时不再等满窗口
+static constexpr int GROUP_COMMIT_BATCH_SIZE = 32;
+// 后台模糊检查点的间隔（毫秒）
+static constexpr int CHECKPOINT_INTERVAL_MS = 60000;
+// 检查点每刷这么多脏页让出一次 CPU，避免长时间占用缓冲池的 latch
+static constexpr int CHECKPOINT_FLUSH_BATCH = 64;
 
 using frame_id_t = int32_t;    // frame id type, 帧页ID,
                                // 页在BufferPool中的存储单元称为帧,一帧对应一页
 using page_id_t = int32_t;     // page id type , 页ID
 using txn_id_t = int32_t;      // transaction id type
-using lsn_t = int32_t;         // log sequence number type
+using lsn_t = int64_t;         // log sequence number type, 日志流中的字节位置
 using slot_offset_t = size_t;  // slot offset type
 using oid_t = uint16_t;
 using timestamp_t =
     int32_t;  // timestamp type, used for transaction concurrency
 
-// log file
+// log file, 日志段文件名为 LOG_FILE_NAME.<段号>
 static const std::string LOG_FILE_NAME = "db.log";
+// 记录最后一个完成的检查点的结束记录
+static const std::string MASTER_RECORD_NAME = "db.master";
 
 // replacer
 static const std::string REPLACER_TYPE = "LRU";
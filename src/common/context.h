@@ -12,6 +12,7 @@ See the Mulan PSL v2 for more details. */
 
 #include "recovery/log_manager.h"
 #include "transaction/concurrency/lock_manager.h"
+#include "transaction/concurrency/version_manager.h"
 #include "transaction/transaction.h"
 
 // class TransactionManager;
@@ -34,6 +35,8 @@ class Context {
   // TransactionManager *txn_mgr_;
   LockManager* lock_mgr_;
   LogManager* log_mgr_;
+  // 为空时写操作不保留旧版本，回滚、恢复和导入数据时使用
+  VersionManager* version_mgr_{nullptr};
   Transaction* txn_;
   char* data_send_;
   int* offset_;
@@ -0,0 +1,246 @@
+/* Copyright (c) 2023 Renmin University of China
+RMDB is licensed under Mulan PSL v2.
+You can use this software according to the terms and conditions of the Mulan PSL
+v2. You may obtain a copy of Mulan PSL v2 at:
+        http://license.coscl.org.cn/MulanPSL2
+THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+See the Mulan PSL v2 for more details. */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "common/config.h"
+
+/**
+ * 全局共享的工作线程池，执行所有查询相关的任务：每个连接的 SQL 语句、查询内并行的子任务、load
+ * 每个工作线程有自己的任务队列，池内线程提交的任务放入自己的队列，外部线程轮流放入各个队列；
+ * 线程优先从自己队列的头部取任务，空闲时从其他队列的尾部窃取。
+ *
+ * 池内线程可能长时间阻塞（等锁、等待子任务、等待 exchange 队列），阻塞前要用 BlockingScope 声明，
+ * 线程池在未阻塞的线程数少于核数时启动补偿线程，避免所有线程都在等待而队列中的任务无人执行
+ */
+class ThreadPool {
+ public:
+  using Task = std::function<void()>;
+
+  explicit ThreadPool(int num_threads) : size_(std::max(1, num_threads)) {
+    queues_.reserve(size_);
+    for (int i = 0; i < size_; ++i) {
+      queues_.emplace_back(std::make_unique<WorkQueue>());
+    }
+    threads_ = size_;
+    workers_.reserve(size_);
+    for (int i = 0; i < size_; ++i) {
+      workers_.emplace_back([this, i] { worker_loop(i); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard lock(latch_);
+      stop_ = true;
+    }
+    wake_cv_.notify_all();
+    for (auto& worker : workers_) {
+      worker.join();
+    }
+    // 补偿线程是分离的，等它们全部退出
+    std::unique_lock lock(latch_);
+    spare_cv_.wait(lock, [&] { return spares_ == 0; });
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // 全局线程池，线程数为核数，不超过 MAX_PARALLEL_DEGREE
+  // 不析构，exit 时（如 crash）不等待仍在执行或等锁的任务
+  static ThreadPool& instance() {
+    static ThreadPool* pool = new ThreadPool(
+        std::min(static_cast<int>(std::thread::hardware_concurrency()),
+                 MAX_PARALLEL_DEGREE));
+    return *pool;
+  }
+
+  // 当前线程是否是线程池的线程
+  static bool in_pool() { return current_pool_ != nullptr; }
+
+  int size() const { return size_; }
+
+  // 提交任务，返回 future，异常在 future.get() 时重新抛出
+  template <typename F, typename... Args>
+  auto submit(F&& f, Args&&... args)
+      -> std::future<std::invoke_result_t<F, Args...> > {
+    using R = std::invoke_result_t<F, Args...>;
+    auto task = std::make_shared<std::packaged_task<R()> >(
+        std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+    std::future<R> future = task->get_future();
+    push([task] { (*task)(); });
+    return future;
+  }
+
+  /**
+   * 池内线程进入可能长时间阻塞的区域，析构时退出；不在池内的线程上什么也不做
+   */
+  class BlockingScope {
+   public:
+    BlockingScope() : pool_(current_pool_) {
+      if (pool_ != nullptr) {
+        pool_->begin_blocking();
+      }
+    }
+
+    ~BlockingScope() {
+      if (pool_ != nullptr) {
+        pool_->end_blocking();
+      }
+    }
+
+    BlockingScope(const BlockingScope&) = delete;
+    BlockingScope& operator=(const BlockingScope&) = delete;
+
+   private:
+    ThreadPool* pool_;
+  };
+
+  // 在阻塞区域内等待 future
+  template <typename T>
+  static T wait(std::future<T>& future) {
+    BlockingScope scope;
+    return future.get();
+  }
+
+ private:
+  struct WorkQueue {
+    std::mutex latch;
+    std::deque<Task> tasks;
+  };
+
+  void push(Task task) {
+    int idx = current_pool_ == this && current_worker_ >= 0
+                  ? current_worker_
+                  : static_cast<int>(next_queue_++ % size_);
+    {
+      std::lock_guard lock(queues_[idx]->latch);
+      queues_[idx]->tasks.emplace_back(std::move(task));
+    }
+    {
+      // 持有 latch_ 修改计数，避免工作线程错过唤醒
+      std::lock_guard lock(latch_);
+      ++pending_;
+    }
+    wake_cv_.notify_one();
+  }
+
+  // worker 为 -1 表示补偿线程，没有自己的队列，只窃取
+  bool pop(int worker, Task* task) {
+    if (pending_.load() == 0) {
+      return false;
+    }
+    if (worker >= 0) {
+      auto& queue = *queues_[worker];
+      std::lock_guard lock(queue.latch);
+      if (!queue.tasks.empty()) {
+        *task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+        --pending_;
+        return true;
+      }
+    }
+    int start = worker >= 0 ? worker + 1 : 0;
+    for (int i = 0; i < size_; ++i) {
+      auto& queue = *queues_[(start + i) % size_];
+      std::lock_guard lock(queue.latch);
+      if (!queue.tasks.empty()) {
+        *task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+        --pending_;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void worker_loop(int worker) {
+    current_pool_ = this;
+    current_worker_ = worker;
+    Task task;
+    while (true) {
+      if (pop(worker, &task)) {
+        task();
+        task = nullptr;
+        continue;
+      }
+      std::unique_lock lock(latch_);
+      // 补偿线程在阻塞的线程恢复后退出
+      if (worker < 0 && threads_ - blocked_ > size_) {
+        --threads_;
+        if (--spares_ == 0) {
+          spare_cv_.notify_all();
+        }
+        return;
+      }
+      if (stop_ && pending_ == 0) {
+        if (worker < 0) {
+          --threads_;
+          if (--spares_ == 0) {
+            spare_cv_.notify_all();
+          }
+        }
+        return;
+      }
+      wake_cv_.wait(lock, [&] {
+        return pending_ > 0 || stop_ ||
+               (worker < 0 && threads_ - blocked_ > size_);
+      });
+    }
+  }
+
+  void begin_blocking() {
+    std::lock_guard lock(latch_);
+    ++blocked_;
+    if (threads_ - blocked_ < size_ && !stop_) {
+      ++threads_;
+      ++spares_;
+      std::thread([this] { worker_loop(-1); }).detach();
+    }
+  }
+
+  void end_blocking() {
+    std::lock_guard lock(latch_);
+    --blocked_;
+    // 让多余的补偿线程退出
+    if (spares_ > 0) {
+      wake_cv_.notify_all();
+    }
+  }
+
+  const int size_;
+  std::vector<std::unique_ptr<WorkQueue> > queues_;
+  std::vector<std::thread> workers_;
+  std::atomic<std::size_t> next_queue_{0};
+  std::atomic<int> pending_{0};  // 所有队列中的任务总数
+
+  std::mutex latch_;
+  std::condition_variable wake_cv_;
+  std::condition_variable spare_cv_;
+  bool stop_{false};
+  int threads_{0};  // 线程总数，包括补偿线程
+  int blocked_{0};  // 处于 BlockingScope 中的线程数
+  int spares_{0};   // 补偿线程数
+
+  static inline thread_local ThreadPool* current_pool_ = nullptr;
+  static inline thread_local int current_worker_ = -1;
+};
@@ -188,6 +188,12 @@ class AmbiguousColumnError : public RMDBError {
       : RMDBError("Ambiguous column: " + col_name) {}
 };
 
+class ReadOnlyTransactionError : public RMDBError {
+ public:
+  ReadOnlyTransactionError()
+      : RMDBError("Cannot modify data in a read-only transaction") {}
+};
+
 class PageNotExistError : public RMDBError {
  public:
   PageNotExistError(const std::string& table_name, int page_no)
@@ -0,0 +1,325 @@
+/* Copyright (c) 2023 Renmin University of China
+RMDB is licensed under Mulan PSL v2.
+You can use this software according to the terms and conditions of the Mulan PSL
+v2. You may obtain a copy of Mulan PSL v2 at:
+        http://license.coscl.org.cn/MulanPSL2
+THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+See the Mulan PSL v2 for more details. */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "execution_defs.h"
+
+// 聚合槽：一个聚合函数在哈希表表项中占用的定长空间
+struct AggSlot {
+  AggType type;       // 聚合类型，不会是 AGG_COL
+  ColType col_type;   // 聚合结果的类型，count 为 TYPE_INT
+  int in_offset = 0;  // 输入元组中被聚合字段的偏移，count 不使用
+  int len = 0;        // 聚合结果长度
+  int acc_offset = 0;  // 聚合结果在表项聚合区中的偏移
+
+  bool same_input(const AggSlot& other) const {
+    if (type != other.type) {
+      return false;
+    }
+    // count(*) 和 count(col) 没有空值，结果相同
+    return type == AGG_COUNT || in_offset == other.in_offset;
+  }
+};
+
+// 聚合键和聚合槽的布局，所有线程共享且只读
+class AggregateLayout {
+ public:
+  AggregateLayout() = default;
+
+  // 分组列依次拷贝到定长的键中
+  void add_key_col(const ColMeta& col) {
+    key_cols_.emplace_back(col.offset, col.len);
+    key_len_ += col.len;
+  }
+
+  // 添加聚合槽，相同的聚合函数共用一个槽，返回槽号
+  int add_slot(AggSlot slot) {
+    for (std::size_t i = 0; i < slots_.size(); ++i) {
+      if (slots_[i].same_input(slot)) {
+        return static_cast<int>(i);
+      }
+    }
+    slot.acc_offset = acc_len_;
+    acc_len_ += slot.len;
+    slots_.emplace_back(slot);
+    return static_cast<int>(slots_.size()) - 1;
+  }
+
+  int key_len() const { return key_len_; }
+
+  int acc_len() const { return acc_len_; }
+
+  const AggSlot& slot(int i) const { return slots_[i]; }
+
+  // 从输入元组中抽取分组键
+  void extract_key(const char* tuple, char* key) const {
+    for (auto& [offset, len] : key_cols_) {
+      memcpy(key, tuple + offset, len);
+      key += len;
+    }
+  }
+
+  // 新分组的第一条元组
+  void init_acc(char* acc, const char* tuple) const {
+    for (auto& slot : slots_) {
+      if (slot.type == AGG_COUNT) {
+        const int one = 1;
+        memcpy(acc + slot.acc_offset, &one, sizeof(int));
+      } else {
+        memcpy(acc + slot.acc_offset, tuple + slot.in_offset, slot.len);
+      }
+    }
+  }
+
+  // 已有分组上累加一条元组
+  void update_acc(char* acc, const char* tuple) const {
+    for (auto& slot : slots_) {
+      char* lhs = acc + slot.acc_offset;
+      switch (slot.type) {
+        case AGG_COUNT:
+          ++*reinterpret_cast<int*>(lhs);
+          break;
+        case AGG_SUM:
+          add(lhs, tuple + slot.in_offset, slot.col_type);
+          break;
+        default:
+          combine_min_max(slot, lhs, tuple + slot.in_offset);
+          break;
+      }
+    }
+  }
+
+  // 合并两个线程局部的聚合结果
+  void merge_acc(char* acc, const char* other) const {
+    for (auto& slot : slots_) {
+      char* lhs = acc + slot.acc_offset;
+      const char* rhs = other + slot.acc_offset;
+      switch (slot.type) {
+        case AGG_COUNT:
+          *reinterpret_cast<int*>(lhs) += *reinterpret_cast<const int*>(rhs);
+          break;
+        case AGG_SUM:
+          add(lhs, rhs, slot.col_type);
+          break;
+        default:
+          combine_min_max(slot, lhs, rhs);
+          break;
+      }
+    }
+  }
+
+ private:
+  static void combine_min_max(const AggSlot& slot, char* lhs,
+                              const char* rhs) {
+    int cmp = compare(lhs, rhs, slot.len, slot.col_type);
+    if ((slot.type == AGG_MAX && cmp < 0) ||
+        (slot.type == AGG_MIN && cmp > 0)) {
+      memcpy(lhs, rhs, slot.len);
+    }
+  }
+
+  std::vector<std::pair<int, int> > key_cols_;  // 分组列在输入元组中的 偏移, 长度
+  std::vector<AggSlot> slots_;
+  int key_len_ = 0;
+  int acc_len_ = 0;
+};
+
+// 定长字节串哈希，每次处理 8 字节
+static inline uint64_t hash_bytes(const char* data, int len) {
+  uint64_t h = 0x9e3779b97f4a7c15ULL ^ static_cast<uint64_t>(len);
+  uint64_t word;
+  while (len >= 8) {
+    memcpy(&word, data, 8);
+    h = (h ^ word) * 0xff51afd7ed558ccdULL;
+    h ^= h >> 32;
+    data += 8;
+    len -= 8;
+  }
+  if (len > 0) {
+    word = 0;
+    memcpy(&word, data, len);
+    h = (h ^ word) * 0xc4ceb9fe1a85ec53ULL;
+  }
+  h ^= h >> 29;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 32;
+  return h;
+}
+
+/**
+ * 开放定址（线性探测）聚合哈希表
+ * 每个表项为 | 分组键 | 聚合槽 |，全部为定长字节，连续存放在一块内存中，
+ * 哈希值单独存放，0 表示空槽，扩容时不需要重新计算哈希
+ */
+class AggregateHashTable {
+ public:
+  explicit AggregateHashTable(const AggregateLayout* layout,
+                              std::size_t capacity = 64)
+      : layout_(layout),
+        key_len_(layout->key_len()),
+        entry_size_(align_up(layout->key_len() + layout->acc_len())) {
+    resize(capacity);
+  }
+
+  std::size_t size() const { return size_; }
+
+  std::size_t capacity() const { return hashes_.size(); }
+
+  // 第 i 个槽是否有数据，用于遍历
+  bool occupied(std::size_t i) const { return hashes_[i] != 0; }
+
+  const char* key_at(std::size_t i) const { return entry(i); }
+
+  const char* acc_at(std::size_t i) const { return entry(i) + key_len_; }
+
+  // 插入一条输入元组，分组键已经抽取到 key 中
+  void insert(const char* key, uint64_t hash, const char* tuple) {
+    bool is_new;
+    char* acc = find_or_insert(key, hash, &is_new);
+    if (is_new) {
+      layout_->init_acc(acc, tuple);
+    } else {
+      layout_->update_acc(acc, tuple);
+    }
+  }
+
+  // 合并另一张表上的同一个分组
+  void merge(const char* key, uint64_t hash, const char* other_acc) {
+    bool is_new;
+    char* acc = find_or_insert(key, hash, &is_new);
+    if (is_new) {
+      memcpy(acc, other_acc, layout_->acc_len());
+    } else {
+      layout_->merge_acc(acc, other_acc);
+    }
+  }
+
+  // 合并另一张表的全部分组
+  void merge(const AggregateHashTable& other) {
+    for (std::size_t i = 0; i < other.capacity(); ++i) {
+      if (other.occupied(i)) {
+        merge(other.key_at(i), other.hashes_[i], other.acc_at(i));
+      }
+    }
+  }
+
+  void clear() {
+    size_ = 0;
+    std::fill(hashes_.begin(), hashes_.end(), 0);
+  }
+
+ private:
+  static int align_up(int n) { return (n + 7) & ~7; }
+
+  char* entry(std::size_t i) { return entries_.data() + i * entry_size_; }
+
+  const char* entry(std::size_t i) const {
+    return entries_.data() + i * entry_size_;
+  }
+
+  // 返回分组对应的聚合槽首地址，扩容后之前返回的地址失效
+  char* find_or_insert(const char* key, uint64_t hash, bool* is_new) {
+    if (hash == 0) {
+      hash = 1;
+    }
+    if ((size_ + 1) * 2 > hashes_.size()) {
+      resize(hashes_.size() * 2);
+    }
+    std::size_t mask = hashes_.size() - 1;
+    for (std::size_t i = hash & mask;; i = (i + 1) & mask) {
+      if (hashes_[i] == 0) {
+        hashes_[i] = hash;
+        memcpy(entry(i), key, key_len_);
+        ++size_;
+        *is_new = true;
+        return entry(i) + key_len_;
+      }
+      if (hashes_[i] == hash && memcmp(entry(i), key, key_len_) == 0) {
+        *is_new = false;
+        return entry(i) + key_len_;
+      }
+    }
+  }
+
+  void resize(std::size_t capacity) {
+    std::vector<uint64_t> old_hashes(capacity, 0);
+    std::vector<char> old_entries(capacity * entry_size_);
+    old_hashes.swap(hashes_);
+    old_entries.swap(entries_);
+    std::size_t mask = capacity - 1;
+    for (std::size_t i = 0; i < old_hashes.size(); ++i) {
+      if (old_hashes[i] == 0) {
+        continue;
+      }
+      std::size_t j = old_hashes[i] & mask;
+      while (hashes_[j] != 0) {
+        j = (j + 1) & mask;
+      }
+      hashes_[j] = old_hashes[i];
+      memcpy(entry(j), old_entries.data() + i * entry_size_, entry_size_);
+    }
+  }
+
+  const AggregateLayout* layout_;
+  int key_len_;
+  int entry_size_;
+  std::size_t size_ = 0;
+  std::vector<uint64_t> hashes_;
+  std::vector<char> entries_;
+};
+
+/**
+ * 分区聚合表，按哈希值高位分成 AGG_PARTITIONS 个分区
+ * 每个工作线程持有一个，预聚合时互不干扰；合并阶段每个分区由一个线程独立完成
+ */
+class PartitionedAggregateTable {
+ public:
+  explicit PartitionedAggregateTable(const AggregateLayout* layout)
+      : layout_(layout), key_(layout->key_len()) {
+    parts_.reserve(AGG_PARTITIONS);
+    for (int i = 0; i < AGG_PARTITIONS; ++i) {
+      parts_.emplace_back(layout);
+    }
+  }
+
+  static int partition_of(uint64_t hash) {
+    return static_cast<int>(hash >> (64 - AGG_PARTITION_BITS));
+  }
+
+  // 消费一条输入元组
+  void consume(const char* tuple) {
+    layout_->extract_key(tuple, key_.data());
+    uint64_t hash = hash_bytes(key_.data(), layout_->key_len());
+    parts_[partition_of(hash)].insert(key_.data(), hash, tuple);
+  }
+
+  AggregateHashTable& partition(int i) { return parts_[i]; }
+
+  const AggregateHashTable& partition(int i) const { return parts_[i]; }
+
+  std::size_t size() const {
+    std::size_t n = 0;
+    for (auto& part : parts_) {
+      n += part.size();
+    }
+    return n;
+  }
+
+ private:
+  const AggregateLayout* layout_;
+  std::vector<char> key_;  // 抽取分组键的缓冲区
+  std::vector<AggregateHashTable> parts_;
+};
@@ -0,0 +1,87 @@
+/* Copyright (c) 2023 Renmin University of China
+RMDB is licensed under Mulan PSL v2.
+You can use this software according to the terms and conditions of the Mulan PSL
+v2. You may obtain a copy of Mulan PSL v2 at:
+        http://license.coscl.org.cn/MulanPSL2
+THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+See the Mulan PSL v2 for more details. */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "common/thread_pool.h"
+#include "record/rm_defs.h"
+
+/**
+ * 线程之间交换元组的有界批队列（exchange）
+ * 生产者按批推入元组，消费者按批取出；任意一方都可以关闭队列，
+ * 关闭后生产者的 push 立即返回 false，消费者取完剩余的批后结束
+ */
+template <typename T>
+class BatchQueue {
+ public:
+  using Batch = T;
+
+  explicit BatchQueue(std::size_t capacity) : capacity_(capacity) {}
+
+  // 队列已关闭时返回 false，批被丢弃
+  bool push(Batch batch) {
+    std::unique_lock lock(latch_);
+    auto ready = [&] { return queue_.size() < capacity_ || closed_; };
+    if (!ready()) {
+      ThreadPool::BlockingScope scope;
+      not_full_.wait(lock, ready);
+    }
+    if (closed_) {
+      return false;
+    }
+    queue_.emplace_back(std::move(batch));
+    not_empty_.notify_one();
+    return true;
+  }
+
+  // 队列已关闭且为空时返回 false
+  bool pop(Batch* batch) {
+    std::unique_lock lock(latch_);
+    auto ready = [&] { return !queue_.empty() || closed_; };
+    if (!ready()) {
+      ThreadPool::BlockingScope scope;
+      not_empty_.wait(lock, ready);
+    }
+    if (queue_.empty()) {
+      return false;
+    }
+    *batch = std::move(queue_.front());
+    queue_.pop_front();
+    not_full_.notify_one();
+    return true;
+  }
+
+  void close() {
+    std::lock_guard lock(latch_);
+    closed_ = true;
+    not_empty_.notify_all();
+    not_full_.notify_all();
+  }
+
+ private:
+  std::size_t capacity_;
+  bool closed_{false};
+  std::deque<Batch> queue_;
+  std::mutex latch_;
+  std::condition_variable not_empty_;
+  std::condition_variable not_full_;
+};
+
+// 每个元组一条记录
+using TupleBatchQueue = BatchQueue<std::vector<std::unique_ptr<RmRecord> > >;
+
+// 定长元组首尾相连存放在一块缓冲区中，省去每个元组一次分配
+using FlatBatchQueue = BatchQueue<std::vector<char> >;
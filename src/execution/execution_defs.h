@@ -10,9 +10,14 @@ See the Mulan PSL v2 for more details. */
 
 #pragma once
 
+#include <algorithm>
+
 #include "common/common.h"
+#include "common/thread_pool.h"
 #include "defs.h"
 #include "errors.h"
+#include "record/rm_defs.h"
+#include "record/rm_scan_filter.h"
 #include "system/sm_meta.h"
 
 struct CondOp {
@@ -59,26 +64,6 @@ struct CondOp {
   }
 };
 
-static inline int compare(const char* a, const char* b, int col_len,
-                          ColType col_type) {
-  switch (col_type) {
-    case TYPE_INT: {
-      const int ai = *reinterpret_cast<const int*>(a);
-      const int bi = *reinterpret_cast<const int*>(b);
-      return (ai > bi) - (ai < bi);
-    }
-    case TYPE_FLOAT: {
-      const float af = *reinterpret_cast<const float*>(a);
-      const float bf = *reinterpret_cast<const float*>(b);
-      return (af > bf) - (af < bf);
-    }
-    case TYPE_STRING:
-      return memcmp(a, b, col_len);
-    default:
-      throw InternalError("Unexpected data type！");
-  }
-}
-
 inline int ix_compare(char*& a, char*& b, const IndexMeta& index_meta) {
   for (auto& [index_offset, col_meta] : index_meta.cols) {
     int res = compare(a + index_offset, b + index_offset, col_meta.len,
@@ -88,6 +73,46 @@ inline int ix_compare(char*& a, char*& b, const IndexMeta& index_meta) {
   return 0;
 }
 
+/**
+ * @description: 尝试把谓词下推为 RmScan 的过滤条件
+ * @return {bool} 下推成功返回 true；子查询算子、类型不一致等情况返回 false，
+ *                 由算子自己求值
+ */
+static inline bool push_down_cond(const Condition& cond, const ColMeta& col,
+                                  RmScanFilter* filter) {
+  if (cond.op == OP_INVALID) {
+    return false;
+  }
+  if (cond.is_rhs_val) {
+    if (cond.op == OP_IN || cond.rhs_val.type != col.type) {
+      return false;
+    }
+    filter->add(col.offset, col.len, col.type, cond.op,
+                cond.rhs_val.raw->data);
+    return true;
+  }
+  // 已经求出值列表的子查询
+  if (!cond.is_sub_query || cond.rhs_value_list.empty()) {
+    return false;
+  }
+  std::vector<const char*> values;
+  for (auto& value : cond.rhs_value_list) {
+    if (value.type != col.type) {
+      return false;
+    }
+    values.emplace_back(value.raw->data);
+  }
+  if (cond.op == OP_IN) {
+    filter->add_in(col.offset, col.len, col.type, values);
+    return true;
+  }
+  if (values.size() != 1) {
+    return false;
+  }
+  filter->add(col.offset, col.len, col.type, cond.op, values[0]);
+  return true;
+}
+
 static inline void add(char* a, const char* b, ColType col_type) {
   switch (col_type) {
     case TYPE_INT: {
@@ -109,3 +134,76 @@ static inline void add(char* a, const char* b, ColType col_type) {
       throw InternalError("Unexpected data type to add！");
   }
 }
+
+// 查询内并行度，即共享线程池的线程数
+static inline int parallel_degree() { return ThreadPool::instance().size(); }
+
+/**
+ * 扫描算子的投影：只输出上层算子引用到的列，
+ * 输出元组中的列按表中的顺序紧凑排列，cols() 中的偏移是输出元组中的偏移。
+ * 表中相邻的列合并成一次拷贝
+ */
+class ScanProjection {
+ public:
+  ScanProjection() = default;
+
+  // col_names 为空或包含了全部列时不投影，输出完整记录
+  ScanProjection(const TabMeta& tab, const std::vector<std::string>& col_names)
+      : cols_(tab.cols),
+        len_(tab.cols.back().offset + tab.cols.back().len) {
+    std::vector<ColMeta> cols;
+    int len = 0;
+    for (auto& col : tab.cols) {
+      if (std::find(col_names.begin(), col_names.end(), col.name) ==
+          col_names.end()) {
+        continue;
+      }
+      if (!runs_.empty() &&
+          runs_.back().src_offset + runs_.back().len == col.offset) {
+        runs_.back().len += col.len;
+      } else {
+        runs_.push_back({col.offset, len, col.len});
+      }
+      cols.emplace_back(col);
+      cols.back().offset = len;
+      len += col.len;
+    }
+    if (cols.empty() || cols.size() == tab.cols.size()) {
+      runs_.clear();
+      return;
+    }
+    cols_ = std::move(cols);
+    len_ = len;
+  }
+
+  bool empty() const { return runs_.empty(); }
+
+  const std::vector<ColMeta>& cols() const { return cols_; }
+
+  size_t len() const { return len_; }
+
+  // 从表的完整记录中取出投影后的元组
+  std::unique_ptr<RmRecord> project(const char* data) const {
+    auto record = std::make_unique<RmRecord>(static_cast<int>(len_));
+    project(data, record->data);
+    return record;
+  }
+
+  // 投影到调用方的缓冲区，out 至少 len() 字节
+  void project(const char* data, char* out) const {
+    for (auto& run : runs_) {
+      memcpy(out + run.dst_offset, data + run.src_offset, run.len);
+    }
+  }
+
+ private:
+  struct CopyRun {
+    int src_offset;
+    int dst_offset;
+    int len;
+  };
+
+  std::vector<ColMeta> cols_;
+  size_t len_{0};
+  std::vector<CopyRun> runs_;
+};
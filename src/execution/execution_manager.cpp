@@ -20,6 +20,7 @@ See the Mulan PSL v2 for more details. */
 #include "executor_update.h"
 #include "index/ix.h"
 #include "record_printer.h"
+#include "recovery/checkpoint_manager.h"
 
 const char* help_info =
     "Supported SQL syntax:\n"
@@ -101,7 +102,9 @@ void QlManager::run_mutli_query(std::shared_ptr<Plan>& plan, Context* context) {
         break;
       }
       case T_CreateIndex: {
-        sm_manager_->create_index(x->tab_name_, x->tab_col_names_, context);
+        sm_manager_->create_index(x->tab_name_, x->tab_col_names_, context,
+                                  x->unique_, x->include_col_names_,
+                                  x->index_type_);
         break;
       }
       case T_DropIndex: {
@@ -143,6 +146,12 @@ void QlManager::run_cmd_utility(std::shared_ptr<Plan>& plan,
         context->txn_->set_txn_mode(true);
         break;
       }
+      case T_Transaction_begin_read_only: {
+        // 只读事务在开始时取快照，之后的查询都读这个快照，不加锁
+        context->txn_->set_txn_mode(true);
+        txn_mgr_->begin_snapshot(context->txn_);
+        break;
+      }
       case T_Transaction_commit: {
         context->txn_ = txn_mgr_->get_transaction(*txn_id);
         txn_mgr_->commit(context->txn_, context->log_mgr_);
@@ -180,49 +189,16 @@ void QlManager::run_cmd_utility(std::shared_ptr<Plan>& plan,
       }
     }
   } else if (auto x = std::dynamic_pointer_cast<StaticCheckpointPlan>(plan)) {
-    // TODO
-    // 这里静态检查点作了优化，直接把检查点之前的日志清空，这样有检查点地址一定是日志文件头，且是最后一个检查点
-    // 先提交了再刷盘
-    // 1.停止接收新事务和正在运行事务
-    // 2.将仍保留在日志缓冲区中的内容写到日志文件中
-    // 如果是隐式事务执行，这里设置为显式，这样就不会多写一条 commit
-    // log，保证日志纯净
+    // 如果是隐式事务执行，这里设置为显式，这样就不会多写一条 commit log
     context->txn_->set_txn_mode(true);
     context->txn_ = txn_mgr_->get_transaction(*txn_id);
     txn_mgr_->commit(context->txn_, context->log_mgr_);
 
-    // 3.在日志文件中写入一个“检查点记录” 忽略
-    // auto *static_checkpoint_log_record = new
-    // StaticCheckpointLogRecord(context->txn_->get_transaction_id());
-    // static_checkpoint_log_record->prev_lsn_ = context->txn_->get_prev_lsn();
-    // context->txn_->set_prev_lsn(context->log_mgr_->add_log_to_buffer(static_checkpoint_log_record));
-    // log_manager->flush_log_to_disk();
-
-    // 4.将当前数据库缓冲区中的内容写到磁盘中
+    // 模糊检查点，其他事务照常执行，不再清空日志
     sm_manager_->flush_meta();
-
-    for (auto& [_, fh] : sm_manager_->fhs_) {
-      std::ignore = _;
-      sm_manager_->get_rm_manager()->flush_file(fh.get());
+    if (checkpoint_mgr_ != nullptr) {
+      checkpoint_mgr_->checkpoint();
     }
-    for (auto& [_, ih] : sm_manager_->ihs_) {
-      std::ignore = _;
-      sm_manager_->get_ix_manager()->flush_index(ih.get());
-    }
-    // 直接把日志清空
-    // 如果日志文件已经开启，先关闭
-    auto disk_manager = sm_manager_->get_disk_manager();
-    auto log_fd = disk_manager->GetLogFd();
-    if (log_fd != -1) {
-      disk_manager->close_file(log_fd);
-      sm_manager_->get_disk_manager()->SetLogFd(-1);
-    }
-
-    std::ofstream ofs(LOG_FILE_NAME, std::ios::trunc);
-    ofs.close();
-
-    // exit(1);
-    // 5.把日志文件中检查点记录的地址写到“重新启动文件”中 忽略
   }
 }
 
@@ -27,17 +27,22 @@ See the Mulan PSL v2 for more details. */
 #include "transaction/transaction_manager.h"
 
 class Planner;
+class CheckpointManager;
 
 class QlManager {
  private:
   SmManager* sm_manager_;
   TransactionManager* txn_mgr_;
   Planner* planner_;
+  CheckpointManager* checkpoint_mgr_;
 
  public:
   QlManager(SmManager* sm_manager, TransactionManager* txn_mgr,
-            Planner* planner)
-      : sm_manager_(sm_manager), txn_mgr_(txn_mgr), planner_(planner) {}
+            Planner* planner, CheckpointManager* checkpoint_mgr = nullptr)
+      : sm_manager_(sm_manager),
+        txn_mgr_(txn_mgr),
+        planner_(planner),
+        checkpoint_mgr_(checkpoint_mgr) {}
 
   void run_mutli_query(std::shared_ptr<Plan>& plan, Context* context);
 
@@ -42,6 +42,10 @@ class AbstractExecutor {
 
   virtual std::unique_ptr<RmRecord> Next() = 0;
 
+  // 当前元组的数据，不拷贝，nextTuple 之后失效。不支持的算子返回 nullptr，
+  // 调用方改用 Next()
+  virtual const char* peek() { return nullptr; }
+
   virtual ColMeta get_col_offset(const TabCol& target) { return ColMeta(); }
 
   // 弃用
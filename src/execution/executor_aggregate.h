@@ -1,229 +1,44 @@
 #pragma once
 
+#include <future>
+
+#include "aggregate_hash_table.h"
+#include "exchange.h"
 #include "execution_defs.h"
 #include "execution_manager.h"
 #include "executor_abstract.h"
+#include "executor_parallel_seq_scan.h"
 #include "index/ix.h"
 #include "system/sm.h"
 
-struct AggregateKey {
-  // 用 rmcord 可能更好
-  std::vector<Value> group_bys;
-};
-
-struct AggregateValue {
-  // 用 rmcord 可能更好，select 里面的聚合值
-  std::vector<Value> values;
-  // having 里面的聚合值
-  std::vector<Value> having_values;
-};
-
-struct AggregateKeyHash {
-  std::size_t operator()(const AggregateKey& key) const {
-    std::size_t hash = 0;
-    for (const auto& value : key.group_bys) {
-      switch (value.type) {
-        case TYPE_INT: {
-          hash ^= std::hash<int>()(value.int_val);
-          break;
-        }
-        case TYPE_FLOAT: {
-          hash ^= std::hash<float>()(value.float_val);
-          break;
-        }
-        case TYPE_STRING: {
-          hash ^= std::hash<std::string>()(value.str_val);
-          break;
-        }
-      }
-      // hash ^= std::hash<int>()(value.int_val) ^
-      // std::hash<float>()(value.float_val) ^ std::hash<std::string>()(
-      //     value.str_val);
-    }
-    return hash;
-  }
-};
-
-struct AggregateKeyEqual {
-  bool operator()(const AggregateKey& lhs, const AggregateKey& rhs) const {
-    return lhs.group_bys == rhs.group_bys;
-  }
-};
-
-class AggregateHashTable {
- public:
-  AggregateHashTable(const std::vector<AggType>& agg_types,
-                     const std::vector<Condition>& having_conds)
-      : agg_types_(agg_types), having_conds_(having_conds) {}
-
-  auto generateInitialAggregateValue(const AggregateValue& input)
-      -> AggregateValue {
-    std::vector<Value> values;
-    std::vector<Value> having_values;
-    for (std::size_t i = 0; i < agg_types_.size(); ++i) {
-      switch (agg_types_[i]) {
-        case AGG_COUNT: {
-          Value v;
-          v.set_int(1);
-          v.init_raw(sizeof(int));
-          values.emplace_back(v);
-          break;
-        }
-        case AGG_MAX:
-        case AGG_MIN:
-        case AGG_SUM:
-          // 直接初始化为输入值
-          values.emplace_back(input.values[i]);
-          break;
-        case AGG_COL:
-          // 占位
-          values.emplace_back();
-          break;
-        default:
-          throw InternalError("Unexpected aggregate type！");
-      }
-    }
-
-    for (std::size_t i = 0; i < having_conds_.size(); ++i) {
-      switch (having_conds_[i].agg_type) {
-        case AGG_COUNT: {
-          Value v;
-          v.set_int(1);
-          v.init_raw(sizeof(int));
-          having_values.emplace_back(v);
-          break;
-        }
-        case AGG_MAX:
-        case AGG_MIN:
-        case AGG_SUM:
-          // 直接初始化为输入值
-          having_values.emplace_back(input.having_values[i]);
-          break;
-        case AGG_COL:
-        default:
-          throw InternalError("Unexpected aggregate type！");
-      }
-    }
-
-    return {values, having_values};
-  }
-
-  void combineAggregateValues(AggregateValue* result,
-                              const AggregateValue& input) {
-    for (std::size_t i = 0; i < agg_types_.size(); i++) {
-      switch (agg_types_[i]) {
-        case AGG_COUNT:
-          // result->values[i].set_int(result->values[i].int_val + 1);
-          result->values[i].int_val += 1;
-          break;
-        case AGG_MAX: {
-          auto& lhs = result->values[i];
-          auto& rhs = input.values[i];
-          if (compare(lhs.raw->data, rhs.raw->data, lhs.str_val.size(),
-                      lhs.type) < 0) {
-            lhs = rhs;
-          }
-          break;
-        }
-        case AGG_MIN: {
-          auto& lhs = result->values[i];
-          const auto& rhs = input.values[i];
-          if (compare(lhs.raw->data, rhs.raw->data, lhs.str_val.size(),
-                      lhs.type) > 0) {
-            lhs = rhs;
-          }
-          break;
-        }
-        case AGG_SUM: {
-          auto& lhs = result->values[i];
-          const auto& rhs = input.values[i];
-          add(lhs.raw->data, rhs.raw->data, lhs.type);
-          break;
-        }
-        case AGG_COL:
-          break;
-      }
-    }
-
-    for (std::size_t i = 0; i < having_conds_.size(); i++) {
-      switch (having_conds_[i].agg_type) {
-        case AGG_COUNT:
-          // result->values[i].set_int(result->values[i].int_val + 1);
-          result->having_values[i].int_val += 1;
-          break;
-        case AGG_MAX: {
-          auto& lhs = result->having_values[i];
-          auto& rhs = input.having_values[i];
-          if (compare(lhs.raw->data, rhs.raw->data, lhs.str_val.size(),
-                      lhs.type) < 0) {
-            lhs = rhs;
-          }
-          break;
-        }
-        case AGG_MIN: {
-          auto& lhs = result->having_values[i];
-          const auto& rhs = input.having_values[i];
-          if (compare(lhs.raw->data, rhs.raw->data, lhs.str_val.size(),
-                      lhs.type) > 0) {
-            lhs = rhs;
-          }
-          break;
-        }
-        case AGG_SUM: {
-          auto& lhs = result->having_values[i];
-          const auto& rhs = input.having_values[i];
-          add(lhs.raw->data, rhs.raw->data, lhs.type);
-          break;
-        }
-        case AGG_COL:
-        default:
-          throw InternalError("Unexpected aggregate type！");
-      }
-    }
-  }
-
-  void insertCombine(const AggregateKey& agg_key,
-                     const AggregateValue& agg_val) {
-    if (hash_table_.count(agg_key) == 0) {
-      hash_table_.emplace(agg_key, generateInitialAggregateValue(agg_val));
-    } else {
-      combineAggregateValues(&hash_table_[agg_key], agg_val);
-    }
-  }
-
- public:
-  std::unordered_map<AggregateKey, AggregateValue, AggregateKeyHash,
-                     AggregateKeyEqual>
-      hash_table_;
-  const std::vector<AggType>& agg_types_;
-  const std::vector<Condition>& having_conds_;
-};
-
 class AggregateExecutor : public AbstractExecutor {
  private:
-  std::string tab_name_;              // 表的名称
-  std::vector<Condition> conds_;      // scan的条件
-  RmFileHandle* fh_;                  // 表的数据文件句柄
-  std::vector<ColMeta> cols_;         // scan后生成的记录的字段
-  size_t len_;                        // scan后生成的每条记录的长度
-  std::vector<Condition> fed_conds_;  // 同conds_，两个字段相同
+  // 输出列的来源：分组键或聚合槽
+  struct OutputCol {
+    bool from_key;
+    int offset;  // 在键或聚合区中的偏移
+    int len;
+  };
+
   Rid rid_;
-  std::unique_ptr<RecScan> scan_;  // table_iterator
-  SmManager* sm_manager_;
-  std::unique_ptr<RmRecord> rm_record_;
   std::unique_ptr<AbstractExecutor> prev_;
-  std::vector<ColMeta> sel_cols_;
-  std::vector<ColMeta> having_cols_;
+  std::vector<ColMeta> cols_;      // 子算子输出的字段
+  size_t len_;                     // 聚合后每条记录的长度
+  std::vector<ColMeta> sel_cols_;  // 聚合后生成的记录的字段
   std::vector<AggType> agg_types_;
   std::vector<Condition> having_conds_;
   std::vector<ColMeta> group_bys_;
-
-  AggregateHashTable ht_;
-  std::unordered_map<AggregateKey, AggregateValue, AggregateKeyHash,
-                     AggregateKeyEqual>::iterator it_;
   bool has_group_col_{false};
   bool is_empty_table_{false};
 
+  AggregateLayout layout_;
+  std::vector<OutputCol> out_cols_;
+  std::vector<int> having_slots_;  // 每个 having 条件对应的聚合槽
+  // 每个线程一张分区表，合并后结果都在第 0 张
+  std::vector<std::unique_ptr<PartitionedAggregateTable> > locals_;
+  int part_idx_{0};
+  std::size_t slot_idx_{0};
+
  public:
   AggregateExecutor(std::unique_ptr<AbstractExecutor> prev,
                     const std::vector<TabCol>& sel_cols,
@@ -232,15 +47,16 @@ class AggregateExecutor : public AbstractExecutor {
                     std::vector<Condition> having_conds, Context* context)
       : prev_(std::move(prev)),
         agg_types_(std::move(agg_types)),
-        having_conds_(std::move(having_conds)),
-        ht_(agg_types_, having_conds_) {
-    // sm_manager_ = sm_manager;
-    // tab_name_ = std::move(tab_name);
-    // conds_ = std::move(conds);
-    // TabMeta &tab = sm_manager_->db_.get_table(tab_name_);
-    // fh_ = sm_manager_->fhs_.at(tab_name_).get();
-    // seq 的所有列
-    cols_ = prev_->cols();
+        having_conds_(std::move(having_conds)) {
+    // seq 的所有列，并行扫描交给聚合的是页面上的完整记录
+    auto* scan = dynamic_cast<ParallelSeqScanExecutor*>(prev_.get());
+    cols_ = scan != nullptr ? scan->table_cols() : prev_->cols();
+
+    // 分组列依次组成定长的聚合键
+    for (auto& group_by : group_bys) {
+      group_bys_.emplace_back(*get_col(cols_, group_by));
+      layout_.add_key_col(group_bys_.back());
+    }
 
     // 记得先清 0
     len_ = 0;
@@ -258,220 +74,96 @@ class AggregateExecutor : public AbstractExecutor {
         sel_cols_.back().offset = sizeof(int);
       } else {
         sel_cols_.emplace_back(*get_col(cols_, sel_col));
-        // count 输出整数，需要改变列类型和偏移量
-        if (agg_types_[i] == AGG_COUNT && sel_cols_.back().type != TYPE_INT) {
-          sel_cols_.back().type = TYPE_INT;
-          sel_cols_.back().len = sizeof(int);
-          // 改和不改都没事
-          sel_cols_.back().offset = sizeof(int);
+      }
+      if (agg_types_[i] == AGG_COL) {
+        // 分组列直接从键中取，analyze 已保证其在 group by 中
+        int key_offset = 0;
+        for (auto& group_by : group_bys_) {
+          if (group_by == sel_cols_.back()) {
+            break;
+          }
+          key_offset += group_by.len;
         }
+        out_cols_.push_back({true, key_offset, sel_cols_.back().len});
+      } else {
+        int slot = add_agg_slot(agg_types_[i], &sel_cols_.back());
+        out_cols_.push_back({false, layout_.slot(slot).acc_offset,
+                             layout_.slot(slot).len});
       }
       len_ += sel_cols_.back().len;
     }
 
     for (auto& having_cond : having_conds_) {
+      ColMeta having_col;
       // count(*)
       if (having_cond.agg_type == AGG_COUNT &&
           having_cond.lhs_col.tab_name.empty() &&
           having_cond.lhs_col.col_name.empty()) {
-        // 占位
-        having_cols_.emplace_back();
-        having_cols_.back().type = TYPE_INT;
-        having_cols_.back().len = sizeof(int);
-        // 改和不改都没事
-        having_cols_.back().offset = sizeof(int);
+        having_col.type = TYPE_INT;
+        having_col.len = sizeof(int);
       } else {
-        having_cols_.emplace_back(*get_col(cols_, having_cond.lhs_col));
-        // count(course)
-        if (having_cond.agg_type == AGG_COUNT &&
-            having_cols_.back().type != TYPE_INT) {
-          having_cols_.back().type = TYPE_INT;
-          having_cols_.back().len = sizeof(int);
-          // 改和不改都没事
-          having_cols_.back().offset = sizeof(int);
-        }
+        having_col = *get_col(cols_, having_cond.lhs_col);
       }
+      having_slots_.emplace_back(
+          add_agg_slot(having_cond.agg_type, &having_col));
     }
 
-    // for (auto &sel_col: sel_cols) {
-    //     // TODO 注意 count(*)
-    //     sel_cols_.emplace_back(*get_col(cols_, sel_col));
-    //     len_ += sel_cols_.back().len;
-    // }
-
-    for (auto& group_by : group_bys) {
-      group_bys_.emplace_back(*get_col(cols_, group_by));
-    }
-
-    // len_ = cols_.back().offset + cols_.back().len;
     context_ = context;
-    // fed_conds_ = conds_;
   }
 
   void beginTuple() override {
     // 子查询要清空，也可以直接缓存？
-    ht_.hash_table_.clear();
-    prev_->beginTuple();
-
-    std::vector<Value> keys(group_bys_.size());
-    std::vector<Value> values(agg_types_.size());
-    std::vector<Value> having_values(having_conds_.size());
-
-    while (!prev_->is_end()) {
-      keys.clear();
-      values.clear();
-      having_values.clear();
-
-      rm_record_ = prev_->Next();
-      for (auto& group_by : group_bys_) {
-        keys.emplace_back();
-        if (group_by.type == TYPE_INT) {
-          const int a =
-              *reinterpret_cast<const int*>(rm_record_->data + group_by.offset);
-          keys.back().set_int(a);
-        } else if (group_by.type == TYPE_FLOAT) {
-          const float a = *reinterpret_cast<const float*>(rm_record_->data +
-                                                          group_by.offset);
-          keys.back().set_float(a);
-        } else if (group_by.type == TYPE_STRING) {
-          std::string s(rm_record_->data + group_by.offset, group_by.len);
-          keys.back().set_str(s);
-        } else {
-          throw InternalError("Unexpected data type！");
-        }
-        // memcpy(keys.back().raw->data, rm_record_->data + group_by.offset,
-        // group_by.len);
-        keys.back().init_raw(group_by.len);
+    locals_.clear();
+    locals_.emplace_back(std::make_unique<PartitionedAggregateTable>(&layout_));
+    is_empty_table_ = false;
+
+    if (auto* scan = dynamic_cast<ParallelSeqScanExecutor*>(prev_.get())) {
+      // 并行扫描的工作线程直接做预聚合，不经过 exchange
+      for (int i = 1; i < scan->degree(); ++i) {
+        locals_.emplace_back(
+            std::make_unique<PartitionedAggregateTable>(&layout_));
       }
-
-      // 获取 select 里面的聚合值
-      for (std::size_t i = 0; i < agg_types_.size(); ++i) {
-        switch (agg_types_[i]) {
-          case AGG_COUNT: {
-            Value v;
-            v.set_int(1);
-            v.init_raw(sizeof(int));
-            values.emplace_back(v);
-            break;
-          }
-          case AGG_MAX:
-          case AGG_MIN:
-          case AGG_SUM: {
-            // TODO 记得初始化
-            Value v;
-            if (sel_cols_[i].type == TYPE_INT) {
-              const int a = *reinterpret_cast<const int*>(rm_record_->data +
-                                                          sel_cols_[i].offset);
-              v.set_int(a);
-            } else if (sel_cols_[i].type == TYPE_FLOAT) {
-              const float a = *reinterpret_cast<const float*>(
-                  rm_record_->data + sel_cols_[i].offset);
-              v.set_float(a);
-            } else if (sel_cols_[i].type == TYPE_STRING) {
-              // throw InternalError("You cant aggreagte string with
-              // max/min/sum");
-              std::string s(rm_record_->data + sel_cols_[i].offset,
-                            sel_cols_[i].len);
-              v.set_str(s);
-            }
-            v.init_raw(sel_cols_[i].len);
-            values.emplace_back(v);
-            break;
-          }
-          case AGG_COL:
-            values.emplace_back();
-            break;
-          default:
-            throw InternalError("Unexpected aggregate type！");
-        }
+      scan->parallel_for_each([this](int worker, const char* tuple) {
+        locals_[worker]->consume(tuple);
+      });
+      parallel_merge();
+    } else {
+      prev_->beginTuple();
+      // 先在当前线程消费一批，输入很少时没必要开启并行
+      std::unique_ptr<RmRecord> record;
+      for (int i = 0; i < AGG_BATCH_SIZE && !prev_->is_end();
+           ++i, prev_->nextTuple()) {
+        locals_[0]->consume(current_tuple(&record));
       }
-
-      // 获取 having 里面的聚合值
-      for (std::size_t i = 0; i < having_conds_.size(); ++i) {
-        switch (having_conds_[i].agg_type) {
-          case AGG_COUNT: {
-            Value v;
-            v.set_int(1);
-            v.init_raw(sizeof(int));
-            having_values.emplace_back(v);
-            break;
-          }
-          case AGG_MAX:
-          case AGG_MIN:
-          case AGG_SUM: {
-            // TODO 记得初始化
-            Value v;
-            if (having_cols_[i].type == TYPE_INT) {
-              const int a = *reinterpret_cast<const int*>(
-                  rm_record_->data + having_cols_[i].offset);
-              v.set_int(a);
-            } else if (having_cols_[i].type == TYPE_FLOAT) {
-              const float a = *reinterpret_cast<const float*>(
-                  rm_record_->data + having_cols_[i].offset);
-              v.set_float(a);
-            } else if (having_cols_[i].type == TYPE_STRING) {
-              std::string s(rm_record_->data + having_cols_[i].offset,
-                            having_cols_[i].len);
-              v.set_str(s);
-            }
-            v.init_raw(having_cols_[i].len);
-            having_values.emplace_back(v);
-            break;
-          }
-          case AGG_COL:
-          default:
-            throw InternalError("Unexpected aggregate type！");
-        }
+      if (!prev_->is_end()) {
+        parallel_consume();
+        parallel_merge();
       }
-
-      ht_.insertCombine({keys}, {values, having_values});
-      prev_->nextTuple();
     }
 
-    it_ = ht_.hash_table_.begin();
+    part_idx_ = 0;
+    slot_idx_ = 0;
     // 空表
-    if (it_ == ht_.hash_table_.end()) {
+    if (locals_[0]->size() == 0) {
       // 空表且有group by，但是没有key直接输出空表
       if (!group_bys_.empty() && has_group_col_) {
+        part_idx_ = AGG_PARTITIONS;
         return;
       }
       is_empty_table_ = true;
+      return;
     }
-
-    while (it_ != ht_.hash_table_.end()) {
-      std::size_t i = 0;
-      for (; i < it_->second.having_values.size(); ++i) {
-        if (!cmp_cond(it_->second.having_values[i], having_conds_[i].rhs_val,
-                      having_conds_[i])) {
-          break;
-        }
-      }
-      if (i == having_conds_.size()) {
-        break;
-      }
-      ++it_;
-    }
+    seek_valid();
   }
 
   void nextTuple() override {
     if (is_empty_table_) {
       is_empty_table_ = false;
+      part_idx_ = AGG_PARTITIONS;
       return;
     }
-    ++it_;
-    while (it_ != ht_.hash_table_.end()) {
-      std::size_t i = 0;
-      for (; i < it_->second.having_values.size(); ++i) {
-        if (!cmp_cond(it_->second.having_values[i], having_conds_[i].rhs_val,
-                      having_conds_[i])) {
-          break;
-        }
-      }
-      if (i == having_conds_.size()) {
-        break;
-      }
-      ++it_;
-    }
+    ++slot_idx_;
+    seek_valid();
   }
 
   std::unique_ptr<RmRecord> Next() override {
@@ -480,132 +172,189 @@ class AggregateExecutor : public AbstractExecutor {
     if (is_empty_table_) {
       int offset = 0;
       for (std::size_t i = 0; i < agg_types_.size(); ++i) {
-        switch (agg_types_[i]) {
-          case AGG_COUNT: {
-            int zero = 0;
-            memcpy(record->data + offset, &zero, sizeof(int));
-            offset += sizeof(int);
-            break;
-          }
-          case AGG_MAX:
-          case AGG_MIN:
-          case AGG_SUM:
-          // {
-          //     // 为了输出空改为字符串类型，原来 len 不变
-          //     sel_cols_[i].type = TYPE_STRING;
-          //     std::string s;
-          //     memcpy(record->data + offset, s.c_str(), sel_cols_[i].len);
-          //     offset += sel_cols_[i].len;
-          //     break;
-          // }
-          case AGG_COL:
-          default:
-            throw InternalError("Unsupported aggregate null type！");
+        if (agg_types_[i] != AGG_COUNT) {
+          throw InternalError("Unsupported aggregate null type！");
         }
+        int zero = 0;
+        memcpy(record->data + offset, &zero, sizeof(int));
+        offset += sizeof(int);
       }
-      return std::move(record);
+      return record;
     }
 
+    auto& table = locals_[0]->partition(part_idx_);
+    const char* key = table.key_at(slot_idx_);
+    const char* acc = table.acc_at(slot_idx_);
     int offset = 0;
-
-    // for (std::size_t i = 0; i < sel_cols_.size(); ++i) {
-    //     auto &sel_col = sel_cols_[i];
-    //     if (agg_types_[i] == AGG_COL) {
-    //         auto &&pos = std::find_if(group_bys_.begin(), group_bys_.end(),
-    //         [&](ColMeta& col_meta) {
-    //             return col_meta.tab_name == sel_col.tab_name && col_meta.name
-    //             == sel_col.name;
-    //         });
-    //         if (pos == group_bys_.end()) {
-    //             throw InternalError("SELECT 列表中不能出现没有在 GROUP BY
-    //             子句中的非聚集列！");
-    //         }
-    //         memcpy(record->data + offset, ->data, group_bys_[i].len);
-    //     }
-    //
-    //     memcpy(record->data + offset, key.raw->data, group_bys_[i].len);
-    //     offset += group_bys_[i].len;
-    // }
-
-    // 先生成左 key 右 value 的形式，具体列顺序由投影算子执行
-    if (has_group_col_) {
-      for (std::size_t i = 0; i < group_bys_.size(); ++i) {
-        auto& key = it_->first.group_bys[i];
-        memcpy(record->data + offset, key.raw->data, group_bys_[i].len);
-        offset += group_bys_[i].len;
-      }
-    }
-
-    for (std::size_t i = 0; i < agg_types_.size(); ++i) {
-      if (agg_types_[i] == AGG_COL) {
-        continue;
-      }
-      auto& value = it_->second.values[i];
-      if (agg_types_[i] == AGG_COUNT) {
-        memcpy(record->data + offset, &value.int_val, sel_cols_[i].len);
-      } else {
-        memcpy(record->data + offset, value.raw->data, sel_cols_[i].len);
-      }
-      offset += sel_cols_[i].len;
+    // 按 select 列的顺序输出，分组列取自键，聚合值取自聚合槽
+    for (auto& out_col : out_cols_) {
+      const char* src = out_col.from_key ? key : acc;
+      memcpy(record->data + offset, src + out_col.offset, out_col.len);
+      offset += out_col.len;
     }
-
-    // assert(offset == len_);
-    return std::move(record);
+    return record;
   }
 
   Rid& rid() override { return rid_; }
 
-  bool is_end() const {
+  bool is_end() const override {
     // 空表输出一次
     if (is_empty_table_) {
       return false;
     }
-    return it_ == ht_.hash_table_.end();
+    return part_idx_ >= AGG_PARTITIONS;
   }
 
   const std::vector<ColMeta>& cols() const override { return sel_cols_; }
 
   size_t tupleLen() const override { return len_; }
 
-  // 判断是否满足单个谓词条件
-  static bool cmp_cond(const Value& l_rec, const Value& r_rec,
-                       const Condition& cond) {
-    if (l_rec.type != r_rec.type) {
-      throw IncompatibleTypeError(coltype2str(l_rec.type),
-                                  coltype2str(r_rec.type));
+  std::string getType() override { return "AggregateExecutor"; }
+
+ private:
+  // 为聚合函数分配聚合槽，count 会把输出列改为整数
+  int add_agg_slot(AggType agg_type, ColMeta* col) {
+    // count 输出整数，需要改变列类型和偏移量
+    if (agg_type == AGG_COUNT && col->type != TYPE_INT) {
+      col->type = TYPE_INT;
+      col->len = sizeof(int);
+      // 改和不改都没事
+      col->offset = sizeof(int);
     }
-    if (l_rec.type == TYPE_INT) {
-      memcpy(l_rec.raw->data, &l_rec.int_val, sizeof(int));
+    if (agg_type == AGG_SUM && col->type == TYPE_STRING) {
+      throw InternalError("Unexpected data type to add！");
     }
+    AggSlot slot;
+    slot.type = agg_type;
+    slot.col_type = col->type;
+    slot.in_offset = agg_type == AGG_COUNT ? 0 : col->offset;
+    slot.len = col->len;
+    return layout_.add_slot(slot);
+  }
 
-    auto&& lhs_value = l_rec.raw->data;
-    auto&& rhs_value = r_rec.raw->data;
+  // 子算子的当前元组：支持 peek() 时直接用它的缓冲区，否则由 holder 持有
+  const char* current_tuple(std::unique_ptr<RmRecord>* holder) {
+    if (const char* data = prev_->peek()) {
+      return data;
+    }
+    *holder = prev_->Next();
+    return (*holder)->data;
+  }
 
-    int cmp = compare(lhs_value, rhs_value, l_rec.str_val.size(), l_rec.type);
-    switch (cond.op) {
-      case OP_EQ:
-        return cmp == 0;
-      case OP_NE:
-        return cmp != 0;
-      case OP_LT:
-        return cmp < 0;
-      case OP_GT:
-        return cmp > 0;
-      case OP_LE:
-        return cmp <= 0;
-      case OP_GE:
-        return cmp >= 0;
-      default:
-        throw InternalError("Unexpected op type！");
+  /**
+   * 当前线程拉取子算子，按批分发给线程池上的任务做线程局部的预聚合。
+   * 元组拷贝到按批分配的连续缓冲区中，工作线程直接在上面求分组键和聚合值
+   */
+  void parallel_consume() {
+    int degree = parallel_degree();
+    std::size_t tuple_len = 0;
+    for (auto& col : cols_) {
+      tuple_len = std::max(tuple_len, static_cast<std::size_t>(col.offset +
+                                                               col.len));
+    }
+    FlatBatchQueue queue(degree * 2);
+    for (int i = 1; i < degree; ++i) {
+      locals_.emplace_back(
+          std::make_unique<PartitionedAggregateTable>(&layout_));
     }
+    std::vector<std::future<void> > workers;
+    workers.reserve(degree);
+    for (int i = 0; i < degree; ++i) {
+      workers.emplace_back(ThreadPool::instance().submit(
+          [&queue, tuple_len, local = locals_[i].get()] {
+            FlatBatchQueue::Batch batch;
+            while (queue.pop(&batch)) {
+              for (std::size_t off = 0; off < batch.size(); off += tuple_len) {
+                local->consume(batch.data() + off);
+              }
+            }
+          }));
+    }
+
+    try {
+      const std::size_t batch_bytes = AGG_BATCH_SIZE * tuple_len;
+      FlatBatchQueue::Batch batch;
+      batch.reserve(batch_bytes);
+      std::unique_ptr<RmRecord> record;
+      for (; !prev_->is_end(); prev_->nextTuple()) {
+        const char* data = current_tuple(&record);
+        batch.insert(batch.end(), data, data + tuple_len);
+        if (batch.size() == batch_bytes) {
+          queue.push(std::move(batch));
+          batch = FlatBatchQueue::Batch();
+          batch.reserve(batch_bytes);
+        }
+      }
+      if (!batch.empty()) {
+        queue.push(std::move(batch));
+      }
+    } catch (...) {
+      queue.close();
+      for (auto& worker : workers) {
+        ThreadPool::wait(worker);
+      }
+      throw;
+    }
+    queue.close();
+    for (auto& worker : workers) {
+      ThreadPool::wait(worker);
+    }
+  }
+
+  // 各分区互不相交，每个分区由一个任务把所有线程局部表合并到第 0 张表
+  void parallel_merge() {
+    if (locals_.size() == 1) {
+      return;
+    }
+    int degree = static_cast<int>(locals_.size());
+    auto merge = [this, degree](int i) {
+      for (int part = i; part < AGG_PARTITIONS; part += degree) {
+        auto& target = locals_[0]->partition(part);
+        for (std::size_t j = 1; j < locals_.size(); ++j) {
+          target.merge(locals_[j]->partition(part));
+        }
+      }
+    };
+    std::vector<std::future<void> > workers;
+    workers.reserve(degree - 1);
+    for (int i = 1; i < degree; ++i) {
+      workers.emplace_back(ThreadPool::instance().submit(merge, i));
+    }
+    merge(0);
+    for (auto& worker : workers) {
+      ThreadPool::wait(worker);
+    }
+    locals_.resize(1);
   }
 
-  bool cmp_conds(const Value& l_rec, const Value& r_rec,
-                 const std::vector<Condition>& conds) {
-    return std::all_of(conds.begin(), conds.end(), [&](const Condition& cond) {
-      return cmp_cond(l_rec, r_rec, cond);
-    });
+  // having 条件是否满足
+  bool satisfy_having(const char* acc) const {
+    for (std::size_t i = 0; i < having_conds_.size(); ++i) {
+      auto& slot = layout_.slot(having_slots_[i]);
+      auto& cond = having_conds_[i];
+      if (slot.col_type != cond.rhs_val.type) {
+        throw IncompatibleTypeError(coltype2str(slot.col_type),
+                                    coltype2str(cond.rhs_val.type));
+      }
+      int cmp = compare(acc + slot.acc_offset, cond.rhs_val.raw->data,
+                        slot.len, slot.col_type);
+      if (!cmp_op(cmp, cond.op)) {
+        return false;
+      }
+    }
+    return true;
   }
 
-  std::string getType() { return "AggregateExecutor"; }
+  // 从 (part_idx_, slot_idx_) 开始找到下一个满足 having 的分组
+  void seek_valid() {
+    for (; part_idx_ < AGG_PARTITIONS; ++part_idx_, slot_idx_ = 0) {
+      auto& table = locals_[0]->partition(part_idx_);
+      for (; slot_idx_ < table.capacity(); ++slot_idx_) {
+        if (table.occupied(slot_idx_) &&
+            satisfy_having(table.acc_at(slot_idx_))) {
+          return;
+        }
+      }
+    }
+  }
 };
@@ -25,62 +25,65 @@ class DeleteExecutor : public AbstractExecutor {
   std::string tab_name_;  // 表名称
   // std::vector<Condition> conds_; // delete的条件
   std::vector<Rid> rids_;  // 需要删除的记录的位置
-  bool is_index_scan_{false};
   TabMeta& tab_;      // 表的元数据
   RmFileHandle* fh_;  // 表的数据文件句柄
 
  public:
   DeleteExecutor(SmManager* sm_manager, std::string tab_name,
-                 std::vector<Rid> rids, Context* context,
-                 bool is_index_scan = false)
+                 std::vector<Rid> rids, Context* context)
       : sm_manager_(sm_manager),
         tab_name_(std::move(tab_name)),
         rids_(std::move(rids)),
-        is_index_scan_(is_index_scan),
         tab_(sm_manager_->db_.get_table(tab_name_)) {
     fh_ = sm_manager_->fhs_[tab_name_].get();
     context_ = context;
-    // X 锁
-    if (!is_index_scan_ && !rids_.empty() && context_ != nullptr) {
-      context_->lock_mgr_->lock_exclusive_on_table(context_->txn_,
-                                                   fh_->GetFd());
-      for (auto& [ix_name, index_meta] : tab_.indexes) {
-        auto predicate_manager = PredicateManager(index_meta);
-        auto gap = Gap(predicate_manager.getIndexConds());
-        context_->lock_mgr_->lock_exclusive_on_gap(context_->txn_, index_meta,
-                                                   gap, fh_->GetFd());
-      }
-    }
+    // 表锁和间隙锁已经由扫描算子加好，这里只对每条记录加 X 锁
   }
 
   // 只执行一次
   std::unique_ptr<RmRecord> Next() override {
+    // 索引的删除攒成一批，最后按叶子批量执行
+    std::vector<std::pair<IxIndex*, IxBatch> > batches;
+    batches.reserve(tab_.indexes.size());
+    for (auto& [index_name, index] : tab_.indexes) {
+      batches.emplace_back(sm_manager_->ihs_.at(index_name).get(),
+                           IxBatch(index.key_len));
+    }
     for (auto& rid : rids_) {
+      // 行级 X 锁，在读记录之前加，避免 S 锁升级
+      if (context_ != nullptr) {
+        context_->lock_mgr_->lock_exclusive_on_record(context_->txn_, rid,
+                                                      fh_->GetFd());
+      }
       auto rec = fh_->get_record(rid, context_);
 
 #ifdef ENABLE_LOGGING
-      auto* delete_log_record = new DeleteLogRecord(
-          context_->txn_->get_transaction_id(), *rec, rid, tab_name_);
-      delete_log_record->prev_lsn_ = context_->txn_->get_prev_lsn();
+      DeleteLogRecord delete_log_record(context_->txn_->get_transaction_id(),
+                                        *rec, rid, tab_.id);
+      delete_log_record.prev_lsn_ = context_->txn_->get_prev_lsn();
       context_->txn_->set_prev_lsn(
-          context_->log_mgr_->add_log_to_buffer(delete_log_record));
-      auto&& page = fh_->fetch_page_handle(rid.page_no).page;
-      page->set_page_lsn(context_->txn_->get_prev_lsn());
-      sm_manager_->get_bpm()->unpin_page(page->get_page_id(), true);
-      delete delete_log_record;
+          context_->log_mgr_->add_log_to_buffer(&delete_log_record));
 #endif
 
-      // 如果有索引，则必然是唯一索引
-      for (auto& [index_name, index] : tab_.indexes) {
-        auto ih = sm_manager_->ihs_.at(index_name).get();
-        char* key = new char[index.col_tot_len];
-        for (auto& [index_offset, col_meta] : index.cols) {
-          memcpy(key + index_offset, rec->data + col_meta.offset, col_meta.len);
-        }
-        ih->delete_entry(key, context_->txn_);
-        delete[] key;
+      int i = 0;
+      for (auto& [_, index] : tab_.indexes) {
+        std::ignore = _;
+        std::vector<char> key(index.key_len);
+        index.get_key(rec->data, rid, key.data());
+        batches[i++].second.add_delete(key.data());
+      }
+      // 删除之前保留旧版本，快照读还能读到它
+      if (context_->version_mgr_ != nullptr) {
+        context_->version_mgr_->add_version(context_->txn_, fh_->GetFd(), rid,
+                                            rec.get());
       }
       fh_->delete_record(rid, context_);
+#ifdef ENABLE_LOGGING
+      // 修改完页面再推进 page_lsn，检查点写回的页面不会带着还没做的修改的 lsn
+      auto&& page = fh_->fetch_page_handle(rid.page_no).page;
+      page->set_page_lsn(context_->txn_->get_prev_lsn());
+      sm_manager_->get_bpm()->unpin_page(page->get_page_id(), true);
+#endif
 
       // 防止 double throw
       // 写入事务写集
@@ -88,6 +91,9 @@ class DeleteExecutor : public AbstractExecutor {
           new WriteRecord(WType::DELETE_TUPLE, tab_name_, rid, *rec);
       context_->txn_->append_write_record(write_record);
     }
+    for (auto& [ih, batch] : batches) {
+      ih->apply_batch(batch, context_->txn_);
+    }
     return nullptr;
   }
 
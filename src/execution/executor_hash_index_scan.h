@@ -0,0 +1,184 @@
+/* Copyright (c) 2023 Renmin University of China
+RMDB is licensed under Mulan PSL v2.
+You can use this software according to the terms and conditions of the Mulan PSL
+v2. You may obtain a copy of Mulan PSL v2 at:
+        http://license.coscl.org.cn/MulanPSL2
+THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+See the Mulan PSL v2 for more details. */
+
+#pragma once
+
+#include <unordered_set>
+
+#include "execution_defs.h"
+#include "execution_manager.h"
+#include "executor_abstract.h"
+#include "index/ix.h"
+#include "predicate_manager.h"
+#include "snapshot_reader.h"
+#include "system/sm.h"
+
+/**
+ * 哈希索引上的等值查找：由索引字段上的常值等号谓词拼出 key，一次查出所有 rid
+ * 后回表。其余谓词下推成 RmScanFilter，在取出的记录上求值
+ */
+class HashIndexScanExecutor : public AbstractExecutor {
+ private:
+  SmManager* sm_manager_;
+  std::string tab_name_;                      // 表名称
+  std::vector<std::string> index_col_names_;  // 哈希索引包含的字段
+  TabMeta& tab_;                              // 表的元数据
+  IndexMeta& index_meta_;                     // 哈希索引的元数据
+  RmFileHandle* fh_;                          // 表的数据文件句柄
+  IxIndex* ih_;
+  std::vector<char> key_;  // 由等号谓词拼出的 key，只有索引字段有值
+  RmScanFilter filter_;    // 回表后检查的其余谓词
+  ScanProjection projection_;  // 输出的列，没有投影时为表的全部列
+  std::vector<Rid> rids_;      // 索引查找的结果
+  std::size_t pos_{0};
+  Rid rid_;
+  std::unique_ptr<RmRecord> rm_record_;
+  // false 为共享间隙锁，true 为互斥间隙锁
+  bool gap_mode_;
+  // 快照读时不为空，扫描不加锁
+  std::unique_ptr<SnapshotReader> snapshot_;
+
+  // 记录的索引字段是否等于 key_，用于来自版本链的旧版本
+  bool match_key(const RmRecord& record) {
+    std::vector<char> key(index_meta_.key_len);
+    index_meta_.get_key(record.data, rid_, key.data());
+    return memcmp(key.data(), key_.data(), index_meta_.col_tot_len) == 0;
+  }
+
+  // 从 pos_ 开始找第一条满足其余谓词的记录
+  void find_next() {
+    for (; pos_ < rids_.size(); ++pos_) {
+      rid_ = rids_[pos_];
+      if (snapshot_ != nullptr) {
+        bool chained;
+        auto record = snapshot_->read(rid_, &chained);
+        if (record != nullptr && (!chained || match_key(*record)) &&
+            filter_.eval(record->data)) {
+          rm_record_ = std::move(record);
+          return;
+        }
+        continue;
+      }
+      // 读记录前加行级 S 锁，这里不持有页面 latch，可以等锁。DML 的扫描
+      // 由上层算子加 X 锁
+      if (!gap_mode_) {
+        context_->lock_mgr_->lock_shared_on_record(context_->txn_, rid_,
+                                                   fh_->GetFd());
+      }
+      auto record = fh_->get_record(rid_, context_);
+      if (filter_.eval(record->data)) {
+        rm_record_ = std::move(record);
+        return;
+      }
+    }
+  }
+
+ public:
+  HashIndexScanExecutor(SmManager* sm_manager, std::string tab_name,
+                        std::vector<Condition> conds,
+                        std::vector<std::string> index_col_names,
+                        Context* context, bool gap_mode = false,
+                        const std::vector<std::string>& proj_cols = {})
+      : sm_manager_(sm_manager),
+        tab_name_(std::move(tab_name)),
+        index_col_names_(std::move(index_col_names)),
+        tab_(sm_manager_->db_.get_table(tab_name_)),
+        index_meta_(tab_.get_index_meta(index_col_names_)),
+        projection_(tab_, proj_cols),
+        gap_mode_(gap_mode) {
+    context_ = context;
+    fh_ = sm_manager_->fhs_.at(tab_name_).get();
+    ih_ = sm_manager_->ihs_.at(tab_.get_index_name(index_col_names_)).get();
+    key_.resize(index_meta_.key_len);
+
+    // 规划器保证每个索引字段上都有类型一致的常值等号谓词，其余谓词都能下推
+    auto predicate_manager = PredicateManager(index_meta_);
+    std::unordered_set<std::string> key_cols;
+    for (auto& cond : conds) {
+      auto it = index_meta_.cols_map.find(cond.lhs_col.col_name);
+      if (it != index_meta_.cols_map.end() && cond.op == OP_EQ &&
+          cond.is_rhs_val && key_cols.emplace(it->first).second) {
+        auto& [index_offset, col] = it->second;
+        memcpy(key_.data() + index_offset, cond.rhs_val.raw->data, col.len);
+        predicate_manager.addPredicate(cond.lhs_col.col_name, cond);
+        continue;
+      }
+      auto& col = *tab_.get_col(cond.lhs_col.col_name);
+      if (!push_down_cond(cond, col, &filter_)) {
+        ColType rhs_type = cond.is_rhs_val ? cond.rhs_val.type
+                                           : cond.rhs_value_list[0].type;
+        throw IncompatibleTypeError(coltype2str(col.type),
+                                    coltype2str(rhs_type));
+      }
+    }
+
+    if (context_->txn_->is_snapshot_read()) {
+      snapshot_ = std::make_unique<SnapshotReader>(
+          context_->version_mgr_, fh_, context_->txn_->get_read_ts());
+      return;
+    }
+
+    // 意向锁和等值谓词对应的间隙锁，与 IndexScanExecutor 相同
+    auto gap = Gap(predicate_manager.getIndexConds());
+    if (gap_mode_) {
+      context_->lock_mgr_->lock_IX_on_table(context_->txn_, fh_->GetFd());
+      context_->lock_mgr_->lock_exclusive_on_gap(context_->txn_, index_meta_,
+                                                 gap, fh_->GetFd());
+    } else {
+      context_->lock_mgr_->lock_IS_on_table(context_->txn_, fh_->GetFd());
+      context_->lock_mgr_->lock_shared_on_gap(context_->txn_, index_meta_, gap,
+                                              fh_->GetFd());
+    }
+  }
+
+  void beginTuple() override {
+    rids_.clear();
+    ih_->get_value(key_.data(), &rids_, context_->txn_);
+    // 快照读还要检查有版本链的记录，它们的旧版本可能等于 key_
+    if (snapshot_ != nullptr) {
+      snapshot_->reset();
+      auto visited = [this](const Rid& rid) { return !snapshot_->visit(rid); };
+      rids_.erase(std::remove_if(rids_.begin(), rids_.end(), visited),
+                  rids_.end());
+      auto unvisited = snapshot_->get_unvisited_rids();
+      rids_.insert(rids_.end(), unvisited.begin(), unvisited.end());
+    }
+    pos_ = 0;
+    find_next();
+  }
+
+  void nextTuple() override {
+    if (pos_ < rids_.size()) {
+      ++pos_;
+      find_next();
+    }
+  }
+
+  std::unique_ptr<RmRecord> Next() override {
+    if (projection_.empty() || rm_record_ == nullptr) {
+      return std::move(rm_record_);
+    }
+    auto record = projection_.project(rm_record_->data);
+    rm_record_ = nullptr;
+    return record;
+  }
+
+  Rid& rid() override { return rid_; }
+
+  bool is_end() const override { return pos_ >= rids_.size(); }
+
+  const std::vector<ColMeta>& cols() const override {
+    return projection_.cols();
+  }
+
+  size_t tupleLen() const override { return projection_.len(); }
+
+  std::string getType() override { return "HashIndexScanExecutor"; }
+};
@@ -20,6 +20,7 @@ See the Mulan PSL v2 for more details. */
 #include "executor_abstract.h"
 #include "index/ix.h"
 #include "predicate_manager.h"
+#include "snapshot_reader.h"
 #include "system/sm.h"
 
 static std::map<CompOp, CompOp> swap_op = {
@@ -38,8 +39,9 @@ class IndexScanExecutor : public AbstractExecutor {
   RmFileHandle* fh_;     // 表的数据文件句柄
   // std::vector<ColMeta> cols_; // 没必要，通过 tab 获取需要读取的字段
   std::vector<std::vector<ColMeta>::iterator> cond_cols_;  // 谓词需要读取的字段
-  size_t len_;             // 选取出来的一条记录的长度
+  size_t len_;             // 表中一条完整记录的长度
   IndexMeta& index_meta_;  // index scan涉及到的索引元数据
+  ScanProjection projection_;  // 输出的列，没有投影时为表的全部列
   Rid rid_;
   std::unique_ptr<IxScan> scan_;
   std::unique_ptr<RmRecord> rm_record_;
@@ -74,11 +76,53 @@ class IndexScanExecutor : public AbstractExecutor {
   // 顺序扫描还是逆序
   bool asc_{true};
 
+  // 用到的列都在索引中，直接由 key 生成记录，不回表
+  bool index_only_{false};
+
+  // 快照读时不为空，扫描不加锁
+  std::unique_ptr<SnapshotReader> snapshot_;
+
   static std::size_t generateID() {
     static size_t current_id = 0;
     return ++current_id;
   }
 
+  /**
+   * 读记录前加行级 S 锁，挡住经其他索引修改这条记录的事务。DML 的扫描不加，
+   * 由上层算子加 X 锁。扫描持有叶子的读 latch，不能带着它等锁，
+   * 否则持有行锁的事务维护索引时会等这个 latch。有冲突时先放开叶子，
+   * 再按 wait-die 等锁；等待期间叶子被修改过，扫描位置失效，只能回滚
+   */
+  void lock_record(const Rid& rid) {
+    if (gap_mode_) {
+      return;
+    }
+    auto* lock_mgr = context_->lock_mgr_;
+    auto* txn = context_->txn_;
+    try {
+      lock_mgr->lock_shared_on_record(txn, rid, fh_->GetFd(), true);
+      return;
+    } catch (TransactionAbortException&) {
+    }
+    if (!scan_->unlatched([&] {
+          lock_mgr->lock_shared_on_record(txn, rid, fh_->GetFd());
+        })) {
+      throw TransactionAbortException(txn->get_transaction_id(),
+                                      AbortReason::DEADLOCK_PREVENTION);
+    }
+  }
+
+  // 取出 iid 处的索引项对应的记录，不回表时只有索引中存储的字段有值
+  std::unique_ptr<RmRecord> fetch_record(const Iid& iid) {
+    lock_record(rid_);
+    if (!index_only_) {
+      return fh_->get_record(rid_, context_);
+    }
+    auto record = std::make_unique<RmRecord>(len_);
+    index_meta_.get_record(ih_->get_key(iid).data, record->data);
+    return record;
+  }
+
   // for index scan
   void write_sorted_results() {
     // 以期望格式写入 sorted_results.txt
@@ -93,10 +137,22 @@ class IndexScanExecutor : public AbstractExecutor {
     }
     out_expected_file << "\n";
 
+    // 快照读先收集对快照可见的记录
+    if (snapshot_ != nullptr) {
+      snapshot_scan(false);
+    }
+
     // 右表先开始
-    for (; !scan_->is_end(); scan_->next()) {
+    while (snapshot_ != nullptr ? !records_.empty() : !scan_->is_end()) {
       // 打印记录
-      rm_record_ = fh_->get_record(scan_->rid(), context_);
+      if (snapshot_ != nullptr) {
+        rm_record_ = std::move(records_.front());
+        records_.pop_front();
+      } else {
+        lock_record(scan_->rid());
+        rm_record_ = fh_->get_record(scan_->rid(), context_);
+        scan_->next();
+      }
       // 写入文件中
       outfile_.write(rm_record_->data, rm_record_->size);
 
@@ -129,19 +185,115 @@ class IndexScanExecutor : public AbstractExecutor {
     out_expected_file.close();
   }
 
+  /**
+   * 快照读：不加锁地读出 scan_ 范围内对快照可见的记录，再补上有版本链但索引项
+   * 不在范围内的记录，结果按索引顺序放入 records_。用到版本链上的旧版本时，
+   * 记录的 key 可能和索引项不同，按旧版本的 key 重新排序。check_conds 为假时
+   * 不检查谓词（归并连接输出全部记录）
+   */
+  void snapshot_scan(bool check_conds) {
+    std::vector<std::pair<std::vector<char>, std::unique_ptr<RmRecord> > > rows;
+    bool reorder = false;
+    auto add_row = [&](const Rid& rid, std::unique_ptr<RmRecord> record,
+                       bool chained) {
+      if (record == nullptr) {
+        return;
+      }
+      std::vector<char> key(index_meta_.key_len);
+      index_meta_.get_key(record->data, rid, key.data());
+      if (chained) {
+        if (check_conds && !predicate_manager_.cmpAllIndexConds(RmRecord(
+                               key.data(), index_meta_.key_len))) {
+          return;
+        }
+        reorder = true;
+      }
+      if (check_conds && !conds_.empty() && !cmp_conds(record.get(), conds_)) {
+        return;
+      }
+      rows.emplace_back(std::move(key), std::move(record));
+    };
+
+    snapshot_->reset();
+    for (; !scan_->is_end(); scan_->next()) {
+      // 当前 key 不满足索引谓词的记录留到最后，有版本链时再看旧版本
+      if (check_conds && !index_clean_ &&
+          !predicate_manager_.cmpIndexConds(scan_->get_key())) {
+        continue;
+      }
+      auto rid = scan_->rid();
+      if (!snapshot_->visit(rid)) {
+        continue;
+      }
+      bool chained;
+      std::unique_ptr<RmRecord> record;
+      if (index_only_) {
+        RmRecord current(len_);
+        index_meta_.get_record(ih_->get_key(scan_->iid()).data, current.data);
+        record = snapshot_->read(rid, current.data, &chained);
+      } else {
+        record = snapshot_->read(rid, &chained);
+      }
+      add_row(rid, std::move(record), chained);
+    }
+    for (auto& rid : snapshot_->get_unvisited_rids()) {
+      add_row(rid, snapshot_->read(rid), true);
+    }
+
+    if (reorder) {
+      std::stable_sort(rows.begin(), rows.end(),
+                       [this](const auto& a, const auto& b) {
+                         for (auto& [offset, col] : index_meta_.cols) {
+                           int cmp = ix_compare(a.first.data() + offset,
+                                                b.first.data() + offset,
+                                                col.type, col.len);
+                           if (cmp != 0) {
+                             return cmp < 0;
+                           }
+                         }
+                         return false;
+                       });
+    }
+    // 逆序扫描只取最大的一条
+    if (!asc_ && rows.size() > 1) {
+      rows.erase(rows.begin(), rows.end() - 1);
+    }
+    records_.clear();
+    for (auto& [_, record] : rows) {
+      std::ignore = _;
+      records_.emplace_back(std::move(record));
+    }
+  }
+
+  // 快照读的 beginTuple，输出 records_ 中的第一条记录
+  void snapshot_begin() {
+    snapshot_scan(true);
+    if (!records_.empty()) {
+      rm_record_ = std::move(records_.front());
+      records_.pop_front();
+    } else {
+      is_end_ = true;
+      rm_record_ = nullptr;
+    }
+  }
+
  public:
   IndexScanExecutor(SmManager* sm_manager, std::string tab_name,
                     std::vector<Condition> conds,
                     std::vector<std::string> index_col_names, Context* context,
-                    bool gap_mode = false, bool asc = true)
+                    bool gap_mode = false, bool asc = true,
+                    const std::vector<std::string>& proj_cols = {},
+                    bool index_only = false)
       : sm_manager_(sm_manager),
         tab_name_(std::move(tab_name)),
         conds_(std::move(conds)),
         index_col_names_(std::move(index_col_names)),
+        tab_(sm_manager_->db_.get_table(tab_name_)),
+        index_meta_(tab_.get_index_meta(index_col_names_)),
+        projection_(tab_, proj_cols),
         gap_mode_(gap_mode),
         asc_(asc),
-        tab_(sm_manager_->db_.get_table(tab_name_)),
-        index_meta_(tab_.get_index_meta(index_col_names_)) {
+        index_only_(index_only) {
     context_ = context;
     // index_no_ = index_no;
     // index_meta_ = tab_.get_index_meta(index_col_names_);
@@ -173,7 +325,8 @@ class IndexScanExecutor : public AbstractExecutor {
 
     // 有点耗时
     const auto index_name = tab_.get_index_name(index_col_names_);
-    ih_ = sm_manager_->ihs_[index_name].get();
+    // 规划器只会为 B+ 树索引生成 IndexScanExecutor
+    ih_ = static_cast<IxIndexHandle*>(sm_manager_->ihs_[index_name].get());
 
     predicate_manager_ = PredicateManager(index_meta_);
 
@@ -196,16 +349,20 @@ class IndexScanExecutor : public AbstractExecutor {
       cond_cols_.emplace_back(tab_.get_col(cond.lhs_col.col_name));
     }
 
-    // S 锁
-    // if (context_ != nullptr) {
-    //     context_->lock_mgr_->lock_shared_on_table(context_->txn_,
-    //     fh_->GetFd());
-    // }
+    if (context_->txn_->is_snapshot_read()) {
+      snapshot_ = std::make_unique<SnapshotReader>(
+          context_->version_mgr_, fh_, context_->txn_->get_read_ts());
+      return;
+    }
+
+    // 表上加意向锁，范围由间隙锁保护，读到的记录再逐行加 S 锁
     auto gap = Gap(predicate_manager_.getIndexConds());
     if (gap_mode_) {
+      context_->lock_mgr_->lock_IX_on_table(context_->txn_, fh_->GetFd());
       context_->lock_mgr_->lock_exclusive_on_gap(context_->txn_, index_meta_,
                                                  gap, fh_->GetFd());
     } else {
+      context_->lock_mgr_->lock_IS_on_table(context_->txn_, fh_->GetFd());
       context_->lock_mgr_->lock_shared_on_gap(context_->txn_, index_meta_, gap,
                                               fh_->GetFd());
     }
@@ -221,6 +378,10 @@ class IndexScanExecutor : public AbstractExecutor {
       is_end_ = false;
       scan_ =
           std::make_unique<IxScan>(ih_, lower_, upper_, sm_manager_->get_bpm());
+      if (snapshot_ != nullptr) {
+        snapshot_begin();
+        return;
+      }
       while (!scan_->is_end()) {
         // 不回表
         // 全是等号或最后一个谓词是比较，不需要再扫索引
@@ -228,7 +389,7 @@ class IndexScanExecutor : public AbstractExecutor {
             predicate_manager_.cmpIndexConds(scan_->get_key())) {
           // 回表，查不在索引里的谓词
           rid_ = scan_->rid();
-          rm_record_ = fh_->get_record(rid_, context_);
+          rm_record_ = fetch_record(scan_->iid());
           if (conds_.empty() || cmp_conds(rm_record_.get(), conds_)) {
             return;
           }
@@ -244,6 +405,10 @@ class IndexScanExecutor : public AbstractExecutor {
       scan_ =
           std::make_unique<IxScan>(ih_, lower_, upper_, sm_manager_->get_bpm());
       already_begin_ = true;
+      if (snapshot_ != nullptr) {
+        snapshot_begin();
+        return;
+      }
 
       // where a > 1, c < 1
       while (!scan_->is_end()) {
@@ -253,7 +418,7 @@ class IndexScanExecutor : public AbstractExecutor {
             predicate_manager_.cmpIndexConds(scan_->get_key())) {
           // 回表，查不在索引里的谓词
           rid_ = scan_->rid();
-          rm_record_ = fh_->get_record(rid_, context_);
+          rm_record_ = fetch_record(scan_->iid());
           if (conds_.empty() || cmp_conds(rm_record_.get(), conds_)) {
             return;
           }
@@ -337,8 +502,11 @@ class IndexScanExecutor : public AbstractExecutor {
       return;
     }
 
-    char* left_key = new char[index_meta_.col_tot_len];
-    char* right_key = new char[index_meta_.col_tot_len];
+    char* left_key = new char[index_meta_.key_len];
+    char* right_key = new char[index_meta_.key_len];
+    // 索引字段之后的 rid 和 INCLUDE 字段不参与查找，下界取最小，上界取最大
+    set_remaining_all_min(index_meta_.col_num, left_key);
+    set_remaining_all_max(index_meta_.col_num, right_key);
 
     // 找出下界 [
     auto last_left_tuple = predicate_manager_.getLeftLastTuple(left_key);
@@ -506,11 +674,16 @@ class IndexScanExecutor : public AbstractExecutor {
     scan_ =
         std::make_unique<IxScan>(ih_, lower_, upper_, sm_manager_->get_bpm());
     already_begin_ = true;
+    if (snapshot_ != nullptr) {
+      snapshot_begin();
+      return;
+    }
 
     // max 找最后一个记录的情况
     if (!scan_->is_end() && !asc_) {
-      rid_ = scan_->prev_rid(upper_);
-      rm_record_ = fh_->get_record(rid_, context_);
+      auto iid = scan_->prev_iid(upper_);
+      rid_ = ih_->get_rid(iid);
+      rm_record_ = fetch_record(iid);
       // std::cout << "fast max" << std::endl;
       return;
     }
@@ -523,7 +696,7 @@ class IndexScanExecutor : public AbstractExecutor {
       if (index_clean_ || predicate_manager_.cmpIndexConds(scan_->get_key())) {
         // 回表，查不在索引里的谓词
         rid_ = scan_->rid();
-        rm_record_ = fh_->get_record(rid_, context_);
+        rm_record_ = fetch_record(scan_->iid());
         if (conds_.empty() || cmp_conds(rm_record_.get(), conds_)) {
           return;
         }
@@ -578,7 +751,7 @@ class IndexScanExecutor : public AbstractExecutor {
       if (index_clean_ || predicate_manager_.cmpIndexConds(scan_->get_key())) {
         // 回表，查不在索引里的谓词
         rid_ = scan_->rid();
-        rm_record_ = fh_->get_record(rid_, context_);
+        rm_record_ = fetch_record(scan_->iid());
         if (conds_.empty() || cmp_conds(rm_record_.get(), conds_)) {
           return;
         }
@@ -587,24 +760,34 @@ class IndexScanExecutor : public AbstractExecutor {
     is_end_ = true;
   }
 
-  std::unique_ptr<RmRecord> Next() override { return std::move(rm_record_); }
+  // 归并和回表都按完整记录进行，输出时才做投影
+  std::unique_ptr<RmRecord> Next() override {
+    if (projection_.empty() || rm_record_ == nullptr) {
+      return std::move(rm_record_);
+    }
+    auto record = projection_.project(rm_record_->data);
+    rm_record_ = nullptr;
+    return record;
+  }
 
   Rid& rid() override { return rid_; }
 
   bool is_end() const { return is_end_; }
 
-  const std::vector<ColMeta>& cols() const override { return tab_.cols; }
+  const std::vector<ColMeta>& cols() const override {
+    return projection_.cols();
+  }
 
-  size_t tupleLen() const override { return len_; }
+  size_t tupleLen() const override { return projection_.len(); }
 
-  // 根据不同的列值类型设置不同的最大值
+  // 根据不同的列值类型设置不同的最大值，包括 key 中索引字段之后的部分
   // int   类型范围 int_min_ ~ int_max_
   // float 类型范围 float_min_ ~ float_max_
   // char  类型范围 0 ~ 255
   void set_remaining_all_max(int last_idx, char*& key) {
     // 设置成最大值
-    for (size_t i = last_idx; i < index_meta_.cols.size(); ++i) {
-      auto& [index_offset, col] = index_meta_.cols[i];
+    for (size_t i = last_idx; i < index_meta_.entry_cols.size(); ++i) {
+      auto& [index_offset, col] = index_meta_.entry_cols[i];
       if (col.type == TYPE_INT) {
         memcpy(key + index_offset, &int_max_, sizeof(int));
       } else if (col.type == TYPE_FLOAT) {
@@ -617,13 +800,13 @@ class IndexScanExecutor : public AbstractExecutor {
     }
   }
 
-  // 根据不同的列值类型设置不同的最小值
+  // 根据不同的列值类型设置不同的最小值，包括 key 中索引字段之后的部分
   // int   类型范围 int_min_ ~ int_max_
   // float 类型范围 float_min_ ~ float_max_
   // char  类型范围 0 ~ 255
   void set_remaining_all_min(int last_idx, char*& key) {
-    for (size_t i = last_idx; i < index_meta_.cols.size(); ++i) {
-      auto& [index_offset, col] = index_meta_.cols[i];
+    for (size_t i = last_idx; i < index_meta_.entry_cols.size(); ++i) {
+      auto& [index_offset, col] = index_meta_.entry_cols[i];
       if (col.type == TYPE_INT) {
         memcpy(key + index_offset, &int_min_, sizeof(int));
       } else if (col.type == TYPE_FLOAT) {
@@ -766,7 +949,7 @@ class IndexScanExecutor : public AbstractExecutor {
   }
 
   bool cmp_conds(const RmRecord* rec, const std::vector<Condition>& conds) {
-    for (int i = 0; i < conds.size(); ++i) {
+    for (size_t i = 0; i < conds.size(); ++i) {
       if (!cmp_cond(i, rec, conds[i])) {
         return false;
       }
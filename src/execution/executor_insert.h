@@ -38,16 +38,10 @@ class InsertExecutor : public AbstractExecutor {
     }
     fh_ = sm_manager_->fhs_[tab_name_].get();
     context_ = context;
-    // X 锁
-    if (tab_.indexes.empty() && context_ != nullptr) {
-      context_->lock_mgr_->lock_exclusive_on_table(context_->txn_,
-                                                   fh_->GetFd());
-      for (auto& [ix_name, index_meta] : tab_.indexes) {
-        auto predicate_manager = PredicateManager(index_meta);
-        auto gap = Gap(predicate_manager.getIndexConds());
-        context_->lock_mgr_->lock_exclusive_on_gap(context_->txn_, index_meta,
-                                                   gap, fh_->GetFd());
-      }
+    // IX 锁，和没有索引的表上扫描持有的 S/X 锁冲突；有索引时由
+    // isSafeInGap 检查间隙锁，新记录的行级 X 锁在 insert_record 中加
+    if (context_ != nullptr) {
+      context_->lock_mgr_->lock_IX_on_table(context_->txn_, fh_->GetFd());
     }
   }
 
@@ -69,22 +63,21 @@ class InsertExecutor : public AbstractExecutor {
 
     // 把索引键缓存
     auto** keys = new char*[tab_.indexes.size()];
-    auto** ihs = new IxIndexHandle*[tab_.indexes.size()];
+    auto** ihs = new IxIndex*[tab_.indexes.size()];
 
     // 同时检查是否有间隙锁和唯一性
     int i = 0;
     bool not_inserted = true;
     for (auto& [index_name, index] : tab_.indexes) {
       ihs[i] = sm_manager_->ihs_[index_name].get();
-      keys[i] = new char[index.col_tot_len];
-      for (auto& [index_offset, col_meta] : index.cols) {
-        memcpy(keys[i] + index_offset, rec.data + col_meta.offset,
-               col_meta.len);
-      }
+      keys[i] = new char[index.key_len];
+      index.get_key(rec.data, rid_, keys[i]);
       RmRecord rm_record(keys[i], index.col_tot_len);
       not_inserted = context_->lock_mgr_->isSafeInGap(context_->txn_, index,
                                                       rm_record, fh_->GetFd());
-      if (!not_inserted || !ihs[i]->is_unique(keys[i], rid_, context_->txn_)) {
+      if (!not_inserted ||
+          (index.unique && !ihs[i]->is_unique(keys[i], rid_, context_->txn_,
+                                              index.col_tot_len))) {
         // 释放内存
         for (int k = 0; k <= i; ++k) {
           delete[] keys[k];
@@ -134,21 +127,26 @@ class InsertExecutor : public AbstractExecutor {
     rid_ = fh_->insert_record(rec.data, context_);
 
 #ifdef ENABLE_LOGGING
-    auto* insert_log_record = new InsertLogRecord(
-        context_->txn_->get_transaction_id(), rec, rid_, tab_name_);
-    insert_log_record->prev_lsn_ = context_->txn_->get_prev_lsn();
+    InsertLogRecord insert_log_record(context_->txn_->get_transaction_id(),
+                                      rec, rid_, tab_.id);
+    insert_log_record.prev_lsn_ = context_->txn_->get_prev_lsn();
     context_->txn_->set_prev_lsn(
-        context_->log_mgr_->add_log_to_buffer(insert_log_record));
+        context_->log_mgr_->add_log_to_buffer(&insert_log_record));
     auto&& page = fh_->fetch_page_handle(rid_.page_no).page;
     page->set_page_lsn(context_->txn_->get_prev_lsn());
     sm_manager_->get_bpm()->unpin_page(page->get_page_id(), true);
-    delete insert_log_record;
 #endif
 
     // 插入完成，释放内存
-    for (int j = 0; j < i; ++j) {
+    int j = 0;
+    for (auto& [index_name, index] : tab_.indexes) {
+      // 非唯一索引的 key 带 rid，插入记录之后才能补上
+      if (!index.unique) {
+        index.get_key(rec.data, rid_, keys[j]);
+      }
       ihs[j]->insert_entry(keys[j], rid_, context_->txn_);
       delete[] keys[j];
+      ++j;
     }
     delete[] keys;
     delete[] ihs;
@@ -0,0 +1,354 @@
+/* Copyright (c) 2023 Renmin University of China
+RMDB is licensed under Mulan PSL v2.
+You can use this software according to the terms and conditions of the Mulan PSL
+v2. You may obtain a copy of Mulan PSL v2 at:
+        http://license.coscl.org.cn/MulanPSL2
+THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+See the Mulan PSL v2 for more details. */
+
+#pragma once
+
+#include <atomic>
+#include <exception>
+#include <future>
+
+#include "exchange.h"
+#include "execution_defs.h"
+#include "execution_manager.h"
+#include "executor_abstract.h"
+#include "index/ix.h"
+#include "morsel_scheduler.h"
+#include "predicate_manager.h"
+#include "snapshot_reader.h"
+#include "system/sm.h"
+
+/**
+ * 并行全表扫描
+ * 表的页面范围切成 morsel，由共享线程池上的多个任务通过 MorselScheduler 领取并过滤，
+ * 满足谓词的元组经 exchange 队列汇总到调用线程，输出顺序不保证是堆表顺序。
+ * 聚合算子可以通过 parallel_for_each 直接在工作线程上消费元组，不经过 exchange
+ * 只用于只读查询，所有谓词都必须能下推到 RmScan（子查询算子不能在多个线程上并发执行）
+ * 快照读时每个工作线程有自己的 SnapshotReader，全部 morsel 扫描完之后，
+ * 合并它们读过的记录，再补上有版本链但没有读到的记录
+ */
+class ParallelSeqScanExecutor : public AbstractExecutor {
+ private:
+  SmManager* sm_manager_;
+  std::string tab_name_;          // 表的名称
+  std::vector<Condition> conds_;  // scan的条件
+  RmFileHandle* fh_;              // 表的数据文件句柄
+  RmScanFilter filter_;           // 全部谓词都下推到 RmScan，工作线程只读
+  Rid rid_;  // 并行扫描不提供 rid
+  TabMeta& tab_;
+  ScanProjection projection_;  // exchange 模式输出的列
+  int degree_;
+  // 快照读时每个工作线程一个，扫描不加锁
+  std::vector<std::unique_ptr<SnapshotReader> > snapshots_;
+
+  // exchange 模式下的状态
+  std::unique_ptr<MorselScheduler> scheduler_;
+  std::unique_ptr<TupleBatchQueue> queue_;
+  std::vector<std::future<void> > producers_;
+  std::atomic<int> running_{0};
+  std::atomic<bool> stop_{false};
+  TupleBatchQueue::Batch batch_;
+  std::size_t batch_idx_{0};
+  bool is_end_{true};
+
+  // 工作线程抛出的第一个异常，由调用线程重新抛出
+  std::mutex error_latch_;
+  std::exception_ptr error_;
+
+ public:
+  ParallelSeqScanExecutor(SmManager* sm_manager, std::string tab_name,
+                          std::vector<Condition> conds, Context* context,
+                          const std::vector<std::string>& proj_cols = {})
+      : sm_manager_(sm_manager),
+        tab_name_(std::move(tab_name)),
+        conds_(std::move(conds)),
+        tab_(sm_manager_->db_.get_table(tab_name_)),
+        projection_(tab_, proj_cols),
+        degree_(parallel_degree()) {
+    fh_ = sm_manager_->fhs_.at(tab_name_).get();
+    context_ = context;
+
+    for (auto& cond : conds_) {
+      bool pushed = push_down_cond(
+          cond, *tab_.get_col(cond.lhs_col.col_name), &filter_);
+      assert(pushed);
+      std::ignore = pushed;
+    }
+
+    if (context_ != nullptr && context_->txn_->is_snapshot_read()) {
+      for (int i = 0; i < degree_; ++i) {
+        snapshots_.emplace_back(std::make_unique<SnapshotReader>(
+            context_->version_mgr_, fh_, context_->txn_->get_read_ts()));
+      }
+      return;
+    }
+
+    // 与 SeqScanExecutor 相同，有索引时 IS 锁 + (-INF, +INF) 的共享间隙锁，
+    // 没有索引时 S 锁
+    if (context_ != nullptr) {
+      if (tab_.indexes.empty()) {
+        context_->lock_mgr_->lock_shared_on_table(context_->txn_,
+                                                  fh_->GetFd());
+      } else {
+        context_->lock_mgr_->lock_IS_on_table(context_->txn_, fh_->GetFd());
+      }
+      for (auto& [ix_name, index_meta] : tab_.indexes) {
+        auto predicate_manager = PredicateManager(index_meta);
+        auto gap = Gap(predicate_manager.getIndexConds());
+        context_->lock_mgr_->lock_shared_on_gap(context_->txn_, index_meta, gap,
+                                                fh_->GetFd());
+      }
+    }
+  }
+
+  ~ParallelSeqScanExecutor() override { stop(); }
+
+  // 是否可以用并行扫描代替 SeqScanExecutor
+  static bool is_parallel_safe(SmManager* sm_manager,
+                               const std::string& tab_name,
+                               const std::vector<Condition>& conds) {
+    if (parallel_degree() < 2) {
+      return false;
+    }
+    auto& tab = sm_manager->db_.get_table(tab_name);
+    RmScanFilter filter;
+    for (auto& cond : conds) {
+      if (!push_down_cond(cond, *tab.get_col(cond.lhs_col.col_name),
+                          &filter)) {
+        return false;
+      }
+    }
+    return sm_manager->fhs_.at(tab_name)->get_file_hdr().num_pages >=
+           PARALLEL_SCAN_MIN_PAGES;
+  }
+
+  int degree() const { return degree_; }
+
+  /**
+   * @description: 在 degree() 个工作线程上扫描全表，对每个满足谓词的元组调用
+   * consume(worker, data)，data 指向缓冲池页面上的完整记录，按 table_cols()
+   * 的偏移读取，只在回调内有效。阻塞到扫描结束
+   */
+  template <typename F>
+  void parallel_for_each(F&& consume) {
+    stop();
+    stop_ = false;
+    error_ = nullptr;
+    reset_snapshots();
+    MorselScheduler scheduler(RM_FIRST_RECORD_PAGE,
+                              fh_->get_file_hdr().num_pages, degree_,
+                              MORSEL_PAGES);
+    auto run = [&](int worker) {
+      try {
+        scan_morsels(&scheduler, worker,
+                     [&](const char* data) { consume(worker, data); });
+      } catch (...) {
+        set_error(std::current_exception());
+      }
+    };
+    // 调用线程自己也承担一份
+    std::vector<std::future<void> > tasks;
+    tasks.reserve(degree_ - 1);
+    for (int i = 1; i < degree_; ++i) {
+      tasks.emplace_back(ThreadPool::instance().submit(run, i));
+    }
+    run(0);
+    for (auto& task : tasks) {
+      ThreadPool::wait(task);
+    }
+    rethrow_error();
+    scan_unvisited([&](const char* data) { consume(0, data); });
+  }
+
+  void beginTuple() override {
+    stop();
+    stop_ = false;
+    error_ = nullptr;
+    reset_snapshots();
+    scheduler_ = std::make_unique<MorselScheduler>(
+        RM_FIRST_RECORD_PAGE, fh_->get_file_hdr().num_pages, degree_,
+        MORSEL_PAGES);
+    queue_ = std::make_unique<TupleBatchQueue>(degree_ * 2);
+    running_ = degree_;
+    producers_.reserve(degree_);
+    for (int i = 0; i < degree_; ++i) {
+      producers_.emplace_back(
+          ThreadPool::instance().submit([this, i] { produce(i); }));
+    }
+    is_end_ = false;
+    batch_.clear();
+    batch_idx_ = 0;
+    fetch_batch();
+  }
+
+  void nextTuple() override {
+    if (is_end_) {
+      return;
+    }
+    if (++batch_idx_ >= batch_.size()) {
+      fetch_batch();
+    }
+  }
+
+  std::unique_ptr<RmRecord> Next() override {
+    return std::move(batch_[batch_idx_]);
+  }
+
+  Rid& rid() override { return rid_; }
+
+  bool is_end() const override { return is_end_; }
+
+  const std::vector<ColMeta>& cols() const override {
+    return projection_.cols();
+  }
+
+  size_t tupleLen() const override { return projection_.len(); }
+
+  // parallel_for_each 交给回调的完整记录的字段
+  const std::vector<ColMeta>& table_cols() const { return tab_.cols; }
+
+  std::string getType() override { return "ParallelSeqScanExecutor"; }
+
+ private:
+  // 不断领取 morsel 并过滤，直到没有任务或被要求停止
+  template <typename F>
+  void scan_morsels(MorselScheduler* scheduler, int worker, F&& consume) {
+    Morsel morsel;
+    while (!stop_ && scheduler->next(worker, &morsel)) {
+      for (RmScan scan(fh_, morsel.start_page, morsel.end_page, &filter_);
+           !scan.is_end(); scan.next()) {
+        if (snapshots_.empty()) {
+          consume(scan.get_data());
+          continue;
+        }
+        // 与 SeqScanExecutor 的快照读相同，来自版本链的旧版本要重新过滤
+        auto& snapshot = snapshots_[worker];
+        auto rid = scan.rid();
+        snapshot->visit(rid);
+        bool chained;
+        auto record = snapshot->read(rid, scan.get_record(), &chained);
+        if (record != nullptr && (!chained || filter_.eval(record->data))) {
+          consume(record->data);
+        }
+      }
+    }
+  }
+
+  /**
+   * @description: 快照读的最后一步，在所有工作线程扫描完之后由一个线程调用：
+   * 有版本链但哪个工作线程都没有读到的记录（已经被删除，或者被修改得不满足
+   * 扫描条件），补上它们对快照可见的版本
+   */
+  template <typename F>
+  void scan_unvisited(F&& consume) {
+    if (snapshots_.empty() || stop_) {
+      return;
+    }
+    auto& snapshot = snapshots_[0];
+    for (std::size_t i = 1; i < snapshots_.size(); ++i) {
+      snapshot->merge_visited(*snapshots_[i]);
+    }
+    for (auto& rid : snapshot->get_unvisited_rids()) {
+      auto record = snapshot->read(rid);
+      if (record != nullptr && filter_.eval(record->data)) {
+        consume(record->data);
+      }
+    }
+  }
+
+  void reset_snapshots() {
+    for (auto& snapshot : snapshots_) {
+      snapshot->reset();
+    }
+  }
+
+  // exchange 模式的工作线程：过滤后的元组按批推入队列
+  void produce(int worker) {
+    TupleBatchQueue::Batch batch;
+    batch.reserve(EXCHANGE_BATCH_SIZE);
+    auto push = [&](char* data) {
+      batch.emplace_back(
+          projection_.empty()
+              ? std::make_unique<RmRecord>(data, projection_.len())
+              : projection_.project(data));
+      if (batch.size() == EXCHANGE_BATCH_SIZE) {
+        if (!queue_->push(std::move(batch))) {
+          stop_ = true;
+        }
+        batch = TupleBatchQueue::Batch();
+        batch.reserve(EXCHANGE_BATCH_SIZE);
+      }
+    };
+    try {
+      scan_morsels(scheduler_.get(), worker, push);
+      if (!batch.empty()) {
+        queue_->push(std::move(batch));
+        batch = TupleBatchQueue::Batch();
+      }
+    } catch (...) {
+      set_error(std::current_exception());
+      queue_->close();
+    }
+    // 最后一个结束的线程补上快照读没有读到的记录，然后关闭队列
+    if (--running_ == 0) {
+      try {
+        scan_unvisited(push);
+        if (!batch.empty()) {
+          queue_->push(std::move(batch));
+        }
+      } catch (...) {
+        set_error(std::current_exception());
+      }
+      queue_->close();
+    }
+  }
+
+  void fetch_batch() {
+    batch_idx_ = 0;
+    do {
+      if (!queue_->pop(&batch_)) {
+        is_end_ = true;
+        stop();
+        rethrow_error();
+        return;
+      }
+    } while (batch_.empty());
+  }
+
+  // 通知工作线程停止并等待其退出，提前结束（如 limit）时未消费的批直接丢弃
+  void stop() {
+    stop_ = true;
+    if (queue_ != nullptr) {
+      queue_->close();
+    }
+    for (auto& producer : producers_) {
+      ThreadPool::wait(producer);
+    }
+    producers_.clear();
+  }
+
+  void set_error(std::exception_ptr error) {
+    std::lock_guard lock(error_latch_);
+    if (error_ == nullptr) {
+      error_ = std::move(error);
+    }
+    stop_ = true;
+  }
+
+  void rethrow_error() {
+    std::exception_ptr error;
+    {
+      std::lock_guard lock(error_latch_);
+      std::swap(error, error_);
+    }
+    if (error != nullptr) {
+      std::rethrow_exception(error);
+    }
+  }
+};
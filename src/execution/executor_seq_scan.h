@@ -15,55 +15,91 @@ See the Mulan PSL v2 for more details. */
 #include "executor_abstract.h"
 #include "index/ix.h"
 #include "predicate_manager.h"
+#include "snapshot_reader.h"
 #include "system/sm.h"
 
 class SeqScanExecutor : public AbstractExecutor {
  private:
   SmManager* sm_manager_;
   std::string tab_name_;          // 表的名称
-  std::vector<Condition> conds_;  // scan的条件
+  std::vector<Condition> conds_;  // 不能下推到 RmScan 的条件
+  RmScanFilter filter_;           // 下推到 RmScan 的条件
   RmFileHandle* fh_;              // 表的数据文件句柄
   // std::vector<ColMeta> cols_; // scan后生成的记录的字段
   std::vector<std::vector<ColMeta>::iterator> cond_cols_;  // 谓词需要读取的字段
-  size_t len_;  // scan后生成的每条记录的长度
   // std::vector<Condition> fed_conds_; // 同conds_，两个字段相同
   Rid rid_;
   std::unique_ptr<RmScan> scan_;  // table_iterator
-  std::unique_ptr<RmRecord> rm_record_;
+  std::unique_ptr<RmRecord> rm_record_;  // 快照读的当前元组
+  std::vector<char> peek_buf_;           // 投影后的当前元组，供 peek() 使用
   std::vector<bool> is_need_scan_;  // 是否需要扫表（非子查询）
   bool is_sub_query_empty_;
   // false 为共享间隙锁，true 为互斥间隙锁
   bool gap_mode_;
   TabMeta& tab_;
+  ScanProjection projection_;  // 输出的列，没有投影时为表的全部列
+  // 快照读时不为空，扫描不加锁
+  std::unique_ptr<SnapshotReader> snapshot_;
+  std::vector<Rid> unvisited_;  // 堆扫描完后还要补上的有版本链的记录
+  std::size_t unvisited_pos_{0};
+  bool final_pass_{false};
 
  public:
   SeqScanExecutor(SmManager* sm_manager, std::string tab_name,
                   std::vector<Condition> conds, Context* context,
-                  bool gap_mode = false)
+                  bool gap_mode = false,
+                  const std::vector<std::string>& proj_cols = {})
       : sm_manager_(sm_manager),
         tab_name_(std::move(tab_name)),
         conds_(std::move(conds)),
         gap_mode_(gap_mode),
-        tab_(sm_manager_->db_.get_table(tab_name_)) {
+        tab_(sm_manager_->db_.get_table(tab_name_)),
+        projection_(tab_, proj_cols) {
     fh_ = sm_manager_->fhs_.at(tab_name_).get();
     // cols_ = tab_.cols;
-    len_ = tab_.cols.back().offset + tab_.cols.back().len;
     context_ = context;
     // fed_conds_ = conds_;
     is_sub_query_empty_ = false;
 
-    cond_cols_.reserve(conds_.size());
+    // 常值谓词下推到 RmScan，在页面上直接过滤，剩下的逐条记录求值
+    std::vector<Condition> residual_conds;
     for (auto& cond : conds_) {
+      auto col = tab_.get_col(cond.lhs_col.col_name);
+      if (push_down_cond(cond, *col, &filter_)) {
+        continue;
+      }
       // 存迭代器
-      cond_cols_.emplace_back(tab_.get_col(cond.lhs_col.col_name));
+      cond_cols_.emplace_back(col);
+      residual_conds.emplace_back(std::move(cond));
     }
+    conds_ = std::move(residual_conds);
 
-    // S 锁
+    if (context_ != nullptr && context_->txn_->is_snapshot_read()) {
+      snapshot_ = std::make_unique<SnapshotReader>(
+          context_->version_mgr_, fh_, context_->txn_->get_read_ts());
+      return;
+    }
+
+    // 表上有索引时，下面的 (-INF, +INF) 间隙锁已经挡住了所有写操作，
+    // 表上只加意向锁；没有索引时只能用表锁防止幻读，DML 直接加 X 锁
     if (context_ != nullptr) {
-      context_->lock_mgr_->lock_shared_on_table(context_->txn_, fh_->GetFd());
+      auto* lock_mgr = context_->lock_mgr_;
+      if (tab_.indexes.empty()) {
+        if (gap_mode_) {
+          lock_mgr->lock_exclusive_on_table(context_->txn_, fh_->GetFd());
+        } else {
+          lock_mgr->lock_shared_on_table(context_->txn_, fh_->GetFd());
+        }
+      } else if (gap_mode_) {
+        lock_mgr->lock_IX_on_table(context_->txn_, fh_->GetFd());
+      } else {
+        lock_mgr->lock_IS_on_table(context_->txn_, fh_->GetFd());
+      }
     }
 
-    // 如果表上有索引，对于全表扫操作加 (-INF, +INF) 的间隙锁
+    // 如果表上有索引，对于全表扫操作加 (-INF, +INF) 的间隙锁。DML 也不按
+    // 谓词缩小范围：全表扫先按谓词过滤再加行锁，UPDATE 也不检查新键值所在
+    // 的间隙，只锁谓词范围挡不住把其他记录改进范围内的事务
     for (auto& [ix_name, index_meta] : tab_.indexes) {
       auto predicate_manager = PredicateManager(index_meta);
       auto gap = Gap(predicate_manager.getIndexConds());
@@ -78,13 +114,19 @@ class SeqScanExecutor : public AbstractExecutor {
   }
 
   void beginTuple() override {
-    scan_ = std::make_unique<RmScan>(fh_);
+    scan_ = std::make_unique<RmScan>(fh_, &filter_);
+    if (snapshot_ != nullptr) {
+      snapshot_->reset();
+      unvisited_.clear();
+      unvisited_pos_ = 0;
+      final_pass_ = false;
+      snapshot_next();
+      return;
+    }
     for (; !scan_->is_end(); scan_->next()) {
       rid_ = scan_->rid();
-      rm_record_ = fh_->get_record(rid_, context_);
-      // TODO 这里会跑太快
-      // rm_record_ = std::move(scan_->get_record());
-      if (cmp_conds(rm_record_.get(), conds_)) {
+      // 页面已被 scan 固定，直接在页面上求值，Next() 时才拷贝
+      if (cmp_conds(scan_->get_data(), conds_)) {
         break;
       }
       if (is_sub_query_empty_) {
@@ -94,29 +136,104 @@ class SeqScanExecutor : public AbstractExecutor {
   }
 
   void nextTuple() override {
+    if (snapshot_ != nullptr) {
+      if (!scan_->is_end()) {
+        scan_->next();
+      } else if (unvisited_pos_ < unvisited_.size()) {
+        ++unvisited_pos_;
+      }
+      snapshot_next();
+      return;
+    }
     if (scan_->is_end()) {
       return;
     }
     for (scan_->next(); !scan_->is_end(); scan_->next()) {
       rid_ = scan_->rid();
-      rm_record_ = fh_->get_record(rid_, context_);
-      // TODO 这里会跑太快
-      // rm_record_ = std::move(scan_->get_record());
-      if (cmp_conds(rm_record_.get(), conds_)) {
+      if (cmp_conds(scan_->get_data(), conds_)) {
         break;
       }
     }
   }
 
-  std::unique_ptr<RmRecord> Next() override { return std::move(rm_record_); }
+  std::unique_ptr<RmRecord> Next() override {
+    if (snapshot_ != nullptr) {
+      return std::move(rm_record_);
+    }
+    return is_end() ? nullptr : make_record();
+  }
+
+  const char* peek() override {
+    if (snapshot_ != nullptr) {
+      return rm_record_->data;
+    }
+    if (projection_.empty()) {
+      return scan_->get_data();
+    }
+    peek_buf_.resize(projection_.len());
+    projection_.project(scan_->get_data(), peek_buf_.data());
+    return peek_buf_.data();
+  }
 
   Rid& rid() override { return rid_; }
 
-  bool is_end() const { return is_sub_query_empty_ || scan_->is_end(); }
+  bool is_end() const {
+    return is_sub_query_empty_ ||
+           (scan_->is_end() && unvisited_pos_ >= unvisited_.size());
+  }
+
+  const std::vector<ColMeta>& cols() const override {
+    return projection_.cols();
+  }
 
-  const std::vector<ColMeta>& cols() const override { return tab_.cols; }
+  size_t tupleLen() const override { return projection_.len(); }
+
+  // 当前记录的输出元组，有投影时只拷贝被引用的列
+  std::unique_ptr<RmRecord> make_record() const {
+    if (projection_.empty()) {
+      return scan_->get_record();
+    }
+    return projection_.project(scan_->get_data());
+  }
 
-  size_t tupleLen() const override { return len_; }
+  /**
+   * 快照读：堆上的记录换成对快照可见的版本再求值，下推谓词是在页面上的当前记录
+   * 上求值的，来自版本链的旧版本要重新求值。堆扫描完后再补上有版本链但没有
+   * 读到的记录
+   */
+  void snapshot_next() {
+    for (; !scan_->is_end(); scan_->next()) {
+      rid_ = scan_->rid();
+      snapshot_->visit(rid_);
+      bool chained;
+      auto record = snapshot_->read(rid_, scan_->get_record(), &chained);
+      if (record != nullptr && (!chained || filter_.eval(record->data)) &&
+          cmp_conds(record->data, conds_)) {
+        rm_record_ = project(std::move(record));
+        return;
+      }
+    }
+    if (!final_pass_) {
+      unvisited_ = snapshot_->get_unvisited_rids();
+      final_pass_ = true;
+    }
+    for (; unvisited_pos_ < unvisited_.size(); ++unvisited_pos_) {
+      rid_ = unvisited_[unvisited_pos_];
+      auto record = snapshot_->read(rid_);
+      if (record != nullptr && filter_.eval(record->data) &&
+          cmp_conds(record->data, conds_)) {
+        rm_record_ = project(std::move(record));
+        return;
+      }
+    }
+  }
+
+  std::unique_ptr<RmRecord> project(std::unique_ptr<RmRecord> record) const {
+    if (projection_.empty()) {
+      return record;
+    }
+    return projection_.project(record->data);
+  }
 
   static inline int compare(const char* a, const char* b, int col_len,
                             ColType col_type) {
@@ -140,9 +257,9 @@ class SeqScanExecutor : public AbstractExecutor {
 
   // 判断是否满足单个谓词条件
   // 判断是否满足单个谓词条件
-  bool cmp_cond(int i, const RmRecord* rec, const Condition& cond) {
+  bool cmp_cond(int i, const char* rec, const Condition& cond) {
     const auto& lhs_col_meta = cond_cols_[i];
-    const char* lhs_data = rec->data + lhs_col_meta->offset;
+    const char* lhs_data = rec + lhs_col_meta->offset;
     char* rhs_data;
     ColType rhs_type;
     // 全局record 防止作为临时变量离开作用域自动析构，char* 指针指向错误的地址
@@ -268,8 +385,8 @@ class SeqScanExecutor : public AbstractExecutor {
     }
   }
 
-  bool cmp_conds(const RmRecord* rec, const std::vector<Condition>& conds) {
-    for (int i = 0; i < conds.size(); ++i) {
+  bool cmp_conds(const char* rec, const std::vector<Condition>& conds) {
+    for (size_t i = 0; i < conds.size(); ++i) {
       if (!cmp_cond(i, rec, conds[i])) {
         return false;
       }
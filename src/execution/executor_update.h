@@ -9,6 +9,8 @@ MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
 See the Mulan PSL v2 for more details. */
 
 #pragma once
+#include <string>
+#include <unordered_set>
 #include <utility>
 
 #include "execution_defs.h"
@@ -29,10 +31,19 @@ class UpdateExecutor : public AbstractExecutor {
   std::vector<std::vector<ColMeta>::iterator> set_cols_;
   bool is_set_index_key_;
 
+  // 一个索引在本语句中攒下的修改，最后按叶子批量执行
+  struct IndexBatch {
+    IxIndex* ih;
+    IxBatch batch;
+    // 唯一索引在本语句中删除和插入的索引字段，查重时要算上还没执行的修改
+    std::unordered_set<std::string> deleted_keys;
+    std::unordered_set<std::string> inserted_keys;
+  };
+
  public:
   UpdateExecutor(SmManager* sm_manager, std::string tab_name,
                  std::vector<SetClause> set_clauses, std::vector<Rid> rids,
-                 bool is_set_index_key, bool is_index_scan, Context* context)
+                 bool is_set_index_key, Context* context)
       : sm_manager_(sm_manager),
         tab_name_(std::move(tab_name)),
         set_clauses_(std::move(set_clauses)),
@@ -50,22 +61,25 @@ class UpdateExecutor : public AbstractExecutor {
       set_cols_.emplace_back(tab_.get_col(set.lhs.col_name));
     }
 
-    // X 锁
-    if (!is_index_scan && !rids_.empty() && context_ != nullptr) {
-      context_->lock_mgr_->lock_exclusive_on_table(context_->txn_,
-                                                   fh_->GetFd());
-      for (auto& [ix_name, index_meta] : tab_.indexes) {
-        auto predicate_manager = PredicateManager(index_meta);
-        auto gap = Gap(predicate_manager.getIndexConds());
-        context_->lock_mgr_->lock_exclusive_on_gap(context_->txn_, index_meta,
-                                                   gap, fh_->GetFd());
-      }
-    }
+    // 表锁和间隙锁已经由扫描算子加好，这里只对每条记录加 X 锁
   }
 
   // 这里 next 只会被调用一次
   std::unique_ptr<RmRecord> Next() override {
+    std::vector<IndexBatch> batches;
+    if (is_set_index_key_) {
+      batches.reserve(tab_.indexes.size());
+      for (auto& [ix_name, index] : tab_.indexes) {
+        batches.push_back({sm_manager_->ihs_.at(ix_name).get(),
+                           IxBatch(index.key_len), {}, {}});
+      }
+    }
     for (auto& rid : rids_) {
+      // 行级 X 锁，在读记录之前加，避免 S 锁升级
+      if (context_ != nullptr) {
+        context_->lock_mgr_->lock_exclusive_on_record(context_->txn_, rid,
+                                                      fh_->GetFd());
+      }
       auto old_record = fh_->get_record(rid, context_);
       auto updated_record = std::make_unique<RmRecord>(*old_record);
 
@@ -81,50 +95,54 @@ class UpdateExecutor : public AbstractExecutor {
       }
 
       if (is_set_index_key_) {
-        auto** old_keys = new char*[tab_.indexes.size()];
-        auto** new_keys = new char*[tab_.indexes.size()];
-        auto** ihs = new IxIndexHandle*[tab_.indexes.size()];
+        std::vector<std::vector<char> > old_keys;
+        std::vector<std::vector<char> > new_keys;
+        old_keys.reserve(tab_.indexes.size());
+        new_keys.reserve(tab_.indexes.size());
 
         int i = 0;
         // 索引查重
         for (auto& [ix_name, index] : tab_.indexes) {
-          ihs[i] = sm_manager_->ihs_[ix_name].get();
-          old_keys[i] = new char[index.col_tot_len];
-          new_keys[i] = new char[index.col_tot_len];
-          for (auto& [index_offset, col_meta] : index.cols) {
-            memcpy(old_keys[i] + index_offset,
-                   old_record->data + col_meta.offset, col_meta.len);
-            memcpy(new_keys[i] + index_offset,
-                   updated_record->data + col_meta.offset, col_meta.len);
+          auto& old_key = old_keys.emplace_back(index.key_len);
+          auto& new_key = new_keys.emplace_back(index.key_len);
+          index.get_key(old_record->data, rid, old_key.data());
+          index.get_key(updated_record->data, rid, new_key.data());
+          auto& index_batch = batches[i++];
+          if (!index.unique || old_key == new_key) {
+            continue;
           }
-          if (!ihs[i]->is_unique(new_keys[i], _abstract_rid, context_->txn_) &&
-              _abstract_rid != rid) {
-            for (int j = 0; j <= i; ++j) {
-              delete[] old_keys[j];
-              delete[] new_keys[j];
-            }
-            delete[] old_keys;
-            delete[] new_keys;
-            delete[] ihs;
+          // 被本语句前面的记录占用，或者被其他记录占用且没有在本语句中删除
+          std::string prefix(new_key.data(), index.col_tot_len);
+          if (index_batch.inserted_keys.count(prefix) != 0 ||
+              (!index_batch.ih->is_unique(new_key.data(), _abstract_rid,
+                                          context_->txn_,
+                                          index.col_tot_len) &&
+               _abstract_rid != rid &&
+               index_batch.deleted_keys.count(prefix) == 0)) {
             throw NonUniqueIndexError("", {ix_name});
           }
-          ++i;
         }
 
-        // Unique Index -> Insert into index
-        for (int j = 0; j < i; ++j) {
-          // TODO
-          // 如果不涉及索引建的变化，直接原地更新记录，不需要维护索引，避免B+树分裂重组的不必要耗时
-          ihs[j]->delete_entry(old_keys[j], context_->txn_);
-          ihs[j]->insert_entry(new_keys[j], rid, context_->txn_);
-          delete[] old_keys[j];
-          delete[] new_keys[j];
+        i = 0;
+        for (auto& [_, index] : tab_.indexes) {
+          std::ignore = _;
+          auto& index_batch = batches[i];
+          auto& old_key = old_keys[i];
+          auto& new_key = new_keys[i];
+          ++i;
+          // 索引键没有变化时不用维护这个索引
+          if (old_key == new_key) {
+            continue;
+          }
+          index_batch.batch.add_delete(old_key.data());
+          index_batch.batch.add_insert(new_key.data(), rid);
+          if (index.unique) {
+            index_batch.deleted_keys.emplace(old_key.data(),
+                                             index.col_tot_len);
+            index_batch.inserted_keys.emplace(new_key.data(),
+                                              index.col_tot_len);
+          }
         }
-
-        // 插入完成，释放内存
-        delete[] old_keys;
-        delete[] new_keys;
-        delete[] ihs;
       }
 
       // 再检查是否有间隙锁
@@ -140,20 +158,28 @@ class UpdateExecutor : public AbstractExecutor {
       // }
 
 #ifdef ENABLE_LOGGING
-      auto* update_log_record =
-          new UpdateLogRecord(context_->txn_->get_transaction_id(), *old_record,
-                              *updated_record, rid, tab_name_);
-      update_log_record->prev_lsn_ = context_->txn_->get_prev_lsn();
+      // 只记下被修改的字节段
+      UpdateLogRecord update_log_record(context_->txn_->get_transaction_id(),
+                                        *old_record, *updated_record, rid,
+                                        tab_.id);
+      update_log_record.prev_lsn_ = context_->txn_->get_prev_lsn();
       context_->txn_->set_prev_lsn(
-          context_->log_mgr_->add_log_to_buffer(update_log_record));
+          context_->log_mgr_->add_log_to_buffer(&update_log_record));
+#endif
+
+      // 更新之前保留旧版本，快照读还能读到它
+      if (context_->version_mgr_ != nullptr) {
+        context_->version_mgr_->add_version(context_->txn_, fh_->GetFd(), rid,
+                                            old_record.get());
+      }
+      fh_->update_record(rid, updated_record->data, context_);
+#ifdef ENABLE_LOGGING
+      // 与删除一样，记录改完之后才设置 page_lsn
       auto&& page = fh_->fetch_page_handle(rid.page_no).page;
       page->set_page_lsn(context_->txn_->get_prev_lsn());
       sm_manager_->get_bpm()->unpin_page(page->get_page_id(), true);
-      delete update_log_record;
 #endif
 
-      fh_->update_record(rid, updated_record->data, context_);
-
       // 防止 double throw
       // 写入事务写集
       auto* write_record =
@@ -161,6 +187,9 @@ class UpdateExecutor : public AbstractExecutor {
                           *updated_record, is_set_index_key_);
       context_->txn_->append_write_record(write_record);
     }
+    for (auto& index_batch : batches) {
+      index_batch.ih->apply_batch(index_batch.batch, context_->txn_);
+    }
     return nullptr;
   }
 
@@ -0,0 +1,90 @@
+/* Copyright (c) 2023 Renmin University of China
+RMDB is licensed under Mulan PSL v2.
+You can use this software according to the terms and conditions of the Mulan PSL
+v2. You may obtain a copy of Mulan PSL v2 at:
+        http://license.coscl.org.cn/MulanPSL2
+THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+See the Mulan PSL v2 for more details. */
+
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// 任务块：表文件中连续的一段页面 [start_page, end_page)
+struct Morsel {
+  int start_page;
+  int end_page;
+};
+
+/**
+ * 任务块调度器
+ * 页面范围切分成定长的 morsel，按连续区间预先分给每个工作线程，保证局部性；
+ * 线程从自己队列的头部取任务，自己的做完后从其他线程队列的尾部窃取
+ */
+class MorselScheduler {
+ public:
+  MorselScheduler(int start_page, int end_page, int workers, int morsel_pages) {
+    queues_.reserve(workers);
+    for (int i = 0; i < workers; ++i) {
+      queues_.emplace_back(std::make_unique<WorkQueue>());
+    }
+    int num_morsels = (end_page - start_page + morsel_pages - 1) / morsel_pages;
+    for (int i = 0; i < num_morsels; ++i) {
+      int start = start_page + i * morsel_pages;
+      int end = std::min(start + morsel_pages, end_page);
+      // 第 i 个 morsel 属于第 i * workers / num_morsels 个线程
+      queues_[static_cast<long long>(i) * workers / num_morsels]
+          ->morsels.push_back({start, end});
+    }
+  }
+
+  // 取下一个任务块，所有任务都已分完时返回 false
+  bool next(int worker, Morsel* morsel) {
+    if (queues_[worker]->pop_front(morsel)) {
+      return true;
+    }
+    int workers = static_cast<int>(queues_.size());
+    for (int i = 1; i < workers; ++i) {
+      if (queues_[(worker + i) % workers]->pop_back(morsel)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  int workers() const { return static_cast<int>(queues_.size()); }
+
+ private:
+  struct WorkQueue {
+    std::mutex latch;
+    std::deque<Morsel> morsels;
+
+    bool pop_front(Morsel* morsel) {
+      std::lock_guard lock(latch);
+      if (morsels.empty()) {
+        return false;
+      }
+      *morsel = morsels.front();
+      morsels.pop_front();
+      return true;
+    }
+
+    bool pop_back(Morsel* morsel) {
+      std::lock_guard lock(latch);
+      if (morsels.empty()) {
+        return false;
+      }
+      *morsel = morsels.back();
+      morsels.pop_back();
+      return true;
+    }
+  };
+
+  std::vector<std::unique_ptr<WorkQueue> > queues_;
+};
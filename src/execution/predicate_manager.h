@@ -92,6 +92,17 @@ class PredicateManager {
     return true;
   }
 
+  // 检查全部索引谓词，用于不是按索引范围读出的 key（快照读的旧版本）
+  bool cmpAllIndexConds(const RmRecord& rec) {
+    for (auto& [left, right] : index_conds_) {
+      if ((left.op != OP_INVALID && !cmpIndexCond(rec, left)) ||
+          (right.op != OP_INVALID && !cmpIndexCond(rec, right))) {
+        return false;
+      }
+    }
+    return true;
+  }
+
   static bool cmpIndexCond(const RmRecord& rec, const CondOp& cond) {
     int cmp = compare(rec.data + cond.offset, cond.rhs_val.raw->data,
                       cond.rhs_val.raw->size, cond.rhs_val.type);
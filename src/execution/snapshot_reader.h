@@ -0,0 +1,120 @@
+/* Copyright (c) 2023 Renmin University of China
+RMDB is licensed under Mulan PSL v2.
+You can use this software according to the terms and conditions of the Mulan PSL
+v2. You may obtain a copy of Mulan PSL v2 at:
+        http://license.coscl.org.cn/MulanPSL2
+THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+See the Mulan PSL v2 for more details. */
+
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "record/rm_file_handle.h"
+#include "transaction/concurrency/version_manager.h"
+
+/**
+ * 扫描算子的快照读：不加锁，读出记录对读时间戳可见的版本，并记下读过哪些记录。
+ * 堆或索引扫描完之后，再处理有版本链但没有读到的记录（已经被删除，或者被修改得
+ * 不满足扫描条件），补上它们对快照可见的版本
+ */
+class SnapshotReader {
+ public:
+  SnapshotReader(VersionManager* version_mgr, RmFileHandle* fh,
+                 timestamp_t read_ts)
+      : version_mgr_(version_mgr),
+        fh_(fh),
+        read_ts_(read_ts),
+        slots_per_page_(fh->get_file_hdr().num_records_per_page) {}
+
+  // 记下读过 rid，返回 false 表示之前已经读过
+  bool visit(const Rid& rid) {
+    auto pos = static_cast<std::size_t>(rid.page_no) * slots_per_page_ +
+               rid.slot_no;
+    if (pos >= visited_.size()) {
+      visited_.resize(std::max(pos + 1, visited_.size() * 2));
+    }
+    if (visited_[pos]) {
+      return false;
+    }
+    visited_[pos] = true;
+    return true;
+  }
+
+  /**
+   * 读 rid 的可见版本，data 为已经读到的当前记录，为空表示记录不存在。
+   * 不可见时返回空，chained 传出可见版本是否来自版本链
+   */
+  std::unique_ptr<RmRecord> read(const Rid& rid, const char* data,
+                                 bool* chained = nullptr) {
+    std::unique_ptr<RmRecord> record;
+    if (data != nullptr) {
+      record = std::make_unique<RmRecord>(fh_->get_file_hdr().record_size,
+                                          const_cast<char*>(data));
+    }
+    return read(rid, std::move(record), chained);
+  }
+
+  // 同上，当前记录已经拷贝出来，如 RmScan::get_record() 持有页面读锁拷贝的
+  std::unique_ptr<RmRecord> read(const Rid& rid,
+                                 std::unique_ptr<RmRecord> record,
+                                 bool* chained = nullptr) {
+    // 先拷贝当前记录再查版本链，顺序与写事务相反
+    bool has_chain =
+        version_mgr_->get_visible(fh_->GetFd(), rid, read_ts_, &record);
+    if (chained != nullptr) {
+      *chained = has_chain;
+    }
+    return record;
+  }
+
+  // 从堆上读 rid 的可见版本
+  std::unique_ptr<RmRecord> read(const Rid& rid, bool* chained = nullptr) {
+    std::unique_ptr<RmRecord> record;
+    try {
+      record = fh_->get_record(rid, nullptr);
+    } catch (RecordNotFoundError&) {
+    }
+    bool has_chain =
+        version_mgr_->get_visible(fh_->GetFd(), rid, read_ts_, &record);
+    if (chained != nullptr) {
+      *chained = has_chain;
+    }
+    return record;
+  }
+
+  // 有版本链但还没有读过的记录，只在扫描结束时调用
+  std::vector<Rid> get_unvisited_rids() {
+    auto rids = version_mgr_->get_chained_rids(fh_->GetFd());
+    rids.erase(std::remove_if(rids.begin(), rids.end(),
+                              [this](const Rid& rid) { return !visit(rid); }),
+               rids.end());
+    return rids;
+  }
+
+  // 并入另一个读者读过的记录，并行扫描的各工作线程扫描完之后调用
+  void merge_visited(const SnapshotReader& other) {
+    if (other.visited_.size() > visited_.size()) {
+      visited_.resize(other.visited_.size());
+    }
+    for (std::size_t pos = 0; pos < other.visited_.size(); ++pos) {
+      if (other.visited_[pos]) {
+        visited_[pos] = true;
+      }
+    }
+  }
+
+  void reset() { visited_.clear(); }
+
+ private:
+  VersionManager* version_mgr_;
+  RmFileHandle* fh_;
+  timestamp_t read_ts_;
+  std::size_t slots_per_page_;
+  std::vector<bool> visited_;  // 按 page_no * 每页槽数 + slot_no 记录
+};
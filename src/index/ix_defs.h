@@ -23,6 +23,25 @@ constexpr int IX_LEAF_HEADER_PAGE = 1;
 constexpr int IX_INIT_ROOT_PAGE = 2;
 constexpr int IX_INIT_NUM_PAGES = 3;
 constexpr int IX_MAX_COL_LEN = 512;
+// 乐观读连续校验失败的次数上限，超过后加读锁下降
+constexpr int IX_OPTIMISTIC_READ_RETRIES = 4;
+// 乐观读缓存结点所在帧的槽数，按页号直接映射，必须是 2 的幂
+constexpr int IX_FRAME_HINTS = 16384;
+// 叶子结点是否对 key 做前缀压缩，只对能 memcmp 的 key 生效，修改后要重建索引
+constexpr bool IX_LEAF_PREFIX_COMPRESSION = true;
+// 批量建索引时每个结点的填充率，给之后的插入留出空间，避免马上分裂
+constexpr double IX_BULK_LOAD_FILL_FACTOR = 0.9;
+// 哈希索引：第 1 页是第一个目录页，第 2 页是初始的桶
+constexpr int IX_HASH_INIT_DIR_PAGE = 1;
+constexpr int IX_HASH_INIT_BUCKET_PAGE = 2;
+constexpr int IX_HASH_INIT_NUM_PAGES = 3;
+// 目录的最大全局深度，桶中的 key 在这些低位上都相同时改挂溢出页
+constexpr int IX_HASH_MAX_DEPTH = 18;
+// 每个目录页存放的桶页号数量
+constexpr int IX_HASH_DIR_ENTRIES = PAGE_SIZE / sizeof(page_id_t);
+
+// 结点中 key 的存储和比较方式，见 ix_key.h
+enum class IxKeyKind { INT, BYTES, NORMALIZED };
 
 class IxFileHdr {
  public:
@@ -41,6 +60,7 @@ class IxFileHdr {
                     // page_no
   page_id_t last_leaf_;  // 尾叶节点对应的页号
   int tot_len_;          // 记录结构体的整体长度
+  IxKeyKind key_kind_{IxKeyKind::BYTES};  // 不持久化，由字段类型推出
 
   IxFileHdr() { tot_len_ = col_num_ = 0; }
 
@@ -134,7 +154,96 @@ class IxFileHdr {
     last_leaf_ = *reinterpret_cast<const page_id_t*>(src + offset);
     offset += sizeof(page_id_t);
     assert(offset == tot_len_);
+    init_key_kind();
+  }
+
+  void init_key_kind() {
+    if (col_num_ == 1 && col_types_[0] == TYPE_INT) {
+      key_kind_ = IxKeyKind::INT;
+      return;
+    }
+    key_kind_ = IxKeyKind::BYTES;
+    for (auto type : col_types_) {
+      if (type != TYPE_STRING) {
+        key_kind_ = IxKeyKind::NORMALIZED;
+      }
+    }
+  }
+};
+
+/* 可扩展哈希索引的文件头，存放在第 0 页 */
+class IxHashFileHdr {
+ public:
+  int num_pages_;                   // 磁盘文件中页面的数量
+  int global_depth_;                // 目录的全局深度
+  int col_num_;                     // key 包含的字段数量
+  std::vector<ColType> col_types_;  // 字段的类型
+  std::vector<int> col_lens_;       // 字段的长度
+  int col_tot_len_;                 // key 的总长度
+  int hash_len_;  // 参与哈希的前缀长度，即索引字段，不含 rid 和 INCLUDE 字段
+  std::vector<page_id_t> dir_pages_;  // 目录页的页号，按目录下标顺序
+  int tot_len_;                       // 记录结构体的整体长度
+
+  IxHashFileHdr() { tot_len_ = col_num_ = 0; }
+
+  void update_tot_len() {
+    tot_len_ = sizeof(int) * 7;
+    tot_len_ += sizeof(ColType) * col_num_ + sizeof(int) * col_num_;
+    tot_len_ += sizeof(page_id_t) * dir_pages_.size();
+    assert(tot_len_ <= PAGE_SIZE);
+  }
+
+  void serialize(char* dest) {
+    update_tot_len();
+    int num_dir_pages = static_cast<int>(dir_pages_.size());
+    int offset = 0;
+    auto put = [&](const void* src, std::size_t len) {
+      memcpy(dest + offset, src, len);
+      offset += len;
+    };
+    put(&tot_len_, sizeof(int));
+    put(&num_pages_, sizeof(int));
+    put(&global_depth_, sizeof(int));
+    put(&col_num_, sizeof(int));
+    put(col_types_.data(), sizeof(ColType) * col_num_);
+    put(col_lens_.data(), sizeof(int) * col_num_);
+    put(&col_tot_len_, sizeof(int));
+    put(&hash_len_, sizeof(int));
+    put(&num_dir_pages, sizeof(int));
+    put(dir_pages_.data(), sizeof(page_id_t) * num_dir_pages);
+    assert(offset == tot_len_);
   }
+
+  void deserialize(const char* src) {
+    int num_dir_pages;
+    int offset = 0;
+    auto get = [&](void* dest, std::size_t len) {
+      memcpy(dest, src + offset, len);
+      offset += len;
+    };
+    get(&tot_len_, sizeof(int));
+    get(&num_pages_, sizeof(int));
+    get(&global_depth_, sizeof(int));
+    get(&col_num_, sizeof(int));
+    col_types_.resize(col_num_);
+    col_lens_.resize(col_num_);
+    get(col_types_.data(), sizeof(ColType) * col_num_);
+    get(col_lens_.data(), sizeof(int) * col_num_);
+    get(&col_tot_len_, sizeof(int));
+    get(&hash_len_, sizeof(int));
+    get(&num_dir_pages, sizeof(int));
+    dir_pages_.resize(num_dir_pages);
+    get(dir_pages_.data(), sizeof(page_id_t) * num_dir_pages);
+    assert(offset == tot_len_);
+  }
+};
+
+/* 哈希桶的页头，之后依次是 keys 和 rids 两个数组 */
+class IxHashBucketHdr {
+ public:
+  int local_depth;      // 桶的局部深度，溢出页不使用
+  int num_key;          // 当前页中的键值对数量
+  page_id_t next_page;  // 同一个桶的下一个溢出页，IX_NO_PAGE 表示没有
 };
 
 class IxPageHdr {
@@ -144,6 +253,7 @@ class IxPageHdr {
   int num_key;                  // # current keys (always equals to #child - 1)
                                 // 已插入的keys数量，key_idx∈[0,num_key)
   bool is_leaf;                 // 是否为叶节点
+  uint16_t prefix_len;          // 前缀压缩的叶子中所有 key 的公共前缀长度
   page_id_t prev_leaf;  // previous leaf node's page_no, effective only when
                         // is_leaf is true
   page_id_t next_leaf;  // next leaf node's page_no, effective only when is_leaf
@@ -0,0 +1,397 @@
+/* Copyright (c) 2023 Renmin University of China
+RMDB is licensed under Mulan PSL v2.
+You can use this software according to the terms and conditions of the Mulan PSL
+v2. You may obtain a copy of Mulan PSL v2 at:
+        http://license.coscl.org.cn/MulanPSL2
+THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+See the Mulan PSL v2 for more details. */
+
+#include "ix_hash_handle.h"
+
+#include <algorithm>
+#include <mutex>
+
+IxHashHandle::IxHashHandle(DiskManager* disk_manager,
+                           BufferPoolManager* buffer_pool_manager, int fd)
+    : IxIndex(fd),
+      disk_manager_(disk_manager),
+      buffer_pool_manager_(buffer_pool_manager) {
+  char* buf = new char[PAGE_SIZE];
+  memset(buf, 0, PAGE_SIZE);
+  disk_manager_->read_page(fd, IX_FILE_HDR_PAGE, buf, PAGE_SIZE);
+  file_hdr_ = new IxHashFileHdr();
+  file_hdr_->deserialize(buf);
+  delete[] buf;
+  disk_manager_->set_fd2pageno(fd, file_hdr_->num_pages_);
+
+  // 目录读入内存，之后的修改同步写回目录页
+  dir_.resize(std::size_t{1} << file_hdr_->global_depth_);
+  for (std::size_t i = 0; i < file_hdr_->dir_pages_.size(); ++i) {
+    BasicPageGuard guard(
+        buffer_pool_manager_,
+        buffer_pool_manager_->fetch_page({fd_, file_hdr_->dir_pages_[i]}));
+    std::size_t begin = i * IX_HASH_DIR_ENTRIES;
+    std::size_t num =
+        std::min<std::size_t>(IX_HASH_DIR_ENTRIES, dir_.size() - begin);
+    memcpy(dir_.data() + begin, guard.GetData(), num * sizeof(page_id_t));
+  }
+}
+
+/**
+ * @description: 把文件头写回第 0 页
+ */
+void IxHashHandle::write_file_hdr() const {
+  file_hdr_->update_tot_len();
+  char* data = new char[file_hdr_->tot_len_];
+  file_hdr_->serialize(data);
+  disk_manager_->write_page(fd_, IX_FILE_HDR_PAGE, data, file_hdr_->tot_len_);
+  delete[] data;
+}
+
+void IxHashHandle::normalize(const char* raw_key, char* key) const {
+  memcpy(key, raw_key, file_hdr_->col_tot_len_);
+  int offset = 0;
+  for (int i = 0; i < file_hdr_->col_num_ && offset < file_hdr_->hash_len_;
+       ++i) {
+    if (file_hdr_->col_types_[i] == TYPE_FLOAT &&
+        *reinterpret_cast<float*>(key + offset) == 0.0f) {
+      *reinterpret_cast<float*>(key + offset) = 0.0f;
+    }
+    offset += file_hdr_->col_lens_[i];
+  }
+}
+
+/**
+ * @description: 对 key 的前 hash_len 个字节做 FNV-1a，再用 murmur3 的 fmix64
+ * 打散低位。哈希值决定 key 在文件中的位置，不能依赖 std::hash 的实现
+ */
+std::uint64_t IxHashHandle::hash(const char* key) const {
+  std::uint64_t h = 14695981039346656037ULL;
+  for (int i = 0; i < file_hdr_->hash_len_; ++i) {
+    h ^= static_cast<unsigned char>(key[i]);
+    h *= 1099511628211ULL;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+template <typename F>
+void IxHashHandle::for_each_page(IxHashBucket& bucket, bool is_write,
+                                 F&& visit) {
+  if (visit(bucket)) {
+    return;
+  }
+  page_id_t next_page = bucket.hdr()->next_page;
+  while (next_page != IX_NO_PAGE) {
+    BasicPageGuard guard(buffer_pool_manager_,
+                         buffer_pool_manager_->fetch_page({fd_, next_page}));
+    IxHashBucket page(file_hdr_, is_write
+                                     ? guard.GetDataMut()
+                                     : const_cast<char*>(guard.GetData()));
+    if (visit(page)) {
+      return;
+    }
+    next_page = page.hdr()->next_page;
+  }
+}
+
+bool IxHashHandle::find_in_bucket(IxHashBucket& bucket, const char* key,
+                                  int len, Rid* value) {
+  bool is_found = false;
+  for_each_page(bucket, false, [&](IxHashBucket& page) {
+    int pos = page.find(key, len);
+    if (pos != -1) {
+      is_found = true;
+      if (value != nullptr) {
+        *value = *page.get_rid(pos);
+      }
+    }
+    return is_found;
+  });
+  return is_found;
+}
+
+/**
+ * @description: 查找索引字段等于 key 的所有 rid
+ * @param {char*} key 只使用前 hash_len 个字节（索引字段），长度仍为 key 的长度
+ * @param {vector<Rid>*} result 结果追加到末尾
+ */
+bool IxHashHandle::get_value(const char* raw_key, std::vector<Rid>* result,
+                             Transaction* transaction) {
+  char key[IX_MAX_COL_LEN];
+  normalize(raw_key, key);
+  std::shared_lock lock(dir_latch_);
+  auto guard = BasicPageGuard(buffer_pool_manager_,
+                              buffer_pool_manager_->fetch_page(
+                                  {fd_, bucket_of(hash(key))}))
+                   .UpgradeRead();
+  IxHashBucket bucket(file_hdr_, const_cast<char*>(guard.GetData()));
+  bool is_found = false;
+  for_each_page(bucket, false, [&](IxHashBucket& page) {
+    for (int i = 0; i < page.get_size(); ++i) {
+      if (memcmp(page.get_key(i), key, file_hdr_->hash_len_) == 0) {
+        result->emplace_back(*page.get_rid(i));
+        is_found = true;
+      }
+    }
+    return false;
+  });
+  return is_found;
+}
+
+bool IxHashHandle::is_unique(const char* raw_key, Rid& value,
+                             Transaction* transaction, int key_len) {
+  int len = key_len > 0 ? key_len : file_hdr_->col_tot_len_;
+  // 比较的字节必须覆盖参与哈希的部分，否则相同的 key 可能落在别的桶
+  assert(len >= file_hdr_->hash_len_);
+  char key[IX_MAX_COL_LEN];
+  normalize(raw_key, key);
+  std::shared_lock lock(dir_latch_);
+  auto guard = BasicPageGuard(buffer_pool_manager_,
+                              buffer_pool_manager_->fetch_page(
+                                  {fd_, bucket_of(hash(key))}))
+                   .UpgradeRead();
+  IxHashBucket bucket(file_hdr_, const_cast<char*>(guard.GetData()));
+  return !find_in_bucket(bucket, key, len, &value);
+}
+
+/**
+ * @description: 插入键值对，桶满时分裂或挂溢出页后重试
+ * @return {page_id_t} 主桶页的页号，key 已存在时返回 IX_NO_PAGE
+ */
+page_id_t IxHashHandle::insert_entry(const char* raw_key, const Rid& value,
+                                     Transaction* transaction) {
+  char key[IX_MAX_COL_LEN];
+  normalize(raw_key, key);
+  const std::uint64_t key_hash = hash(key);
+  while (true) {
+    {
+      std::shared_lock lock(dir_latch_);
+      page_id_t page_no = bucket_of(key_hash);
+      auto guard = BasicPageGuard(buffer_pool_manager_,
+                                  buffer_pool_manager_->fetch_page(
+                                      {fd_, page_no}))
+                       .UpgradeWrite();
+      IxHashBucket bucket(file_hdr_, guard.GetDataMut());
+      if (find_in_bucket(bucket, key, file_hdr_->col_tot_len_, nullptr)) {
+        return IX_NO_PAGE;
+      }
+      bool is_inserted = false;
+      for_each_page(bucket, true, [&](IxHashBucket& page) {
+        if (page.is_full()) {
+          return false;
+        }
+        page.push_back(key, value);
+        is_inserted = true;
+        return true;
+      });
+      if (is_inserted) {
+        return page_no;
+      }
+    }
+    std::unique_lock lock(dir_latch_);
+    grow(key_hash);
+  }
+}
+
+/**
+ * @description: 删除键值对，桶变空时不合并，目录也不收缩
+ */
+bool IxHashHandle::delete_entry(const char* raw_key,
+                                Transaction* transaction) {
+  char key[IX_MAX_COL_LEN];
+  normalize(raw_key, key);
+  std::shared_lock lock(dir_latch_);
+  auto guard = BasicPageGuard(buffer_pool_manager_,
+                              buffer_pool_manager_->fetch_page(
+                                  {fd_, bucket_of(hash(key))}))
+                   .UpgradeWrite();
+  IxHashBucket bucket(file_hdr_, guard.GetDataMut());
+  bool is_deleted = false;
+  for_each_page(bucket, true, [&](IxHashBucket& page) {
+    int pos = page.find(key, file_hdr_->col_tot_len_);
+    if (pos != -1) {
+      page.erase(pos);
+      is_deleted = true;
+    }
+    return is_deleted;
+  });
+  return is_deleted;
+}
+
+/**
+ * @description: 批量执行插入和删除。每个 key 只访问一个桶，没有 B+ 树那样
+ * 共享下降路径的收益，逐个执行即可
+ */
+void IxHashHandle::apply_batch(const IxBatch& batch, Transaction* transaction) {
+  for (bool is_delete : {true, false}) {
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+      if (batch.is_delete_[i] != is_delete) {
+        continue;
+      }
+      if (is_delete) {
+        delete_entry(batch.key(i), transaction);
+      } else {
+        insert_entry(batch.key(i), batch.rids_[i], transaction);
+      }
+    }
+  }
+}
+
+BasicPageGuard IxHashHandle::create_page() {
+  ++file_hdr_->num_pages_;
+  PageId page_id = {.fd = fd_, .page_no = INVALID_PAGE_ID};
+  auto* page = buffer_pool_manager_->new_page(&page_id);
+  return {buffer_pool_manager_, page};
+}
+
+page_id_t IxHashHandle::create_bucket(int local_depth) {
+  auto guard = create_page();
+  *reinterpret_cast<IxHashBucketHdr*>(guard.GetDataMut()) = {
+      .local_depth = local_depth,
+      .num_key = 0,
+      .next_page = IX_NO_PAGE,
+  };
+  return guard.GetPageId().page_no;
+}
+
+/**
+ * @description: 把内存中的一个目录项写回目录页，目录页不够时新建
+ */
+void IxHashHandle::store_dir_entry(int idx) {
+  std::size_t dir_page_idx = idx / IX_HASH_DIR_ENTRIES;
+  BasicPageGuard guard;
+  if (dir_page_idx == file_hdr_->dir_pages_.size()) {
+    guard = create_page();
+    file_hdr_->dir_pages_.emplace_back(guard.GetPageId().page_no);
+  } else {
+    guard = BasicPageGuard(buffer_pool_manager_,
+                           buffer_pool_manager_->fetch_page(
+                               {fd_, file_hdr_->dir_pages_[dir_page_idx]}));
+  }
+  auto* entries = reinterpret_cast<page_id_t*>(guard.GetDataMut());
+  entries[idx % IX_HASH_DIR_ENTRIES] = dir_[idx];
+}
+
+/**
+ * @description: key 所在的桶已满，分裂该桶；桶中的 key 在低 IX_HASH_MAX_DEPTH
+ * 位上无法区分时改为挂一个溢出页。调用者持有目录写锁
+ * @param {uint64_t} key_hash 待插入的 key 的哈希值
+ */
+void IxHashHandle::grow(std::uint64_t key_hash) {
+  const std::uint64_t max_mask = (std::uint64_t{1} << IX_HASH_MAX_DEPTH) - 1;
+  int bucket_idx = static_cast<int>(
+      key_hash & ((std::uint64_t{1} << file_hdr_->global_depth_) - 1));
+  page_id_t page_no = dir_[bucket_idx];
+  BasicPageGuard guard(buffer_pool_manager_,
+                       buffer_pool_manager_->fetch_page({fd_, page_no}));
+  IxHashBucket bucket(file_hdr_, const_cast<char*>(guard.GetData()));
+  bool has_room = false;
+  bool can_split = false;
+  page_id_t last_page = page_no;
+  for_each_page(bucket, false, [&](IxHashBucket& page) {
+    has_room = has_room || !page.is_full();
+    for (int i = 0; i < page.get_size() && !can_split; ++i) {
+      can_split = ((hash(page.get_key(i)) ^ key_hash) & max_mask) != 0;
+    }
+    if (page.hdr()->next_page != IX_NO_PAGE) {
+      last_page = page.hdr()->next_page;
+    }
+    return false;
+  });
+  if (has_room) {
+    // 其他线程已经分裂过这个桶
+    return;
+  }
+  if (can_split && bucket.hdr()->local_depth < IX_HASH_MAX_DEPTH) {
+    guard.Drop();
+    split(bucket_idx);
+    return;
+  }
+  page_id_t overflow_page = create_bucket(0);
+  if (last_page != page_no) {
+    guard = BasicPageGuard(buffer_pool_manager_,
+                           buffer_pool_manager_->fetch_page({fd_, last_page}));
+  }
+  reinterpret_cast<IxHashBucketHdr*>(guard.GetDataMut())->next_page =
+      overflow_page;
+}
+
+/**
+ * @description: 按哈希值的第 local_depth 位把桶分成两个，必要时目录加倍。
+ * 调用者持有目录写锁
+ * @param {int} bucket_idx 指向该桶的任一目录项
+ */
+void IxHashHandle::split(int bucket_idx) {
+  page_id_t old_page = dir_[bucket_idx];
+  std::vector<char> keys;
+  std::vector<Rid> rids;
+  int depth;
+  {
+    BasicPageGuard guard(buffer_pool_manager_,
+                         buffer_pool_manager_->fetch_page({fd_, old_page}));
+    IxHashBucket bucket(file_hdr_, guard.GetDataMut());
+    depth = bucket.hdr()->local_depth++;
+    // 取出所有键值对，溢出页留在原桶中继续使用
+    for_each_page(bucket, true, [&](IxHashBucket& page) {
+      for (int i = 0; i < page.get_size(); ++i) {
+        keys.insert(keys.end(), page.get_key(i),
+                    page.get_key(i) + file_hdr_->col_tot_len_);
+        rids.emplace_back(*page.get_rid(i));
+      }
+      page.hdr()->num_key = 0;
+      return false;
+    });
+  }
+
+  if (depth == file_hdr_->global_depth_) {
+    int size = static_cast<int>(dir_.size());
+    dir_.resize(2 * size);
+    std::copy_n(dir_.begin(), size, dir_.begin() + size);
+    ++file_hdr_->global_depth_;
+    for (int i = size; i < 2 * size; ++i) {
+      store_dir_entry(i);
+    }
+  }
+
+  // 指向原桶且第 depth 位为 1 的目录项改为指向新桶
+  page_id_t new_page = create_bucket(depth + 1);
+  int low = bucket_idx & ((1 << depth) - 1);
+  for (int i = low | (1 << depth); i < static_cast<int>(dir_.size());
+       i += 1 << (depth + 1)) {
+    dir_[i] = new_page;
+    store_dir_entry(i);
+  }
+
+  for (std::size_t i = 0; i < rids.size(); ++i) {
+    const char* key = keys.data() + i * file_hdr_->col_tot_len_;
+    append_to((hash(key) >> depth) & 1 ? new_page : old_page, key, rids[i]);
+  }
+}
+
+/**
+ * @description: 把键值对放进桶中第一个有空位的页面，都满时在末尾挂溢出页。
+ * 调用者持有目录写锁
+ */
+void IxHashHandle::append_to(page_id_t page_no, const char* key,
+                             const Rid& rid) {
+  while (true) {
+    BasicPageGuard guard(buffer_pool_manager_,
+                         buffer_pool_manager_->fetch_page({fd_, page_no}));
+    IxHashBucket page(file_hdr_, guard.GetDataMut());
+    if (!page.is_full()) {
+      page.push_back(key, rid);
+      return;
+    }
+    if (page.hdr()->next_page == IX_NO_PAGE) {
+      page.hdr()->next_page = create_bucket(0);
+    }
+    page_no = page.hdr()->next_page;
+  }
+}
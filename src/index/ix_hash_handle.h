@@ -0,0 +1,149 @@
+/* Copyright (c) 2023 Renmin University of China
+RMDB is licensed under Mulan PSL v2.
+You can use this software according to the terms and conditions of the Mulan PSL
+v2. You may obtain a copy of Mulan PSL v2 at:
+        http://license.coscl.org.cn/MulanPSL2
+THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+See the Mulan PSL v2 for more details. */
+
+#pragma once
+
+#include <cstdint>
+#include <shared_mutex>
+#include <vector>
+
+#include "ix_defs.h"
+#include "ix_index.h"
+#include "storage/page_guard.h"
+
+/* 管理哈希索引中的一个桶页面（主桶页或溢出页） */
+class IxHashBucket {
+ public:
+  IxHashBucket(const IxHashFileHdr* file_hdr, char* data)
+      : key_len_(file_hdr->col_tot_len_) {
+    hdr_ = reinterpret_cast<IxHashBucketHdr*>(data);
+    keys_ = data + sizeof(IxHashBucketHdr);
+    capacity_ = capacity(key_len_);
+    rids_ = reinterpret_cast<Rid*>(keys_ + capacity_ * key_len_);
+  }
+
+  // 每页最多存放的键值对数量
+  static int capacity(int key_len) {
+    return static_cast<int>((PAGE_SIZE - sizeof(IxHashBucketHdr)) /
+                            (key_len + sizeof(Rid)));
+  }
+
+  int get_size() const { return hdr_->num_key; }
+
+  bool is_full() const { return hdr_->num_key >= capacity_; }
+
+  char* get_key(int i) const { return keys_ + i * key_len_; }
+
+  Rid* get_rid(int i) const { return &rids_[i]; }
+
+  IxHashBucketHdr* hdr() const { return hdr_; }
+
+  // 找到与 key 的前 len 个字节相同的第一个位置，找不到返回 -1
+  int find(const char* key, int len) const {
+    for (int i = 0; i < hdr_->num_key; ++i) {
+      if (memcmp(get_key(i), key, len) == 0) {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  void push_back(const char* key, const Rid& rid) {
+    assert(!is_full());
+    memcpy(get_key(hdr_->num_key), key, key_len_);
+    rids_[hdr_->num_key] = rid;
+    ++hdr_->num_key;
+  }
+
+  // 桶内无序，用最后一个键值对填补空位
+  void erase(int i) {
+    int last = --hdr_->num_key;
+    if (i != last) {
+      memcpy(get_key(i), get_key(last), key_len_);
+      rids_[i] = rids_[last];
+    }
+  }
+
+ private:
+  IxHashBucketHdr* hdr_;
+  char* keys_;
+  Rid* rids_;
+  int key_len_;
+  int capacity_;
+};
+
+/**
+ * 可扩展哈希索引，只支持等值查找
+ * 目录缓存在内存中并同步写入目录页，每次查找只访问一个桶（及其溢出页）
+ * 并发控制：普通操作持目录读锁和主桶页的页锁，分裂和挂溢出页持目录写锁
+ */
+class IxHashHandle : public IxIndex {
+  friend class IxManager;
+
+ private:
+  DiskManager* disk_manager_;
+  BufferPoolManager* buffer_pool_manager_;
+  IxHashFileHdr* file_hdr_;
+  std::vector<page_id_t> dir_;  // 目录，下标是哈希值的低 global_depth 位
+  std::shared_mutex dir_latch_;
+
+ public:
+  IxHashHandle(DiskManager* disk_manager,
+               BufferPoolManager* buffer_pool_manager, int fd);
+
+  ~IxHashHandle() override { delete file_hdr_; }
+
+  bool get_value(const char* key, std::vector<Rid>* result,
+                 Transaction* transaction) override;
+
+  bool is_unique(const char* key, Rid& value, Transaction* transaction,
+                 int key_len = 0) override;
+
+  page_id_t insert_entry(const char* key, const Rid& value,
+                         Transaction* transaction) override;
+
+  bool delete_entry(const char* key, Transaction* transaction) override;
+
+  void apply_batch(const IxBatch& batch, Transaction* transaction) override;
+
+  void write_file_hdr() const override;
+
+  int get_global_depth() const { return file_hdr_->global_depth_; }
+
+ private:
+  // 规范化 key：浮点数 -0.0 写成 0.0，保证相等的 key 字节也相同
+  void normalize(const char* raw_key, char* key) const;
+
+  std::uint64_t hash(const char* key) const;
+
+  page_id_t bucket_of(std::uint64_t hash) const {
+    return dir_[hash & ((std::uint64_t{1} << file_hdr_->global_depth_) - 1)];
+  }
+
+  // 在一个桶的所有页面中找与 key 前 len 个字节相同的键值对
+  bool find_in_bucket(IxHashBucket& bucket, const char* key, int len,
+                      Rid* value);
+
+  // 依次访问主桶页和各个溢出页，visit 返回 true 时停止
+  template <typename F>
+  void for_each_page(IxHashBucket& bucket, bool is_write, F&& visit);
+
+  BasicPageGuard create_page();
+
+  page_id_t create_bucket(int local_depth);
+
+  void store_dir_entry(int idx);
+
+  void grow(std::uint64_t hash);
+
+  void split(int bucket_idx);
+
+  void append_to(page_id_t page_no, const char* key, const Rid& rid);
+};
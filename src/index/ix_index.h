@@ -0,0 +1,83 @@
+/* Copyright (c) 2023 Renmin University of China
+RMDB is licensed under Mulan PSL v2.
+You can use this software according to the terms and conditions of the Mulan PSL
+v2. You may obtain a copy of Mulan PSL v2 at:
+        http://license.coscl.org.cn/MulanPSL2
+THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+See the Mulan PSL v2 for more details. */
+
+#pragma once
+
+#include <vector>
+
+#include "ix_defs.h"
+#include "storage/rwlatch.h"
+#include "transaction/transaction.h"
+
+/**
+ * 一条语句对同一个索引的多处修改，key 是上层的原格式
+ * 由 IxIndex::apply_batch 批量执行，同一个 key 的删除排在插入前面
+ */
+class IxBatch {
+ public:
+  explicit IxBatch(int key_len) : key_len_(key_len) {}
+
+  void add_insert(const char* key, const Rid& rid) { add(key, rid, false); }
+
+  void add_delete(const char* key) { add(key, {}, true); }
+
+  std::size_t size() const { return rids_.size(); }
+
+  bool empty() const { return rids_.empty(); }
+
+ private:
+  friend class IxIndexHandle;
+  friend class IxHashHandle;
+
+  void add(const char* key, const Rid& rid, bool is_delete) {
+    keys_.insert(keys_.end(), key, key + key_len_);
+    rids_.emplace_back(rid);
+    is_delete_.emplace_back(is_delete);
+  }
+
+  const char* key(std::size_t i) const {
+    return keys_.data() + i * key_len_;
+  }
+
+  int key_len_;
+  std::vector<char> keys_;
+  std::vector<Rid> rids_;
+  std::vector<bool> is_delete_;
+};
+
+/* 索引的公共接口，B+树（IxIndexHandle）和哈希索引（IxHashHandle）都实现它 */
+class IxIndex {
+ public:
+  int fd_;  // 存储索引的文件
+  RWLatch rw_latch_;
+
+  explicit IxIndex(int fd) : fd_(fd) {}
+
+  virtual ~IxIndex() = default;
+
+  // 查找 key 对应的 rid
+  virtual bool get_value(const char* key, std::vector<Rid>* result,
+                         Transaction* transaction) = 0;
+
+  // check unique，key_len 小于 key 的长度时只检查前 key_len 个字节
+  virtual bool is_unique(const char* key, Rid& value, Transaction* transaction,
+                         int key_len = 0) = 0;
+
+  // 插入键值对，key 已存在时返回 IX_NO_PAGE
+  virtual page_id_t insert_entry(const char* key, const Rid& value,
+                                 Transaction* transaction) = 0;
+
+  virtual bool delete_entry(const char* key, Transaction* transaction) = 0;
+
+  virtual void apply_batch(const IxBatch& batch, Transaction* transaction) = 0;
+
+  // 把文件头写回第 0 页，关闭索引和做检查点时调用
+  virtual void write_file_hdr() const = 0;
+};
@@ -10,26 +10,125 @@ See the Mulan PSL v2 for more details. */
 
 #include "ix_index_handle.h"
 
+#include <algorithm>
+#include <numeric>
+
 #include "ix_scan.h"
 
 void IxIndexHandle::release_all_index_latch_page(Transaction* transaction) {
   if (transaction != nullptr) {
-    for (auto& page : *transaction->get_index_latch_page_set()) {
-      page->WUnlatch();
-      buffer_pool_manager_->unpin_page(page->get_page_id(), false);
-    }
-    // 清空
+    // guard 析构时解锁并 unpin
     transaction->get_index_latch_page_set()->clear();
   }
 }
 
-bool IxNodeHandle::isSafe(Operation operation) {
+void IxNodeHandle::load_layout() {
+  prefix = page->get_data() + sizeof(IxPageHdr);
+  if (!is_prefix_compressed()) {
+    prefix_len = 0;
+    key_len = file_hdr->col_tot_len_;
+    capacity = file_hdr->btree_order_ + 1;
+    keys = prefix;
+    rids = reinterpret_cast<Rid*>(keys + file_hdr->keys_size_);
+    return;
+  }
+  // 乐观读可能读到正在修改的页头，限制在合法范围内保证不越界
+  prefix_len = std::min<int>(page_hdr->prefix_len, file_hdr->col_tot_len_);
+  key_len = file_hdr->col_tot_len_ - prefix_len;
+  capacity = capacity_for(prefix_len);
+  keys = prefix + prefix_len;
+  rids = reinterpret_cast<Rid*>(page->get_data() + PAGE_SIZE) - capacity;
+}
+
+int IxNodeHandle::capacity_for(int len) const {
+  if (!is_prefix_compressed()) {
+    return file_hdr->btree_order_ + 1;
+  }
+  return static_cast<int>((PAGE_SIZE - sizeof(IxPageHdr) - len) /
+                          (file_hdr->col_tot_len_ - len + sizeof(Rid)));
+}
+
+int IxNodeHandle::prefix_len_after(const char* key) const {
+  if (!is_prefix_compressed()) {
+    return 0;
+  }
+  if (page_hdr->num_key == 0) {
+    return file_hdr->col_tot_len_;
+  }
+  return ix_common_prefix(prefix, key, prefix_len);
+}
+
+/**
+ * @brief 修改公共前缀的长度，按新的布局重写所有 key 和 rid
+ * @note 前缀变长时新增的前缀取自第一个 key，调用者保证所有 key 都有这个前缀
+ */
+void IxNodeHandle::set_prefix_len(int len) {
+  // 新旧布局会重叠，先拷贝一份旧页面
+  char old_page[PAGE_SIZE];
+  memcpy(old_page, page->get_data(), PAGE_SIZE);
+  const char* old_prefix = old_page + sizeof(IxPageHdr);
+  const char* old_keys = old_prefix + prefix_len;
+  const Rid* old_rids = reinterpret_cast<const Rid*>(
+      old_page + (reinterpret_cast<char*>(rids) - page->get_data()));
+  int old_prefix_len = prefix_len;
+  int old_key_len = key_len;
+
+  page_hdr->prefix_len = len;
+  load_layout();
+  if (len > old_prefix_len) {
+    memcpy(prefix + old_prefix_len, old_keys, len - old_prefix_len);
+  }
+  for (int i = 0; i < page_hdr->num_key; ++i) {
+    const char* old_key = old_keys + i * old_key_len;
+    if (len < old_prefix_len) {
+      // 前缀中去掉的部分放回每个 key 的开头
+      memcpy(get_key(i), old_prefix + len, old_prefix_len - len);
+      memcpy(get_key(i) + old_prefix_len - len, old_key, old_key_len);
+    } else {
+      memcpy(get_key(i), old_key + len - old_prefix_len, key_len);
+    }
+  }
+  memcpy(rids, old_rids, page_hdr->num_key * sizeof(Rid));
+}
+
+void IxNodeHandle::reserve_prefix(const char* first, const char* last) {
+  if (page_hdr->num_key == 0) {
+    // 空结点直接取新 key 的公共前缀
+    page_hdr->prefix_len =
+        ix_common_prefix(first, last, file_hdr->col_tot_len_);
+    load_layout();
+    memcpy(prefix, first, prefix_len);
+    return;
+  }
+  // key 有序，首尾两个 key 的公共前缀就是整个范围的公共前缀
+  int len = std::min(ix_common_prefix(prefix, first, prefix_len),
+                     ix_common_prefix(prefix, last, prefix_len));
+  if (len < prefix_len) {
+    set_prefix_len(len);
+  }
+}
+
+void IxNodeHandle::compact_prefix() {
+  if (!is_prefix_compressed() || page_hdr->num_key == 0) {
+    return;
+  }
+  int len = prefix_len + ix_common_prefix(get_key(0),
+                                          get_key(page_hdr->num_key - 1),
+                                          key_len);
+  if (len > prefix_len) {
+    set_prefix_len(len);
+  }
+}
+
+bool IxNodeHandle::isSafe(Operation operation, const char* key) {
   int min_size = 2;
   if (!is_root_page()) {
     min_size = get_min_size();
   }
   if (operation == Operation::INSERT) {
-    return get_size() + 1 < get_max_size();
+    // 不知道 key 时按前缀缩短为 0 估计
+    int len = key == nullptr ? 0 : prefix_len_after(key);
+    return get_size() + 1 < capacity_for(len);
   }
   if (operation == Operation::DELETE) {
     return get_size() > min_size;
@@ -50,10 +149,25 @@ int IxNodeHandle::lower_bound(const char* target) const {
   // 查找当前节点中第一个大于等于target的key，并返回key的位置给上层
   // 提示:
   // 可以采用多种查找方式，如顺序遍历、二分查找等；使用ix_compare()函数进行比较
-  int l = 0, r = page_hdr->num_key;
+  if (file_hdr->key_kind_ == IxKeyKind::INT) {
+    return ix_int_search<false>(reinterpret_cast<const int*>(keys), 0,
+                                page_hdr->num_key,
+                                *reinterpret_cast<const int*>(target));
+  }
+  // 其他格式都是 memcmp，前缀压缩的叶子先比较一次公共前缀，之后只比较后缀
+  int n = page_hdr->num_key;
+  if (prefix_len > 0) {
+    int cmp = memcmp(target, prefix, prefix_len);
+    if (cmp != 0) {
+      return cmp < 0 ? 0 : n;
+    }
+    target += prefix_len;
+    n = std::min(n, capacity);
+  }
+  int l = 0, r = n;
   while (l < r) {
     int mid = (l + r) >> 1;
-    int cmp = Compare(target, get_key(mid));
+    int cmp = memcmp(target, get_key(mid), key_len);
     if (cmp <= 0) {
       r = mid;
     } else {
@@ -75,17 +189,34 @@ int IxNodeHandle::upper_bound(const char* target) const {
   // 查找当前节点中第一个大于target的key，并返回key的位置给上层
   // 提示:
   // 可以采用多种查找方式：顺序遍历、二分查找等；使用ix_compare()函数进行比较
-  int l = 1, r = page_hdr->num_key;
+  // 解决空树，返回 0
+  if (page_hdr->num_key == 0) {
+    return 0;
+  }
+  if (file_hdr->key_kind_ == IxKeyKind::INT) {
+    return ix_int_search<true>(reinterpret_cast<const int*>(keys), 1,
+                               page_hdr->num_key,
+                               *reinterpret_cast<const int*>(target));
+  }
+  int n = page_hdr->num_key;
+  if (prefix_len > 0) {
+    int cmp = memcmp(target, prefix, prefix_len);
+    if (cmp != 0) {
+      return cmp < 0 ? 1 : n;
+    }
+    target += prefix_len;
+    n = std::min(n, capacity);
+  }
+  int l = 1, r = n;
   while (l < r) {
     int mid = (l + r) >> 1;
-    int cmp = Compare(target, get_key(mid));
+    int cmp = memcmp(target, get_key(mid), key_len);
     if (cmp < 0) {
       r = mid;
     } else {
       l = mid + 1;
     }
   }
-  // 解决空树，返回 0
   return r;
 }
 
@@ -104,7 +235,7 @@ bool IxNodeHandle::leaf_lookup(const char* key, Rid** value) {
   // 3. 如果存在，获取key对应的Rid，并赋值给传出参数value
   // 提示：可以调用lower_bound()和get_rid()函数。
   int pos = lower_bound(key);
-  if (pos == page_hdr->num_key || Compare(key, get_key(pos))) {
+  if (pos == page_hdr->num_key || compare_key(key, pos) != 0) {
     return false;
   }
   *value = get_rid(pos);
@@ -151,26 +282,53 @@ void IxNodeHandle::insert_pairs(int pos, const char* key, const Rid* rid,
     throw IndexEntryNotFoundError();
   }
 
+  // 前缀压缩的叶子先保证新 key 都有公共前缀，布局可能因此改变
+  auto&& cols_len = file_hdr->col_tot_len_;
+  if (is_prefix_compressed() && n > 0) {
+    reserve_prefix(key, key + (n - 1) * cols_len);
+  }
+
   // 获取当前键和 RID 的指针
   auto&& cur_key = get_key(pos);
   auto&& cur_rid = get_rid(pos);
   auto&& num_keys = page_hdr->num_key;
-  auto&& cols_len = file_hdr->col_tot_len_;
 
   // 腾出 (num_keys - pos) 个空间
   if (pos < num_keys) {
-    memmove(cur_key + n * cols_len, cur_key, (num_keys - pos) * cols_len);
+    memmove(cur_key + n * key_len, cur_key, (num_keys - pos) * key_len);
     memmove(cur_rid + n, cur_rid, (num_keys - pos) * sizeof(Rid));
   }
 
-  // 拷贝 n 个键值对
-  memcpy(cur_key, key, n * cols_len);
+  // 拷贝 n 个键值对，压缩时只拷贝后缀
+  if (prefix_len == 0) {
+    memcpy(cur_key, key, n * cols_len);
+  } else {
+    for (int i = 0; i < n; ++i) {
+      memcpy(cur_key + i * key_len, key + i * cols_len + prefix_len, key_len);
+    }
+  }
   memcpy(cur_rid, rid, n * sizeof(Rid));
 
   // 更新键数量
   page_hdr->num_key += n;
 }
 
+void IxNodeHandle::insert_pairs_from(int pos, const IxNodeHandle& src,
+                                     int begin, int end) {
+  int n = end - begin;
+  if (src.prefix_len == 0) {
+    insert_pairs(pos, src.get_key(begin), src.get_rid(begin), n);
+    return;
+  }
+  // 源结点是压缩的，先还原出完整的 key
+  int cols_len = file_hdr->col_tot_len_;
+  std::vector<char> keys_buf(n * cols_len);
+  for (int i = 0; i < n; ++i) {
+    src.copy_key(begin + i, keys_buf.data() + i * cols_len);
+  }
+  insert_pairs(pos, keys_buf.data(), src.get_rid(begin), n);
+}
+
 /**
  * @brief 用于在结点中插入单个键值对。
  * 函数返回插入后的键值对数量
@@ -185,7 +343,7 @@ std::pair<int, int> IxNodeHandle::insert(const char* key, const Rid& value) {
   // 3. 如果key不重复则插入键值对
   // 4. 返回完成插入操作之后的键值对数量
   auto&& pos = lower_bound(key);
-  if (pos < page_hdr->num_key && Compare(key, get_key(pos)) == 0) {
+  if (pos < page_hdr->num_key && compare_key(key, pos) == 0) {
     return {page_hdr->num_key, -1};
   }
   insert_pair(pos, key, value);
@@ -210,10 +368,9 @@ void IxNodeHandle::erase_pair(int pos) {
   auto&& cur_key = get_key(pos);
   auto&& cur_rid = get_rid(pos);
   auto&& num_keys = page_hdr->num_key;
-  auto&& cols_len = file_hdr->col_tot_len_;
 
   // 腾出 1 个空间
-  memmove(cur_key, cur_key + cols_len, (num_keys - pos - 1) * cols_len);
+  memmove(cur_key, cur_key + key_len, (num_keys - pos - 1) * key_len);
   memmove(cur_rid, cur_rid + 1, (num_keys - pos - 1) * sizeof(Rid));
 
   // 更新键数量
@@ -232,7 +389,7 @@ std::pair<int, int> IxNodeHandle::remove(const char* key) {
   // 2. 如果要删除的键值对存在，删除键值对
   // 3. 返回完成删除操作后的键值对数量
   auto&& pos = lower_bound(key);
-  if (pos < page_hdr->num_key && Compare(key, get_key(pos)) == 0) {
+  if (pos < page_hdr->num_key && compare_key(key, pos) == 0) {
     erase_pair(pos);
   }
   return {page_hdr->num_key, pos};
@@ -240,7 +397,7 @@ std::pair<int, int> IxNodeHandle::remove(const char* key) {
 
 IxIndexHandle::IxIndexHandle(DiskManager* disk_manager,
                              BufferPoolManager* buffer_pool_manager, int fd)
-    : fd_(fd),
+    : IxIndex(fd),
       disk_manager_(disk_manager),
       buffer_pool_manager_(buffer_pool_manager) {
   // init file_hdr_
@@ -259,63 +416,202 @@ IxIndexHandle::IxIndexHandle(DiskManager* disk_manager,
 }
 
 /**
- * @brief 用于查找指定键所在的叶子结点
+ * @description: 把文件头写回第 0 页
+ */
+void IxIndexHandle::write_file_hdr() const {
+  char* data = new char[file_hdr_->tot_len_];
+  file_hdr_->serialize(data);
+  disk_manager_->write_page(fd_, IX_FILE_HDR_PAGE, data, file_hdr_->tot_len_);
+  delete[] data;
+}
+
+/**
+ * @brief 写操作的悲观下降，从根开始加写锁，孩子安全时释放祖先的写锁
  * @param key 要查找的目标key值
- * @param operation 查找到目标键值对后要进行的操作类型
- * @param transaction 事务参数，如果不需要则默认传入nullptr
- * @return [leaf node] and [root_is_latched] 返回目标叶子结点以及根结点是否加锁
- * @note need to Unlatch and unpin the leaf node outside!
- * 注意：用了FindLeafPage之后一定要unlatch叶结点，否则下次latch该结点会堵塞！
+ * @param operation 查找到目标键值对后要进行的操作类型，INSERT 或 DELETE
+ * @param transaction 事务参数，持有还没有释放的祖先的写锁
+ * @return [leaf node] and [root_is_latched] 返回加了写锁的叶子结点以及根锁是否
+ * 仍被持有
+ * @note 根锁和事务持有的祖先由调用者释放，叶子的锁随 guard 释放
  */
-std::pair<std::shared_ptr<IxNodeHandle>, bool> IxIndexHandle::find_leaf_page(
-    const char* key, Operation operation, Transaction* transaction,
-    bool find_first) {
-  // Todo:
-  // 1. 获取根节点
-  // 2. 从根节点开始不断向下查找目标key
-  // 3. 找到包含该key值的叶子结点停止查找，并返回叶子节点
+std::pair<IxWriteNodeGuard, bool> IxIndexHandle::find_leaf_page(
+    const char* key, Operation operation, Transaction* transaction) {
   // 因为根有可能被删除 获取根节点前先加根锁
   root_latch_.lock();
   bool is_root_locked = true;
-  auto&& node = fetch_node(file_hdr_->root_page_);
-  if (operation == Operation::FIND) {
-    // 读操作
-    node->page->RLatch();
+  auto node = fetch_node_basic(file_hdr_->root_page_).upgrade_write();
+  if (node->isSafe(operation, key)) {
     root_latch_.unlock();
     is_root_locked = false;
-  } else {
-    // 写操作
-    node->page->WLatch();
-    if (node->isSafe(operation)) {
-      root_latch_.unlock();
-      is_root_locked = false;
-    }
   }
 
   while (!node->is_leaf_page()) {
-    auto&& child_node =
-        fetch_node(find_first ? node->value_at(0) : node->internal_lookup(key));
-    if (operation == Operation::FIND) {
-      child_node->page->RLatch();
-      node->page->RUnlatch();
-      buffer_pool_manager_->unpin_page(node->get_page_id(), false);
-    } else {
-      child_node->page->WLatch();
-      // !TODO 支持并发事务
-      transaction->append_index_latch_page_set(node->page);
-      if (child_node->isSafe(operation)) {
-        if (is_root_locked) {
-          root_latch_.unlock();
-          is_root_locked = false;
-        }
+    auto child_node =
+        fetch_node_basic(node->internal_lookup(key)).upgrade_write();
+    // !TODO 支持并发事务
+    transaction->append_index_latch_page_set(node.take_guard());
+    if (child_node->isSafe(operation, key)) {
+      // 孩子安全时根不会再改变
+      if (is_root_locked) {
+        root_latch_.unlock();
+        is_root_locked = false;
+      }
+      // 第一个 key 可能改变时 maintain_parent 要修改祖先，不能提前释放
+      if (!child_node->may_change_first_key(key)) {
         // 释放所有父节点写锁
         release_all_index_latch_page(transaction);
       }
     }
-    node = child_node;
+    node = std::move(child_node);
+  }
+
+  return {std::move(node), is_root_locked};
+}
+
+/**
+ * @brief 读操作加读锁下降，孩子加锁之后才释放父结点的读锁
+ * @param key 要查找的目标key值
+ * @return 加了读锁的叶子结点
+ */
+IxReadNodeGuard IxIndexHandle::find_leaf_page_read(const char* key) {
+  // 因为根有可能被删除 获取根节点前先加根锁
+  root_latch_.lock();
+  auto node = fetch_node_basic(file_hdr_->root_page_).upgrade_read();
+  root_latch_.unlock();
+  while (!node->is_leaf_page()) {
+    auto child_node = fetch_node_read(node->internal_lookup(key));
+    node = std::move(child_node);
+  }
+  return node;
+}
+
+/**
+ * @brief 写操作的乐观下降：内部结点和读操作一样只加读锁，只对叶子结点加写锁
+ * @param key 要查找的目标key值
+ * @return 加了写锁的叶子结点
+ * @note 调用者发现需要分裂、合并或者修改父结点时，释放叶子后改走 find_leaf_page
+ * 悲观下降；需要在外面 unlatch 并 unpin 叶子结点
+ */
+IxWriteNodeGuard IxIndexHandle::find_leaf_page_optimistic(const char* key) {
+  // 不加根锁，先读根的页号再给它加锁，加锁后它仍是根才能往下走
+  // 替换根的写者持有旧根的写锁，所以加锁期间根不会再改变
+  IxReadNodeGuard node;
+  while (true) {
+    page_id_t root_page = file_hdr_->root_page_;
+    auto root = fetch_node_basic(root_page);
+    // 根结点就是叶子
+    if (root->is_leaf_page()) {
+      auto leaf_node = root.upgrade_write();
+      if (leaf_node->is_root_page() && leaf_node->is_leaf_page() &&
+          file_hdr_->root_page_ == root_page) {
+        return leaf_node;
+      }
+      continue;
+    }
+    node = root.upgrade_read();
+    if (node->is_root_page() && node->is_internal_page() &&
+        file_hdr_->root_page_ == root_page) {
+      break;
+    }
   }
 
-  return {node, is_root_locked};
+  while (true) {
+    auto child_node = fetch_node_basic(node->internal_lookup(key));
+    // 持有父结点读锁时子结点的类型不会改变，子结点加锁后才释放父结点
+    if (child_node->is_leaf_page()) {
+      return child_node.upgrade_write();
+    }
+    node = child_node.upgrade_read();
+  }
+}
+
+/**
+ * @brief 乐观读取页面所在的帧。frame_hints_ 中记下的帧仍存着该页面时直接返回，
+ * 不 pin 也不进 buffer pool 的锁；否则 pin 住页面放到 guard 中并记下帧
+ * @param page_no 要读取的页号
+ * @param version 传出读页面之前的版本号，调用者读完后用它校验
+ * @param guard 未命中时 pin 住的结点，原来 pin 住的结点被释放
+ * @return 页面所在的帧
+ * @note 帧是 buffer pool 中固定的数组，不 pin 也能安全地读；帧换入其他页面时
+ * 版本号会变，校验通过才说明读期间帧里一直是这个页面
+ */
+Page* IxIndexHandle::peek_page(int page_no, uint64_t* version,
+                               IxBasicNodeGuard* guard) const {
+  auto& hint = frame_hints_[page_no & (IX_FRAME_HINTS - 1)];
+  Page* page = hint.load(std::memory_order_relaxed);
+  if (page != nullptr) {
+    *version = page->read_version();
+    if (page->get_page_id() == PageId{fd_, page_no}) {
+      return page;
+    }
+  }
+  *guard = fetch_node_basic(page_no);
+  page = (*guard)->page;
+  hint.store(page, std::memory_order_relaxed);
+  *version = page->read_version();
+  return page;
+}
+
+/**
+ * @brief 乐观下降：不加读锁，每一层取版本号，读完后校验，写者只需要 WLatch
+ * 结点所在的帧由 peek_page 取得，命中时整个下降不 pin 页面
+ * @param key 要查找的目标key值
+ * @param read 在叶子结点上执行的只读操作，校验失败时其结果作废
+ * @return 路径上的结点在读期间都没有被修改返回 true
+ * @note 读到的页面可能正在被修改，使用前要检查键数量，防止越界
+ */
+template <typename F>
+bool IxIndexHandle::optimistic_read_leaf(const char* key, F&& read) const {
+  IxBasicNodeGuard guard;
+  uint64_t version;
+  // 布局要在取版本号之后读，校验通过才说明读的时候布局没有变
+  IxNodeHandle node(file_hdr_,
+                    peek_page(file_hdr_->root_page_, &version, &guard));
+  // 根可能刚被替换，校验版本号之后父结点为空才说明它仍是根
+  bool is_valid = (version & 1) == 0 && node.is_root_page();
+  while (is_valid) {
+    int size = node.get_size();
+    if (size < 0 || size > node.get_max_size() ||
+        (size == 0 && node.is_internal_page())) {
+      is_valid = false;
+      break;
+    }
+    if (node.is_leaf_page()) {
+      read(node);
+      is_valid = node.page->validate_version(version);
+      break;
+    }
+    // 孩子的页号要在校验通过之后才能使用
+    page_id_t child_page_no = node.internal_lookup(key);
+    if (!node.page->validate_version(version)) {
+      is_valid = false;
+      break;
+    }
+    uint64_t child_version;
+    IxNodeHandle child_node(file_hdr_,
+                            peek_page(child_page_no, &child_version, &guard));
+    // 取到孩子的版本号之后父结点仍未被修改，孩子才仍挂在父结点下
+    is_valid =
+        (child_version & 1) == 0 && node.page->validate_version(version);
+    node = std::move(child_node);
+    version = child_version;
+  }
+  return is_valid;
+}
+
+/**
+ * @brief 在 key 所在的叶子结点上执行只读操作 read(leaf)
+ * 先乐观读，冲突频繁时退回到加读锁的下降
+ */
+template <typename F>
+void IxIndexHandle::read_leaf(const char* key, F&& read) {
+  for (int i = 0; i < IX_OPTIMISTIC_READ_RETRIES; ++i) {
+    if (optimistic_read_leaf(key, read)) {
+      return;
+    }
+  }
+  auto leaf_node = find_leaf_page_read(key);
+  read(*leaf_node);
 }
 
 /**
@@ -326,37 +622,39 @@ std::pair<std::shared_ptr<IxNodeHandle>, bool> IxIndexHandle::find_leaf_page(
  * @param transaction 事务指针
  * @return bool 返回目标键值对是否存在
  */
-bool IxIndexHandle::get_value(const char* key, std::vector<Rid>* result,
+bool IxIndexHandle::get_value(const char* raw_key, std::vector<Rid>* result,
                               Transaction* transaction) {
+  // 上层传入的 key 转成结点中的存储格式
+  const IxKey ix_key(*file_hdr_, raw_key);
+  const char* key = ix_key.data();
   // Todo:
   // 1. 获取目标key值所在的叶子结点
   // 2. 在叶子节点中查找目标key值的位置，并读取key对应的rid
   // 3. 把rid存入result参数中
   // 提示：使用完buffer_pool提供的page之后，记得unpin page；记得处理并发的上锁
-  auto&& leaf_node =
-      find_leaf_page(key, Operation::FIND, transaction, false).first;
-  Rid* rid;
-  if (leaf_node->leaf_lookup(key, &rid)) {
-    leaf_node->page->RUnlatch();
-    buffer_pool_manager_->unpin_page(leaf_node->get_page_id(), false);
-    result->emplace_back(*rid);
-    return true;
+  bool is_found = false;
+  Rid value{};
+  read_leaf(key, [&](IxNodeHandle& leaf_node) {
+    Rid* rid;
+    is_found = leaf_node.leaf_lookup(key, &rid);
+    if (is_found) {
+      value = *rid;
+    }
+  });
+  if (is_found) {
+    result->emplace_back(value);
   }
-  leaf_node->page->RUnlatch();
-  buffer_pool_manager_->unpin_page(leaf_node->get_page_id(), false);
-  return false;
+  return is_found;
 }
 
 /**
  * @brief  将传入的一个node拆分(Split)成两个结点，在node的右边生成一个新结点new
  * node
  * @param node 需要拆分的结点
- * @return 拆分得到的new_node
- * @note need to unpin the new node outside
- * 注意：本函数执行完毕后，原node和new node都需要在函数外面进行unpin
+ * @param split_point 从这个位置开始的键值对移到新结点
+ * @return 拆分得到的new_node，加了写锁，随 guard 释放
  */
-std::shared_ptr<IxNodeHandle> IxIndexHandle::split(
-    std::shared_ptr<IxNodeHandle>& node) {
+IxWriteNodeGuard IxIndexHandle::split(IxNodeHandle& node, int split_point) {
   // Todo:
   // 1. 将原结点的键值对平均分配，右半部分分裂为新的右兄弟结点
   //    需要初始化新节点的page_hdr内容
@@ -364,37 +662,38 @@ std::shared_ptr<IxNodeHandle> IxIndexHandle::split(
   //    为新节点分配键值对，更新旧节点的键值对数记录
   // 3.
   // 如果新的右兄弟结点不是叶子结点，更新该结点的所有孩子结点的父节点信息(使用IxIndexHandle::maintain_child())
-  auto new_sibling_node = create_node();
-  new_sibling_node->page->WLatch();
-  auto&& split_point = node->get_min_size();
-  if (node->is_leaf_page()) {
+  auto new_sibling_node = create_node().upgrade_write();
+  new_sibling_node.mark_dirty();
+  if (node.is_leaf_page()) {
     // 更新左右叶子节点关系
-    new_sibling_node->set_prev_leaf(node->get_page_no());
-    new_sibling_node->set_next_leaf(node->get_next_leaf());
-    node->set_next_leaf(new_sibling_node->get_page_no());
+    new_sibling_node->set_prev_leaf(node.get_page_no());
+    new_sibling_node->set_next_leaf(node.get_next_leaf());
+    node.set_next_leaf(new_sibling_node->get_page_no());
     // 更新下一个叶子节点的前一个节点为新节点
     // 无论是否是最右兄弟节点都要更新，因为最后一个叶子节点指向叶头节点
-    auto&& next_leaf = fetch_node(new_sibling_node->get_next_leaf());
-    next_leaf->page->WLatch();
+    // 下一个叶子可能在别的父结点下，不加锁：它的 prev_leaf 只有持有 node
+    // 写锁的线程会修改，加锁反而会和从右向左锁兄弟的合并、扫描死锁
+    auto next_leaf = fetch_node_basic(new_sibling_node->get_next_leaf());
     next_leaf->set_prev_leaf(new_sibling_node->get_page_no());
-    next_leaf->page->WUnlatch();
-    buffer_pool_manager_->unpin_page(next_leaf->get_page_id(), true);
+    next_leaf.mark_dirty();
   }
   // 记得维护节点元信息
   new_sibling_node->page_hdr->num_key = 0;
-  new_sibling_node->page_hdr->is_leaf = node->is_leaf_page();
-  new_sibling_node->page_hdr->parent = node->get_parent_page_no();
+  new_sibling_node->page_hdr->prefix_len = 0;
+  new_sibling_node->page_hdr->parent = node.get_parent_page_no();
+  new_sibling_node->set_is_leaf_page(node.is_leaf_page());
   // 插入到右兄弟节点
-  new_sibling_node->insert_pairs(0, node->get_key(split_point),
-                                 node->get_rid(split_point),
-                                 node->page_hdr->num_key - split_point);
+  new_sibling_node->insert_pairs_from(0, node, split_point,
+                                     node.page_hdr->num_key);
   // 这里直接设置 size，软移除
-  node->set_size(split_point);
+  node.set_size(split_point);
+  // 剩下的 key 的公共前缀可能更长
+  node.compact_prefix();
 
   // ！如果是内部节点，还需要维护孩子节点关系
   if (new_sibling_node->is_internal_page()) {
     for (int i = 0; i < new_sibling_node->page_hdr->num_key; ++i) {
-      maintain_child(new_sibling_node, i);
+      maintain_child(*new_sibling_node, i);
     }
   }
   return new_sibling_node;
@@ -413,11 +712,11 @@ std::shared_ptr<IxNodeHandle> IxIndexHandle::split(
  * @note
  * 一个结点插入了键值对之后需要分裂，分裂后左半部分的键值对保留在原结点，在参数中称为old_node，
  * 右半部分的键值对分裂为新的右兄弟节点，在参数中称为new_node（参考Split函数来理解old_node和new_node）
- * @note 本函数执行完毕后，new node和old node都需要在函数外面进行unpin
+ * @note new node和old node的锁和 pin 由调用者释放
  */
-void IxIndexHandle::insert_into_parent(std::shared_ptr<IxNodeHandle>& old_node,
+void IxIndexHandle::insert_into_parent(IxNodeHandle& old_node,
                                        const char* key,
-                                       std::shared_ptr<IxNodeHandle>& new_node,
+                                       IxNodeHandle& new_node,
                                        Transaction* transaction) {
   // Todo:
   // 1. 分裂前的结点（原结点,
@@ -427,68 +726,107 @@ void IxIndexHandle::insert_into_parent(std::shared_ptr<IxNodeHandle>& old_node,
   // 4. 如果父亲结点仍需要继续分裂，则进行递归插入
   // 提示：记得unpin page
   // 是否为根结点
-  if (old_node->is_root_page()) {
-    auto&& new_root = create_node();
+  if (old_node.is_root_page()) {
+    auto new_root = create_node();
+    new_root.mark_dirty();
     new_root->page_hdr->parent = IX_NO_PAGE;
     new_root->page_hdr->num_key = 0;
     new_root->page_hdr->is_leaf = false;
     new_root->page_hdr->prev_leaf = new_root->page_hdr->next_leaf = IX_NO_PAGE;
-    new_root->insert_pair(0, old_node->get_key(0),
-                          {old_node->get_page_no(), -1});
-    new_root->insert_pair(1, key, {new_node->get_page_no(), -1});
+    char first_key[IX_MAX_COL_LEN];
+    old_node.copy_key(0, first_key);
+    new_root->insert_pair(0, first_key, {old_node.get_page_no(), -1});
+    new_root->insert_pair(1, key, {new_node.get_page_no(), -1});
 
     // 维护父子关系
-    old_node->set_parent_page_no(new_root->get_page_no());
-    new_node->set_parent_page_no(new_root->get_page_no());
+    old_node.set_parent_page_no(new_root->get_page_no());
+    new_node.set_parent_page_no(new_root->get_page_no());
 
     // 成为新的根节点
     file_hdr_->root_page_ = new_root->get_page_no();
 
     // 维护完毕，释放根锁
     root_latch_.unlock();
-    buffer_pool_manager_->unpin_page(new_root->get_page_id(), true);
     release_all_index_latch_page(transaction);
   } else {
-    // 获取原结点（old_node）的父亲结点
-    auto&& parent_node = fetch_node(old_node->get_parent_page_no());
+    // 获取原结点（old_node）的父亲结点，它的写锁由事务持有
+    auto parent_node = fetch_node_basic(old_node.get_parent_page_no());
+    parent_node.mark_dirty();
     // 将新右兄弟节点头记录信息插入
     parent_node->insert_pair(parent_node->find_child(old_node) + 1, key,
-                             {new_node->get_page_no(), -1});
+                             {new_node.get_page_no(), -1});
     // 插入后满了
     if (parent_node->isFull()) {
-      auto&& new_sibling_node = split(parent_node);
-      insert_into_parent(parent_node, new_sibling_node->get_key(0),
-                         new_sibling_node, transaction);
-      new_sibling_node->page->WUnlatch();
-      buffer_pool_manager_->unpin_page(new_sibling_node->get_page_id(), true);
+      auto new_sibling_node =
+          split(*parent_node, parent_node->get_size() / 2);
+      insert_into_parent(*parent_node, new_sibling_node->get_key(0),
+                         *new_sibling_node, transaction);
     }
     release_all_index_latch_page(transaction);
-    buffer_pool_manager_->unpin_page(parent_node->get_page_id(), true);
   }
 }
 
 // 检查是否是 unique key，只有 insert 操作会调用
-bool IxIndexHandle::is_unique(const char* key, Rid& value,
-                              Transaction* transaction) {
-  // 操作应该为insert
-  auto&& [leaf_node, is_root_locked] =
-      find_leaf_page(key, Operation::FIND, transaction, false);
-  if (is_root_locked) {
-    root_latch_.unlock();
+bool IxIndexHandle::is_unique(const char* raw_key, Rid& value,
+                              Transaction* transaction, int key_len) {
+  const IxKey ix_key(*file_hdr_, raw_key);
+  const char* key = ix_key.data();
+  if (key_len > 0 && key_len < file_hdr_->col_tot_len_) {
+    return is_unique_prefix(key, value, key_len);
   }
-  int pos = leaf_node->lower_bound(key);
-  if (pos == leaf_node->page_hdr->num_key ||
-      Compare(key, leaf_node->get_key(pos))) {
-    // 释放写锁
-    leaf_node->page->RUnlatch();
-    buffer_pool_manager_->unpin_page(leaf_node->get_page_id(), false);
-    return true;
+  // 操作应该为insert
+  bool is_unique = true;
+  read_leaf(key, [&](IxNodeHandle& leaf_node) {
+    int pos = leaf_node.lower_bound(key);
+    is_unique =
+        pos == leaf_node.get_size() || leaf_node.compare_key(key, pos) != 0;
+    if (!is_unique) {
+      value = *leaf_node.get_rid(pos);
+    }
+  });
+  return is_unique;
+}
+
+/**
+ * @brief 检查是否已有 key 的前 key_len 个字节与 key 相同，用于带 INCLUDE
+ * 字段的唯一索引。只有能 memcmp 的 key 才会有多列，前缀之后补 0
+ * 就是前缀相同的 key 中最小的一个
+ */
+bool IxIndexHandle::is_unique_prefix(const char* key, Rid& value,
+                                     int key_len) {
+  assert(file_hdr_->key_kind_ != IxKeyKind::INT);
+  char lower[IX_MAX_COL_LEN];
+  memcpy(lower, key, key_len);
+  memset(lower + key_len, 0, file_hdr_->col_tot_len_ - key_len);
+  char found[IX_MAX_COL_LEN];
+  bool is_found = false;
+  page_id_t next_leaf = IX_NO_PAGE;
+  read_leaf(lower, [&](IxNodeHandle& leaf_node) {
+    is_found = false;
+    next_leaf = IX_NO_PAGE;
+    int pos = leaf_node.lower_bound(lower);
+    if (pos < leaf_node.get_size()) {
+      leaf_node.copy_key(pos, found);
+      is_found = memcmp(found, key, key_len) == 0;
+      if (is_found) {
+        value = *leaf_node.get_rid(pos);
+      }
+    } else if (leaf_node.get_page_no() != file_hdr_->last_leaf_) {
+      next_leaf = leaf_node.get_next_leaf();
+    }
+  });
+  // 前缀相同的 key 可能从下一个叶子的开头开始
+  if (next_leaf != IX_NO_PAGE) {
+    auto leaf_node = fetch_node_read(next_leaf);
+    if (leaf_node->get_size() > 0) {
+      leaf_node->copy_key(0, found);
+      is_found = memcmp(found, key, key_len) == 0;
+      if (is_found) {
+        value = *leaf_node->get_rid(0);
+      }
+    }
   }
-  value = *leaf_node->get_rid(pos);
-  // 释放写锁
-  leaf_node->page->RUnlatch();
-  buffer_pool_manager_->unpin_page(leaf_node->get_page_id(), false);
-  return false;
+  return !is_found;
 }
 
 /**
@@ -497,16 +835,38 @@ bool IxIndexHandle::is_unique(const char* key, Rid& value,
  * @param transaction 事务指针
  * @return page_id_t 插入到的叶结点的page_no
  */
-page_id_t IxIndexHandle::insert_entry(const char* key, const Rid& value,
+page_id_t IxIndexHandle::insert_entry(const char* raw_key, const Rid& value,
                                       Transaction* transaction) {
+  const IxKey ix_key(*file_hdr_, raw_key);
+  const char* key = ix_key.data();
   // Todo:
   // 1. 查找key值应该插入到哪个叶子节点
   // 2. 在该叶子节点中插入键值对
   // 3. 如果结点已满，分裂结点，并把新结点的相关信息插入父节点
   // 提示：记得unpin
   // page；若当前叶子节点是最右叶子节点，则需要更新file_hdr_.last_leaf；记得处理并发的上锁
-  auto&& [leaf_node, is_root_locked] =
-      find_leaf_page(key, Operation::INSERT, transaction, false);
+  // 先乐观地只锁叶子，插入后不会分裂且不用更新父结点的第一个 key 时直接完成
+  {
+    auto leaf_node = find_leaf_page_optimistic(key);
+    int pos = leaf_node->lower_bound(key);
+    if (pos < leaf_node->get_size() && leaf_node->compare_key(key, pos) == 0) {
+      return IX_NO_PAGE;
+    }
+    if (pos > 0 && leaf_node->isSafe(Operation::INSERT, key)) {
+      leaf_node->insert_pair(pos, key, value);
+      leaf_node.mark_dirty();
+      return leaf_node->get_page_no();
+    }
+  }
+
+  // 悲观下降，从根开始加写锁
+  auto [leaf_node, is_root_locked] =
+      find_leaf_page(key, Operation::INSERT, transaction);
+  // 前缀压缩的叶子插入后前缀变短，可能放不下
+  if (!leaf_node->has_room(key)) {
+    leaf_node.mark_dirty();
+    return split_and_insert(*leaf_node, key, value, transaction);
+  }
   int old_size = leaf_node->get_size();
   // key 重复
   const auto& [new_size, pos] = leaf_node->insert(key, value);
@@ -516,48 +876,72 @@ page_id_t IxIndexHandle::insert_entry(const char* key, const Rid& value,
     }
     // 处理事务
     release_all_index_latch_page(transaction);
-    // 解锁和 unpin
-    leaf_node->page->WUnlatch();
-    buffer_pool_manager_->unpin_page(leaf_node->page->get_page_id(), false);
     return IX_NO_PAGE;
   }
+  leaf_node.mark_dirty();
 
   // 优化，只有插入在第一个key位置时，才需要在父节点中向上更新node的第一个key
   if (pos == 0) {
-    maintain_parent(leaf_node);
+    maintain_parent(*leaf_node);
   }
 
-  page_id_t return_page_id = INVALID_PAGE_ID;
   // 如果结点已满，分裂结点，并把新结点的相关信息插入父节点
   if (leaf_node->isFull()) {
-    auto&& new_sibling_node = split(leaf_node);
+    int split_point = leaf_node->get_size() / 2;
+    auto new_sibling_node = split(*leaf_node, split_point);
     // 分裂完成后兄弟叶子节点关系已经维护好了
     // 维护最右的叶子节点
     if (leaf_node->get_page_no() == file_hdr_->last_leaf_) {
       file_hdr_->last_leaf_ = new_sibling_node->get_page_no();
     }
-    insert_into_parent(leaf_node, new_sibling_node->get_key(0),
-                       new_sibling_node, transaction);
-    leaf_node->page->WUnlatch();
+    char sibling_key[IX_MAX_COL_LEN];
+    new_sibling_node->copy_key(0, sibling_key);
+    insert_into_parent(*leaf_node, sibling_key, *new_sibling_node,
+                       transaction);
     // 如果分裂后插入的key在兄弟叶子节点
-    if (Compare(new_sibling_node->get_key(new_sibling_node->lower_bound(key)),
-                key) == 0) {
-      return_page_id = new_sibling_node->get_page_no();
-    } else {
-      return_page_id = leaf_node->get_page_no();
+    if (pos >= split_point) {
+      return new_sibling_node->get_page_no();
     }
-    new_sibling_node->page->WUnlatch();
-    buffer_pool_manager_->unpin_page(leaf_node->get_page_id(), true);
-    buffer_pool_manager_->unpin_page(new_sibling_node->get_page_id(), true);
-    return return_page_id;
-  }
-
-  // 先解写锁 写锁不影响 pageId
-  leaf_node->page->WUnlatch();
-  // unpin 之后page可能会被替换 拷贝下页id
-  return_page_id = leaf_node->get_page_no();
-  buffer_pool_manager_->unpin_page(leaf_node->get_page_id(), true);
-  return return_page_id;
+    return leaf_node->get_page_no();
+  }
+
+  // 插在第一个位置时祖先的锁一直持有到 maintain_parent 完成
+  if (is_root_locked) {
+    root_latch_.unlock();
+  }
+  release_all_index_latch_page(transaction);
+  return leaf_node->get_page_no();
+}
+
+/**
+ * @brief 叶子前缀缩短后放不下新 key 时，先分裂再插入
+ * 这样的 key 没有结点的公共前缀，只会插在结点的一端。按 key 的位置分裂，
+ * 让 key 所在的一半只留 min_size 个键值对，不压缩也放得下
+ * @return page_id_t 插入到的叶结点的page_no
+ * @note leaf_node 的写锁由调用者持有并释放
+ */
+page_id_t IxIndexHandle::split_and_insert(IxNodeHandle& leaf_node,
+                                          const char* key, const Rid& value,
+                                          Transaction* transaction) {
+  int pos = leaf_node.lower_bound(key);
+  assert(pos == 0 || pos == leaf_node.get_size());
+  bool is_left = pos == 0;
+  int split_point = is_left ? leaf_node.get_min_size()
+                            : leaf_node.get_size() - leaf_node.get_min_size();
+  auto new_sibling_node = split(leaf_node, split_point);
+  if (leaf_node.get_page_no() == file_hdr_->last_leaf_) {
+    file_hdr_->last_leaf_ = new_sibling_node->get_page_no();
+  }
+  auto& target_node = is_left ? leaf_node : *new_sibling_node;
+  target_node.insert_pair(is_left ? 0 : target_node.get_size(), key, value);
+  // 插在第一个位置，要在释放祖先的锁之前更新父结点
+  if (is_left) {
+    maintain_parent(leaf_node);
+  }
+  char sibling_key[IX_MAX_COL_LEN];
+  new_sibling_node->copy_key(0, sibling_key);
+  insert_into_parent(leaf_node, sibling_key, *new_sibling_node, transaction);
+  return target_node.get_page_no();
 }
 
 /**
@@ -565,7 +949,10 @@ page_id_t IxIndexHandle::insert_entry(const char* key, const Rid& value,
  * @param key 要删除的key值
  * @param transaction 事务指针
  */
-bool IxIndexHandle::delete_entry(const char* key, Transaction* transaction) {
+bool IxIndexHandle::delete_entry(const char* raw_key,
+                                 Transaction* transaction) {
+  const IxKey ix_key(*file_hdr_, raw_key);
+  const char* key = ix_key.data();
   // Todo:
   // 1. 获取该键值对所在的叶子结点
   // 2. 在该叶子结点中删除键值对
@@ -573,8 +960,23 @@ bool IxIndexHandle::delete_entry(const char* key, Transaction* transaction) {
   // 如果删除成功需要调用CoalesceOrRedistribute来进行合并或重分配操作，并根据函数返回结果判断是否有结点需要删除
   // 4.
   // 如果需要并发，并且需要删除叶子结点，则需要在事务的delete_page_set中添加删除结点的对应页面；记得处理并发的上锁
-  auto&& [leaf_node, is_root_locked] =
-      find_leaf_page(key, Operation::DELETE, transaction, false);
+  // 先乐观地只锁叶子，删除后不会合并或重分配且不用更新父结点时直接完成
+  {
+    auto leaf_node = find_leaf_page_optimistic(key);
+    int pos = leaf_node->lower_bound(key);
+    if (pos == leaf_node->get_size() || leaf_node->compare_key(key, pos) != 0) {
+      return false;
+    }
+    if (pos > 0 && leaf_node->isSafe(Operation::DELETE)) {
+      leaf_node->erase_pair(pos);
+      leaf_node.mark_dirty();
+      return true;
+    }
+  }
+
+  // 悲观下降，从根开始加写锁
+  auto [leaf_node, is_root_locked] =
+      find_leaf_page(key, Operation::DELETE, transaction);
   int old_size = leaf_node->get_size();
   // key 找不到
   const auto& [new_size, pos] = leaf_node->remove(key);
@@ -584,28 +986,24 @@ bool IxIndexHandle::delete_entry(const char* key, Transaction* transaction) {
     }
     // 处理事务
     release_all_index_latch_page(transaction);
-    // 解锁和 unpin
-    leaf_node->page->WUnlatch();
-    buffer_pool_manager_->unpin_page(leaf_node->page->get_page_id(), false);
     return false;
   }
+  leaf_node.mark_dirty();
 
   // 优化，只有删除在第一个key位置时，才需要在父节点中向上更新node的第一个key
   if (pos == 0) {
-    maintain_parent(leaf_node);
+    maintain_parent(*leaf_node);
   }
 
   // 并且需要删除叶子结点，先不实现并发
   bool is_delete =
-      coalesce_or_redistribute(leaf_node, transaction, &is_root_locked);
+      coalesce_or_redistribute(*leaf_node, transaction, &is_root_locked);
   if (is_root_locked) {
     root_latch_.unlock();
   }
   release_all_index_latch_page(transaction);
-  leaf_node->page->WUnlatch();
-  buffer_pool_manager_->unpin_page(leaf_node->get_page_id(), true);
   if (is_delete) {
-    // assert(buffer_pool_manager_->delete_page(leaf_node->get_page_id()));
+    // assert(buffer_pool_manager_->delete_page(leaf_node.get_page_id()));
   }
   if (transaction != nullptr) {
     // for (auto &page: *transaction->get_index_deleted_page_set()) {
@@ -617,6 +1015,86 @@ bool IxIndexHandle::delete_entry(const char* key, Transaction* transaction) {
   return true;
 }
 
+/**
+ * @description: 批量执行插入和删除
+ * 修改按 key 排序后从左到右处理，每次下降到一个叶子后做完落在该叶子内的修改，
+ * 需要分裂、合并或更新祖先的修改留到最后逐个走悲观路径
+ * @param {IxBatch&} batch 一批修改，同一个 key 先删除后插入
+ * @param {Transaction*} transaction 事务指针
+ */
+void IxIndexHandle::apply_batch(const IxBatch& batch,
+                                Transaction* transaction) {
+  int len = file_hdr_->col_tot_len_;
+  std::vector<char> keys(batch.size() * len);
+  for (std::size_t i = 0; i < batch.size(); ++i) {
+    const IxKey ix_key(*file_hdr_, batch.key(i));
+    memcpy(keys.data() + i * len, ix_key.data(), len);
+  }
+  auto key_at = [&](int i) { return keys.data() + i * len; };
+  std::vector<int> order(batch.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+    int cmp = ix_compare_key(*file_hdr_, key_at(a), key_at(b));
+    return cmp != 0 ? cmp < 0 : batch.is_delete_[a] > batch.is_delete_[b];
+  });
+
+  std::vector<int> deferred;
+  std::size_t i = 0;
+  while (i < order.size()) {
+    auto leaf_node = find_leaf_page_optimistic(key_at(order[i]));
+    bool is_last_leaf = leaf_node->get_next_leaf() == IX_LEAF_HEADER_PAGE;
+    bool is_dirty = false;
+    for (bool is_first = true; i < order.size(); ++i, is_first = false) {
+      int idx = order[i];
+      const char* key = key_at(idx);
+      int pos = leaf_node->lower_bound(key);
+      // 比叶子中所有 key 都大时可能属于后面的叶子，重新下降
+      if (!is_first && pos == leaf_node->get_size() && !is_last_leaf) {
+        break;
+      }
+      // 同一个 key 前面的修改推迟了，后面的也要推迟，保持先后顺序
+      if (!deferred.empty() &&
+          ix_compare_key(*file_hdr_, key, key_at(deferred.back())) == 0) {
+        deferred.emplace_back(idx);
+        continue;
+      }
+      bool is_found =
+          pos < leaf_node->get_size() && leaf_node->compare_key(key, pos) == 0;
+      if (batch.is_delete_[idx]) {
+        if (!is_found) {
+          continue;
+        }
+        if (pos > 0 && leaf_node->isSafe(Operation::DELETE)) {
+          leaf_node->erase_pair(pos);
+          is_dirty = true;
+          continue;
+        }
+      } else {
+        if (is_found) {
+          continue;
+        }
+        if (pos > 0 && leaf_node->isSafe(Operation::INSERT, key)) {
+          leaf_node->insert_pair(pos, key, batch.rids_[idx]);
+          is_dirty = true;
+          continue;
+        }
+      }
+      deferred.emplace_back(idx);
+    }
+    if (is_dirty) {
+      leaf_node.mark_dirty();
+    }
+  }
+
+  for (int idx : deferred) {
+    if (batch.is_delete_[idx]) {
+      delete_entry(batch.key(idx), transaction);
+    } else {
+      insert_entry(batch.key(idx), batch.rids_[idx], transaction);
+    }
+  }
+}
+
 /**
  * @brief 用于当根结点被删除了一个键值对之后的处理
  * @param old_root_node 原根节点
@@ -624,7 +1102,7 @@ bool IxIndexHandle::delete_entry(const char* key, Transaction* transaction) {
  * @note size of root page can be less than min size and this method is only
  * called within coalesce_or_redistribute()
  */
-bool IxIndexHandle::adjust_root(std::shared_ptr<IxNodeHandle>& old_root_node) {
+bool IxIndexHandle::adjust_root(IxNodeHandle& old_root_node) {
   // Todo:
   // 1.
   // 如果old_root_node是内部结点，并且大小为1，则直接把它的孩子更新成新的根结点
@@ -632,22 +1110,22 @@ bool IxIndexHandle::adjust_root(std::shared_ptr<IxNodeHandle>& old_root_node) {
   // 3. 除了上述两种情况，不需要进行操作
   // 如果old_root_node是叶结点，则直接更新 root page
   // 检查是否需要更新根结点
-  if (old_root_node->is_leaf_page() && old_root_node->get_size() == 0) {
+  if (old_root_node.is_leaf_page() && old_root_node.get_size() == 0) {
     // 叶结点且大小为0，更新根结点为初始值
     file_hdr_->root_page_ = IX_INIT_ROOT_PAGE;
     return false;
   }
-  if (old_root_node->is_internal_page() && old_root_node->get_size() == 1) {
+  if (old_root_node.is_internal_page() && old_root_node.get_size() == 1) {
     // 内部结点且大小为1，更新根结点为唯一子结点
-    file_hdr_->root_page_ = old_root_node->remove_and_return_only_child();
+    file_hdr_->root_page_ = old_root_node.remove_and_return_only_child();
     // 获取新的根结点并更新其父结点信息
-    auto new_root_node = fetch_node(file_hdr_->root_page_);
+    auto new_root_node = fetch_node_basic(file_hdr_->root_page_);
     new_root_node->set_parent_page_no(IX_NO_PAGE);
-    buffer_pool_manager_->unpin_page(new_root_node->get_page_id(), true);
+    new_root_node.mark_dirty();
     // 先不管删除
-    // buffer_pool_manager_->delete_page(old_root_node->get_page_id());
+    // buffer_pool_manager_->delete_page(old_root_node.get_page_id());
     // 释放旧的根结点
-    release_node_handle(*old_root_node);
+    release_node_handle(old_root_node);
     return true;
   }
   // 不需要进行操作
@@ -670,9 +1148,8 @@ bool IxIndexHandle::adjust_root(std::shared_ptr<IxNodeHandle>& old_root_node) {
  * index>0，则neighbor是node前驱结点，表示：neighbor(left)  node(right)
  * 注意更新parent结点的相关kv对
  */
-void IxIndexHandle::redistribute(std::shared_ptr<IxNodeHandle>& neighbor_node,
-                                 std::shared_ptr<IxNodeHandle>& node,
-                                 std::shared_ptr<IxNodeHandle>& parent,
+void IxIndexHandle::redistribute(IxNodeHandle& neighbor_node,
+                                 IxNodeHandle& node, IxNodeHandle& parent,
                                  int index) {
   // Todo:
   // 1. 通过index判断neighbor_node是否为node的前驱结点
@@ -681,24 +1158,27 @@ void IxIndexHandle::redistribute(std::shared_ptr<IxNodeHandle>& neighbor_node,
   // 更新父节点中的相关信息，并且修改移动键值对对应孩子结点的父结点信息（maintain_child函数）
   // 注意：neighbor_node的位置不同，需要移动的键值对不同，需要分类讨论
   // 因为node节点被删除，缺一个，兄弟节点给出一个
+  // 叶子结点可能是前缀压缩的，更新父结点时要用完整的 key
+  char first_key[IX_MAX_COL_LEN];
   // node(left) neighbor(right)
   if (index == 0) {
-    node->insert_pair(node->get_size(), neighbor_node->get_key(0),
-                      neighbor_node->get_rid(0));
-    neighbor_node->erase_pair(0);
+    node.insert_pairs_from(node.get_size(), neighbor_node, 0, 1);
+    neighbor_node.erase_pair(0);
     // 更新父节点 index + 1 对应为右兄弟节点的第一个 key
     // 以满足小于 index + 1 的 key 指向 node，大于等于 index + 1 的 key 指向
     // neighbor
-    parent->set_key(index + 1, neighbor_node->get_key(0));
+    neighbor_node.copy_key(0, first_key);
+    parent.set_key(index + 1, first_key);
     // maintain_parent(neighbor_node);
     // 叶子节点才需要更新孩子节点的父节点信息
-    maintain_child(node, node->get_size() - 1);
+    maintain_child(node, node.get_size() - 1);
   } else {
     // neighbor(left) node(right)
-    node->insert_pair(0, neighbor_node->get_last_key(),
-                      neighbor_node->get_last_rid());
-    neighbor_node->erase_pair(neighbor_node->get_size() - 1);
-    parent->set_key(index, node->get_key(0));
+    node.insert_pairs_from(0, neighbor_node, neighbor_node.get_size() - 1,
+                           neighbor_node.get_size());
+    neighbor_node.erase_pair(neighbor_node.get_size() - 1);
+    node.copy_key(0, first_key);
+    parent.set_key(index, first_key);
     // maintain_parent(node);
     // 叶子节点才需要更新孩子节点的父节点信息
     maintain_child(node, 0);
@@ -725,9 +1205,9 @@ void IxIndexHandle::redistribute(std::shared_ptr<IxNodeHandle>& neighbor_node,
  * @note Assume that *neighbor_node is the left sibling of *node (neighbor ->
  * node)
  */
-bool IxIndexHandle::coalesce(std::shared_ptr<IxNodeHandle>* neighbor_node,
-                             std::shared_ptr<IxNodeHandle>* node,
-                             std::shared_ptr<IxNodeHandle>* parent, int index,
+bool IxIndexHandle::coalesce(IxNodeHandle* neighbor_node,
+                             IxNodeHandle* node,
+                             IxNodeHandle* parent, int index,
                              Transaction* transaction, bool* root_is_latched) {
   // Todo:
   // 1.
@@ -746,29 +1226,28 @@ bool IxIndexHandle::coalesce(std::shared_ptr<IxNodeHandle>* neighbor_node,
   // neighbor(left) node(right)
   auto& node_ = *node;
   auto& neighbor_node_ = *neighbor_node;
-  auto&& prev_size = neighbor_node_->get_size();
-  neighbor_node_->insert_pairs(prev_size, node_->keys, node_->rids,
-                               node_->get_size());
+  auto&& prev_size = neighbor_node_.get_size();
+  neighbor_node_.insert_pairs_from(prev_size, node_, 0, node_.get_size());
 
   // 非叶子节点才需要维护node结点孩子结点的父节点信息
-  if (node_->is_internal_page()) {
-    for (int pos = prev_size; pos < neighbor_node_->get_size(); ++pos) {
+  if (node_.is_internal_page()) {
+    for (int pos = prev_size; pos < neighbor_node_.get_size(); ++pos) {
       maintain_child(neighbor_node_, pos);
     }
   } else {
     // 是叶子节点，维护叶子兄弟节点前后关系
     erase_leaf(node_);
-    if (node_->get_page_no() == file_hdr_->last_leaf_) {
+    if (node_.get_page_no() == file_hdr_->last_leaf_) {
       // 如果是叶子结点且为最右叶子结点，需要更新file_hdr_.last_leaf
-      file_hdr_->last_leaf_ = neighbor_node_->get_page_no();
+      file_hdr_->last_leaf_ = neighbor_node_.get_page_no();
     }
   }
 
   // 释放和删除node结点
-  transaction->append_index_deleted_page((*node_).page);
-  release_node_handle(*node_);
+  transaction->append_index_deleted_page(node_.page);
+  release_node_handle(node_);
   // 并删除parent中node结点的信息
-  (*parent)->erase_pair(index);
+  parent->erase_pair(index);
   return coalesce_or_redistribute(*parent, transaction, root_is_latched);
 }
 
@@ -783,9 +1262,9 @@ bool IxIndexHandle::coalesce(std::shared_ptr<IxNodeHandle>* neighbor_node,
  * If sibling's size + input page's size >= 2 * page's minsize, then
  * redistribute. Otherwise, merge(Coalesce).
  */
-bool IxIndexHandle::coalesce_or_redistribute(
-    std::shared_ptr<IxNodeHandle>& node, Transaction* transaction,
-    bool* root_is_latched) {
+bool IxIndexHandle::coalesce_or_redistribute(IxNodeHandle& node,
+                                             Transaction* transaction,
+                                             bool* root_is_latched) {
   // Todo:
   // 1. 判断node结点是否为根节点
   //    1.1 如果是根节点，需要调用AdjustRoot()
@@ -798,7 +1277,7 @@ bool IxIndexHandle::coalesce_or_redistribute(
   // >= NodeMinSize*2)，则只需要重新分配键值对（调用Redistribute函数）
   // 5.
   // 如果不满足上述条件，则需要合并两个结点，将右边的结点合并到左边的结点（调用Coalesce函数）
-  if (node->is_root_page()) {
+  if (node.is_root_page()) {
     // 1.1 如果是根节点，需要调用AdjustRoot()
     // 函数来进行处理，返回根节点是否需要被删除
     bool is_delete = adjust_root(node);
@@ -812,46 +1291,41 @@ bool IxIndexHandle::coalesce_or_redistribute(
   }
 
   // 如果不是根节点，并且不需要执行合并或重分配操作，大于等于半满，不需要合并或重分配
-  if (node->get_size() >= node->get_min_size()) {
+  if (node.get_size() >= node.get_min_size()) {
     release_all_index_latch_page(transaction);
     return false;
   }
 
-  auto&& parent_node = fetch_node(node->get_parent_page_no());
-  auto&& index = parent_node->find_child(node);
+  // 父结点的写锁由事务持有，这里只 pin
+  auto parent_node = fetch_node_basic(node.get_parent_page_no());
+  parent_node.mark_dirty();
+  int index = parent_node->find_child(node);
   // 有父节点必然有兄弟节点，优先选择左兄弟节点
-  auto&& neighbor_node =
-      fetch_node(parent_node->value_at(index == 0 ? 1 : index - 1));
-  neighbor_node->page->WLatch();
+  auto neighbor_node =
+      fetch_node_basic(parent_node->value_at(index == 0 ? 1 : index - 1))
+          .upgrade_write();
+  neighbor_node.mark_dirty();
 
   // 如果node结点和兄弟结点的键值对数量之和，能够支撑两个B+树结点，只需重分配
-  if (node->get_size() + neighbor_node->get_size() >= node->get_min_size()
-                                                          << 1) {
+  if (node.get_size() + neighbor_node->get_size() >= node.get_min_size() << 1) {
     // 可以提前释放根锁了
     if (*root_is_latched) {
       root_latch_.unlock();
       *root_is_latched = false;
     }
-    redistribute(neighbor_node, node, parent_node, index);
+    redistribute(*neighbor_node, node, *parent_node, index);
     release_all_index_latch_page(transaction);
-    buffer_pool_manager_->unpin_page(parent_node->get_page_id(), true);
-    neighbor_node->page->WUnlatch();
-    buffer_pool_manager_->unpin_page(neighbor_node->get_page_id(), true);
     return false;
   }
 
   // 对指针取地址，用于交换两个指针指向的内容
-  if (coalesce(&neighbor_node, &node, &parent_node, index, transaction,
+  if (coalesce(&*neighbor_node, &node, &*parent_node, index, transaction,
                root_is_latched)) {
     // 要删除父节点
     if (transaction != nullptr) {
       transaction->append_index_deleted_page(parent_node->page);
     }
   }
-
-  buffer_pool_manager_->unpin_page(parent_node->get_page_id(), true);
-  neighbor_node->page->WUnlatch();
-  buffer_pool_manager_->unpin_page(neighbor_node->get_page_id(), true);
   return true;
 }
 
@@ -866,16 +1340,11 @@ bool IxIndexHandle::coalesce_or_redistribute(
  * iid和rid存的不是一个东西，rid是上层传过来的记录位置，iid是索引内部生成的索引槽位置
  */
 Rid IxIndexHandle::get_rid(const Iid& iid) const {
-  auto node = fetch_node(iid.page_no);
-  // node->page->RLatch();
+  auto node = fetch_node_basic(iid.page_no);
   if (iid.slot_no >= node->get_size()) {
-    // node->page->RUnlatch();
     throw IndexEntryNotFoundError();
   }
-  auto rid = *node->get_rid(iid.slot_no);
-  // node->page->RUnlatch();
-  buffer_pool_manager_->unpin_page(node->get_page_id(), false);  // unpin it!
-  return rid;
+  return *node->get_rid(iid.slot_no);
 }
 
 /**
@@ -886,23 +1355,24 @@ Rid IxIndexHandle::get_rid(const Iid& iid) const {
  * @note 上层传入的key本来是int类型，通过(const char *)&key进行了转换
  * 可用*(int *)key转换回去
  */
-Iid IxIndexHandle::lower_bound(const char* key) {
-  auto&& leaf_node = find_leaf_page(key, Operation::FIND, nullptr, false).first;
-  auto&& pos = leaf_node->lower_bound(key);
+Iid IxIndexHandle::lower_bound(const char* raw_key) {
+  const IxKey ix_key(*file_hdr_, raw_key);
+  const char* key = ix_key.data();
   Iid iid{};
-  if (pos == leaf_node->get_size()) {
-    if (leaf_node->get_page_no() == file_hdr_->last_leaf_) {
-      iid = {leaf_node->get_page_no(), pos};
+  read_leaf(key, [&](IxNodeHandle& leaf_node) {
+    auto&& pos = leaf_node.lower_bound(key);
+    if (pos == leaf_node.get_size()) {
+      if (leaf_node.get_page_no() == file_hdr_->last_leaf_) {
+        iid = {leaf_node.get_page_no(), pos};
+      } else {
+        // 比如leafnode最后一个是38，而右边叶子开始是40
+        // 我找>=39，然后如果不是最右叶子节点，那么要找的地方必然是下一个叶子的第0个位置
+        iid = {leaf_node.get_next_leaf(), 0};
+      }
     } else {
-      // 比如leafnode最后一个是38，而右边叶子开始是40
-      // 我找>=39，然后如果不是最右叶子节点，那么要找的地方必然是下一个叶子的第0个位置
-      iid = {leaf_node->get_next_leaf(), 0};
+      iid = {leaf_node.get_page_no(), pos};
     }
-  } else {
-    iid = {leaf_node->get_page_no(), pos};
-  }
-  leaf_node->page->RUnlatch();
-  buffer_pool_manager_->unpin_page(leaf_node->get_page_id(), false);
+  });
   return iid;
 }
 
@@ -912,27 +1382,28 @@ Iid IxIndexHandle::lower_bound(const char* key) {
  * @param key
  * @return Iid
  */
-Iid IxIndexHandle::upper_bound(const char* key) {
-  auto&& leaf_node = find_leaf_page(key, Operation::FIND, nullptr, false).first;
-  auto&& pos = leaf_node->upper_bound(key);
+Iid IxIndexHandle::upper_bound(const char* raw_key) {
+  const IxKey ix_key(*file_hdr_, raw_key);
+  const char* key = ix_key.data();
   Iid iid{};
-  // 如果第一个比他大的在第 0 个 key
-  if (pos == 1 && Compare(key, leaf_node->get_key(0)) < 0) {
-    --pos;
-  }
-  if (pos == leaf_node->get_size()) {
-    if (leaf_node->get_page_no() == file_hdr_->last_leaf_) {
-      iid = {leaf_node->get_page_no(), pos};
+  read_leaf(key, [&](IxNodeHandle& leaf_node) {
+    auto&& pos = leaf_node.upper_bound(key);
+    // 如果第一个比他大的在第 0 个 key
+    if (pos == 1 && leaf_node.compare_key(key, 0) < 0) {
+      --pos;
+    }
+    if (pos == leaf_node.get_size()) {
+      if (leaf_node.get_page_no() == file_hdr_->last_leaf_) {
+        iid = {leaf_node.get_page_no(), pos};
+      } else {
+        // 比如leafnode最后一个是38，而右边开始是40
+        // 我找<=39，然后如果不是最右叶子节点，那么要找的地方必然是下一个叶子的第0个位置
+        iid = {leaf_node.get_next_leaf(), 0};
+      }
     } else {
-      // 比如leafnode最后一个是38，而右边开始是40
-      // 我找<=39，然后如果不是最右叶子节点，那么要找的地方必然是下一个叶子的第0个位置
-      iid = {leaf_node->get_next_leaf(), 0};
+      iid = {leaf_node.get_page_no(), pos};
     }
-  } else {
-    iid = {leaf_node->get_page_no(), pos};
-  }
-  leaf_node->page->RUnlatch();
-  buffer_pool_manager_->unpin_page(leaf_node->get_page_id(), false);
+  });
   return iid;
 }
 
@@ -943,12 +1414,8 @@ Iid IxIndexHandle::upper_bound(const char* key) {
  * @return Iid
  */
 Iid IxIndexHandle::leaf_end() const {
-  auto node = fetch_node(file_hdr_->last_leaf_);
-  node->page->RLatch();
-  Iid iid = {.page_no = file_hdr_->last_leaf_, .slot_no = node->get_size()};
-  node->page->RUnlatch();
-  buffer_pool_manager_->unpin_page(node->get_page_id(), false);  // unpin it!
-  return iid;
+  auto node = fetch_node_read(file_hdr_->last_leaf_);
+  return {.page_no = file_hdr_->last_leaf_, .slot_no = node->get_size()};
 }
 
 /**
@@ -963,34 +1430,41 @@ Iid IxIndexHandle::leaf_begin() const {
 }
 
 /**
- * @brief 获取一个指定结点
+ * @brief 获取一个指定结点，guard 析构时自动 unpin
  *
  * @param page_no
- * @return IxNodeHandle*
- * @note pin the page, remember to unpin it outside!
+ * @return IxBasicNodeGuard 只 pin 不加锁
+ */
+IxBasicNodeGuard IxIndexHandle::fetch_node_basic(int page_no) const {
+  auto* page = buffer_pool_manager_->fetch_page({fd_, page_no});
+  return {BasicPageGuard(buffer_pool_manager_, page), file_hdr_, page};
+}
+
+/**
+ * @brief 获取一个指定结点并加读锁，guard 析构时自动解锁并 unpin
  */
-std::shared_ptr<IxNodeHandle> IxIndexHandle::fetch_node(int page_no) const {
+IxReadNodeGuard IxIndexHandle::fetch_node_read(int page_no) const {
   auto* page = buffer_pool_manager_->fetch_page({fd_, page_no});
-  return std::make_shared<IxNodeHandle>(file_hdr_, page);
+  page->RLatch();
+  return {ReadPageGuard(buffer_pool_manager_, page), file_hdr_, page};
 }
 
 /**
  * @brief 创建一个新结点
  *
- * @return IxNodeHandle*
- * @note pin the page, remember to unpin it outside!
+ * @return IxBasicNodeGuard 只 pin 不加锁，guard 析构时自动 unpin
  * 注意：对于Index的处理是，删除某个页面后，认为该被删除的页面是free_page
  * 而first_free_page实际上就是最新被删除的页面，初始为IX_NO_PAGE
  * 在最开始插入时，一直是create
  * node，那么first_page_no一直没变，一直是IX_NO_PAGE
  * 与Record的处理不同，Record将未插入满的记录页认为是free_page
  */
-std::shared_ptr<IxNodeHandle> IxIndexHandle::create_node() {
+IxBasicNodeGuard IxIndexHandle::create_node() {
   ++file_hdr_->num_pages_;
   PageId new_page_id = {.fd = fd_, .page_no = INVALID_PAGE_ID};
   // 从3开始分配page_no，第一次分配之后，new_page_id.page_no=3，file_hdr_.num_pages=4
   auto* page = buffer_pool_manager_->new_page(&new_page_id);
-  return std::make_shared<IxNodeHandle>(file_hdr_, page);
+  return {BasicPageGuard(buffer_pool_manager_, page), file_hdr_, page};
 }
 
 /**
@@ -998,22 +1472,29 @@ std::shared_ptr<IxNodeHandle> IxIndexHandle::create_node() {
  *
  * @param node
  */
-void IxIndexHandle::maintain_parent(std::shared_ptr<IxNodeHandle>& node) {
-  auto curr = node;
+void IxIndexHandle::maintain_parent(IxNodeHandle& node) {
+  IxNodeHandle* curr = &node;
+  // 持有 curr 的 pin，下一轮还要读它
+  IxBasicNodeGuard curr_guard;
   while (curr->get_parent_page_no() != IX_NO_PAGE) {
     // Load its parent
-    auto parent = fetch_node(curr->get_parent_page_no());
-    int rank = parent->find_child(curr);
+    auto parent = fetch_node_basic(curr->get_parent_page_no());
+    int rank = parent->find_child(*curr);
     char* parent_key = parent->get_key(rank);
-    char* child_first_key = curr->get_key(0);
+    char child_first_key[IX_MAX_COL_LEN];
+    curr->copy_key(0, child_first_key);
     if (memcmp(parent_key, child_first_key, file_hdr_->col_tot_len_) == 0) {
-      assert(buffer_pool_manager_->unpin_page(parent->get_page_id(), true));
       break;
     }
     memcpy(parent_key, child_first_key,
            file_hdr_->col_tot_len_);  // 修改了parent node
-    curr = parent;
-    assert(buffer_pool_manager_->unpin_page(parent->get_page_id(), true));
+    parent.mark_dirty();
+    curr_guard = std::move(parent);
+    curr = &*curr_guard;
+    // 父结点的第一个 key 没有变，再往上的祖先可能没有加锁，不能再访问
+    if (rank != 0) {
+      break;
+    }
   }
 }
 
@@ -1023,204 +1504,165 @@ void IxIndexHandle::maintain_parent(std::shared_ptr<IxNodeHandle>& node) {
  *
  * @param leaf 要删除的leaf
  */
-void IxIndexHandle::erase_leaf(std::shared_ptr<IxNodeHandle>& leaf) {
-  assert(leaf->is_leaf_page());
+void IxIndexHandle::erase_leaf(IxNodeHandle& leaf) {
+  assert(leaf.is_leaf_page());
 
-  auto prev = fetch_node(leaf->get_prev_leaf());
-  prev->set_next_leaf(leaf->get_next_leaf());
-  buffer_pool_manager_->unpin_page(prev->get_page_id(), true);
+  auto prev = fetch_node_basic(leaf.get_prev_leaf());
+  prev->set_next_leaf(leaf.get_next_leaf());
+  prev.mark_dirty();
 
-  auto next = fetch_node(leaf->get_next_leaf());
-  next->set_prev_leaf(leaf->get_prev_leaf());  // 注意此处是SetPrevLeaf()
-  buffer_pool_manager_->unpin_page(next->get_page_id(), true);
+  auto next = fetch_node_basic(leaf.get_next_leaf());
+  next->set_prev_leaf(leaf.get_prev_leaf());  // 注意此处是SetPrevLeaf()
+  next.mark_dirty();
 }
 
 /**
- * @brief 删除node时，更新file_hdr_.num_pages
+ * @brief 删除node时调用。删除的页面号不会被再次分配，文件中的页面数不变：
+ * 打开索引时从file_hdr_.num_pages开始分配page_no，如果这里减少num_pages，
+ * 重新打开之后新建的结点会覆盖文件末尾还在使用的结点
  *
  * @param node
  */
-void IxIndexHandle::release_node_handle(IxNodeHandle& node) {
-  --file_hdr_->num_pages_;
-}
+void IxIndexHandle::release_node_handle(
+    __attribute__((unused)) IxNodeHandle& node) {}
 
 /**
  * @brief 将node的第child_idx个孩子结点的父节点置为node
  */
-void IxIndexHandle::maintain_child(std::shared_ptr<IxNodeHandle>& node,
-                                   int child_idx) {
-  if (!node->is_leaf_page()) {
+void IxIndexHandle::maintain_child(IxNodeHandle& node, int child_idx) {
+  if (!node.is_leaf_page()) {
     //  Current node is inner node, load its child and set its parent to current
     //  node
-    int child_page_no = node->value_at(child_idx);
-    auto child = fetch_node(child_page_no);
-    child->set_parent_page_no(node->get_page_no());
-    buffer_pool_manager_->unpin_page(child->get_page_id(), true);
+    int child_page_no = node.value_at(child_idx);
+    auto child = fetch_node_basic(child_page_no);
+    child->set_parent_page_no(node.get_page_no());
+    child.mark_dirty();
   }
 }
 
 RmRecord IxIndexHandle::get_key(const Iid& iid) const {
-  auto node = fetch_node(iid.page_no);
+  auto node = fetch_node_basic(iid.page_no);
   if (iid.slot_no >= node->get_size()) {
-    buffer_pool_manager_->unpin_page(node->get_page_id(), false);
     throw IndexEntryNotFoundError();
   }
-  RmRecord record(node->get_key(iid.slot_no), file_hdr_->col_tot_len_);
-  buffer_pool_manager_->unpin_page(node->get_page_id(), false);
-  return record;
-}
-
-void IxIndexHandle::create_upper_parent_nodes(char* key, Rid* rid,
-                                              int first_parent_page_no,
-                                              int sum) {
-  // 初始化第一个父亲节点
-  int pos = 0;
-
-  auto node = create_node();
-  node->page_hdr->is_leaf = false;
-  char* node_key = node->get_key(0);
-  Rid* node_rid = node->get_rid(0);
-  int tot_len = file_hdr_->col_tot_len_;
-
-  int block = 0;
-  // 计算叶子结点的个数和每块应装入的元组条数
-  // max_size * 0.7 大小 尽可能避免分裂重组
-  int expected_leaf_num = static_cast<int>((file_hdr_->btree_order_ + 1) * 0.9);
-  int blocks = sum / expected_leaf_num + (sum % expected_leaf_num ? 1 : 0);
-  // 调整块数量，确保每个叶子节点半满
-  if (blocks > 1 && (file_hdr_->btree_order_ + 1) / 2 > sum / blocks) {
-    // assert(0);
-    --blocks;
-  }
-
-  // 实际每个叶子上的元组数量
-  int actual_leaf_num = sum / blocks;
-  // 多出来的元组
-  int remaining_leaf_num = sum % blocks;
-
-  int upper_expected_parent_num =
-      static_cast<int>((file_hdr_->btree_order_ + 1) * 0.9);
-  int upper_blocks = blocks / upper_expected_parent_num +
-                     (blocks % upper_expected_parent_num ? 1 : 0);
-  // 调整块数量，确保每个叶子节点半满
-  if (upper_blocks > 1 &&
-      (file_hdr_->btree_order_ + 1) / 2 > blocks / upper_blocks) {
-    --upper_blocks;
-  }
-
-  // 实际每个父亲节点上的元组数量
-  int actual_upper_parent_num = blocks / upper_blocks;
-  // 多出来的元组
-  int remaining_upper_parent_num = blocks % upper_blocks;
-
-  // 第一个父亲节点页号
-  int parent_page_no = first_parent_page_no + blocks;
-
-  // 只能构成一个节点，即为根节点
-  if (blocks == 1) {
-    node->set_parent_page_no(INVALID_PAGE_ID);
-    file_hdr_->root_page_ = node->get_page_no();
+  RmRecord record(file_hdr_->col_tot_len_);
+  // 还原成上层的原格式
+  if (file_hdr_->key_kind_ == IxKeyKind::NORMALIZED) {
+    char key[IX_MAX_COL_LEN];
+    node->copy_key(iid.slot_no, key);
+    ix_decode_key(*file_hdr_, key, record.data);
   } else {
-    // 否则叶子节点指向父亲节点
-    node->set_parent_page_no(parent_page_no);
+    node->copy_key(iid.slot_no, record.data);
   }
+  return record;
+}
 
-  // 设置叶子节点大小
-  node->set_size(actual_leaf_num);
-
-  // 对于父亲节点，孩子节点数量
-  int child_pos = 0;
-
-  // 把每个索引块的第一个元组拷贝，用于父亲节点生成
-  char* key_temp = nullptr;
-  char* key_temp_head = nullptr;
-  Rid* rid_temp = nullptr;
-  Rid* rid_temp_head = nullptr;
-
-  // 只有有父亲节点才需要
-  if (blocks > 1) {
-    key_temp = new char[blocks * tot_len];
-    key_temp_head = key_temp;
-    rid_temp = new Rid[blocks];
-    rid_temp_head = rid_temp;
+/**
+ * @description: 由有序的键值对自底向上一次建好整棵树，只用于刚创建的空索引
+ * 叶子按填充率装入，给之后的插入留出空间，再逐层用每个孩子的第一个 key 建上层
+ * @param {char*} keys 结点存储格式的 key，有序、不重复、连续存放
+ * @param {Rid*} rids 每个 key 对应的 rid
+ * @param {int} num 键值对的数量
+ * @param {double} fill_factor 每个结点装入的键值对占 btree_order 的比例
+ */
+void IxIndexHandle::bulk_load(const char* keys, const Rid* rids, int num,
+                              double fill_factor) {
+  if (num == 0) {
+    return;
   }
-
-  auto* src_key = key;
-  auto* src_rid = rid;
-
-  for (int i = 0; i < sum; i++) {
-    if (pos == actual_leaf_num) {
-      pos = 0;
-      // unpin
-      buffer_pool_manager_->unpin_page(node->get_page_id(), true);
-      // 建立新节点
-      node = create_node();
-      node->page_hdr->is_leaf = false;
-
-      node_key = node->get_key(0);
-      node_rid = node->get_rid(0);
-
-      // 一样的操作
-      if (++block + remaining_leaf_num == blocks) {
-        ++actual_leaf_num;
-      }
-
-      // 设置大小
-      node->set_size(actual_leaf_num);
-
-      // 对于父亲节点，孩子节点数量 + 1
-      if (++child_pos >= actual_upper_parent_num) {
-        // 孩子节点数量设置为 0
-        child_pos = 0;
-        // 父亲节点 + 1
-        // 注意这里的2和起始节点页号有关，parent_page_no - blocks -
-        // first_parent_page_no 才是实际父节点块数
-        if (++parent_page_no - blocks - first_parent_page_no ==
-            upper_blocks - remaining_upper_parent_num) {
-          ++actual_upper_parent_num;
-        }
-      }
-      // 指向父亲节点
-      node->set_parent_page_no(parent_page_no);
+  int tot_len = file_hdr_->col_tot_len_;
+  int order = file_hdr_->btree_order_;
+  int min_size = (order + 1) / 2;
+  int target =
+      std::clamp(static_cast<int>(order * fill_factor), min_size, order);
+  // n 个键值对平均分到若干结点，除根以外每个结点都不少于 min_size
+  auto distribute = [&](int n) {
+    int blocks = (n + target - 1) / target;
+    if (blocks > 1 && n / blocks < min_size) {
+      --blocks;
     }
-
-    // 注意如果一个叶子节点放满了，跳到下一个叶子头也得拷贝
-    if (pos == 0 && blocks > 1) {
-      // 将每个索引块的第一个元组拷贝一份到临时数组中
-      memcpy(key_temp_head, src_key, tot_len);
-      Rid rid{.page_no = node->get_page_no(), .slot_no = -1};
-      memcpy(rid_temp_head, &rid, sizeof(Rid));
-      key_temp_head += tot_len;
-      // 加一个 rid
-      ++rid_temp_head;
+    std::vector<int> sizes(blocks, n / blocks);
+    for (int i = 0; i < n % blocks; ++i) {
+      ++sizes[i];
     }
-
-    // 初始化键值对
-    memcpy(node_key, src_key, tot_len);
-    memcpy(node_rid, src_rid, sizeof(Rid));
-    src_key += tot_len;
-    node_key += tot_len;
-    ++src_rid;
-    ++node_rid;
-    ++pos;
+    return sizes;
+  };
+  auto init_node = [](IxNodeHandle& node, bool is_leaf) {
+    node.page_hdr->next_free_page_no = IX_NO_PAGE;
+    node.page_hdr->parent = IX_NO_PAGE;
+    node.page_hdr->num_key = 0;
+    node.page_hdr->prefix_len = 0;
+    node.page_hdr->prev_leaf = node.page_hdr->next_leaf = IX_NO_PAGE;
+    node.set_is_leaf_page(is_leaf);
+  };
+
+  // 当前层每个结点的第一个 key 和页号，作为上一层的键值对
+  std::vector<char> level_keys;
+  std::vector<Rid> level_rids;
+  std::vector<int> sizes = distribute(num);
+  level_keys.resize(sizes.size() * tot_len);
+  level_rids.resize(sizes.size());
+
+  // 叶子层，第一个叶子沿用初始的根结点
+  std::optional<IxBasicNodeGuard> prev_leaf;
+  int offset = 0;
+  for (std::size_t i = 0; i < sizes.size(); ++i) {
+    auto node =
+        prev_leaf ? create_node() : fetch_node_basic(IX_INIT_ROOT_PAGE);
+    node.mark_dirty();
+    init_node(*node, true);
+    node->set_prev_leaf(prev_leaf ? (*prev_leaf)->get_page_no()
+                                  : IX_LEAF_HEADER_PAGE);
+    node->set_next_leaf(IX_LEAF_HEADER_PAGE);
+    node->insert_pairs(0, keys + static_cast<std::size_t>(offset) * tot_len,
+                       rids + offset, sizes[i]);
+    memcpy(level_keys.data() + i * tot_len,
+           keys + static_cast<std::size_t>(offset) * tot_len, tot_len);
+    level_rids[i] = {node->get_page_no(), -1};
+    offset += sizes[i];
+    if (prev_leaf) {
+      (*prev_leaf)->set_next_leaf(node->get_page_no());
+    }
+    prev_leaf = std::move(node);
   }
-
-  delete[] key;
-  delete[] rid;
-
-  // 没有到根节点，继续递归
-  if (blocks > 1) {
-    buffer_pool_manager_->unpin_page(node->get_page_id(), true);
-    create_upper_parent_nodes(key_temp, rid_temp, first_parent_page_no + blocks,
-                              blocks);
-  } else {
-    file_hdr_->root_page_ = node->get_page_no();
-    buffer_pool_manager_->unpin_page(node->get_page_id(), true);
+  // num > 0，至少有一个叶子
+  file_hdr_->last_leaf_ = (*prev_leaf)->get_page_no();
+  prev_leaf.reset();
+  auto leaf_header = fetch_node_basic(IX_LEAF_HEADER_PAGE);
+  leaf_header->set_prev_leaf(file_hdr_->last_leaf_);
+  leaf_header->set_next_leaf(IX_INIT_ROOT_PAGE);
+  leaf_header.mark_dirty();
+
+  // 逐层向上，直到只剩一个结点
+  while (level_rids.size() > 1) {
+    sizes = distribute(static_cast<int>(level_rids.size()));
+    std::vector<char> upper_keys(sizes.size() * tot_len);
+    std::vector<Rid> upper_rids(sizes.size());
+    offset = 0;
+    for (std::size_t i = 0; i < sizes.size(); ++i) {
+      auto node = create_node();
+      node.mark_dirty();
+      init_node(*node, false);
+      node->insert_pairs(
+          0, level_keys.data() + static_cast<std::size_t>(offset) * tot_len,
+          level_rids.data() + offset, sizes[i]);
+      for (int j = 0; j < sizes[i]; ++j) {
+        maintain_child(*node, j);
+      }
+      memcpy(upper_keys.data() + i * tot_len,
+             level_keys.data() + static_cast<std::size_t>(offset) * tot_len,
+             tot_len);
+      upper_rids[i] = {node->get_page_no(), -1};
+      offset += sizes[i];
+    }
+    level_keys = std::move(upper_keys);
+    level_rids = std::move(upper_rids);
   }
+  file_hdr_->root_page_ = level_rids.front().page_no;
 }
 
-void ToGraph(const IxIndexHandle* ih, IxNodeHandle* node,
-             BufferPoolManager* bpm, std::ofstream& out) {
+// node 的 pin 由调用者持有
+void ToGraph(const IxIndexHandle* ih, IxNodeHandle* node, std::ofstream& out) {
   std::string leaf_prefix("LEAF_");
   std::string internal_prefix("INT_");
   if (node->is_leaf_page()) {
@@ -1239,8 +1681,10 @@ void ToGraph(const IxIndexHandle* ih, IxNodeHandle* node,
         << "max_size=" << leaf->get_max_size()
         << ",min_size=" << leaf->get_min_size() << "</TD></TR>\n";
     out << "<TR>";
+    char key[IX_MAX_COL_LEN];
     for (int i = 0; i < leaf->get_size(); i++) {
-      out << "<TD>" << *reinterpret_cast<int*>(leaf->get_key(i)) << "</TD>\n";
+      leaf->copy_key(i, key);
+      out << "<TD>" << *reinterpret_cast<int*>(key) << "</TD>\n";
     }
     out << "</TR>";
     // Print table end
@@ -1297,19 +1741,18 @@ void ToGraph(const IxIndexHandle* ih, IxNodeHandle* node,
     }
     // Print leaves
     for (int i = 0; i < inner->get_size(); i++) {
-      auto child_node = ih->fetch_node(inner->value_at(i));
-      ToGraph(ih, child_node.get(), bpm, out);  // 继续递归
+      auto child_node = ih->fetch_node_basic(inner->value_at(i));
+      ToGraph(ih, &*child_node, out);  // 继续递归
       if (i > 0) {
-        auto sibling_node = ih->fetch_node(inner->value_at(i - 1));
+        auto sibling_node = ih->fetch_node_basic(inner->value_at(i - 1));
         if (!sibling_node->is_leaf_page() && !child_node->is_leaf_page()) {
-          out << "{rank=same " << internal_prefix << sibling_node->get_page_no()
-              << " " << internal_prefix << child_node->get_page_no() << "};\n";
+          out << "{rank=same " << internal_prefix
+              << sibling_node->get_page_no() << " " << internal_prefix
+              << child_node->get_page_no() << "};\n";
         }
-        bpm->unpin_page(sibling_node->get_page_id(), false);
       }
     }
   }
-  bpm->unpin_page(node->get_page_id(), false);
 }
 
 /**
@@ -1318,12 +1761,13 @@ void ToGraph(const IxIndexHandle* ih, IxNodeHandle* node,
  * @param bpm 缓冲池
  * @param outf dot文件名
  */
-void IxIndexHandle::Draw(BufferPoolManager* bpm, const std::string& outf) {
+void IxIndexHandle::Draw(__attribute__((unused)) BufferPoolManager* bpm,
+                         const std::string& outf) {
   std::ofstream out(outf);
   out << "digraph G {" << std::endl;
 
-  auto node = fetch_node(file_hdr_->root_page_);
-  ToGraph(this, node.get(), bpm, out);
+  auto node = fetch_node_basic(file_hdr_->root_page_);
+  ToGraph(this, &*node, out);
   out << "}" << std::endl;
   out.close();
 
@@ -12,9 +12,13 @@ See the Mulan PSL v2 for more details. */
 
 #include <readline/readline.h>
 
+#include <atomic>
 #include <optional>
 
 #include "ix_defs.h"
+#include "ix_index.h"
+#include "ix_key.h"
+#include "storage/page_guard.h"
 #include "transaction/transaction.h"
 
 enum class Operation {
@@ -56,10 +60,15 @@ inline int ix_compare(const char* a, const char* b,
   return 0;
 }
 
+template <typename Guard>
+class IxNodeGuard;
+
 /* 管理B+树中的每个节点 */
 class IxNodeHandle {
   friend class IxIndexHandle;
   friend class IxScan;
+  template <typename Guard>
+  friend class IxNodeGuard;
 
  private:
   const IxFileHdr* file_hdr;  // 节点所在文件的头部信息
@@ -69,6 +78,35 @@ class IxNodeHandle {
   char*
       keys;  // page->data的第二部分，指针指向首地址，长度为file_hdr->keys_size，每个key的长度为file_hdr->col_len
   Rid* rids;  // page->data的第三部分，指针指向首地址
+  /**
+   * 前缀压缩的叶子：页头之后是 prefix_len 字节的公共前缀，keys 中只存每个 key
+   * 去掉前缀后的 key_len 字节，rids 放在页尾，容量随前缀长度变化
+   * 未压缩的结点 prefix_len 为 0，key_len 为 col_tot_len
+   * 布局由页头算出并缓存在句柄中，页面加锁之后要重新 load_layout()
+   */
+  char* prefix;
+  int prefix_len;
+  int key_len;
+  int capacity;  // 结点最多能存的键值对数量
+
+  void load_layout();
+
+  bool is_prefix_compressed() const {
+    return IX_LEAF_PREFIX_COMPRESSION &&
+           file_hdr->key_kind_ != IxKeyKind::INT && page_hdr->is_leaf;
+  }
+
+  // 公共前缀长度为 len 时结点的容量
+  int capacity_for(int len) const;
+
+  // 插入 key 之后公共前缀的长度
+  int prefix_len_after(const char* key) const;
+
+  // 公共前缀改为 len，重排整个结点
+  void set_prefix_len(int len);
+
+  // 即将插入 [first, last] 范围内的 key，必要时缩短公共前缀
+  void reserve_prefix(const char* first, const char* last);
 
  public:
   IxNodeHandle() = default;
@@ -76,26 +114,45 @@ class IxNodeHandle {
   IxNodeHandle(const IxFileHdr* file_hdr_, Page* page_)
       : file_hdr(file_hdr_), page(page_) {
     page_hdr = reinterpret_cast<IxPageHdr*>(page->get_data());
-    keys = page->get_data() + sizeof(IxPageHdr);
-    rids = reinterpret_cast<Rid*>(keys + file_hdr->keys_size_);
+    load_layout();
   }
 
-  inline bool isSafe(Operation operation);
+  // 句柄不持有页面，pin 和锁由 IxNodeGuard 管理，禁止拷贝出脱离 guard 的句柄
+  IxNodeHandle(const IxNodeHandle&) = delete;
+  IxNodeHandle& operator=(const IxNodeHandle&) = delete;
+  IxNodeHandle(IxNodeHandle&&) = default;
+  IxNodeHandle& operator=(IxNodeHandle&&) = default;
+
+  inline bool isSafe(Operation operation, const char* key = nullptr);
+
+  // 插入或删除 key 是否可能改变结点的第一个 key，改变时要向上更新祖先
+  bool may_change_first_key(const char* key) {
+    return is_leaf_page() ? lower_bound(key) == 0 : upper_bound(key) == 1;
+  }
 
   inline int get_size() { return page_hdr->num_key; }
 
   inline void set_size(int size) { page_hdr->num_key = size; }
 
-  int get_max_size() { return file_hdr->btree_order_ + 1; }
+  int get_max_size() { return capacity; }
 
-  int get_min_size() { return get_max_size() / 2; }
+  // 前缀压缩的叶子容量可能更大，下限仍按未压缩的结点计算，合并后一定放得下
+  int get_min_size() { return (file_hdr->btree_order_ + 1) / 2; }
+
+  // 插入 key 后是否放得下，前缀压缩的叶子插入后前缀可能变短
+  bool has_room(const char* key) const {
+    return page_hdr->num_key < capacity_for(prefix_len_after(key));
+  }
+
+  // 删除尾部的 key 后公共前缀可能变长，重新压缩
+  void compact_prefix();
 
   int key_at(int i) { return *(int*)get_key(i); }
 
   /* 得到第i个孩子结点的page_no */
   page_id_t value_at(int i) { return get_rid(i)->page_no; }
 
-  page_id_t get_page_no() { return page->get_page_id().page_no; }
+  page_id_t get_page_no() const { return page->get_page_id().page_no; }
 
   inline PageId get_page_id() { return page->get_page_id(); }
 
@@ -123,10 +180,27 @@ class IxNodeHandle {
     page_hdr->parent = parent;
   }
 
-  inline void set_is_leaf_page(bool val) { page_hdr->is_leaf = val; }
+  inline void set_is_leaf_page(bool val) {
+    page_hdr->is_leaf = val;
+    load_layout();
+  }
 
-  inline char* get_key(int key_idx) const {
-    return keys + key_idx * file_hdr->col_tot_len_;
+  // 第 key_idx 个 key 在结点中存储的部分，前缀压缩的叶子中不含公共前缀
+  inline char* get_key(int key_idx) const { return keys + key_idx * key_len; }
+
+  // 拷贝出第 key_idx 个完整的 key
+  void copy_key(int key_idx, char* dest) const {
+    memcpy(dest, prefix, prefix_len);
+    memcpy(dest + prefix_len, get_key(key_idx), key_len);
+  }
+
+  // 完整的 key 与第 key_idx 个 key 比较
+  int compare_key(const char* key, int key_idx) const {
+    if (prefix_len == 0) {
+      return Compare(key, get_key(key_idx));
+    }
+    int cmp = memcmp(key, prefix, prefix_len);
+    return cmp != 0 ? cmp : memcmp(key + prefix_len, get_key(key_idx), key_len);
   }
 
   inline Rid* get_rid(int rid_idx) const { return &rids[rid_idx]; }
@@ -135,6 +209,7 @@ class IxNodeHandle {
 
   inline Rid* get_last_rid() { return get_rid(get_size() - 1); }
 
+  // 只用于内部结点
   void set_key(int key_idx, const char* key) {
     memcpy(keys + key_idx * file_hdr->col_tot_len_, key,
            file_hdr->col_tot_len_);
@@ -148,6 +223,9 @@ class IxNodeHandle {
 
   void insert_pairs(int pos, const char* key, const Rid* rid, int n);
 
+  // 把 src 的第 [begin, end) 个键值对插入到 pos 位置
+  void insert_pairs_from(int pos, const IxNodeHandle& src, int begin, int end);
+
   page_id_t internal_lookup(const char* key);
 
   bool leaf_lookup(const char* key, Rid** value);
@@ -187,12 +265,12 @@ class IxNodeHandle {
    * @param child
    * @return int
    */
-  int find_child(const std::shared_ptr<IxNodeHandle>& child) const {
+  int find_child(const IxNodeHandle& child) const {
     // int rid_idx = lower_bound(child->get_key(0));
     // TODO：优化为什么不二分
     int rid_idx;
     for (rid_idx = 0; rid_idx < page_hdr->num_key; rid_idx++) {
-      if (get_rid(rid_idx)->page_no == child->get_page_no()) {
+      if (get_rid(rid_idx)->page_no == child.get_page_no()) {
         break;
       }
     }
@@ -201,27 +279,68 @@ class IxNodeHandle {
   }
 
   inline int Compare(const char* a, const char* b) const {
-    return ix_compare(a, b, file_hdr->col_types_, file_hdr->col_lens_);
+    return ix_compare_key(*file_hdr, a, b);
   }
 
   inline bool isFull() { return page_hdr->num_key == get_max_size(); }
 };
 
+/**
+ * 持有页面 guard 的结点句柄，只能移动，析构时按 guard 的类型释放锁并 unpin
+ * Guard 为 BasicPageGuard（只 pin）、ReadPageGuard 或 WritePageGuard
+ */
+template <typename Guard>
+class IxNodeGuard {
+ public:
+  IxNodeGuard() = default;
+
+  IxNodeGuard(Guard guard, const IxFileHdr* file_hdr, Page* page)
+      : guard_(std::move(guard)), node_(file_hdr, page) {}
+
+  IxNodeHandle* operator->() { return &node_; }
+
+  IxNodeHandle& operator*() { return node_; }
+
+  // 修改了结点，unpin 时写回
+  void mark_dirty() { guard_.GetDataMut(); }
+
+  // 只 pin 的结点加读锁或写锁，原 guard 失效
+  IxNodeGuard<ReadPageGuard> upgrade_read() {
+    return {guard_.UpgradeRead(), node_.file_hdr, node_.page};
+  }
+
+  IxNodeGuard<WritePageGuard> upgrade_write() {
+    return {guard_.UpgradeWrite(), node_.file_hdr, node_.page};
+  }
+
+  // 提前释放锁并 unpin
+  void Drop() { guard_.Drop(); }
+
+  // 交出页面 guard，悲观下降时把祖先的写锁交给事务持有
+  Guard take_guard() { return std::move(guard_); }
+
+ private:
+  Guard guard_;
+  IxNodeHandle node_;
+};
+
+using IxBasicNodeGuard = IxNodeGuard<BasicPageGuard>;
+using IxReadNodeGuard = IxNodeGuard<ReadPageGuard>;
+using IxWriteNodeGuard = IxNodeGuard<WritePageGuard>;
+
 /* B+树 */
-class IxIndexHandle {
+class IxIndexHandle : public IxIndex {
   friend class IxScan;
   friend class IxManager;
 
- public:
-  int fd_;  // 存储B+树的文件
-  RWLatch rw_latch_;
-
  private:
   DiskManager* disk_manager_;
   BufferPoolManager* buffer_pool_manager_;
   // IxFileHdr *file_hdr_; //
   // 存了root_page，但其初始化为2（第0页存FILE_HDR_PAGE，第1页存LEAF_HEADER_PAGE）
   std::mutex root_latch_;
+  // 乐观读记下的每个页面所在的帧，命中时不 pin 也不进 buffer pool 的锁
+  mutable std::atomic<Page*> frame_hints_[IX_FRAME_HINTS] = {};
 
   // class Context {
   // public:
@@ -253,20 +372,24 @@ class IxIndexHandle {
   IxIndexHandle(DiskManager* disk_manager,
                 BufferPoolManager* buffer_pool_manager, int fd);
 
-  ~IxIndexHandle() { delete file_hdr_; }
+  ~IxIndexHandle() override { delete file_hdr_; }
 
   void Draw(BufferPoolManager* bpm, const std::string& outf);
 
   IxFileHdr*
       file_hdr_;  // 存了root_page，但其初始化为2（第0页存FILE_HDR_PAGE，第1页存LEAF_HEADER_PAGE）
 
-  std::shared_ptr<IxNodeHandle> create_node();
+  // 新建结点，只 pin 不加锁
+  IxBasicNodeGuard create_node();
+
+  // 固定页面的结点句柄，离开作用域自动释放
+  IxBasicNodeGuard fetch_node_basic(int page_no) const;
 
-  // for get/create node
-  std::shared_ptr<IxNodeHandle> fetch_node(int page_no) const;
+  IxReadNodeGuard fetch_node_read(int page_no) const;
 
-  void create_upper_parent_nodes(char* key, Rid* rid, int first_parent_page_no,
-                                 int sum);
+  // 由有序的键值对批量建树，只用于空索引
+  void bulk_load(const char* keys, const Rid* rids, int num,
+                 double fill_factor = IX_BULK_LOAD_FILL_FACTOR);
 
   // for safe look empty table
   bool is_empty();
@@ -276,43 +399,54 @@ class IxIndexHandle {
 
   // for search
   bool get_value(const char* key, std::vector<Rid>* result,
-                 Transaction* transaction);
+                 Transaction* transaction) override;
+
+  // 写操作的悲观下降，返回加了写锁的叶子以及根锁是否仍被持有
+  std::pair<IxWriteNodeGuard, bool> find_leaf_page(const char* key,
+                                                   Operation operation,
+                                                   Transaction* transaction);
 
-  std::pair<std::shared_ptr<IxNodeHandle>, bool> find_leaf_page(
-      const char* key, Operation operation, Transaction* transaction,
-      bool find_first = false);
+  // 读操作加读锁下降，返回加了读锁的叶子
+  IxReadNodeGuard find_leaf_page_read(const char* key);
 
-  // check unique
-  bool is_unique(const char* key, Rid& value, Transaction* transaction);
+  IxWriteNodeGuard find_leaf_page_optimistic(const char* key);
+
+  // check unique，key_len 小于 key 的长度时只检查前 key_len 个字节
+  bool is_unique(const char* key, Rid& value, Transaction* transaction,
+                 int key_len = 0) override;
 
   // for insert
   page_id_t insert_entry(const char* key, const Rid& value,
-                         Transaction* transaction);
+                         Transaction* transaction) override;
+
+  IxWriteNodeGuard split(IxNodeHandle& node, int split_point);
 
-  std::shared_ptr<IxNodeHandle> split(std::shared_ptr<IxNodeHandle>& node);
+  page_id_t split_and_insert(IxNodeHandle& leaf_node, const char* key,
+                             const Rid& value, Transaction* transaction);
 
-  void insert_into_parent(std::shared_ptr<IxNodeHandle>& old_node,
-                          const char* key,
-                          std::shared_ptr<IxNodeHandle>& new_node,
-                          Transaction* transaction);
+  void insert_into_parent(IxNodeHandle& old_node, const char* key,
+                          IxNodeHandle& new_node, Transaction* transaction);
 
   // for delete
-  bool delete_entry(const char* key, Transaction* transaction);
+  bool delete_entry(const char* key, Transaction* transaction) override;
+
+  // 批量插入和删除，同一个叶子上的修改只下降一次
+  void apply_batch(const IxBatch& batch, Transaction* transaction) override;
 
-  bool coalesce_or_redistribute(std::shared_ptr<IxNodeHandle>& node,
+  void write_file_hdr() const override;
+
+  bool coalesce_or_redistribute(IxNodeHandle& node,
                                 Transaction* transaction = nullptr,
                                 bool* root_is_latched = nullptr);
 
-  bool adjust_root(std::shared_ptr<IxNodeHandle>& old_root_node);
+  bool adjust_root(IxNodeHandle& old_root_node);
 
-  void redistribute(std::shared_ptr<IxNodeHandle>& neighbor_node,
-                    std::shared_ptr<IxNodeHandle>& node,
-                    std::shared_ptr<IxNodeHandle>& parent, int index);
+  void redistribute(IxNodeHandle& neighbor_node, IxNodeHandle& node,
+                    IxNodeHandle& parent, int index);
 
-  bool coalesce(std::shared_ptr<IxNodeHandle>* neighbor_node,
-                std::shared_ptr<IxNodeHandle>* node,
-                std::shared_ptr<IxNodeHandle>* parent, int index,
-                Transaction* transaction, bool* root_is_latched);
+  bool coalesce(IxNodeHandle* neighbor_node, IxNodeHandle* node,
+                IxNodeHandle* parent, int index, Transaction* transaction,
+                bool* root_is_latched);
 
   Iid lower_bound(const char* key);
 
@@ -329,18 +463,29 @@ class IxIndexHandle {
   // 辅助函数
   void update_root_page_no(page_id_t root) { file_hdr_->root_page_ = root; }
 
-  // std::shared_ptr<IxNodeHandle> create_node();
-
   // for maintain data structure
-  void maintain_parent(std::shared_ptr<IxNodeHandle>& node);
+  void maintain_parent(IxNodeHandle& node);
 
-  void erase_leaf(std::shared_ptr<IxNodeHandle>& leaf);
+  void erase_leaf(IxNodeHandle& leaf);
 
   void release_node_handle(IxNodeHandle& node);
 
-  void maintain_child(std::shared_ptr<IxNodeHandle>& node, int child_idx);
+  // 乐观读取结点所在的帧，frame_hints_ 未命中时 pin 住页面放到 guard 中
+  Page* peek_page(int page_no, uint64_t* version,
+                  IxBasicNodeGuard* guard) const;
+
+  // 乐观读：不加读锁找到 key 所在的叶子并在其上调用 read(leaf)
+  template <typename F>
+  bool optimistic_read_leaf(const char* key, F&& read) const;
+
+  template <typename F>
+  void read_leaf(const char* key, F&& read);
+
+  bool is_unique_prefix(const char* key, Rid& value, int key_len);
+
+  void maintain_child(IxNodeHandle& node, int child_idx);
 
   inline int Compare(const char* a, const char* b) const {
-    return ix_compare(a, b, file_hdr_->col_types_, file_hdr_->col_lens_);
+    return ix_compare_key(*file_hdr_, a, b);
   }
 };
@@ -0,0 +1,219 @@
+/* Copyright (c) 2023 Renmin University of China
+RMDB is licensed under Mulan PSL v2.
+You can use this software according to the terms and conditions of the Mulan PSL
+v2. You may obtain a copy of Mulan PSL v2 at:
+        http://license.coscl.org.cn/MulanPSL2
+THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+See the Mulan PSL v2 for more details. */
+
+#pragma once
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+#include "ix_defs.h"
+
+/**
+ * B+ 树结点中 key 的存储格式，由 IxFileHdr::key_kind_ 决定：
+ * IxKeyKind::INT        单列 int，按原格式存储，结点内用整数比较
+ * IxKeyKind::BYTES      全部是字符串列，原格式就可以直接 memcmp
+ * IxKeyKind::NORMALIZED 其他情况，每列编码成保序的字节串后拼接，整个 key 一次 memcmp
+ *                       int 翻转符号位后按大端存储，float 按位变换后按大端存储
+ * 后两种格式的叶子结点只存一份所有 key 的公共前缀，见 IxNodeHandle
+ */
+
+// 大于这个长度的 key 在堆上编码
+constexpr int IX_KEY_INLINE_LEN = 128;
+// AVX2 查找时二分缩小到的窗口大小
+constexpr int IX_SIMD_WINDOW = 32;
+
+static inline void ix_store_be32(char* dest, uint32_t v) {
+  dest[0] = static_cast<char>(v >> 24);
+  dest[1] = static_cast<char>(v >> 16);
+  dest[2] = static_cast<char>(v >> 8);
+  dest[3] = static_cast<char>(v);
+}
+
+static inline uint32_t ix_load_be32(const char* src) {
+  auto* p = reinterpret_cast<const unsigned char*>(src);
+  return (static_cast<uint32_t>(p[0]) << 24) |
+         (static_cast<uint32_t>(p[1]) << 16) |
+         (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+// 把原格式的 key 编码成 NORMALIZED 格式
+static inline void ix_encode_key(const IxFileHdr& file_hdr, const char* src,
+                                 char* dest) {
+  int offset = 0;
+  for (int i = 0; i < file_hdr.col_num_; ++i) {
+    int len = file_hdr.col_lens_[i];
+    switch (file_hdr.col_types_[i]) {
+      case TYPE_INT: {
+        uint32_t v;
+        memcpy(&v, src + offset, sizeof(v));
+        ix_store_be32(dest + offset, v ^ 0x80000000u);
+        break;
+      }
+      case TYPE_FLOAT: {
+        float f;
+        memcpy(&f, src + offset, sizeof(f));
+        // -0.0 与 0.0 相等，统一编码成 0.0
+        if (f == 0) {
+          f = 0;
+        }
+        uint32_t v;
+        memcpy(&v, &f, sizeof(v));
+        v = (v & 0x80000000u) ? ~v : (v | 0x80000000u);
+        ix_store_be32(dest + offset, v);
+        break;
+      }
+      default:
+        memcpy(dest + offset, src + offset, len);
+        break;
+    }
+    offset += len;
+  }
+}
+
+// ix_encode_key 的逆变换
+static inline void ix_decode_key(const IxFileHdr& file_hdr, const char* src,
+                                 char* dest) {
+  int offset = 0;
+  for (int i = 0; i < file_hdr.col_num_; ++i) {
+    int len = file_hdr.col_lens_[i];
+    switch (file_hdr.col_types_[i]) {
+      case TYPE_INT: {
+        uint32_t v = ix_load_be32(src + offset) ^ 0x80000000u;
+        memcpy(dest + offset, &v, sizeof(v));
+        break;
+      }
+      case TYPE_FLOAT: {
+        uint32_t v = ix_load_be32(src + offset);
+        v = (v & 0x80000000u) ? (v & ~0x80000000u) : ~v;
+        memcpy(dest + offset, &v, sizeof(v));
+        break;
+      }
+      default:
+        memcpy(dest + offset, src + offset, len);
+        break;
+    }
+    offset += len;
+  }
+}
+
+// 比较两个结点存储格式的 key
+static inline int ix_compare_key(const IxFileHdr& file_hdr, const char* a,
+                                 const char* b) {
+  if (file_hdr.key_kind_ == IxKeyKind::INT) {
+    int ia, ib;
+    memcpy(&ia, a, sizeof(int));
+    memcpy(&ib, b, sizeof(int));
+    return (ia > ib) - (ia < ib);
+  }
+  return memcmp(a, b, file_hdr.col_tot_len_);
+}
+
+// a 和 b 前 len 个字节中公共前缀的长度
+static inline int ix_common_prefix(const char* a, const char* b, int len) {
+  int i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t wa, wb;
+    memcpy(&wa, a + i, sizeof(wa));
+    memcpy(&wb, b + i, sizeof(wb));
+    if (wa != wb) {
+      // 小端序下第一个不同的字节对应最低的不同位
+      return i + (__builtin_ctzll(wa ^ wb) >> 3);
+    }
+  }
+  while (i < len && a[i] == b[i]) {
+    ++i;
+  }
+  return i;
+}
+
+/**
+ * @description: 在有序的 int 数组 keys[lo, hi) 中查找第一个满足条件的位置，
+ * kUpper 为 false 时条件是 >= target，否则是 > target，找不到返回 hi。
+ * 无分支二分，有 AVX2 时缩小到 IX_SIMD_WINDOW 个 key 后一次比较 8 个
+ */
+template <bool kUpper>
+static inline int ix_int_search(const int* keys, int lo, int hi, int target) {
+  if (lo >= hi) {
+    return lo;
+  }
+  const int* base = keys + lo;
+  int n = hi - lo;
+#ifdef __AVX2__
+  constexpr int min_window = IX_SIMD_WINDOW;
+#else
+  constexpr int min_window = 1;
+#endif
+  while (n > min_window) {
+    int half = n >> 1;
+    bool go_right =
+        kUpper ? base[half - 1] <= target : base[half - 1] < target;
+    base = go_right ? base + half : base;
+    n -= half;
+  }
+#ifdef __AVX2__
+  // 窗口内小于（或不大于）target 的 key 的个数就是答案在窗口内的偏移
+  const __m256i target_vec = _mm256_set1_epi32(target);
+  int cnt = 0;
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i key_vec =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(base + i));
+    if (kUpper) {
+      __m256i gt = _mm256_cmpgt_epi32(key_vec, target_vec);
+      cnt += 8 - __builtin_popcount(
+                     _mm256_movemask_ps(_mm256_castsi256_ps(gt)));
+    } else {
+      __m256i lt = _mm256_cmpgt_epi32(target_vec, key_vec);
+      cnt += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(lt)));
+    }
+  }
+  for (; i < n; ++i) {
+    cnt += kUpper ? base[i] <= target : base[i] < target;
+  }
+  return static_cast<int>(base - keys) + cnt;
+#else
+  bool go_right = kUpper ? *base <= target : *base < target;
+  return static_cast<int>(base - keys) + go_right;
+#endif
+}
+
+/**
+ * 上层传入的原格式 key 转成结点中的存储格式，INT 和 BYTES 格式不拷贝
+ */
+class IxKey {
+ public:
+  IxKey(const IxFileHdr& file_hdr, const char* key) : data_(key) {
+    if (file_hdr.key_kind_ != IxKeyKind::NORMALIZED) {
+      return;
+    }
+    char* buf = inline_buf_;
+    if (file_hdr.col_tot_len_ > IX_KEY_INLINE_LEN) {
+      heap_buf_ = std::make_unique<char[]>(file_hdr.col_tot_len_);
+      buf = heap_buf_.get();
+    }
+    ix_encode_key(file_hdr, key, buf);
+    data_ = buf;
+  }
+
+  IxKey(const IxKey&) = delete;
+  IxKey& operator=(const IxKey&) = delete;
+
+  const char* data() const { return data_; }
+
+ private:
+  char inline_buf_[IX_KEY_INLINE_LEN];
+  std::unique_ptr<char[]> heap_buf_;
+  const char* data_;
+};
@@ -15,6 +15,7 @@ See the Mulan PSL v2 for more details. */
 #include <string>
 
 #include "ix_defs.h"
+#include "ix_hash_handle.h"
 #include "ix_index_handle.h"
 #include "system/sm_meta.h"
 
@@ -124,6 +125,7 @@ class IxManager {
           .parent = IX_NO_PAGE,
           .num_key = 0,
           .is_leaf = true,
+          .prefix_len = 0,
           .prev_leaf = IX_INIT_ROOT_PAGE,
           .next_leaf = IX_INIT_ROOT_PAGE,
       };
@@ -139,6 +141,7 @@ class IxManager {
           .parent = IX_NO_PAGE,
           .num_key = 0,
           .is_leaf = true,
+          .prefix_len = 0,
           .prev_leaf = IX_LEAF_HEADER_PAGE,
           .next_leaf = IX_LEAF_HEADER_PAGE,
       };
@@ -152,6 +155,56 @@ class IxManager {
     disk_manager_->close_file(fd);
   }
 
+  /**
+   * @description: 创建可扩展哈希索引文件，初始全局深度为 0，只有一个桶
+   * @param {vector<ColMeta>&} index_cols key 的全部字段
+   * @param {int} hash_len 参与哈希的前缀长度，即索引字段的总长度
+   */
+  void create_hash_index(const std::string& ix_name,
+                         const std::vector<ColMeta>& index_cols,
+                         int hash_len) {
+    disk_manager_->create_file(ix_name);
+    int fd = disk_manager_->open_file(ix_name);
+
+    IxHashFileHdr fhdr;
+    fhdr.num_pages_ = IX_HASH_INIT_NUM_PAGES;
+    fhdr.global_depth_ = 0;
+    fhdr.col_num_ = static_cast<int>(index_cols.size());
+    fhdr.col_tot_len_ = 0;
+    for (auto& col : index_cols) {
+      fhdr.col_types_.emplace_back(col.type);
+      fhdr.col_lens_.emplace_back(col.len);
+      fhdr.col_tot_len_ += col.len;
+    }
+    if (fhdr.col_tot_len_ > IX_MAX_COL_LEN) {
+      disk_manager_->close_file(fd);
+      disk_manager_->destroy_file(ix_name);
+      throw InvalidColLengthError(fhdr.col_tot_len_);
+    }
+    fhdr.hash_len_ = hash_len;
+    fhdr.dir_pages_.emplace_back(IX_HASH_INIT_DIR_PAGE);
+    fhdr.update_tot_len();
+
+    char page_buf[PAGE_SIZE];
+    memset(page_buf, 0, PAGE_SIZE);
+    fhdr.serialize(page_buf);
+    disk_manager_->write_page(fd, IX_FILE_HDR_PAGE, page_buf, PAGE_SIZE);
+    // 目录只有一项，指向初始的桶
+    memset(page_buf, 0, PAGE_SIZE);
+    *reinterpret_cast<page_id_t*>(page_buf) = IX_HASH_INIT_BUCKET_PAGE;
+    disk_manager_->write_page(fd, IX_HASH_INIT_DIR_PAGE, page_buf, PAGE_SIZE);
+    memset(page_buf, 0, PAGE_SIZE);
+    *reinterpret_cast<IxHashBucketHdr*>(page_buf) = {
+        .local_depth = 0,
+        .num_key = 0,
+        .next_page = IX_NO_PAGE,
+    };
+    disk_manager_->write_page(fd, IX_HASH_INIT_BUCKET_PAGE, page_buf,
+                              PAGE_SIZE);
+
+    disk_manager_->close_file(fd);
+  }
+
   void destroy_index(const std::string& index_name) {
     disk_manager_->destroy_file(index_name);
   }
@@ -191,26 +244,24 @@ class IxManager {
                                            fd);
   }
 
-  void close_index(const IxIndexHandle* ih) {
-    char* data = new char[ih->file_hdr_->tot_len_];
-    ih->file_hdr_->serialize(data);
-    disk_manager_->write_page(ih->fd_, IX_FILE_HDR_PAGE, data,
-                              ih->file_hdr_->tot_len_);
+  std::unique_ptr<IxHashHandle> open_hash_index(const std::string& index_name) {
+    int fd = disk_manager_->open_file(index_name);
+    return std::make_unique<IxHashHandle>(disk_manager_, buffer_pool_manager_,
+                                          fd);
+  }
+
+  void close_index(const IxIndex* ih) {
+    ih->write_file_hdr();
     // 缓冲区的所有页刷到磁盘，注意这句话必须写在close_file前面
     buffer_pool_manager_->flush_all_pages(ih->fd_);
     // ！清空页表，防止 disk read error
     buffer_pool_manager_->delete_all_pages(ih->fd_);
     disk_manager_->close_file(ih->fd_);
-    delete[] data;
   }
 
-  void flush_index(const IxIndexHandle* ih) {
-    char* data = new char[ih->file_hdr_->tot_len_];
-    ih->file_hdr_->serialize(data);
-    disk_manager_->write_page(ih->fd_, IX_FILE_HDR_PAGE, data,
-                              ih->file_hdr_->tot_len_);
+  void flush_index(const IxIndex* ih) {
+    ih->write_file_hdr();
     // 缓冲区的所有页刷到磁盘，注意这句话必须写在close_file前面
     buffer_pool_manager_->flush_all_pages_for_checkpoint(ih->fd_);
-    delete[] data;
   }
 };
@@ -23,20 +23,16 @@ class IxScan : public RecScan {
   Iid iid_;  // 初始为lower（用于遍历的指针）
   Iid end_;  // 初始为upper
   BufferPoolManager* bpm_;
-  std::shared_ptr<IxNodeHandle> cur_node_handle_;
+  IxReadNodeGuard cur_node_handle_;  // 当前叶子，持有读锁直到离开该叶子
 
  public:
   IxScan(const IxIndexHandle* ih, const Iid& lower, const Iid& upper,
          BufferPoolManager* bpm)
-      : ih_(ih), iid_(lower), end_(upper), bpm_(bpm) {
-    cur_node_handle_ = ih_->fetch_node(iid_.page_no);
-    cur_node_handle_->page->RLatch();
-  }
-
-  ~IxScan() override {
-    cur_node_handle_->page->RUnlatch();
-    bpm_->unpin_page(cur_node_handle_->get_page_id(), false);
-  }
+      : ih_(ih),
+        iid_(lower),
+        end_(upper),
+        bpm_(bpm),
+        cur_node_handle_(ih_->fetch_node_read(iid_.page_no)) {}
 
   void next() override;
 
@@ -53,4 +49,19 @@ class IxScan : public RecScan {
   Rid prev_rid(const Iid& iid);
 
   RmRecord get_key();
+
+  /**
+   * 放开当前叶子的读锁执行 fn（比如等待行锁），之后重新加读锁。期间保持
+   * pin，帧不会换入其他页面，版本号没变说明叶子没有被修改过
+   * @return 叶子没有被修改过，扫描位置仍然有效
+   */
+  template <typename F>
+  bool unlatched(F&& fn) {
+    auto pinned = ih_->fetch_node_basic(iid_.page_no);
+    uint64_t version = cur_node_handle_->page->read_version();
+    cur_node_handle_ = {};
+    fn();
+    cur_node_handle_ = pinned.upgrade_read();
+    return cur_node_handle_->page->validate_version(version);
+  }
 };
@@ -49,8 +49,11 @@ class Optimizer {
       return std::make_shared<OtherPlan>(T_DescTable, std::move(x->tab_name));
     }
     if (auto x = std::dynamic_pointer_cast<ast::TxnBegin>(query->parse)) {
-      // begin;
-      return std::make_shared<OtherPlan>(T_Transaction_begin, std::string());
+      // begin; begin read only;
+      return std::make_shared<OtherPlan>(x->read_only
+                                             ? T_Transaction_begin_read_only
+                                             : T_Transaction_begin,
+                                         std::string());
     }
     if (auto x = std::dynamic_pointer_cast<ast::TxnAbort>(query->parse)) {
       // abort;
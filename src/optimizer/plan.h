@@ -36,11 +36,13 @@ typedef enum PlanTag {
   T_Delete,
   T_select,
   T_Transaction_begin,
+  T_Transaction_begin_read_only,
   T_Transaction_commit,
   T_Transaction_abort,
   T_Transaction_rollback,
   T_SeqScan,
   T_IndexScan,
+  T_HashIndexScan,
   T_NestLoop,
   T_SortMerge,  // sort merge join
   T_Sort,
@@ -83,6 +85,10 @@ class ScanPlan : public Plan {
   std::vector<std::string> index_col_names_;
   // 顺序扫还是逆序
   bool asc_;
+  // 上层算子引用到的列，为空时输出完整记录
+  std::vector<std::string> proj_cols_;
+  // 引用到的列都在索引中，索引扫描直接由 key 生成元组，不回表
+  bool index_only_{false};
 };
 
 class JoinPlan : public Plan {
@@ -222,6 +228,10 @@ class DDLPlan : public Plan {
   std::string tab_name_;
   std::vector<std::string> tab_col_names_;
   std::vector<ColDef> cols_;
+  // 只用于 create index
+  bool unique_{true};
+  std::vector<std::string> include_col_names_;
+  IndexType index_type_{IndexType::BTREE};
 };
 
 // help; show tables; desc tables; begin; abort; commit; rollback语句对应的plan
@@ -10,6 +10,7 @@ See the Mulan PSL v2 for more details. */
 
 #include "planner.h"
 
+#include <algorithm>
 #include <functional>
 #include <memory>
 
@@ -51,6 +52,10 @@ bool Planner::get_index_cols(std::string& tab_name,
   size_t max_len = 0, max_equals = 0, cur_len = 0, cur_equals = 0;
   for (auto& [index_name, index] : tab.indexes) {
     std::ignore = index_name;
+    // 哈希索引不支持范围查找，由 get_hash_index_cols 单独匹配
+    if (index.type == IndexType::HASH) {
+      continue;
+    }
     cur_len = cur_equals = 0;
     for (auto& [_, col] : index.cols) {
       std::ignore = _;
@@ -148,6 +153,44 @@ bool Planner::get_index_cols(std::string& tab_name,
   return true;
 }
 
+/**
+ * @description: 匹配哈希索引，要求每个索引字段上都有类型一致的常值等号谓词。
+ * 其余谓词由扫描算子回表后过滤，只接受常值和值列表
+ * @return {bool} 找到可用的哈希索引时返回 true，index_col_names 为其索引字段
+ */
+bool Planner::get_hash_index_cols(const std::string& tab_name,
+                                  const std::vector<Condition>& curr_conds,
+                                  std::vector<std::string>& index_col_names) {
+  TabMeta& tab = sm_manager_->db_.get_table(tab_name);
+  for (auto& cond : curr_conds) {
+    if (!cond.is_rhs_val && cond.rhs_value_list.empty()) {
+      return false;
+    }
+  }
+  auto has_eq_cond = [&](const ColMeta& col) {
+    return std::any_of(
+        curr_conds.begin(), curr_conds.end(), [&](const Condition& cond) {
+          return cond.lhs_col.col_name == col.name && cond.op == OP_EQ &&
+                 cond.is_rhs_val && cond.rhs_val.type == col.type;
+        });
+  };
+  for (auto& [index_name, index] : tab.indexes) {
+    std::ignore = index_name;
+    if (index.type != IndexType::HASH ||
+        !std::all_of(index.cols.begin(), index.cols.end(),
+                     [&](auto& col) { return has_eq_cond(col.second); })) {
+      continue;
+    }
+    index_col_names.clear();
+    for (auto& [_, col] : index.cols) {
+      std::ignore = _;
+      index_col_names.emplace_back(col.name);
+    }
+    return true;
+  }
+  return false;
+}
+
 /**
  * @brief 表算子条件谓词生成
  *
@@ -287,6 +330,13 @@ std::shared_ptr<Plan> Planner::make_one_rel(std::shared_ptr<Query>& query,
     auto curr_conds = pop_conds(query->conds, tables[i], context);
     // int index_no = get_indexNo(tables[i], curr_conds);
     std::vector<std::string> index_col_names;
+    // 索引字段全是等值查找时优先走哈希索引
+    if (get_hash_index_cols(tables[i], curr_conds, index_col_names)) {
+      table_scan_executors[i] = std::make_shared<ScanPlan>(
+          T_HashIndexScan, sm_manager_, std::move(tables[i]),
+          std::move(curr_conds), std::move(index_col_names));
+      continue;
+    }
     bool index_exist = get_index_cols(tables[i], curr_conds, index_col_names);
     if (index_exist == false) {
       // 该表没有索引
@@ -359,7 +409,7 @@ std::shared_ptr<Plan> Planner::make_one_rel(std::shared_ptr<Query>& query,
       auto left_plan = std::dynamic_pointer_cast<ScanPlan>(left);
       std::vector<std::string> index_col_names;
       // TODO 这里是优化成index
-      if (left_plan->tag != T_IndexScan) {
+      if (left_plan->tag == T_SeqScan) {
         bool index_exist =
             get_index_cols(it->lhs_col.tab_name, join_conds, index_col_names);
         if (index_exist) {
@@ -375,7 +425,7 @@ std::shared_ptr<Plan> Planner::make_one_rel(std::shared_ptr<Query>& query,
       auto right_conds = join_conds;
       std::swap(right_conds[0].lhs_col, right_conds[0].rhs_col);
       auto right_plan = std::dynamic_pointer_cast<ScanPlan>(right);
-      if (right_plan->tag != T_IndexScan) {
+      if (right_plan->tag == T_SeqScan) {
         bool index_exist =
             get_index_cols(it->rhs_col.tab_name, right_conds, index_col_names);
         if (index_exist) {
@@ -562,6 +612,75 @@ std::shared_ptr<Plan> Planner::generate_sort_plan(std::shared_ptr<Query>& query,
                                     x->order->orderby_dir == ast::OrderBy_DESC);
 }
 
+/**
+ * @description: 投影下推，扫描算子只输出上层算子引用到的列，连接时不再拼接整行
+ * 排序算子和归并连接要把完整记录写入 sorted_results.txt，其下的扫描保持输出完整记录
+ * @param {shared_ptr<Plan>&} plan 物理计划
+ * @param {vector<TabCol>} used_cols plan 之上的算子引用到的列
+ */
+void Planner::push_down_projection(const std::shared_ptr<Plan>& plan,
+                                   std::vector<TabCol> used_cols) {
+  if (auto x = std::dynamic_pointer_cast<ScanPlan>(plan)) {
+    x->proj_cols_.clear();
+    for (auto& col : used_cols) {
+      if (col.tab_name == x->tab_name_ &&
+          std::find(x->proj_cols_.begin(), x->proj_cols_.end(),
+                    col.col_name) == x->proj_cols_.end()) {
+        x->proj_cols_.emplace_back(col.col_name);
+      }
+    }
+    // 没有引用任何列（如 count(*)），保留第一列，索引扫描保留索引的第一列
+    if (x->proj_cols_.empty()) {
+      x->proj_cols_.emplace_back(x->tag == T_IndexScan
+                                     ? x->index_col_names_.front()
+                                     : x->cols_.front().name);
+    }
+    if (x->tag == T_IndexScan) {
+      check_index_only(*x);
+    }
+    return;
+  }
+  if (auto x = std::dynamic_pointer_cast<JoinPlan>(plan)) {
+    if (x->tag != T_NestLoop) {
+      return;
+    }
+    for (auto& cond : x->conds_) {
+      used_cols.emplace_back(cond.lhs_col);
+      if (!cond.is_rhs_val && !cond.is_sub_query) {
+        used_cols.emplace_back(cond.rhs_col);
+      }
+    }
+    push_down_projection(x->left_, used_cols);
+    push_down_projection(x->right_, std::move(used_cols));
+  }
+}
+
+/**
+ * @description: 输出的列和扫描自己要检查的谓词都在索引中（索引字段或 INCLUDE
+ * 字段）时，索引扫描可以直接由 key 生成元组，不用回表
+ * @param {ScanPlan&} plan 已经完成投影下推的索引扫描计划
+ */
+void Planner::check_index_only(ScanPlan& plan) {
+  auto& index_meta = sm_manager_->db_.get_table(plan.tab_name_)
+                         .get_index_meta(plan.index_col_names_);
+  plan.index_only_ = false;
+  for (auto& col_name : plan.proj_cols_) {
+    if (!index_meta.has_col(col_name)) {
+      return;
+    }
+  }
+  // 列与列比较的谓词会走归并连接，要把完整记录写进排序结果
+  for (auto& cond : plan.conds_) {
+    if (!cond.is_rhs_val && !cond.is_sub_query) {
+      return;
+    }
+    if (!index_meta.has_col(cond.lhs_col.col_name)) {
+      return;
+    }
+  }
+  plan.index_only_ = true;
+}
+
 std::shared_ptr<Plan> Planner::generate_select_plan(
     std::shared_ptr<Query>& query, Context* context) {
   // 逻辑优化
@@ -582,6 +701,15 @@ std::shared_ptr<Plan> Planner::generate_select_plan(
     }
   }
 
+  // 投影、分组和 having 引用的列
+  std::vector<TabCol> used_cols = sel_cols;
+  used_cols.insert(used_cols.end(), query->group_bys.begin(),
+                   query->group_bys.end());
+  for (auto& having : query->havings) {
+    used_cols.emplace_back(having.lhs_col);
+  }
+  push_down_projection(plannerRoot, std::move(used_cols));
+
   // 生成聚合计划
   if (is_agg) {
     plannerRoot = std::make_shared<AggregatePlan>(
@@ -630,9 +758,13 @@ std::shared_ptr<Plan> Planner::do_planner(std::shared_ptr<Query>& query,
   } else if (auto x =
                  std::dynamic_pointer_cast<ast::CreateIndex>(query->parse)) {
     // create index;
-    plannerRoot = std::make_shared<DDLPlan>(
+    auto ddl_plan = std::make_shared<DDLPlan>(
         T_CreateIndex, std::move(x->tab_name), std::move(x->col_names),
         std::vector<ColDef>());
+    ddl_plan->unique_ = x->unique;
+    ddl_plan->include_col_names_ = std::move(x->include_col_names);
+    ddl_plan->index_type_ = x->hash ? IndexType::HASH : IndexType::BTREE;
+    plannerRoot = std::move(ddl_plan);
   } else if (auto x = std::dynamic_pointer_cast<ast::DropIndex>(query->parse)) {
     // drop index
     plannerRoot = std::make_shared<DDLPlan>(T_DropIndex, std::move(x->tab_name),
@@ -657,10 +789,11 @@ std::shared_ptr<Plan> Planner::do_planner(std::shared_ptr<Query>& query,
     // 只有一张表，不需要进行物理优化了
     // int index_no = get_indexNo(x->tab_name, query->conds);
     std::vector<std::string> index_col_names;
-    bool index_exist =
-        get_index_cols(x->tab_name, query->conds, index_col_names);
-
-    if (index_exist == false) {
+    if (get_hash_index_cols(x->tab_name, query->conds, index_col_names)) {
+      table_scan_executors = std::make_shared<ScanPlan>(
+          T_HashIndexScan, sm_manager_, x->tab_name, std::move(query->conds),
+          std::move(index_col_names));
+    } else if (!get_index_cols(x->tab_name, query->conds, index_col_names)) {
       // 该表没有索引
       table_scan_executors = std::make_shared<ScanPlan>(
           T_SeqScan, sm_manager_, x->tab_name, std::move(query->conds),
@@ -684,10 +817,11 @@ std::shared_ptr<Plan> Planner::do_planner(std::shared_ptr<Query>& query,
     // 只有一张表，不需要进行物理优化了
     // int index_no = get_indexNo(x->tab_name, query->conds);
     std::vector<std::string> index_col_names;
-    bool index_exist =
-        get_index_cols(x->tab_name, query->conds, index_col_names);
-
-    if (index_exist == false) {
+    if (get_hash_index_cols(x->tab_name, query->conds, index_col_names)) {
+      table_scan_executors = std::make_shared<ScanPlan>(
+          T_HashIndexScan, sm_manager_, x->tab_name, std::move(query->conds),
+          std::move(index_col_names));
+    } else if (!get_index_cols(x->tab_name, query->conds, index_col_names)) {
       // 该表没有索引
       table_scan_executors = std::make_shared<ScanPlan>(
           T_SeqScan, sm_manager_, x->tab_name, std::move(query->conds),
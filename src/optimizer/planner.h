@@ -72,6 +72,11 @@ class Planner {
   std::shared_ptr<Plan> generate_select_plan(std::shared_ptr<Query>& query,
                                              Context* context);
 
+  void push_down_projection(const std::shared_ptr<Plan>& plan,
+                            std::vector<TabCol> used_cols);
+
+  void check_index_only(ScanPlan& plan);
+
   std::shared_ptr<Plan> pop_scan(int* scantbl, const std::string& table,
                                  std::vector<std::string>& joined_tables,
                                  std::vector<std::shared_ptr<Plan> >& plans);
@@ -83,5 +88,9 @@ class Planner {
   bool get_index_cols(std::string& tab_name, std::vector<Condition>& curr_conds,
                       std::vector<std::string>& index_col_names);
 
+  bool get_hash_index_cols(const std::string& tab_name,
+                           const std::vector<Condition>& curr_conds,
+                           std::vector<std::string>& index_col_names);
+
   static ColType interp_sv_type(ast::SvType& sv_type) { return m[sv_type]; }
 };
@@ -58,7 +58,11 @@ struct ShowIndexs : public TreeNode {
       : tab_name(std::move(tab_name_)) {}
 };
 
-struct TxnBegin : public TreeNode {};
+struct TxnBegin : public TreeNode {
+  bool read_only;  // BEGIN READ ONLY，事务走快照读
+
+  explicit TxnBegin(bool read_only_ = false) : read_only(read_only_) {}
+};
 
 struct TxnCommit : public TreeNode {};
 
@@ -107,9 +111,18 @@ struct DescTable : public TreeNode {
 struct CreateIndex : public TreeNode {
   std::string tab_name;
   std::vector<std::string> col_names;
+  bool unique;
+  std::vector<std::string> include_col_names;
+  bool hash;  // USING HASH
 
-  CreateIndex(std::string& tab_name_, std::vector<std::string>& col_names_)
-      : tab_name(std::move(tab_name_)), col_names(std::move(col_names_)) {}
+  CreateIndex(std::string& tab_name_, std::vector<std::string>& col_names_,
+              bool unique_, std::vector<std::string>& include_col_names_,
+              bool hash_ = false)
+      : tab_name(std::move(tab_name_)),
+        col_names(std::move(col_names_)),
+        unique(unique_),
+        include_col_names(std::move(include_col_names_)),
+        hash(hash_) {}
 };
 
 struct DropIndex : public TreeNode {
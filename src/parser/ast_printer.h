@@ -110,10 +110,12 @@ class TreePrinter {
       std::cout << "DESC_TABLE\n";
       print_val(x->tab_name, offset);
     } else if (auto x = std::dynamic_pointer_cast<CreateIndex>(node)) {
-      std::cout << "CREATE_INDEX\n";
+      std::cout << (x->unique ? "CREATE_INDEX\n" : "CREATE_NONUNIQUE_INDEX\n");
       print_val(x->tab_name, offset);
       // print_val(x->col_name, offset);
       for (auto& col_name : x->col_names) print_val(col_name, offset);
+      for (auto& col_name : x->include_col_names) print_val(col_name, offset);
+      if (x->hash) print_val(std::string("HASH"), offset);
     } else if (auto x = std::dynamic_pointer_cast<DropIndex>(node)) {
       std::cout << "DROP_INDEX\n";
       print_val(x->tab_name, offset);
@@ -193,7 +195,7 @@ class TreePrinter {
       print_node_list(x->group_bys, offset);  // group by
       print_node_list(x->havings, offset);    // having
     } else if (auto x = std::dynamic_pointer_cast<TxnBegin>(node)) {
-      std::cout << "BEGIN\n";
+      std::cout << (x->read_only ? "BEGIN READ ONLY\n" : "BEGIN\n");
     } else if (auto x = std::dynamic_pointer_cast<TxnCommit>(node)) {
       std::cout << "COMMIT\n";
     } else if (auto x = std::dynamic_pointer_cast<TxnAbort>(node)) {
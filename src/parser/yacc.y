@@ -26,6 +26,7 @@ using namespace ast;
 %token SHOW TABLES CREATE TABLE DROP DESC INSERT INTO VALUES DELETE FROM ASC ORDER BY
 WHERE UPDATE SET SELECT INT CHAR FLOAT DATETIME INDEX AND JOIN EXIT HELP TXN_BEGIN TXN_COMMIT TXN_ABORT TXN_ROLLBACK ORDER_BY ENABLE_NESTLOOP ENABLE_SORTMERGE
 COUNT MAX MIN SUM AS GROUP HAVING IN STATIC_CHECKPOINT LOAD OUTPUT_FILE ON OFF
+NONUNIQUE INCLUDE USING HASH READ ONLY
 
 // non-keywords
 %token LEQ NEQ GEQ T_EOF
@@ -46,7 +47,8 @@ COUNT MAX MIN SUM AS GROUP HAVING IN STATIC_CHECKPOINT LOAD OUTPUT_FILE ON OFF
 %type <sv_val> value
 %type <sv_vals> valueList
 %type <sv_str> tbName colName alias asClause
-%type <sv_strs> tableList colNameList
+%type <sv_strs> tableList colNameList optIncludeClause
+%type <sv_bool> optUsingClause
 %type <sv_col> col
 %type <sv_cols> colList group_by_clause
 %type <sv_bound> select_item
@@ -107,6 +109,10 @@ txnStmt:
     {
         $$ = std::make_shared<TxnBegin>();
     }
+    |   TXN_BEGIN READ ONLY
+    {
+        $$ = std::make_shared<TxnBegin>(true);
+    }
     |   TXN_COMMIT
     {
         $$ = std::make_shared<TxnCommit>();
@@ -156,9 +162,13 @@ ddl:
     {
         $$ = std::make_shared<DescTable>($2);
     }
-    |   CREATE INDEX tbName '(' colNameList ')'
+    |   CREATE INDEX tbName '(' colNameList ')' optUsingClause optIncludeClause
     {
-        $$ = std::make_shared<CreateIndex>($3, $5);
+        $$ = std::make_shared<CreateIndex>($3, $5, true, $8, $7);
+    }
+    |   CREATE NONUNIQUE INDEX tbName '(' colNameList ')' optUsingClause optIncludeClause
+    {
+        $$ = std::make_shared<CreateIndex>($4, $6, false, $9, $8);
     }
     |   DROP INDEX tbName '(' colNameList ')'
     {
@@ -200,6 +210,28 @@ fieldList:
     }
     ;
 
+optUsingClause:
+        /* epsilon */
+    {
+        $$ = false;
+    }
+    |   USING HASH
+    {
+        $$ = true;
+    }
+    ;
+
+optIncludeClause:
+        /* epsilon */
+    {
+        /* ignore */
+    }
+    |   INCLUDE '(' colNameList ')'
+    {
+        $$ = std::move($3);
+    }
+    ;
+
 colNameList:
         colName
     {
@@ -17,9 +17,11 @@ See the Mulan PSL v2 for more details. */
 #include "execution/executor_abstract.h"
 #include "execution/executor_aggregate.h"
 #include "execution/executor_delete.h"
+#include "execution/executor_hash_index_scan.h"
 #include "execution/executor_index_scan.h"
 #include "execution/executor_insert.h"
 #include "execution/executor_nestedloop_join.h"
+#include "execution/executor_parallel_seq_scan.h"
 #include "execution/executor_projection.h"
 #include "execution/executor_seq_scan.h"
 #include "execution/executor_sort.h"
@@ -85,6 +87,10 @@ class Portal {
           std::unique_ptr<AbstractExecutor>(), plan);
     }
     if (auto x = std::dynamic_pointer_cast<DMLPlan>(plan)) {
+      // 只读事务走快照读，不能修改数据
+      if (x->tag != T_select && context->txn_->is_snapshot_read()) {
+        throw ReadOnlyTransactionError();
+      }
       switch (x->tag) {
         case T_select: {
           std::shared_ptr<ProjectionPlan> p =
@@ -108,27 +114,20 @@ class Portal {
           for (scan->beginTuple(); !scan->is_end(); scan->nextTuple()) {
             rids.emplace_back(scan->rid());
           }
-          // TODO update 算子优化，如果更新值不涉及索引键，则不需要维护索引
-          bool is_set_index_key = true;
-          if (scan->getType() == "IndexScanExecutor") {
-            auto* index_scan = dynamic_cast<IndexScanExecutor*>(scan.get());
-            auto& map = index_scan->get_index_meta().cols_map;
-            // 查找 set 值是否是 key
-            int i = 0;
-            for (; i < x->set_clauses_.size(); ++i) {
-              if (map.count(x->set_clauses_[i].lhs.col_name) > 0) {
-                break;
-              }
-            }
-            if (i == x->set_clauses_.size()) {
-              is_set_index_key = false;
+          // 更新的字段不在任何索引中（包括 INCLUDE 的字段）时不需要维护索引
+          bool is_set_index_key = false;
+          auto& tab = sm_manager_->db_.get_table(x->tab_name_);
+          for (auto& set_clause : x->set_clauses_) {
+            for (auto& [_, index] : tab.indexes) {
+              std::ignore = _;
+              is_set_index_key |= index.has_col(set_clause.lhs.col_name);
             }
           }
           std::unique_ptr<AbstractExecutor> root =
               std::make_unique<UpdateExecutor>(
                   sm_manager_, std::move(x->tab_name_),
                   std::move(x->set_clauses_), std::move(rids), is_set_index_key,
-                  scan->getType() == "IndexScanExecutor", context);
+                  context);
           return std::make_shared<PortalStmt>(PORTAL_DML_WITHOUT_SELECT,
                                               std::vector<TabCol>(),
                                               std::move(root), plan);
@@ -143,7 +142,7 @@ class Portal {
           std::unique_ptr<AbstractExecutor> root =
               std::make_unique<DeleteExecutor>(
                   sm_manager_, std::move(x->tab_name_), std::move(rids),
-                  context, scan->getType() == "IndexScanExecutor");
+                  context);
           return std::make_shared<PortalStmt>(PORTAL_DML_WITHOUT_SELECT,
                                               std::vector<TabCol>(),
                                               std::move(root), plan);
@@ -227,15 +226,22 @@ class Portal {
       if (x->tag == T_SeqScan) {
         return std::make_unique<SeqScanExecutor>(
             sm_manager_, std::move(x->tab_name_), std::move(x->conds_), context,
-            gap_mode);
+            gap_mode, x->proj_cols_);
+      }
+      if (x->tag == T_HashIndexScan) {
+        return std::make_unique<HashIndexScanExecutor>(
+            sm_manager_, std::move(x->tab_name_), std::move(x->conds_),
+            std::move(x->index_col_names_), context, gap_mode, x->proj_cols_);
       }
       return std::make_unique<IndexScanExecutor>(
           sm_manager_, std::move(x->tab_name_), std::move(x->conds_),
-          std::move(x->index_col_names_), context, gap_mode, x->asc_);
+          std::move(x->index_col_names_), context, gap_mode, x->asc_,
+          x->proj_cols_, x->index_only_);
     }
     if (auto x = std::dynamic_pointer_cast<AggregatePlan>(plan)) {
       return std::make_unique<AggregateExecutor>(
-          convert_plan_executor(x->subplan_, context), std::move(x->sel_cols_),
+          convert_unordered_executor(x->subplan_, context),
+          std::move(x->sel_cols_),
           std::move(x->agg_types_), std::move(x->group_bys_),
           std::move(x->havings_), context);
     }
@@ -266,9 +272,24 @@ class Portal {
     }
     if (auto x = std::dynamic_pointer_cast<SortPlan>(plan)) {
       return std::make_unique<SortExecutor>(
-          convert_plan_executor(x->subplan_, context), std::move(x->sel_col_),
+          convert_unordered_executor(x->subplan_, context),
+          std::move(x->sel_col_),
           x->is_desc_);
     }
     return nullptr;
   }
+
+  // 父算子不依赖输入顺序（聚合、排序）时，大表的全表扫描改为并行扫描
+  std::unique_ptr<AbstractExecutor> convert_unordered_executor(
+      const std::shared_ptr<Plan>& plan, Context* context) {
+    auto x = std::dynamic_pointer_cast<ScanPlan>(plan);
+    if (x != nullptr && x->tag == T_SeqScan &&
+        ParallelSeqScanExecutor::is_parallel_safe(sm_manager_, x->tab_name_,
+                                                  x->conds_)) {
+      return std::make_unique<ParallelSeqScanExecutor>(
+          sm_manager_, std::move(x->tab_name_), std::move(x->conds_), context,
+          x->proj_cols_);
+    }
+    return convert_plan_executor(plan, context);
+  }
 };
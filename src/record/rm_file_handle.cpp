@@ -21,17 +21,18 @@ std::unique_ptr<RmRecord> RmFileHandle::get_record(const Rid& rid,
   // Todo:
   // 1. 获取指定记录所在的page handle
   // 2. 初始化一个指向RmRecord的指针（赋值其内部的data和size）
-  // 行级 S 锁
-  // if (context != nullptr && context->lock_mgr_ != nullptr) {
-  //     context->lock_mgr_->lock_shared_on_record(context->txn_, rid, fd_);
-  // }
-  // 读记录会有表锁或间隙锁保护，不需要加锁
+  // 行级锁由扫描算子和 DML 算子在读记录之前加好，这里不再加锁。
+  // 快照读不加行锁，持有页面读锁拷贝，不会读到改了一半的记录
   auto page_handle = fetch_page_handle(rid.page_no);
+  page_handle.page->RLatch();
   if (!Bitmap::is_set(page_handle.bitmap, rid.slot_no)) {
+    page_handle.page->RUnlatch();
+    buffer_pool_manager_->unpin_page(page_handle.page->get_page_id(), false);
     throw RecordNotFoundError(rid.page_no, rid.slot_no);
   }
   auto record = std::make_unique<RmRecord>(page_handle.get_slot(rid.slot_no),
                                            file_hdr_.record_size, true);
+  page_handle.page->RUnlatch();
   buffer_pool_manager_->unpin_page(page_handle.page->get_page_id(), false);
   // RVO
   return record;
@@ -50,47 +51,83 @@ Rid RmFileHandle::insert_record(char* buf, Context* context) {
   // 3. 将buf复制到空闲slot位置
   // 4. 更新page_handle.page_hdr中的数据结构
   // 注意考虑插入一条记录后页面已满的情况，需要更新file_hdr_.first_free_page_no
-  // TODO 不需要加行级写锁？
-  // TODO 这里实际上是以一个页面放一个记录，太占用空间了！
   auto page_handle = create_page_handle();
   page_handle.page->WLatch();
-  // TODO 算法优化
-  auto slot_no = Bitmap::first_bit(false, page_handle.bitmap,
-                                   file_hdr_.num_records_per_page);
+  int slot_no;
+  while ((slot_no = lock_free_slot(page_handle, context)) ==
+         file_hdr_.num_records_per_page) {
+    // 页面已经被其他插入填满时，重新取第一个空闲页面；还有空闲槽位但都被
+    // 未提交的删除锁住时，插入到新页面上，新页面成为第一个空闲页面
+    bool full =
+        page_handle.page_hdr->num_records == file_hdr_.num_records_per_page;
+    page_handle.page->WUnlatch();
+    buffer_pool_manager_->unpin_page(page_handle.page->get_page_id(), false);
+    if (full) {
+      page_handle = create_page_handle();
+    } else {
+      std::lock_guard lock(latch_);
+      page_handle = create_new_page_handle();
+    }
+    page_handle.page->WLatch();
+  }
 
-  // 行级 X 锁
-  // if (context != nullptr) {
-  //     context->lock_mgr_->lock_exclusive_on_record(context->txn_,
-  //     {page_handle.page->get_page_id().page_no, slot_no},
-  //                                                  fd_);
-  // }
+  // 先挂上"插入之前不存在"的版本再置位，快照读不会看到未提交的插入
+  if (context != nullptr && context->version_mgr_ != nullptr) {
+    context->version_mgr_->add_version(
+        context->txn_, fd_, {page_handle.page->get_page_id().page_no, slot_no},
+        nullptr);
+  }
 
   Bitmap::set(page_handle.bitmap, slot_no);
 
   if (++page_handle.page_hdr->num_records == file_hdr_.num_records_per_page) {
     file_hdr_.first_free_page_no = page_handle.page_hdr->next_free_page_no;
   }
-  // 尽早解锁，然后拷贝
-  page_handle.page->WUnlatch();
+  // 置位之后扫描就能看到这个槽位，拷贝完才能解锁
   memcpy(page_handle.get_slot(slot_no), buf, file_hdr_.record_size);
+  page_handle.page->WUnlatch();
 
   Rid rid{page_handle.page->get_page_id().page_no, slot_no};
   buffer_pool_manager_->unpin_page(page_handle.page->get_page_id(), true);
   return rid;
 }
 
+/**
+ * @description: 在页面上找一个空闲槽位并加上行级 X 锁，调用者持有页面写锁。
+ * 空闲槽位可能是未提交的删除留下的，删除事务还持有 X 锁，持有页面 latch 时
+ * 不能等锁，跳过这样的槽位
+ * @return {int} 槽位号，没有能用的槽位时为 num_records_per_page
+ * @param {RmPageHandle&} page_handle 要插入的页面
+ * @param {Context*} context 为空时不加锁
+ */
+int RmFileHandle::lock_free_slot(const RmPageHandle& page_handle,
+                                 Context* context) {
+  int num_slots = file_hdr_.num_records_per_page;
+  int slot_no = Bitmap::first_bit(false, page_handle.bitmap, num_slots);
+  if (context == nullptr) {
+    return slot_no;
+  }
+  for (; slot_no < num_slots;
+       slot_no = Bitmap::next_bit(false, page_handle.bitmap, num_slots,
+                                  slot_no)) {
+    try {
+      context->lock_mgr_->lock_exclusive_on_record(
+          context->txn_, {page_handle.page->get_page_id().page_no, slot_no},
+          fd_, true);
+      break;
+    } catch (TransactionAbortException&) {
+    }
+  }
+  return slot_no;
+}
+
 /**
  * @description: 在当前表中的指定位置插入一条记录
  * @param {Rid&} rid 要插入记录的位置
  * @param {char*} buf 要插入记录的数据
  */
 void RmFileHandle::insert_record(const Rid& rid, char* buf) {
-  // TODO 不需要加行级写锁？
-  // 行级 X 锁
-  // if (context != nullptr) {
-  //     context->lock_mgr_->lock_exclusive_on_record(context->txn_,
-  //     {page_handle.page->get_page_id().page_no, slot_no}, fd_);
-  // }
+  // 只用于回滚和恢复，回滚的事务已经持有这条记录的 X 锁
   auto page_handle = fetch_page_handle(rid.page_no);
   page_handle.page->WLatch();
   if (!Bitmap::is_set(page_handle.bitmap, rid.slot_no)) {
@@ -99,9 +136,8 @@ void RmFileHandle::insert_record(const Rid& rid, char* buf) {
       file_hdr_.first_free_page_no = page_handle.page_hdr->next_free_page_no;
     }
   }
-  // 尽早解锁，然后拷贝
-  page_handle.page->WUnlatch();
   memcpy(page_handle.get_slot(rid.slot_no), buf, file_hdr_.record_size);
+  page_handle.page->WUnlatch();
   buffer_pool_manager_->unpin_page(page_handle.page->get_page_id(), true);
 }
 
@@ -137,14 +173,12 @@ void RmFileHandle::delete_record(const Rid& rid, Context* context) {
   // 1. 获取指定记录所在的page handle
   // 2. 更新page_handle.page_hdr中的数据结构
   // 注意考虑删除一条记录后页面未满的情况，需要调用release_page_handle()
-  // 行级 X 锁
-  // 有间隙锁保护，不需要行级X锁
-  // if (context != nullptr) {
-  //     context->lock_mgr_->lock_exclusive_on_record(context->txn_, rid, fd_);
-  // }
+  // 行级 X 锁由 DeleteExecutor 在读记录之前加好
   auto page_handle = fetch_page_handle(rid.page_no);
   page_handle.page->WLatch();
   if (!Bitmap::is_set(page_handle.bitmap, rid.slot_no)) {
+    page_handle.page->WUnlatch();
+    buffer_pool_manager_->unpin_page(page_handle.page->get_page_id(), false);
     throw RecordNotFoundError(rid.page_no, rid.slot_no);
   }
   Bitmap::reset(page_handle.bitmap, rid.slot_no);
@@ -165,16 +199,17 @@ void RmFileHandle::update_record(const Rid& rid, char* buf, Context* context) {
   // Todo:
   // 1. 获取指定记录所在的page handle
   // 2. 更新记录
-  // 行级 X 锁
-  // if (context != nullptr) {
-  //     context->lock_mgr_->lock_exclusive_on_record(context->txn_, rid, fd_);
-  // }
-  // 不需要加页锁，如果更新同一记录由间隙锁保护
+  // 行级 X 锁由 UpdateExecutor 在读记录之前加好，但快照读和扫描不加行锁，
+  // 还要加页面写锁
   auto page_handle = fetch_page_handle(rid.page_no);
+  page_handle.page->WLatch();
   if (!Bitmap::is_set(page_handle.bitmap, rid.slot_no)) {
+    page_handle.page->WUnlatch();
+    buffer_pool_manager_->unpin_page(page_handle.page->get_page_id(), false);
     throw RecordNotFoundError(rid.page_no, rid.slot_no);
   }
   memcpy(page_handle.get_slot(rid.slot_no), buf, file_hdr_.record_size);
+  page_handle.page->WUnlatch();
   buffer_pool_manager_->unpin_page(page_handle.page->get_page_id(), true);
 }
 
@@ -216,9 +251,9 @@ RmPageHandle RmFileHandle::create_new_page_handle() {
     throw PageNotExistError(disk_manager_->get_file_name(fd_), page_id.page_no);
   }
   RmPageHandle rm_page_handle{&file_hdr_, page};
-  // 重置元信息
+  // 重置元信息，新页面插到空闲页面链表的头部
   rm_page_handle.page_hdr->num_records = 0;
-  rm_page_handle.page_hdr->next_free_page_no = RM_NO_PAGE;
+  rm_page_handle.page_hdr->next_free_page_no = file_hdr_.first_free_page_no;
   Bitmap::init(rm_page_handle.bitmap, file_hdr_.bitmap_size);
   // 新增空闲页面
   ++file_hdr_.num_pages;
@@ -113,5 +113,7 @@ class RmFileHandle {
  private:
   RmPageHandle create_page_handle();
 
+  int lock_free_slot(const RmPageHandle& page_handle, Context* context);
+
   void release_page_handle(RmPageHandle& page_handle);
 };
@@ -98,10 +98,18 @@ class RmManager {
    * @param {RmFileHandle*} file_handle 要关闭文件的句柄
    */
   void flush_file(const RmFileHandle* file_handle) {
+    flush_file_hdr(file_handle);
+    // 缓冲区的所有页刷到磁盘，注意这句话必须写在close_file前面
+    buffer_pool_manager_->flush_all_pages_for_checkpoint(file_handle->fd_);
+  }
+
+  /**
+   * @description: 只把表的文件头写回磁盘，数据页由调用者按 WAL 规则写回
+   * @param {RmFileHandle*} file_handle 表的文件句柄
+   */
+  void flush_file_hdr(const RmFileHandle* file_handle) {
     disk_manager_->write_page(file_handle->fd_, RM_FILE_HDR_PAGE,
                               (char*)&file_handle->file_hdr_,
                               sizeof(file_handle->file_hdr_));
-    // 缓冲区的所有页刷到磁盘，注意这句话必须写在close_file前面
-    buffer_pool_manager_->flush_all_pages_for_checkpoint(file_handle->fd_);
   }
 };
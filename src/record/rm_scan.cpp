@@ -15,12 +15,25 @@ See the Mulan PSL v2 for more details. */
 /**
  * @brief 初始化file_handle和rid
  * @param file_handle
+ * @param filter 下推的过滤条件，只返回满足条件的记录
  */
-RmScan::RmScan(const RmFileHandle* file_handle) : file_handle_(file_handle) {
-  // Todo:
+RmScan::RmScan(const RmFileHandle* file_handle, const RmScanFilter* filter)
+    : RmScan(file_handle, RM_FIRST_RECORD_PAGE,
+             file_handle->file_hdr_.num_pages, filter) {}
+
+/**
+ * @brief 初始化只扫描 [start_page, end_page) 的 scan
+ * @param file_handle
+ * @param start_page 起始页面号
+ * @param end_page 结束页面号（不包含）
+ * @param filter 下推的过滤条件，只返回满足条件的记录
+ */
+RmScan::RmScan(const RmFileHandle* file_handle, int start_page, int end_page,
+               const RmScanFilter* filter)
+    : file_handle_(file_handle), end_page_(end_page), filter_(filter) {
   // 初始化file_handle和rid（指向第一个存放了记录的位置）
-  rid_ = {RM_FIRST_RECORD_PAGE, -1};
-  if (rid_.page_no < file_handle_->file_hdr_.num_pages) {
+  rid_ = {start_page, -1};
+  if (rid_.page_no < end_page_) {
     cur_page_handle_ = file_handle_->fetch_page_handle(rid_.page_no);
     // 这里设置-1，Bit::next_bit即是0，直接设置为0，会少判断0
     next();
@@ -30,22 +43,41 @@ RmScan::RmScan(const RmFileHandle* file_handle) : file_handle_(file_handle) {
 }
 
 /**
- * @brief 找到文件中下一个存放了记录的位置
+ * @brief 提前结束的 scan 要 unpin 当前页面
+ */
+RmScan::~RmScan() {
+  if (!is_end()) {
+    file_handle_->buffer_pool_manager_->unpin_page(
+        cur_page_handle_.page->get_page_id(), false);
+  }
+}
+
+/**
+ * @brief 找到文件中下一个存放了记录且满足过滤条件的位置
  */
 void RmScan::next() {
   // Todo:
   // 找到文件中下一个存放了记录的非空闲位置，用rid_来指向这个位置
+  const int num_records_per_page = file_handle_->file_hdr_.num_records_per_page;
   do {
-    rid_.slot_no = Bitmap::next_bit(
-        true, cur_page_handle_.bitmap,
-        file_handle_->file_hdr_.num_records_per_page, rid_.slot_no);
-    if (rid_.slot_no < file_handle_->file_hdr_.num_records_per_page) {
+    // 页面可能正在被插入或修改，持有读锁查找和过滤
+    cur_page_handle_.page->RLatch();
+    rid_.slot_no = Bitmap::next_bit(true, cur_page_handle_.bitmap,
+                                    num_records_per_page, rid_.slot_no);
+    // 在页面上直接过滤，不满足的记录不拷贝
+    while (filter_ != nullptr && rid_.slot_no < num_records_per_page &&
+           !filter_->eval(cur_page_handle_.get_slot(rid_.slot_no))) {
+      rid_.slot_no = Bitmap::next_bit(true, cur_page_handle_.bitmap,
+                                      num_records_per_page, rid_.slot_no);
+    }
+    cur_page_handle_.page->RUnlatch();
+    if (rid_.slot_no < num_records_per_page) {
       return;
     }
     // 一定要 unpin，否则多次 scan 以后所有页面都会无法替换！
     file_handle_->buffer_pool_manager_->unpin_page(
         cur_page_handle_.page->get_page_id(), false);
-    if (++rid_.page_no >= file_handle_->file_hdr_.num_pages) {
+    if (++rid_.page_no >= end_page_) {
       break;
     }
     cur_page_handle_ = file_handle_->fetch_page_handle(rid_.page_no);
@@ -81,8 +113,13 @@ bool RmScan::is_end() const {
  */
 Rid RmScan::rid() const { return rid_; }
 
-// 像 ixscan 一样直接得到记录，减少缓冲池访问加锁
+// 像 ixscan 一样直接得到记录，减少缓冲池访问加锁。持有页面读锁拷贝，
+// 不加行锁的快照读不会读到改了一半的记录
 std::unique_ptr<RmRecord> RmScan::get_record() {
-  return std::make_unique<RmRecord>(cur_page_handle_.get_slot(rid_.slot_no),
-                                    file_handle_->file_hdr_.record_size, true);
+  cur_page_handle_.page->RLatch();
+  auto record =
+      std::make_unique<RmRecord>(cur_page_handle_.get_slot(rid_.slot_no),
+                                 file_handle_->file_hdr_.record_size, true);
+  cur_page_handle_.page->RUnlatch();
+  return record;
 }
@@ -12,6 +12,7 @@ See the Mulan PSL v2 for more details. */
 
 #include "rm_defs.h"
 #include "rm_file_handle.h"
+#include "rm_scan_filter.h"
 
 class RmFileHandle;
 
@@ -20,9 +21,18 @@ class RmScan : public RecScan {
   const RmFileHandle* file_handle_;
   RmPageHandle cur_page_handle_;
   Rid rid_;
+  int end_page_;  // 扫描范围为 [起始页, end_page_)
+  const RmScanFilter* filter_;  // 下推的过滤条件，为空则返回所有记录
 
  public:
-  RmScan(const RmFileHandle* file_handle);
+  RmScan(const RmFileHandle* file_handle,
+         const RmScanFilter* filter = nullptr);
+
+  // 只扫描 [start_page, end_page) 范围内的页面，用于并行扫描
+  RmScan(const RmFileHandle* file_handle, int start_page, int end_page,
+         const RmScanFilter* filter = nullptr);
+
+  ~RmScan();
 
   void next() override;
 
@@ -31,4 +41,10 @@ class RmScan : public RecScan {
   Rid rid() const override;
 
   std::unique_ptr<RmRecord> get_record();
+
+  // 直接返回页面中的记录地址，不拷贝，扫描到下一页后失效。不持有页面锁，
+  // 只能在行锁或表锁挡住了写操作时使用，快照读要用 get_record()
+  char* get_data() const {
+    return cur_page_handle_.get_slot(rid_.slot_no);
+  }
 };
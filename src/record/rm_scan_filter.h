@@ -0,0 +1,75 @@
+/* Copyright (c) 2023 Renmin University of China
+RMDB is licensed under Mulan PSL v2.
+You can use this software according to the terms and conditions of the Mulan PSL
+v2. You may obtain a copy of Mulan PSL v2 at:
+        http://license.coscl.org.cn/MulanPSL2
+THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+See the Mulan PSL v2 for more details. */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "common/common.h"
+
+/**
+ * 下推到 RmScan 的过滤条件，扫描时直接在页面的记录槽上求值，
+ * 不满足的记录不会被拷贝出来。各条件之间是与的关系，只读，可以被多个线程共享
+ */
+class RmScanFilter {
+ public:
+  // 字段 op 常值，右值按字段长度拷贝
+  void add(int offset, int len, ColType type, CompOp op, const char* rhs) {
+    terms_.push_back({offset, len, type, op, {std::string(rhs, len)}});
+  }
+
+  // 字段 in (值列表)
+  void add_in(int offset, int len, ColType type,
+              const std::vector<const char*>& values) {
+    Term term{offset, len, type, OP_IN, {}};
+    term.rhs.reserve(values.size());
+    for (auto value : values) {
+      term.rhs.emplace_back(value, len);
+    }
+    terms_.emplace_back(std::move(term));
+  }
+
+  bool empty() const { return terms_.empty(); }
+
+  // 记录是否满足所有条件
+  bool eval(const char* slot) const {
+    for (auto& term : terms_) {
+      if (!term.eval(slot)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+ private:
+  struct Term {
+    int offset;
+    int len;
+    ColType type;
+    CompOp op;
+    std::vector<std::string> rhs;  // OP_IN 时为值列表，否则只有一个值
+
+    bool eval(const char* slot) const {
+      const char* lhs = slot + offset;
+      if (op == OP_IN) {
+        for (auto& value : rhs) {
+          if (compare(lhs, value.data(), len, type) == 0) {
+            return true;
+          }
+        }
+        return false;
+      }
+      return cmp_op(compare(lhs, rhs[0].data(), len, type), op);
+    }
+  };
+
+  std::vector<Term> terms_;
+};
@@ -0,0 +1,184 @@
+/* Copyright (c) 2023 Renmin University of China
+RMDB is licensed under Mulan PSL v2.
+You can use this software according to the terms and conditions of the Mulan PSL
+v2. You may obtain a copy of Mulan PSL v2 at:
+        http://license.coscl.org.cn/MulanPSL2
+THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+See the Mulan PSL v2 for more details. */
+
+#include "checkpoint_manager.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "record/rm_manager.h"
+#include "transaction/transaction_manager.h"
+
+/**
+ * @description: 做一次模糊检查点，期间事务照常执行
+ */
+void CheckpointManager::checkpoint() {
+  std::lock_guard lock(checkpoint_latch_);
+  // 检查点期间不能执行 DDL：要遍历表和索引的文件句柄，写回的脏页所在的文件
+  // 也不能被关闭
+  std::lock_guard ddl_lock(sm_manager_->ddl_latch_);
+  BeginCheckpointLogRecord begin_log_record;
+  auto begin_lsn = log_manager_->add_log_to_buffer(&begin_log_record);
+
+  // 分批写回此时的脏页，下一个检查点的脏页表就只剩之后修改的页面
+  std::vector<std::pair<PageId, lsn_t> > dirty_pages;
+  buffer_pool_manager_->get_dirty_pages(&dirty_pages);
+  for (std::size_t i = 0; i < dirty_pages.size(); ++i) {
+    buffer_pool_manager_->flush_page_if_dirty(dirty_pages[i].first);
+    if ((i + 1) % CHECKPOINT_FLUSH_BATCH == 0) {
+      std::this_thread::yield();
+    }
+  }
+
+  // 页面写回之后再写文件头，检查点开始之前分配的页面都算在文件头的页数中，
+  // 否则恢复时会把已经落盘的页面当成不存在
+  for (auto& [_, fh] : sm_manager_->fhs_) {
+    std::ignore = _;
+    sm_manager_->get_rm_manager()->flush_file_hdr(fh.get());
+  }
+  for (auto& [_, ih] : sm_manager_->ihs_) {
+    std::ignore = _;
+    ih->write_file_hdr();
+  }
+
+  // 先取活跃事务表再取脏页表，不在活跃事务表中、正在修改页面的事务一定是在
+  // 检查点开始之后才开始的
+  auto active_txns = transaction_manager_->get_active_transactions();
+  lsn_t min_active_lsn = begin_lsn;
+  for (auto& txn : active_txns) {
+    min_active_lsn = std::min(min_active_lsn, txn.first_lsn);
+  }
+
+  // 写回期间又被修改的页面记到脏页表中，页面用表编号标识，重启后 fd 会变
+  std::unordered_map<int, int> table_ids;  // fd -> 表编号
+  for (auto& [tab_name, fh] : sm_manager_->fhs_) {
+    table_ids.emplace(fh->GetFd(), sm_manager_->db_.get_table(tab_name).id);
+  }
+  dirty_pages.clear();
+  buffer_pool_manager_->get_dirty_pages(&dirty_pages);
+  std::vector<CheckpointDirtyPage> dirty_page_table;
+  for (auto& [page_id, rec_lsn] : dirty_pages) {
+    auto it = table_ids.find(page_id.fd);
+    // 索引页没有日志，由表上的日志恢复
+    if (it == table_ids.end()) {
+      continue;
+    }
+    // 修改完页面、还没设置 page_lsn 时不知道 rec_lsn，修改它的事务在活跃事务表
+    // 中或者在检查点开始之后才开始，从它们中最早的日志开始重做该页
+    dirty_page_table.push_back({it->second, page_id.page_no,
+                                rec_lsn == INVALID_LSN ? min_active_lsn
+                                                       : rec_lsn});
+  }
+
+  end_checkpoint(begin_lsn, active_txns, dirty_page_table);
+}
+
+/**
+ * @description: 写检查点结束记录并更新主记录。缓冲池全是脏页时脏页表有
+ * 上百万字节，按 MAX_ENTRIES_SIZE 拆成多条结束记录，后一条的 prev_lsn_
+ * 指向前一条
+ * @param {lsn_t} begin_lsn 检查点开始记录的 lsn
+ * @param {vector<CheckpointActiveTxn>&} active_txns 活跃事务表
+ * @param {vector<CheckpointDirtyPage>&} dirty_pages 脏页表
+ */
+void CheckpointManager::end_checkpoint(
+    lsn_t begin_lsn, const std::vector<CheckpointActiveTxn>& active_txns,
+    const std::vector<CheckpointDirtyPage>& dirty_pages) {
+  lsn_t end_lsn = INVALID_LSN;
+  lsn_t min_lsn = begin_lsn;
+  std::size_t txn_pos = 0;
+  std::size_t page_pos = 0;
+  do {
+    std::size_t space = EndCheckpointLogRecord::MAX_ENTRIES_SIZE;
+    std::size_t num_txns = std::min(active_txns.size() - txn_pos,
+                                    space / sizeof(CheckpointActiveTxn));
+    space -= num_txns * sizeof(CheckpointActiveTxn);
+    std::size_t num_pages = std::min(dirty_pages.size() - page_pos,
+                                     space / sizeof(CheckpointDirtyPage));
+    auto txn_it = active_txns.begin() + txn_pos;
+    auto page_it = dirty_pages.begin() + page_pos;
+    EndCheckpointLogRecord end_log_record(
+        begin_lsn, {txn_it, txn_it + num_txns},
+        {page_it, page_it + num_pages});
+    end_log_record.prev_lsn_ = end_lsn;
+    end_lsn = log_manager_->add_log_to_buffer(&end_log_record);
+    min_lsn = std::min(min_lsn, end_log_record.min_lsn());
+    txn_pos += num_txns;
+    page_pos += num_pages;
+  } while (txn_pos < active_txns.size() || page_pos < dirty_pages.size());
+
+  log_manager_->wait_for_flush(end_lsn);
+  write_master_record(end_lsn);
+  // 主记录持久化之后，恢复不会再用到 min_lsn 之前的日志段
+  log_manager_->recycle_log(min_lsn);
+}
+
+/**
+ * @description: 读取最后一个完成的检查点
+ * @return {lsn_t} 检查点结束记录的 lsn，没有检查点时为 INVALID_LSN
+ */
+lsn_t CheckpointManager::read_master_record() {
+  int fd = open(MASTER_RECORD_NAME.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return INVALID_LSN;
+  }
+  lsn_t end_lsn;
+  if (read(fd, &end_lsn, sizeof(lsn_t)) != sizeof(lsn_t)) {
+    end_lsn = INVALID_LSN;
+  }
+  close(fd);
+  return end_lsn;
+}
+
+/**
+ * @description: 把检查点结束记录的 lsn 写入主记录。先写临时文件再改名，
+ * 崩溃时主记录要么是旧的检查点，要么是新的。改名之后同步目录，
+ * 之后才能回收旧检查点还需要的日志段
+ * @param {lsn_t} end_lsn 检查点结束记录的 lsn
+ */
+void CheckpointManager::write_master_record(lsn_t end_lsn) {
+  std::string tmp_name = MASTER_RECORD_NAME + ".tmp";
+  int fd = open(tmp_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) {
+    throw UnixError();
+  }
+  bool written = write(fd, &end_lsn, sizeof(lsn_t)) == sizeof(lsn_t) &&
+                 fdatasync(fd) == 0;
+  close(fd);
+  if (!written || rename(tmp_name.c_str(), MASTER_RECORD_NAME.c_str()) != 0) {
+    throw UnixError();
+  }
+  DiskManager::sync_dir(".");
+}
+
+// 后台线程，每隔 CHECKPOINT_INTERVAL_MS 做一次检查点
+void CheckpointManager::run() {
+  std::unique_lock lock(latch_);
+  while (!stop_) {
+    cv_.wait_for(lock, std::chrono::milliseconds(CHECKPOINT_INTERVAL_MS),
+                 [this] { return stop_; });
+    if (stop_) {
+      break;
+    }
+    lock.unlock();
+    try {
+      checkpoint();
+    } catch (RMDBError& e) {
+      // 主记录没有更新，恢复时仍然使用上一个检查点，下次再试
+    }
+    lock.lock();
+  }
+}
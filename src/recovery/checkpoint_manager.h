@@ -0,0 +1,88 @@
+/* Copyright (c) 2023 Renmin University of China
+RMDB is licensed under Mulan PSL v2.
+You can use this software according to the terms and conditions of the Mulan PSL
+v2. You may obtain a copy of Mulan PSL v2 at:
+        http://license.coscl.org.cn/MulanPSL2
+THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+See the Mulan PSL v2 for more details. */
+
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "log_manager.h"
+#include "storage/buffer_pool_manager.h"
+#include "system/sm_manager.h"
+
+class TransactionManager;
+
+/**
+ * 模糊检查点，不停止事务：
+ * 1. 写检查点开始记录；
+ * 2. 在后台分批把此时的脏页写回磁盘，写回之前按 WAL 先刷日志；
+ * 3. 写检查点结束记录，带上活跃事务表和仍然是脏页的页面及其 rec_lsn；
+ * 4. 结束记录持久化之后，把它的 lsn 写入主记录（MASTER_RECORD_NAME）；
+ * 5. 回收脏页表中最小的 rec_lsn 和活跃事务最早的日志之前的日志段。
+ * 恢复时从主记录找到最后一个完成的检查点，检查点之前的修改只需重做
+ * 脏页表中 rec_lsn 之后的部分，日志的总量也就受检查点间隔的限制
+ */
+class CheckpointManager {
+ public:
+  CheckpointManager(BufferPoolManager* buffer_pool_manager,
+                    SmManager* sm_manager, LogManager* log_manager,
+                    TransactionManager* transaction_manager)
+      : buffer_pool_manager_(buffer_pool_manager),
+        sm_manager_(sm_manager),
+        log_manager_(log_manager),
+        transaction_manager_(transaction_manager) {}
+
+  ~CheckpointManager() { stop(); }
+
+  // 恢复完成之后启动后台线程，每隔 CHECKPOINT_INTERVAL_MS 做一次检查点
+  void start() {
+    std::lock_guard lock(latch_);
+    if (!thread_.joinable()) {
+      stop_ = false;
+      thread_ = std::thread([this] { run(); });
+    }
+  }
+
+  void stop() {
+    {
+      std::lock_guard lock(latch_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+  }
+
+  void checkpoint();
+
+  static lsn_t read_master_record();
+
+ private:
+  void run();
+
+  void end_checkpoint(lsn_t begin_lsn,
+                      const std::vector<CheckpointActiveTxn>& active_txns,
+                      const std::vector<CheckpointDirtyPage>& dirty_pages);
+
+  static void write_master_record(lsn_t end_lsn);
+
+  BufferPoolManager* buffer_pool_manager_;
+  SmManager* sm_manager_;
+  LogManager* log_manager_;
+  TransactionManager* transaction_manager_;
+  std::mutex checkpoint_latch_;  // 同一时间只做一个检查点
+  std::mutex latch_;             // 保护后台线程的状态
+  std::condition_variable cv_;
+  bool stop_{false};
+  std::thread thread_;
+};
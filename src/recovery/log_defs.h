@@ -29,7 +29,28 @@ static constexpr int OFFSET_LOG_TOT_LEN = OFFSET_LSN + sizeof(lsn_t);
 static constexpr int OFFSET_LOG_TID = OFFSET_LOG_TOT_LEN + sizeof(uint32_t);
 // the offset of prev_lsn_ in log header
 static constexpr int OFFSET_PREV_LSN = OFFSET_LOG_TID + sizeof(txn_id_t);
+// the offset of the checksum in log header
+static constexpr int OFFSET_LOG_CHECKSUM = OFFSET_PREV_LSN + sizeof(lsn_t);
 // offset of log data
-static constexpr int OFFSET_LOG_DATA = OFFSET_PREV_LSN + sizeof(lsn_t);
+static constexpr int OFFSET_LOG_DATA = OFFSET_LOG_CHECKSUM + sizeof(uint32_t);
 // sizeof log_header
 static constexpr int LOG_HEADER_SIZE = OFFSET_LOG_DATA;
+
+/**
+ * @description: 日志记录的校验和（FNV-1a），覆盖除校验和字段之外的整条日志。
+ * 日志段会被重用，段中残留的旧日志和没写完的日志都靠它和 lsn 识别出来
+ * @return {uint32_t} 校验和
+ * @param {char*} log_data 序列化之后的日志记录
+ * @param {uint32_t} len 日志记录的长度
+ */
+inline uint32_t log_checksum(const char* log_data, uint32_t len) {
+  uint32_t hash = 2166136261u;
+  auto update = [&hash](const char* begin, const char* end) {
+    for (const char* p = begin; p < end; ++p) {
+      hash = (hash ^ static_cast<uint8_t>(*p)) * 16777619u;
+    }
+  };
+  update(log_data, log_data + OFFSET_LOG_CHECKSUM);
+  update(log_data + LOG_HEADER_SIZE, log_data + len);
+  return hash;
+}
@@ -11,6 +11,9 @@ See the Mulan PSL v2 for more details. */
 #include "log_manager.h"
 
 #include <cstring>
+#include <vector>
+
+#include "common/thread_pool.h"
 
 /**
  * @description: 添加日志记录到日志缓冲区中，并返回日志记录号
@@ -18,27 +21,163 @@ See the Mulan PSL v2 for more details. */
  * @return {lsn_t} 返回该日志的日志记录号
  */
 lsn_t LogManager::add_log_to_buffer(LogRecord* log_record) {
-  latch_.lock();
-  if (log_buffer_.is_full(log_record->log_tot_len_)) {
-    flush_log_to_disk();
+  uint32_t len = log_record->log_tot_len_;
+  // 一次 fetch_add 分配日志流中的一段空间，起始位置就是 lsn
+  uint64_t begin = reserve_.fetch_add(len);
+  uint64_t end = begin + len;
+  log_record->lsn_ = static_cast<lsn_t>(begin);
+
+  wait_for_space(end);
+  uint32_t offset = begin & (LOG_RING_SIZE - 1);
+  if (offset + len <= LOG_RING_SIZE) {
+    char* dest = ring_.get() + offset;
+    log_record->serialize(dest);
+    uint32_t checksum = log_checksum(dest, len);
+    memcpy(dest + OFFSET_LOG_CHECKSUM, &checksum, sizeof(uint32_t));
+  } else {
+    // 跨过缓冲区末尾，分两段拷贝
+    thread_local std::vector<char> buf;
+    buf.resize(len);
+    log_record->serialize(buf.data());
+    uint32_t checksum = log_checksum(buf.data(), len);
+    memcpy(buf.data() + OFFSET_LOG_CHECKSUM, &checksum, sizeof(uint32_t));
+    uint32_t first = LOG_RING_SIZE - offset;
+    memcpy(ring_.get() + offset, buf.data(), first);
+    memcpy(ring_.get(), buf.data() + first, len - first);
+  }
+  slot(begin).store(end, std::memory_order_release);
+
+  // 写满一半缓冲区，让后台线程去刷这一半
+  if ((begin ^ end) & LOG_BUFFER_SIZE) {
+    {
+      std::lock_guard lock(group_latch_);
+      flush_request_lsn_ = std::max(flush_request_lsn_, log_record->lsn_);
+    }
+    cv_.notify_one();
   }
-  log_record->lsn_ = global_lsn_++;
-  log_record->serialize(log_buffer_.buffer_ + log_buffer_.offset_);
-  log_buffer_.offset_ += log_record->log_tot_len_;
-  latch_.unlock();
   return log_record->lsn_;
 }
 
 /**
- * @description:
- * 把日志缓冲区的内容刷到磁盘中，由于目前只设置了一个缓冲区，因此需要阻塞其他日志操作
+ * @description: 等到缓冲区中 end 之前的空间已经刷盘，可以覆盖。
+ * 刷盘线程可能在等本线程写完日志，所以不能阻塞在 flush_latch_ 上
+ * @param {uint64_t} end 要写入的日志在日志流中的结束位置
+ */
+void LogManager::wait_for_space(uint64_t end) {
+  while (end - flushed_pos_.load(std::memory_order_acquire) > LOG_RING_SIZE) {
+    std::unique_lock flush_lock(flush_latch_, std::try_to_lock);
+    if (!flush_lock.owns_lock() || !flush_written()) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+/**
+ * @description: 把缓冲区中已经全部写完的一段前缀刷盘，调用者持有 flush_latch_
+ * @return {bool} 是否有日志刷盘
+ */
+bool LogManager::flush_written() {
+  uint64_t begin = flushed_pos_.load(std::memory_order_relaxed);
+  uint64_t end = begin;
+  uint64_t last = begin;
+  while (true) {
+    // 槽位上是上一轮的日志时，结束位置不会超过 end
+    uint64_t next = slot(end).load(std::memory_order_acquire);
+    if (next <= end) {
+      break;
+    }
+    last = end;
+    end = next;
+  }
+  if (end == begin) {
+    return false;
+  }
+
+  write_ring(begin, end);
+  disk_manager_->sync_log();
+  flushed_pos_.store(end, std::memory_order_release);
+  bool new_segment = false;
+  {
+    std::lock_guard lock(group_latch_);
+    persist_lsn_.store(static_cast<lsn_t>(last));
+    // 写到了新的日志段，预先创建它的下一个
+    auto segment = static_cast<int64_t>(end >> LOG_SEGMENT_BITS) + 1;
+    if (segment > next_segment_) {
+      next_segment_ = segment;
+      new_segment = true;
+    }
+  }
+  flushed_cv_.notify_all();
+  if (new_segment) {
+    segment_cv_.notify_one();
+  }
+  return true;
+}
+
+// 把日志流中 [begin, end) 的内容写入日志段文件
+void LogManager::write_ring(uint64_t begin, uint64_t end) {
+  uint32_t offset = begin & (LOG_RING_SIZE - 1);
+  auto len = static_cast<uint32_t>(end - begin);
+  if (len == 0) {
+    return;
+  }
+  auto pos = static_cast<lsn_t>(begin);
+  if (offset + len <= LOG_RING_SIZE) {
+    disk_manager_->write_log(ring_.get() + offset, len, pos);
+  } else {
+    uint32_t first = LOG_RING_SIZE - offset;
+    disk_manager_->write_log(ring_.get() + offset, first, pos);
+    disk_manager_->write_log(ring_.get(), len - first, pos + first);
+  }
+}
+
+/**
+ * @description: 把调用之前分配的所有日志刷到磁盘中。还在拷贝的日志会挡住
+ * 后面的日志，分几轮刷盘直到全部写完
  */
 void LogManager::flush_log_to_disk() {
-  // std::lock_guard lock(latch_);
-  if (log_buffer_.offset_ == 0) {
+  std::lock_guard flush_lock(flush_latch_);
+  uint64_t target = reserve_.load();
+  while (flushed_pos_.load(std::memory_order_relaxed) < target) {
+    if (!flush_written()) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+/**
+ * @description: 恢复时设置日志流的结束位置，之后的日志从这里接着写。
+ * 此时还没有线程写日志
+ * @param {lsn_t} global_lsn 最后一条有效日志的结束位置，即下一条日志的 lsn
+ */
+void LogManager::set_global_lsn(lsn_t global_lsn) {
+  std::lock_guard flush_lock(flush_latch_);
+  auto pos = static_cast<uint64_t>(global_lsn);
+  reserve_.store(pos);
+  flushed_pos_.store(pos, std::memory_order_release);
+}
+
+/**
+ * @description: 等待 lsn 及之前的日志持久化，由日志写线程合并刷盘
+ * @param {lsn_t} lsn 需要持久化的日志记录号
+ */
+void LogManager::wait_for_flush(lsn_t lsn) {
+  if (persist_lsn_.load() >= lsn) {
     return;
   }
-  disk_manager_->write_log(log_buffer_.buffer_, log_buffer_.offset_);
-  log_buffer_.offset_ = 0;
-  persist_lsn_ = global_lsn_ - 1;
+  std::unique_lock lk(group_latch_);
+  if (!run_background_thread_) {
+    lk.unlock();
+    flush_log_to_disk();
+    return;
+  }
+  flush_request_lsn_ = std::max(flush_request_lsn_, lsn);
+  ++num_waiters_;
+  cv_.notify_one();
+  {
+    // 提交在线程池上执行，等待刷盘时让线程池补充线程，其他语句才能继续写日志
+    ThreadPool::BlockingScope scope;
+    flushed_cv_.wait(lk, [this, lsn] { return persist_lsn_.load() >= lsn; });
+  }
+  --num_waiters_;
 }
@@ -10,9 +10,16 @@ See the Mulan PSL v2 for more details. */
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <memory>
 #include <mutex>
 #include <thread>
+#include <utility>
 #include <vector>
 
 #include "common/config.h"
@@ -27,12 +34,15 @@ enum LogType : int {
   BEGIN,
   COMMIT,
   ABORT,
-  STATIC_CHECKPOINT
+  STATIC_CHECKPOINT,
+  BEGIN_CHECKPOINT,
+  END_CHECKPOINT
 };
 
 static std::string LogTypeStr[] = {
-    "UPDATE", "INSERT", "DELETE",           "BEGIN",
-    "COMMIT", "ABORT",  "STATIC_CHECKPOINT"};
+    "UPDATE",           "INSERT",          "DELETE",        "BEGIN",
+    "COMMIT",           "ABORT",           "STATIC_CHECKPOINT",
+    "BEGIN_CHECKPOINT", "END_CHECKPOINT"};
 
 class LogRecord {
  public:
@@ -44,7 +54,7 @@ class LogRecord {
 
   virtual ~LogRecord() = default;
 
-  // 把日志记录序列化到dest中
+  // 把日志记录序列化到dest中，校验和由 LogManager 在整条日志序列化之后填写
   virtual void serialize(char* dest) const {
     memcpy(dest + OFFSET_LOG_TYPE, &log_type_, sizeof(LogType));
     memcpy(dest + OFFSET_LSN, &lsn_, sizeof(lsn_t));
@@ -68,10 +78,10 @@ class LogRecord {
               << "\n";
     printf("Print Log Record:\n");
     printf("log_type_: %s\n", LogTypeStr[log_type_].c_str());
-    printf("lsn: %d\n", lsn_);
+    printf("lsn: %lld\n", static_cast<long long>(lsn_));
     printf("log_tot_len: %d\n", log_tot_len_);
     printf("log_tid: %d\n", log_tid_);
-    printf("prev_lsn: %d\n", prev_lsn_);
+    printf("prev_lsn: %lld\n", static_cast<long long>(prev_lsn_));
   }
 };
 
@@ -101,6 +111,138 @@ class StaticCheckpointLogRecord : public LogRecord {
   }
 };
 
+/**
+ * 模糊检查点的开始，结束记录中的活跃事务表和脏页表都是在它之后获取的
+ */
+class BeginCheckpointLogRecord : public LogRecord {
+ public:
+  BeginCheckpointLogRecord() {
+    log_type_ = BEGIN_CHECKPOINT;
+    lsn_ = INVALID_LSN;
+    log_tot_len_ = LOG_HEADER_SIZE;
+    log_tid_ = INVALID_TXN_ID;
+    prev_lsn_ = INVALID_LSN;
+  }
+
+  void format_print() override {
+    printf("begin checkpoint record\n");
+    LogRecord::format_print();
+  }
+};
+
+/* 检查点活跃事务表中的一项 */
+struct CheckpointActiveTxn {
+  txn_id_t txn_id;
+  lsn_t first_lsn;  // 事务的 begin 日志
+  lsn_t last_lsn;   // 事务的最后一条日志
+};
+
+/* 检查点脏页表中的一项，页面用表编号和页号标识 */
+struct CheckpointDirtyPage {
+  int table_id;
+  page_id_t page_no;
+  lsn_t rec_lsn;  // 页面写回磁盘之后第一条修改它的日志
+};
+
+/**
+ * 模糊检查点的结束，记录检查点开始之后的活跃事务表（事务及其首尾两条日志）和
+ * 脏页表（页面及其 rec_lsn）。记录的大小不超过 LOG_BUFFER_SIZE，
+ * 恢复时才能一次读入。两张表放不下时拆成多条结束记录，每条用 prev_lsn_
+ * 指向同一个检查点的前一条，主记录指向最后一条
+ */
+class EndCheckpointLogRecord : public LogRecord {
+ public:
+  // 一条结束记录中活跃事务表和脏页表最多占用的字节数
+  static constexpr std::size_t MAX_ENTRIES_SIZE =
+      LOG_BUFFER_SIZE - LOG_HEADER_SIZE - sizeof(lsn_t) - 2 * sizeof(int);
+
+  EndCheckpointLogRecord() {
+    log_type_ = END_CHECKPOINT;
+    lsn_ = INVALID_LSN;
+    log_tot_len_ = LOG_HEADER_SIZE + sizeof(lsn_t) + 2 * sizeof(int);
+    log_tid_ = INVALID_TXN_ID;
+    prev_lsn_ = INVALID_LSN;
+    begin_lsn_ = INVALID_LSN;
+  }
+
+  EndCheckpointLogRecord(
+      lsn_t begin_lsn, std::vector<CheckpointActiveTxn> active_txns,
+      std::vector<CheckpointDirtyPage> dirty_pages)
+      : EndCheckpointLogRecord() {
+    begin_lsn_ = begin_lsn;
+    active_txns_ = std::move(active_txns);
+    dirty_pages_ = std::move(dirty_pages);
+    log_tot_len_ += active_txns_.size() * sizeof(CheckpointActiveTxn) +
+                    dirty_pages_.size() * sizeof(CheckpointDirtyPage);
+  }
+
+  void serialize(char* dest) const override {
+    LogRecord::serialize(dest);
+    int offset = OFFSET_LOG_DATA;
+    memcpy(dest + offset, &begin_lsn_, sizeof(lsn_t));
+    offset += sizeof(lsn_t);
+    int size = static_cast<int>(active_txns_.size());
+    memcpy(dest + offset, &size, sizeof(int));
+    offset += sizeof(int);
+    memcpy(dest + offset, active_txns_.data(),
+           size * sizeof(CheckpointActiveTxn));
+    offset += size * sizeof(CheckpointActiveTxn);
+    size = static_cast<int>(dirty_pages_.size());
+    memcpy(dest + offset, &size, sizeof(int));
+    offset += sizeof(int);
+    memcpy(dest + offset, dirty_pages_.data(),
+           size * sizeof(CheckpointDirtyPage));
+  }
+
+  void deserialize(const char* src) override {
+    LogRecord::deserialize(src);
+    int offset = OFFSET_LOG_DATA;
+    memcpy(&begin_lsn_, src + offset, sizeof(lsn_t));
+    offset += sizeof(lsn_t);
+    int size;
+    memcpy(&size, src + offset, sizeof(int));
+    offset += sizeof(int);
+    active_txns_.resize(size);
+    memcpy(active_txns_.data(), src + offset,
+           size * sizeof(CheckpointActiveTxn));
+    offset += size * sizeof(CheckpointActiveTxn);
+    memcpy(&size, src + offset, sizeof(int));
+    offset += sizeof(int);
+    dirty_pages_.resize(size);
+    memcpy(dirty_pages_.data(), src + offset,
+           size * sizeof(CheckpointDirtyPage));
+  }
+
+  /**
+   * @description: 从这个检查点恢复需要的最早一条日志：检查点开始之前的修改
+   * 从脏页表中最小的 rec_lsn 开始重做，活跃事务要从 begin 日志开始分析和回滚。
+   * 之前的日志段都可以回收
+   * @return {lsn_t} 恢复需要的最早一条日志的 lsn
+   */
+  lsn_t min_lsn() const {
+    lsn_t lsn = begin_lsn_;
+    for (auto& txn : active_txns_) {
+      lsn = std::min(lsn, txn.first_lsn);
+    }
+    for (auto& page : dirty_pages_) {
+      lsn = std::min(lsn, page.rec_lsn);
+    }
+    return lsn;
+  }
+
+  void format_print() override {
+    printf("end checkpoint record\n");
+    LogRecord::format_print();
+    printf("begin lsn: %lld\n", static_cast<long long>(begin_lsn_));
+    printf("active txns: %zu\n", active_txns_.size());
+    printf("dirty pages: %zu\n", dirty_pages_.size());
+  }
+
+  lsn_t begin_lsn_;  // 对应的检查点开始记录
+  std::vector<CheckpointActiveTxn> active_txns_;  // 活跃事务表
+  std::vector<CheckpointDirtyPage> dirty_pages_;  // 脏页表
+};
+
 class BeginLogRecord : public LogRecord {
  public:
   BeginLogRecord() {
@@ -179,243 +321,260 @@ class AbortLogRecord : public LogRecord {
   }
 };
 
-class InsertLogRecord : public LogRecord {
+/**
+ * insert 和 delete 日志记录的公共部分：表编号、记录位置和整条记录的内容。
+ * 日志记录不持有记录的内容，构造时指向调用者的记录，反序列化时指向日志缓冲区，
+ * 在栈上构造后直接序列化进日志缓冲区，不需要分配内存
+ */
+class TupleLogRecord : public LogRecord {
  public:
-  InsertLogRecord() {
-    log_type_ = INSERT;
+  explicit TupleLogRecord(LogType log_type) {
+    log_type_ = log_type;
     lsn_ = INVALID_LSN;
     log_tot_len_ = LOG_HEADER_SIZE;
     log_tid_ = INVALID_TXN_ID;
     prev_lsn_ = INVALID_LSN;
-    table_name_ = nullptr;
+    table_id_ = -1;
+    rid_ = {-1, -1};
+    value_size_ = 0;
+    value_ = nullptr;
   }
 
-  ~InsertLogRecord() override { delete[] table_name_; }
-
-  InsertLogRecord(txn_id_t txn_id, RmRecord& insert_value, Rid& rid,
-                  const std::string& table_name)
-      : InsertLogRecord() {
+  TupleLogRecord(LogType log_type, txn_id_t txn_id, const RmRecord& value,
+                 const Rid& rid, int table_id)
+      : TupleLogRecord(log_type) {
     log_tid_ = txn_id;
-    insert_value_ = insert_value;
+    table_id_ = table_id;
     rid_ = rid;
-    log_tot_len_ += sizeof(int);
-    log_tot_len_ += insert_value_.size;
-    log_tot_len_ += sizeof(Rid);
-    table_name_size_ = table_name.length();
-    table_name_ = new char[table_name_size_ + 1];
-    memcpy(table_name_, table_name.c_str(), table_name_size_);
-    table_name_[table_name_size_] = '\0';
-    log_tot_len_ += sizeof(size_t) + table_name_size_;
+    value_size_ = value.size;
+    value_ = value.data;
+    log_tot_len_ += sizeof(int) + sizeof(Rid) + sizeof(int) + value_size_;
   }
 
-  // 把 insert 日志记录序列化到 dest 中
+  // 把日志记录序列化到 dest 中
   void serialize(char* dest) const override {
     LogRecord::serialize(dest);
     int offset = OFFSET_LOG_DATA;
-    memcpy(dest + offset, &insert_value_.size, sizeof(int));
+    memcpy(dest + offset, &table_id_, sizeof(int));
     offset += sizeof(int);
-    memcpy(dest + offset, insert_value_.data, insert_value_.size);
-    offset += insert_value_.size;
     memcpy(dest + offset, &rid_, sizeof(Rid));
     offset += sizeof(Rid);
-    memcpy(dest + offset, &table_name_size_, sizeof(size_t));
-    offset += sizeof(size_t);
-    memcpy(dest + offset, table_name_, table_name_size_);
+    memcpy(dest + offset, &value_size_, sizeof(int));
+    offset += sizeof(int);
+    memcpy(dest + offset, value_, value_size_);
   }
 
-  // 从 src 中反序列化出一条 Insert 日志记录
+  // 从 src 中反序列化出一条日志记录，value_ 指向 src 中的记录内容
   void deserialize(const char* src) override {
     LogRecord::deserialize(src);
-    insert_value_.Deserialize(src + OFFSET_LOG_DATA);
-    int offset = OFFSET_LOG_DATA + sizeof(int) + insert_value_.size;
-    rid_ = *reinterpret_cast<const Rid*>(src + offset);
+    int offset = OFFSET_LOG_DATA;
+    memcpy(&table_id_, src + offset, sizeof(int));
+    offset += sizeof(int);
+    memcpy(&rid_, src + offset, sizeof(Rid));
     offset += sizeof(Rid);
-    table_name_size_ = *reinterpret_cast<const size_t*>(src + offset);
-    offset += sizeof(size_t);
-    table_name_ = new char[table_name_size_ + 1];
-    memcpy(table_name_, src + offset, table_name_size_);
-    table_name_[table_name_size_] = '\0';
+    memcpy(&value_size_, src + offset, sizeof(int));
+    offset += sizeof(int);
+    value_ = src + offset;
   }
 
   void format_print() override {
-    printf("insert record\n");
     LogRecord::format_print();
-    printf("insert value: %s\n", insert_value_.data);
-    printf("insert rid: %d, %d\n", rid_.page_no, rid_.slot_no);
-    printf("table name: %s\n", table_name_);
+    printf("value: %.*s\n", value_size_, value_);
+    printf("rid: %d, %d\n", rid_.page_no, rid_.slot_no);
+    printf("table id: %d\n", table_id_);
   }
 
-  inline std::string get_table_name() const { return table_name_; }
-
-  RmRecord insert_value_;   // 插入的记录
-  Rid rid_;                 // 记录插入的位置
-  char* table_name_;        // 插入记录的表名称
-  size_t table_name_size_;  // 表名称的大小
+  int table_id_;       // 记录所在表的编号
+  Rid rid_;            // 记录的位置
+  int value_size_;     // 记录的大小
+  const char* value_;  // 插入或删除的记录
 };
 
-/**
- * TODO: delete操作的日志记录
- */
-class DeleteLogRecord : public LogRecord {
+class InsertLogRecord : public TupleLogRecord {
  public:
-  DeleteLogRecord() {
-    log_type_ = DELETE;
-    lsn_ = INVALID_LSN;
-    log_tot_len_ = LOG_HEADER_SIZE;
-    log_tid_ = INVALID_TXN_ID;
-    prev_lsn_ = INVALID_LSN;
-    table_name_ = nullptr;
-  }
+  InsertLogRecord() : TupleLogRecord(INSERT) {}
 
-  ~DeleteLogRecord() override { delete[] table_name_; }
+  InsertLogRecord(txn_id_t txn_id, const RmRecord& insert_value,
+                  const Rid& rid, int table_id)
+      : TupleLogRecord(INSERT, txn_id, insert_value, rid, table_id) {}
 
-  DeleteLogRecord(txn_id_t txn_id, RmRecord& delete_value, Rid& rid,
-                  const std::string& table_name)
-      : DeleteLogRecord() {
-    log_tid_ = txn_id;
-    delete_value_ = delete_value;
-    rid_ = rid;
-    log_tot_len_ += sizeof(int);
-    log_tot_len_ += delete_value_.size;
-    log_tot_len_ += sizeof(Rid);
-    table_name_size_ = table_name.length();
-    table_name_ = new char[table_name_size_ + 1];
-    memcpy(table_name_, table_name.c_str(), table_name_size_);
-    table_name_[table_name_size_] = '\0';
-    log_tot_len_ += sizeof(size_t) + table_name_size_;
+  void format_print() override {
+    printf("insert record\n");
+    TupleLogRecord::format_print();
   }
+};
 
-  // 把 delete 日志记录序列化到 dest 中
-  void serialize(char* dest) const override {
-    LogRecord::serialize(dest);
-    int offset = OFFSET_LOG_DATA;
-    memcpy(dest + offset, &delete_value_.size, sizeof(int));
-    offset += sizeof(int);
-    memcpy(dest + offset, delete_value_.data, delete_value_.size);
-    offset += delete_value_.size;
-    memcpy(dest + offset, &rid_, sizeof(Rid));
-    offset += sizeof(Rid);
-    memcpy(dest + offset, &table_name_size_, sizeof(size_t));
-    offset += sizeof(size_t);
-    memcpy(dest + offset, table_name_, table_name_size_);
-  }
+/**
+ * TODO: delete操作的日志记录
+ */
+class DeleteLogRecord : public TupleLogRecord {
+ public:
+  DeleteLogRecord() : TupleLogRecord(DELETE) {}
 
-  // 从 src 中反序列化出一条 delete 日志记录
-  void deserialize(const char* src) override {
-    LogRecord::deserialize(src);
-    delete_value_.Deserialize(src + OFFSET_LOG_DATA);
-    int offset = OFFSET_LOG_DATA + sizeof(int) + delete_value_.size;
-    rid_ = *reinterpret_cast<const Rid*>(src + offset);
-    offset += sizeof(Rid);
-    table_name_size_ = *reinterpret_cast<const size_t*>(src + offset);
-    offset += sizeof(size_t);
-    table_name_ = new char[table_name_size_ + 1];
-    memcpy(table_name_, src + offset, table_name_size_);
-    table_name_[table_name_size_] = '\0';
-  }
+  DeleteLogRecord(txn_id_t txn_id, const RmRecord& delete_value,
+                  const Rid& rid, int table_id)
+      : TupleLogRecord(DELETE, txn_id, delete_value, rid, table_id) {}
 
   void format_print() override {
     printf("delete record\n");
-    LogRecord::format_print();
-    printf("delete value: %s\n", delete_value_.data);
-    printf("delete rid: %d, %d\n", rid_.page_no, rid_.slot_no);
-    printf("table name: %s\n", table_name_);
+    TupleLogRecord::format_print();
   }
-
-  inline std::string get_table_name() { return {table_name_}; }
-
-  RmRecord delete_value_;   // 删除的记录
-  Rid rid_;                 // 记录删除的位置
-  char* table_name_;        // 删除记录的表名称
-  size_t table_name_size_;  // 表名称的大小
 };
 
 /**
- * TODO: update操作的日志记录
+ * update 日志记录只记下新旧记录中不同的字节段，每段依次存放
+ * 段的偏移、长度、旧内容和新内容。相隔很近的两段合并成一段，
+ * 省下的段头比多记的几个相同字节更长。
+ * 和 TupleLogRecord 一样不持有内容，构造时指向调用者的新旧记录，
+ * 反序列化时指向日志缓冲区中的字节段
  */
 class UpdateLogRecord : public LogRecord {
  public:
+  // 每个字节段的段头：uint16_t 偏移和 uint16_t 长度
+  static constexpr int RANGE_HEADER_SIZE = 2 * sizeof(uint16_t);
+
   UpdateLogRecord() {
     log_type_ = UPDATE;
     lsn_ = INVALID_LSN;
     log_tot_len_ = LOG_HEADER_SIZE;
     log_tid_ = INVALID_TXN_ID;
     prev_lsn_ = INVALID_LSN;
-    table_name_ = nullptr;
+    table_id_ = -1;
+    rid_ = {-1, -1};
+    value_size_ = 0;
+    num_ranges_ = 0;
+    old_value_ = nullptr;
+    new_value_ = nullptr;
+    ranges_ = nullptr;
   }
 
-  ~UpdateLogRecord() override { delete[] table_name_; }
-
-  UpdateLogRecord(txn_id_t txn_id, RmRecord& old_value, RmRecord& update_value,
-                  Rid& rid, const std::string& table_name)
+  UpdateLogRecord(txn_id_t txn_id, const RmRecord& old_value,
+                  const RmRecord& new_value, const Rid& rid, int table_id)
       : UpdateLogRecord() {
     log_tid_ = txn_id;
-    old_value_ = old_value;
-    update_value_ = update_value;
+    table_id_ = table_id;
     rid_ = rid;
-    // 旧值和新值共用一个 size
-    log_tot_len_ += sizeof(int) + old_value_.size + update_value_.size;
-    log_tot_len_ += sizeof(Rid);
-    table_name_size_ = table_name.length();
-    table_name_ = new char[table_name_size_ + 1];
-    memcpy(table_name_, table_name.c_str(), table_name_size_);
-    table_name_[table_name_size_] = '\0';
-    log_tot_len_ += sizeof(size_t) + table_name_size_;
+    value_size_ = static_cast<uint16_t>(old_value.size);
+    old_value_ = old_value.data;
+    new_value_ = new_value.data;
+    log_tot_len_ += sizeof(int) + sizeof(Rid) + 2 * sizeof(uint16_t);
+    diff(old_value_, new_value_, value_size_, [this](int, int len) {
+      ++num_ranges_;
+      log_tot_len_ += RANGE_HEADER_SIZE + 2 * len;
+    });
   }
 
   // 把 update 日志记录序列化到 dest 中
   void serialize(char* dest) const override {
     LogRecord::serialize(dest);
     int offset = OFFSET_LOG_DATA;
-    memcpy(dest + offset, &old_value_.size, sizeof(int));
+    memcpy(dest + offset, &table_id_, sizeof(int));
     offset += sizeof(int);
-    memcpy(dest + offset, old_value_.data, old_value_.size);
-    offset += old_value_.size;
-    memcpy(dest + offset, update_value_.data, update_value_.size);
-    offset += update_value_.size;
     memcpy(dest + offset, &rid_, sizeof(Rid));
     offset += sizeof(Rid);
-    memcpy(dest + offset, &table_name_size_, sizeof(size_t));
-    offset += sizeof(size_t);
-    memcpy(dest + offset, table_name_, table_name_size_);
-  }
-
-  // 从 src 中反序列化出一条 update 日志记录
+    memcpy(dest + offset, &value_size_, sizeof(uint16_t));
+    offset += sizeof(uint16_t);
+    memcpy(dest + offset, &num_ranges_, sizeof(uint16_t));
+    offset += sizeof(uint16_t);
+    diff(old_value_, new_value_, value_size_,
+         [this, dest, &offset](int range_offset, int len) {
+           uint16_t header[2] = {static_cast<uint16_t>(range_offset),
+                                 static_cast<uint16_t>(len)};
+           memcpy(dest + offset, header, RANGE_HEADER_SIZE);
+           offset += RANGE_HEADER_SIZE;
+           memcpy(dest + offset, old_value_ + range_offset, len);
+           offset += len;
+           memcpy(dest + offset, new_value_ + range_offset, len);
+           offset += len;
+         });
+  }
+
+  // 从 src 中反序列化出一条 update 日志记录，ranges_ 指向 src 中的字节段
   void deserialize(const char* src) override {
     LogRecord::deserialize(src);
-    old_value_.Deserialize(src + OFFSET_LOG_DATA);
-    update_value_.Deserialize(
-        src + OFFSET_LOG_DATA + sizeof(int) + old_value_.size, old_value_.size);
-    int offset =
-        OFFSET_LOG_DATA + sizeof(int) + old_value_.size + update_value_.size;
-    rid_ = *reinterpret_cast<const Rid*>(src + offset);
+    int offset = OFFSET_LOG_DATA;
+    memcpy(&table_id_, src + offset, sizeof(int));
+    offset += sizeof(int);
+    memcpy(&rid_, src + offset, sizeof(Rid));
     offset += sizeof(Rid);
-    table_name_size_ = *reinterpret_cast<const size_t*>(src + offset);
-    offset += sizeof(size_t);
-    table_name_ = new char[table_name_size_ + 1];
-    memcpy(table_name_, src + offset, table_name_size_);
-    table_name_[table_name_size_] = '\0';
+    memcpy(&value_size_, src + offset, sizeof(uint16_t));
+    offset += sizeof(uint16_t);
+    memcpy(&num_ranges_, src + offset, sizeof(uint16_t));
+    offset += sizeof(uint16_t);
+    old_value_ = nullptr;
+    new_value_ = nullptr;
+    ranges_ = src + offset;
   }
 
+  // 在修改前的记录上重做修改，只能在反序列化之后调用
+  void redo(char* record) const { apply(record, true); }
+
+  // 把修改后的记录恢复成修改前的内容，只能在反序列化之后调用
+  void undo(char* record) const { apply(record, false); }
+
   void format_print() override {
     printf("update record\n");
     LogRecord::format_print();
-    printf("old value: %s\n", old_value_.data);
-    printf("update value: %s\n", update_value_.data);
+    printf("value size: %d\n", value_size_);
+    printf("changed ranges: %d\n", num_ranges_);
     printf("update rid: %d, %d\n", rid_.page_no, rid_.slot_no);
-    printf("table name: %s\n", table_name_);
+    printf("table id: %d\n", table_id_);
   }
 
-  inline std::string get_table_name() const { return {table_name_}; }
+  int table_id_;           // 记录所在表的编号
+  Rid rid_;                // 记录的位置
+  uint16_t value_size_;    // 记录的大小
+  uint16_t num_ranges_;    // 修改的字节段数量
+  const char* old_value_;  // 旧的记录，只在构造的日志记录中有效
+  const char* new_value_;  // 新的记录，只在构造的日志记录中有效
+  const char* ranges_;     // 字节段，只在反序列化的日志记录中有效
+
+ private:
+  /**
+   * @description: 找出新旧记录中不同的字节段，间隔不超过段头一半的两段合并
+   * @param {char*} old_value 旧的记录
+   * @param {char*} new_value 新的记录
+   * @param {int} size 记录的大小
+   * @param {F} f 按偏移从小到大对每个字节段调用 f(offset, len)
+   */
+  template <typename F>
+  static void diff(const char* old_value, const char* new_value, int size,
+                   F&& f) {
+    int i = 0;
+    while (i < size) {
+      if (old_value[i] == new_value[i]) {
+        ++i;
+        continue;
+      }
+      int begin = i;
+      int end = i + 1;
+      for (i = end; i < size; ++i) {
+        if (old_value[i] == new_value[i]) {
+          continue;
+        }
+        if (2 * (i - end) > RANGE_HEADER_SIZE) {
+          break;
+        }
+        end = i + 1;
+      }
+      f(begin, end - begin);
+    }
+  }
 
-  RmRecord old_value_;      // 旧的记录
-  RmRecord update_value_;   // 新的记录
-  Rid rid_;                 // 记录删除的位置
-  char* table_name_;        // 删除记录的表名称
-  size_t table_name_size_;  // 表名称的大小
+  void apply(char* record, bool is_redo) const {
+    const char* range = ranges_;
+    for (int i = 0; i < num_ranges_; ++i) {
+      uint16_t header[2];
+      memcpy(header, range, RANGE_HEADER_SIZE);
+      range += RANGE_HEADER_SIZE;
+      memcpy(record + header[0], is_redo ? range + header[1] : range,
+             header[1]);
+      range += 2 * header[1];
+    }
+  }
 };
 
-/* 日志缓冲区，只有一个buffer，因此需要阻塞地去把日志写入缓冲区中 */
+/* 恢复时读日志用的缓冲区 */
 
 class LogBuffer {
  public:
@@ -433,58 +592,160 @@ class LogBuffer {
   uint32_t offset_;  // 写入 log 的 offset
 };
 
-/* 日志管理器，负责把日志写入日志缓冲区，以及把日志缓冲区中的内容写入磁盘中 */
+static_assert((LOG_RING_SIZE & (LOG_RING_SIZE - 1)) == 0 &&
+                  (LOG_RING_SLOTS & (LOG_RING_SLOTS - 1)) == 0,
+              "log ring size and slots must be powers of two");
+// 每条日志至少占一个日志头，起始位置相差不到 16 字节的两条日志不会共用槽位
+static_assert(LOG_HEADER_SIZE >= 16 && LOG_RING_SLOTS * 16 == LOG_RING_SIZE,
+              "not enough log ring slots");
+
+/**
+ * 日志管理器，负责把日志写入日志缓冲区，以及把日志缓冲区中的内容写入磁盘中。
+ *
+ * 日志的 lsn 就是它在日志流中的起始位置。日志缓冲区是一个环形缓冲区，
+ * 写日志不加锁：一次 fetch_add 分配日志流中的一段空间，也就分配了 lsn，
+ * 各线程并行地把日志拷贝进自己的空间，再在起始位置对应的槽位上发布这条日志的
+ * 结束位置。刷盘时从上次刷到的位置开始沿槽位往后找，只把已经全部写完的前缀
+ * 写入日志段文件，persist_lsn_ 也只推进到这个前缀。
+ * 缓冲区是两个 LOG_BUFFER_SIZE，写满一半时唤醒后台线程去刷这一半，
+ * 其他线程继续写另一半；空间不够时写日志的线程自己帮忙刷盘。
+ *
+ * 提交的事务调用 wait_for_flush 等自己的 commit 日志持久化，后台的日志写线程
+ * 被唤醒后再等一个组提交窗口，把这段时间内所有事务的日志一次写入并
+ * fdatasync，然后唤醒所有已经持久化的等待者。
+ *
+ * 新建日志段要写满 LOG_SEGMENT_SIZE 并 fsync，日志开始写一个日志段时，
+ * 另一个后台线程就预先创建下一个，刷盘时不用等日志段创建
+ */
 class LogManager {
  public:
   explicit LogManager(DiskManager* disk_manager)
       : disk_manager_(disk_manager),
         run_background_thread_(true),
-        log_flush_interval_(std::chrono::seconds(1)) {
+        log_flush_interval_(std::chrono::seconds(1)),
+        group_commit_wait_(GROUP_COMMIT_WAIT_US),
+        ring_(new char[LOG_RING_SIZE]),
+        slots_(new std::atomic<uint64_t>[LOG_RING_SLOTS]) {
+    // 结束位置不大于起始位置的槽位是旧的，还没有日志发布
+    for (uint32_t i = 0; i < LOG_RING_SLOTS; ++i) {
+      slots_[i].store(0);
+    }
     background_thread_ = std::thread([this] { background_flush(); });
+    segment_thread_ = std::thread([this] { background_prepare_segment(); });
   }
 
   ~LogManager() {
     {
-      std::lock_guard lock(latch_);
+      std::lock_guard lock(group_latch_);
       run_background_thread_ = false;
     }
     cv_.notify_one();
+    segment_cv_.notify_one();
     if (background_thread_.joinable()) {
       background_thread_.join();
     }
+    if (segment_thread_.joinable()) {
+      segment_thread_.join();
+    }
   }
 
   lsn_t add_log_to_buffer(LogRecord* log_record);
 
   void flush_log_to_disk();
 
-  inline LogBuffer* get_log_buffer() { return &log_buffer_; }
-  inline lsn_t get_persist_lsn() const { return persist_lsn_; }
-  inline void set_global_lsn(lsn_t global_lsn) {
-    global_lsn_.store(global_lsn);
+  void wait_for_flush(lsn_t lsn);
+
+  inline lsn_t get_persist_lsn() const { return persist_lsn_.load(); }
+  // 只在恢复时、还没有写日志之前调用
+  void set_global_lsn(lsn_t global_lsn);
+  // 回收 lsn 所在日志段之前的日志段，调用者保证恢复不再需要它们
+  void recycle_log(lsn_t lsn) { disk_manager_->recycle_log(lsn); }
+  inline void set_persist_lsn(lsn_t persist_lsn) {
+    persist_lsn_.store(persist_lsn);
+  }
+  // 组提交窗口越长，一次刷盘合并的事务越多，单个事务的提交延迟也越高
+  inline void set_group_commit_wait(std::chrono::microseconds wait) {
+    std::lock_guard lock(group_latch_);
+    group_commit_wait_ = wait;
   }
-  inline void set_persist_lsn(lsn_t persist_lsn) { persist_lsn_ = persist_lsn; }
 
  private:
+  // 日志写线程：有提交在等待时等一个组提交窗口后刷盘，否则按间隔定期刷盘
   void background_flush() {
-    std::unique_lock lk(latch_);
+    std::unique_lock lk(group_latch_);
     while (run_background_thread_) {
-      if (cv_.wait_for(lk, log_flush_interval_,
-                       [this] { return !run_background_thread_; })) {
+      cv_.wait_for(lk, log_flush_interval_, [this] {
+        return !run_background_thread_ ||
+               flush_request_lsn_ > persist_lsn_.load();
+      });
+      if (!run_background_thread_) {
         break;
       }
+      if (flush_request_lsn_ > persist_lsn_.load() &&
+          group_commit_wait_.count() > 0) {
+        cv_.wait_for(lk, group_commit_wait_, [this] {
+          return !run_background_thread_ ||
+                 num_waiters_ >= GROUP_COMMIT_BATCH_SIZE;
+        });
+      }
+      lk.unlock();
       flush_log_to_disk();
+      lk.lock();
+    }
+  }
+
+  // 预先创建日志段的线程：创建 next_segment_，失败时写日志的线程再自己创建。
+  // 退出之前先做完已经请求的创建
+  void background_prepare_segment() {
+    std::unique_lock lk(group_latch_);
+    int64_t prepared = -1;
+    while (true) {
+      segment_cv_.wait(lk, [this, &prepared] {
+        return !run_background_thread_ || next_segment_ > prepared;
+      });
+      if (next_segment_ <= prepared) {
+        break;
+      }
+      prepared = next_segment_;
+      lk.unlock();
+      try {
+        disk_manager_->prepare_log_segment(prepared);
+      } catch (RMDBError&) {
+      }
+      lk.lock();
     }
   }
 
-  std::condition_variable cv_;
+  void wait_for_space(uint64_t end);
+
+  std::atomic<uint64_t>& slot(uint64_t begin) {
+    return slots_[(begin >> 4) & (LOG_RING_SLOTS - 1)];
+  }
+
+  bool flush_written();
+
+  void write_ring(uint64_t begin, uint64_t end);
+
+  DiskManager* disk_manager_;
+  std::condition_variable cv_;          // 唤醒日志写线程
+  std::condition_variable flushed_cv_;  // 唤醒等待刷盘的提交
+  std::mutex group_latch_;              // 保护组提交的状态
   std::thread background_thread_;
+  std::thread segment_thread_;
+  std::condition_variable segment_cv_;  // 唤醒预先创建日志段的线程
+  int64_t next_segment_{-1};            // 需要预先创建的日志段
   bool run_background_thread_{};
   std::chrono::seconds log_flush_interval_{};
-
-  std::atomic<lsn_t> global_lsn_{0};  // 全局lsn，递增，用于为每条记录分发lsn
-  std::mutex latch_;                  // 用于对log_buffer_的互斥访问
-  LogBuffer log_buffer_;              // 日志缓冲区
-  lsn_t persist_lsn_{};  // 记录已经持久化到磁盘中的最后一条日志的日志号
-  DiskManager* disk_manager_;
+  std::chrono::microseconds group_commit_wait_{};
+  lsn_t flush_request_lsn_{INVALID_LSN};  // 等待者要求持久化到的最大 lsn
+  int num_waiters_{0};                    // 等待刷盘的提交数量
+
+  std::atomic<uint64_t> reserve_{0};  // 下一条日志在日志流中的位置
+  std::unique_ptr<char[]> ring_;  // 环形日志缓冲区，位置对 LOG_RING_SIZE 取模
+  // 按起始位置对应的槽位，存放这条日志的结束位置
+  std::unique_ptr<std::atomic<uint64_t>[]> slots_;
+  std::atomic<uint64_t> flushed_pos_{0};  // 已经刷盘的日志流位置
+  std::mutex flush_latch_;  // 同一时间只有一个线程刷盘
+  // 记录已经持久化到磁盘中的最后一条日志的日志号
+  std::atomic<lsn_t> persist_lsn_{INVALID_LSN};
 };
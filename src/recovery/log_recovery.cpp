@@ -10,287 +10,363 @@ See the Mulan PSL v2 for more details. */
 
 #include "log_recovery.h"
 
+#include <exception>
+#include <future>
+#include <iostream>
+#include <map>
+#include <mutex>
 #include <queue>
+#include <tuple>
+#include <utility>
 
+#include "common/thread_pool.h"
+#include "record/rm_manager.h"
+#include "recovery/checkpoint_manager.h"
 #include "transaction/transaction_manager.h"
 
+namespace {
+
+// 日志头的 lsn 是它在日志流中的位置，长度在合理范围内，才可能是一条有效的日志
+bool is_valid_header(const LogRecord& header, lsn_t lsn) {
+  return header.lsn_ == lsn && header.log_tot_len_ >= LOG_HEADER_SIZE &&
+         header.log_tot_len_ <= LOG_BUFFER_SIZE;
+}
+
+bool is_valid_checksum(const char* log_data, uint32_t len) {
+  uint32_t checksum;
+  memcpy(&checksum, log_data + OFFSET_LOG_CHECKSUM, sizeof(uint32_t));
+  return checksum == log_checksum(log_data, len);
+}
+
+}  // namespace
+
 /**
- * @description: analyze阶段，需要获得脏页表（DPT）和未完成的事务列表（ATT）
+ * @description: analyze阶段，需要获得脏页表（DPT）和未完成的事务列表（ATT）。
+ * 主记录指向最近完成的检查点，从它的结束记录得到脏页表，从检查点需要的最早
+ * 一条日志开始往后分析，遇到第一条无效的日志（lsn 不是它的位置或者校验和不对）
+ * 就是日志流的末尾。检查点开始之前的修改只有所在页面在检查点的脏页表中、
+ * 且不早于页面的 rec_lsn 时才需要重做。需要重做的日志按表分组，每组由
+ * 一个线程重做
  */
 void RecoveryManager::analyze() {
   // 逻辑递增，txn_id 和 lsn 都要恢复到 crash 前的状态
   lsn_t max_lsn = INVALID_LSN;
   txn_id_t max_txn_id = INVALID_TXN_ID;
-  std::size_t log_offset = 0;
-  // 这里返回的read_bytes <= LOG_BUFFER_SIZE
-  size_t read_bytes;
+  // 没有检查点时从日志流的开头分析，所有修改都要重做
+  lsn_t log_offset = 0;
+  lsn_t checkpoint_lsn = INVALID_LSN;
+  lsn_t end_checkpoint_lsn = CheckpointManager::read_master_record();
+  if (end_checkpoint_lsn != INVALID_LSN) {
+    // 结束记录可能拆成了多条，从最后一条沿 prev_lsn_ 往前读
+    log_offset = end_checkpoint_lsn;
+    std::vector<char> buf;
+    for (lsn_t lsn = end_checkpoint_lsn; lsn != INVALID_LSN;) {
+      read_log(lsn, &buf);
+      EndCheckpointLogRecord log;
+      log.deserialize(buf.data());
+      if (log.log_type_ != END_CHECKPOINT ||
+          (checkpoint_lsn != INVALID_LSN && log.begin_lsn_ != checkpoint_lsn)) {
+        throw InternalError("RecoveryManager::analyze: bad master record");
+      }
+      checkpoint_lsn = log.begin_lsn_;
+      // 活跃事务从 begin 日志开始都会被分析到，不用检查点中的最后一条日志
+      log_offset = std::min(log_offset, log.min_lsn());
+      for (auto& page : log.dirty_pages_) {
+        dirty_page_table_.emplace(page_key(page.table_id, page.page_no),
+                                  page.rec_lsn);
+      }
+      lsn = log.prev_lsn_;
+    }
+  }
+  // 修改记录的 lsn 和页面，扫描完之后再用检查点的脏页表筛选
+  struct PageLog {
+    lsn_t lsn;
+    int table_id;
+    page_id_t page_no;
+  };
+  std::vector<PageLog> page_logs;
 
-  while ((read_bytes = disk_manager_->read_log(buffer_.buffer_, LOG_BUFFER_SIZE,
-                                               log_offset)) > 0) {
+  // 这里返回的read_bytes <= LOG_BUFFER_SIZE
+  uint32_t read_bytes;
+  bool end_of_log = false;
+  while (!end_of_log &&
+         (read_bytes = disk_manager_->read_log(
+              buffer_.buffer_, LOG_BUFFER_SIZE, log_offset)) > 0) {
+    buffer_.offset_ = 0;
     while (buffer_.offset_ + LOG_HEADER_SIZE <= read_bytes) {
-      // 获取日志长度
-      auto& log_size = *reinterpret_cast<const uint32_t*>(
-          buffer_.buffer_ + buffer_.offset_ + OFFSET_LOG_TOT_LEN);
+      auto* log_data = buffer_.buffer_ + buffer_.offset_;
+      LogRecord header;
+      header.deserialize(log_data);
+      if (!is_valid_header(header, log_offset + buffer_.offset_)) {
+        end_of_log = true;
+        break;
+      }
       // 日志完整内容需要从下次 read 中获取
-      if (log_size > read_bytes - buffer_.offset_) {
+      if (header.log_tot_len_ > read_bytes - buffer_.offset_) {
         break;
       }
-
-      auto& log_type = *reinterpret_cast<const LogType*>(
-          buffer_.buffer_ + buffer_.offset_ + OFFSET_LOG_TYPE);
-      switch (log_type) {
-        case BEGIN: {
-          auto* log = new BeginLogRecord;
-          log->deserialize(buffer_.buffer_ + buffer_.offset_);
-          active_txn_.emplace(log->log_tid_, log->lsn_);
-          // 在 log 文件中的 offset
-          lsn_mapping_.emplace(log->lsn_, log_offset + buffer_.offset_);
-          buffer_.offset_ += log->log_tot_len_;
-
-          // 找到 txn 和 lsn 最后的状态
-          max_lsn = std::max(max_lsn, log->lsn_);
-          max_txn_id = std::max(max_txn_id, log->log_tid_);
-
-          delete log;
+      // 日志段中残留的旧日志，或者崩溃时没有写完的日志
+      if (!is_valid_checksum(log_data, header.log_tot_len_)) {
+        end_of_log = true;
+        break;
+      }
+      buffer_.offset_ += header.log_tot_len_;
+      // 找到 txn 和 lsn 最后的状态
+      max_lsn = header.lsn_;
+      max_txn_id = std::max(max_txn_id, header.log_tid_);
+
+      switch (header.log_type_) {
+        case BEGIN:
+          active_txn_.emplace(header.log_tid_, header.lsn_);
           break;
-        }
-        case COMMIT: {
-          auto* log = new CommitLogRecord;
-          log->deserialize(buffer_.buffer_ + buffer_.offset_);
+        case COMMIT:
+        case ABORT:
           // 提交了则持久化到磁盘中了，不需要恢复
-          active_txn_.erase(log->log_tid_);
-          // 在 log 文件中的 offset
-          lsn_mapping_.emplace(log->lsn_, log_offset + buffer_.offset_);
-          buffer_.offset_ += log->log_tot_len_;
-          // 找到 txn 和 lsn 最后的状态
-          max_lsn = std::max(max_lsn, log->lsn_);
-          max_txn_id = std::max(max_txn_id, log->log_tid_);
-
-          delete log;
-          break;
-        }
-        case ABORT: {
-          auto* log = new AbortLogRecord;
-          log->deserialize(buffer_.buffer_ + buffer_.offset_);
-          active_txn_.erase(log->log_tid_);
-          // 在 log 文件中的 offset
-          lsn_mapping_.emplace(log->lsn_, log_offset + buffer_.offset_);
-          buffer_.offset_ += log->log_tot_len_;
-          // 找到 txn 和 lsn 最后的状态
-          max_lsn = std::max(max_lsn, log->lsn_);
-          max_txn_id = std::max(max_txn_id, log->log_tid_);
-
-          delete log;
+          active_txn_.erase(header.log_tid_);
           break;
-        }
-        case INSERT: {
-          auto* log = new InsertLogRecord;
-          log->deserialize(buffer_.buffer_ + buffer_.offset_);
-          // emplace 如果存在会插入失败，用下标插入
-          active_txn_[log->log_tid_] = log->lsn_;
-          // 在 log 文件中的 offset
-          lsn_mapping_.emplace(log->lsn_, log_offset + buffer_.offset_);
-
-          auto fh = sm_manager_->fhs_.at(log->table_name_).get();
-          // 如果新建页面一次都没有落盘，可能会不存在
-          try {
-            fh->fetch_page_handle(log->rid_.page_no);
-          } catch (RMDBError& e) {
-            // throw InternalError(e.what());
-            fh->create_new_page_handle();
-          }
-          auto&& rm_page_handle = fh->fetch_page_handle(log->rid_.page_no);
-          // 判断需要 redo
-          if (rm_page_handle.page->get_page_lsn() < log->lsn_) {
-            dirty_page_table_.emplace_back(log->lsn_);
-            rm_page_handle.page->set_page_lsn(log->lsn_);
-          }
-          buffer_pool_manager_->unpin_page(rm_page_handle.page->get_page_id(),
-                                           true);
-          buffer_pool_manager_->unpin_page(rm_page_handle.page->get_page_id(),
-                                           true);
-
-          buffer_.offset_ += log->log_tot_len_;
-
-          // 找到 txn 和 lsn 最后的状态
-          max_lsn = std::max(max_lsn, log->lsn_);
-          max_txn_id = std::max(max_txn_id, log->log_tid_);
-
-          delete log;
-          break;
-        }
+        case INSERT:
         case DELETE: {
-          auto* log = new DeleteLogRecord;
-          log->deserialize(buffer_.buffer_ + buffer_.offset_);
+          TupleLogRecord log(header.log_type_);
+          log.deserialize(log_data);
           // emplace 如果存在会插入失败，用下标插入
-          active_txn_[log->log_tid_] = log->lsn_;
-          // 在 log 文件中的 offset
-          lsn_mapping_.emplace(log->lsn_, log_offset + buffer_.offset_);
-
-          auto fh = sm_manager_->fhs_.at(log->table_name_).get();
-          // 如果新建页面一次都没有落盘，可能会不存在
-          try {
-            fh->fetch_page_handle(log->rid_.page_no);
-          } catch (RMDBError& e) {
-            // throw InternalError(e.what());
-            fh->create_new_page_handle();
-          }
-          auto&& rm_page_handle = fh->fetch_page_handle(log->rid_.page_no);
-          // 判断需要 redo
-          if (rm_page_handle.page->get_page_lsn() < log->lsn_) {
-            dirty_page_table_.emplace_back(log->lsn_);
-            rm_page_handle.page->set_page_lsn(log->lsn_);
-          }
-          buffer_pool_manager_->unpin_page(rm_page_handle.page->get_page_id(),
-                                           true);
-          buffer_pool_manager_->unpin_page(rm_page_handle.page->get_page_id(),
-                                           true);
-
-          buffer_.offset_ += log->log_tot_len_;
-
-          // 找到 txn 和 lsn 最后的状态
-          max_lsn = std::max(max_lsn, log->lsn_);
-          max_txn_id = std::max(max_txn_id, log->log_tid_);
-
-          delete log;
+          active_txn_[log.log_tid_] = log.lsn_;
+          page_logs.push_back({log.lsn_, log.table_id_, log.rid_.page_no});
           break;
         }
         case UPDATE: {
-          auto* log = new UpdateLogRecord;
-          log->deserialize(buffer_.buffer_ + buffer_.offset_);
-          // emplace 如果存在会插入失败，用下标插入
-          active_txn_[log->log_tid_] = log->lsn_;
-          // 在 log 文件中的 offset
-          lsn_mapping_.emplace(log->lsn_, log_offset + buffer_.offset_);
-
-          auto fh = sm_manager_->fhs_.at(log->table_name_).get();
-          // 如果新建页面一次都没有落盘，可能会不存在
-          try {
-            fh->fetch_page_handle(log->rid_.page_no);
-          } catch (RMDBError& e) {
-            // throw InternalError(e.what());
-            fh->create_new_page_handle();
-          }
-          auto&& rm_page_handle = fh->fetch_page_handle(log->rid_.page_no);
-          // 判断需要 redo
-          if (rm_page_handle.page->get_page_lsn() < log->lsn_) {
-            dirty_page_table_.emplace_back(log->lsn_);
-            rm_page_handle.page->set_page_lsn(log->lsn_);
-          }
-          buffer_pool_manager_->unpin_page(rm_page_handle.page->get_page_id(),
-                                           true);
-          buffer_pool_manager_->unpin_page(rm_page_handle.page->get_page_id(),
-                                           true);
-
-          buffer_.offset_ += log->log_tot_len_;
-
-          // 找到 txn 和 lsn 最后的状态
-          max_lsn = std::max(max_lsn, log->lsn_);
-          max_txn_id = std::max(max_txn_id, log->log_tid_);
-
-          delete log;
+          UpdateLogRecord log;
+          log.deserialize(log_data);
+          active_txn_[log.log_tid_] = log.lsn_;
+          page_logs.push_back({log.lsn_, log.table_id_, log.rid_.page_no});
           break;
         }
         default:
           break;
       }
     }
-    // read_bytes - (read_bytes - offset)
+    // 日志段不存在时读到的内容不满一条日志，也到了末尾
+    if (buffer_.offset_ == 0) {
+      end_of_log = true;
+    }
     log_offset += buffer_.offset_;
-    buffer_.offset_ = 0;
-    memset(buffer_.buffer_, 0, sizeof(LOG_BUFFER_SIZE));
   }
-  log_manager_->set_global_lsn(max_lsn + 1);
+
+  // 检查点开始之后的修改一定要重做，把它们的页面补进脏页表
+  for (auto& page_log : page_logs) {
+    if (checkpoint_lsn == INVALID_LSN || page_log.lsn >= checkpoint_lsn) {
+      auto [it, inserted] = dirty_page_table_.emplace(
+          page_key(page_log.table_id, page_log.page_no), page_log.lsn);
+      if (!inserted) {
+        it->second = std::min(it->second, page_log.lsn);
+      }
+    }
+  }
+  for (auto& page_log : page_logs) {
+    auto it =
+        dirty_page_table_.find(page_key(page_log.table_id, page_log.page_no));
+    if (it != dirty_page_table_.end() && page_log.lsn >= it->second) {
+      redo_streams_[page_log.table_id].push_back(page_log.lsn);
+    }
+  }
+
+  clear_log_tail(log_offset);
+  log_manager_->set_global_lsn(log_offset);
   log_manager_->set_persist_lsn(max_lsn);
   transaction_manager_->set_next_txn_id(max_txn_id + 1);
 }
 
 /**
- * @description: 重做所有未落盘的操作
+ * @description: 清掉日志流末尾之后崩溃前没有刷完的日志，它们最多有
+ * LOG_RING_SIZE 字节。不清掉的话，之后接着写的日志恰好在某条旧日志的位置
+ * 结束时，这条旧日志会在下次恢复时被当成有效的日志
+ * @param {lsn_t} end_lsn 日志流的末尾
+ */
+void RecoveryManager::clear_log_tail(lsn_t end_lsn) {
+  std::vector<char> zeros(LOG_RING_SIZE);
+  disk_manager_->write_log(zeros.data(), LOG_RING_SIZE, end_lsn);
+  disk_manager_->sync_log();
+}
+
+/**
+ * @description: 从日志段中读出一条日志，日志必须是有效的
+ * @param {lsn_t} lsn 日志的 lsn
+ * @param {vector<char>*} buf 存放日志
+ */
+void RecoveryManager::read_log(lsn_t lsn, std::vector<char>* buf) {
+  buf->resize(LOG_HEADER_SIZE);
+  LogRecord header{};
+  header.lsn_ = INVALID_LSN;
+  if (disk_manager_->read_log(buf->data(), LOG_HEADER_SIZE, lsn) ==
+      LOG_HEADER_SIZE) {
+    header.deserialize(buf->data());
+  }
+  if (!is_valid_header(header, lsn)) {
+    throw InternalError("RecoveryManager::read_log: bad log record");
+  }
+  int len = static_cast<int>(header.log_tot_len_);
+  buf->resize(len);
+  if (disk_manager_->read_log(buf->data() + LOG_HEADER_SIZE,
+                              len - LOG_HEADER_SIZE, lsn + LOG_HEADER_SIZE) !=
+          len - LOG_HEADER_SIZE ||
+      !is_valid_checksum(buf->data(), len)) {
+    throw InternalError("RecoveryManager::read_log: bad log record");
+  }
+}
+
+/**
+ * @description: 判断页面上是否还没有 lsn 的修改，没有时先把 page_lsn 推进到
+ * lsn，再由调用者重做
+ * @return {bool} 是否需要重做
+ * @param {RmFileHandle*} fh 表的文件句柄
+ * @param {page_id_t} page_no 日志修改的页面
+ * @param {lsn_t} lsn 日志的 lsn
+ */
+bool RecoveryManager::need_redo(RmFileHandle* fh, page_id_t page_no,
+                                lsn_t lsn) {
+  // 如果新建页面一次都没有落盘，可能会不存在
+  try {
+    fh->fetch_page_handle(page_no);
+  } catch (RMDBError& e) {
+    fh->create_new_page_handle();
+  }
+  auto&& rm_page_handle = fh->fetch_page_handle(page_no);
+  bool redo = rm_page_handle.page->get_page_lsn() < lsn;
+  if (redo) {
+    rm_page_handle.page->set_page_lsn(lsn);
+  }
+  buffer_pool_manager_->unpin_page(rm_page_handle.page->get_page_id(), true);
+  buffer_pool_manager_->unpin_page(rm_page_handle.page->get_page_id(), true);
+  return redo;
+}
+
+/**
+ * @description: 重做所有未落盘的操作。不同表的日志在线程池上并行重做，
+ * 表的文件头、空闲页链表和索引都只属于一张表，同一张表的日志按 lsn 顺序重做
  */
 void RecoveryManager::redo() {
-  for (auto& lsn : dirty_page_table_) {
-    int log_offset = lsn_mapping_[lsn];
-    disk_manager_->read_log(buffer_.buffer_, LOG_BUFFER_SIZE, log_offset);
+  std::vector<const std::vector<lsn_t>*> streams;
+  streams.reserve(redo_streams_.size());
+  for (auto& [_, lsns] : redo_streams_) {
+    std::ignore = _;
+    streams.push_back(&lsns);
+  }
+  std::mutex error_latch;
+  std::exception_ptr error;
+  auto run = [&](std::size_t i) {
+    try {
+      redo_table(*streams[i]);
+    } catch (...) {
+      std::lock_guard lock(error_latch);
+      if (error == nullptr) {
+        error = std::current_exception();
+      }
+    }
+  };
+  // 调用线程自己也承担一张表
+  std::vector<std::future<void> > tasks;
+  for (std::size_t i = 1; i < streams.size(); ++i) {
+    tasks.emplace_back(ThreadPool::instance().submit(run, i));
+  }
+  if (!streams.empty()) {
+    run(0);
+  }
+  for (auto& task : tasks) {
+    ThreadPool::wait(task);
+  }
+  if (error != nullptr) {
+    std::rethrow_exception(error);
+  }
+}
+
+/**
+ * @description: 按 lsn 顺序重做一张表的日志，页面上已经有的修改跳过
+ * @param {vector<lsn_t>&} lsns 表上需要重做的日志
+ */
+void RecoveryManager::redo_table(const std::vector<lsn_t>& lsns) {
+  std::vector<char> buf;
+  // 索引操作要用事务记下加过 latch 的页面，每个线程各用一个
+  Transaction transaction(transaction_.get_transaction_id());
+  for (auto lsn : lsns) {
+    read_log(lsn, &buf);
     auto& log_type =
-        *reinterpret_cast<const LogType*>(buffer_.buffer_ + OFFSET_LOG_TYPE);
+        *reinterpret_cast<const LogType*>(buf.data() + OFFSET_LOG_TYPE);
     switch (log_type) {
       case INSERT: {
-        auto log = new InsertLogRecord;
-        log->deserialize(buffer_.buffer_);
+        InsertLogRecord log;
+        log.deserialize(buf.data());
 
         // redo 记录
-        auto fh = sm_manager_->fhs_.at(log->table_name_).get();
-        fh->insert_record(log->rid_, log->insert_value_.data);
+        auto& tab = sm_manager_->db_.get_table(log.table_id_);
+        auto fh = sm_manager_->fhs_.at(tab.name).get();
+        if (!need_redo(fh, log.rid_.page_no, lsn)) {
+          break;
+        }
+        fh->insert_record(log.rid_, const_cast<char*>(log.value_));
 
         // redo 索引
-        auto& indexes = sm_manager_->db_.get_table(log->table_name_).indexes;
+        auto& indexes = tab.indexes;
         for (auto& [index_name, index_meta] : indexes) {
-          char* key = new char[index_meta.col_tot_len];
+          char* key = new char[index_meta.key_len];
           auto& ih = sm_manager_->ihs_.at(index_name);
-          for (auto& [offset, col_meta] : index_meta.cols) {
-            memcpy(key + offset, log->insert_value_.data + col_meta.offset,
-                   col_meta.len);
-          }
-          ih->insert_entry(key, log->rid_, &transaction_);
+          index_meta.get_key(log.value_, log.rid_, key);
+          ih->insert_entry(key, log.rid_, &transaction);
           delete[] key;
         }
-
-        delete log;
         break;
       }
       case DELETE: {
-        auto log = new DeleteLogRecord;
-        log->deserialize(buffer_.buffer_);
+        DeleteLogRecord log;
+        log.deserialize(buf.data());
 
-        auto fh = sm_manager_->fhs_.at(log->table_name_).get();
+        auto& tab = sm_manager_->db_.get_table(log.table_id_);
+        auto fh = sm_manager_->fhs_.at(tab.name).get();
+        if (!need_redo(fh, log.rid_.page_no, lsn)) {
+          break;
+        }
         try {
-          fh->delete_record(log->rid_, nullptr);
+          fh->delete_record(log.rid_, nullptr);
         } catch (RecordNotFoundError& e) {
         }
 
         // redo 索引
-        auto& indexes = sm_manager_->db_.get_table(log->table_name_).indexes;
+        auto& indexes = tab.indexes;
         for (auto& [index_name, index_meta] : indexes) {
-          char* key = new char[index_meta.col_tot_len];
+          char* key = new char[index_meta.key_len];
           auto& ih = sm_manager_->ihs_.at(index_name);
-          for (auto& [offset, col_meta] : index_meta.cols) {
-            memcpy(key + offset, log->delete_value_.data + col_meta.offset,
-                   col_meta.len);
-          }
-          ih->delete_entry(key, &transaction_);
+          index_meta.get_key(log.value_, log.rid_, key);
+          ih->delete_entry(key, &transaction);
           delete[] key;
         }
-
-        delete log;
         break;
       }
       case UPDATE: {
-        auto log = new UpdateLogRecord;
-        log->deserialize(buffer_.buffer_ + buffer_.offset_);
+        UpdateLogRecord log;
+        log.deserialize(buf.data());
 
-        auto fh = sm_manager_->fhs_.at(log->table_name_).get();
-        fh->update_record(log->rid_, log->update_value_.data, nullptr);
+        // 日志中只有修改的字节段，在堆上的记录上重做得到新记录
+        auto& tab = sm_manager_->db_.get_table(log.table_id_);
+        auto fh = sm_manager_->fhs_.at(tab.name).get();
+        if (!need_redo(fh, log.rid_.page_no, lsn)) {
+          break;
+        }
+        auto old_record = fh->get_record(log.rid_, nullptr);
+        RmRecord update_record(*old_record);
+        log.redo(update_record.data);
+        fh->update_record(log.rid_, update_record.data, nullptr);
 
         // redo 索引
-        auto& indexes = sm_manager_->db_.get_table(log->table_name_).indexes;
+        auto& indexes = tab.indexes;
         for (auto& [index_name, index_meta] : indexes) {
-          char* old_key = new char[index_meta.col_tot_len];
-          char* new_key = new char[index_meta.col_tot_len];
+          char* old_key = new char[index_meta.key_len];
+          char* new_key = new char[index_meta.key_len];
           auto& ih = sm_manager_->ihs_.at(index_name);
-          for (auto& [offset, col_meta] : index_meta.cols) {
-            memcpy(old_key + offset, log->old_value_.data + col_meta.offset,
-                   col_meta.len);
-            memcpy(new_key + offset, log->update_value_.data + col_meta.offset,
-                   col_meta.len);
-          }
-          ih->delete_entry(old_key, &transaction_);
-          ih->insert_entry(new_key, log->rid_, &transaction_);
+          index_meta.get_key(old_record->data, log.rid_, old_key);
+          index_meta.get_key(update_record.data, log.rid_, new_key);
+          ih->delete_entry(old_key, &transaction);
+          ih->insert_entry(new_key, log.rid_, &transaction);
           delete[] old_key;
           delete[] new_key;
         }
-
-        delete log;
         break;
       }
       default:
@@ -300,9 +376,133 @@ void RecoveryManager::redo() {
 }
 
 /**
- * @description: 回滚未完成的事务
+ * @description: 回滚未完成的事务。先替它们重新加上记录上的 X 锁、挂上修改
+ * 之前的版本，再交给后台线程回滚，服务端不用等回滚结束就能接受连接
  */
 void RecoveryManager::undo() {
+  // 已经锁住的 (索引名, 唯一键)，每个键只由一个失败者加锁
+  std::set<std::pair<std::string, std::string> > locked_keys;
+  for (auto& [txn_id, lsn] : active_txn_) {
+    auto& txn = losers_[txn_id];
+    txn = std::make_unique<Transaction>(txn_id);
+    txn->set_prev_lsn(lsn);
+    lock_loser(txn.get(), lsn, &locked_keys);
+    transaction_manager_->add_recovering_txn(txn.get());
+  }
+  if (!losers_.empty()) {
+    undo_thread_ = std::thread([this] {
+      try {
+        undo_losers();
+      } catch (RMDBError& e) {
+        // 和启动时恢复失败一样退出，不能带着回滚了一半的事务继续服务
+        std::cerr << e.what() << std::endl;
+        exit(1);
+      }
+    });
+  }
+}
+
+/**
+ * @description: 沿 prev_lsn 链给未完成的事务重新加锁。事务的 id 比重启后的
+ * 事务都小，与它冲突的新事务会回滚而不是等待。事务删除或改掉的唯一键回滚时要
+ * 重新插入索引，给这些键加间隙 X 锁，新事务不能先插入相同的键。
+ * 快照读不加锁，给它挂上修改之前的版本
+ * @param {Transaction*} txn 未完成的事务
+ * @param {lsn_t} last_lsn 事务的最后一条日志
+ * @param {set*} locked_keys 已经被其他失败者锁住的唯一键
+ */
+void RecoveryManager::lock_loser(
+    Transaction* txn, lsn_t last_lsn,
+    std::set<std::pair<std::string, std::string> >* locked_keys) {
+  auto* lock_manager = transaction_manager_->get_lock_manager();
+  std::vector<char> buf;
+  // (fd, page_no, slot_no) -> 事务第一次修改之前的记录，为空表示原来不存在。
+  // 从后往前遍历，每遇到一条修改就把前像往前推一步
+  std::map<std::tuple<int, int, int>, std::unique_ptr<RmRecord> > images;
+  for (lsn_t lsn = last_lsn; lsn != INVALID_LSN;) {
+    read_log(lsn, &buf);
+    LogRecord header;
+    header.deserialize(buf.data());
+    // 最后遍历到的是 begin 日志，回滚结束之前它之后的日志段都不能回收
+    txn->set_first_lsn(lsn);
+    lsn = header.prev_lsn_;
+    if (header.log_type_ != INSERT && header.log_type_ != DELETE &&
+        header.log_type_ != UPDATE) {
+      continue;
+    }
+
+    int table_id;
+    Rid rid;
+    std::unique_ptr<RmRecord> image;
+    if (header.log_type_ == UPDATE) {
+      UpdateLogRecord log;
+      log.deserialize(buf.data());
+      table_id = log.table_id_;
+      rid = log.rid_;
+    } else {
+      TupleLogRecord log(header.log_type_);
+      log.deserialize(buf.data());
+      table_id = log.table_id_;
+      rid = log.rid_;
+      if (header.log_type_ == DELETE) {
+        image = std::make_unique<RmRecord>(log.value_size_,
+                                           const_cast<char*>(log.value_));
+      }
+    }
+    auto& tab = sm_manager_->db_.get_table(table_id);
+    auto fh = sm_manager_->fhs_.at(tab.name).get();
+    lock_manager->lock_IX_on_table(txn, fh->GetFd());
+    lock_manager->lock_exclusive_on_record(txn, rid, fh->GetFd());
+
+    auto key = std::make_tuple(fh->GetFd(), rid.page_no, rid.slot_no);
+    auto it = images.find(key);
+    if (header.log_type_ == UPDATE) {
+      // 更新之后的记录是后一条修改的前像，没有后一条修改时就是堆上的记录
+      if (it != images.end() && it->second != nullptr) {
+        image = std::make_unique<RmRecord>(*it->second);
+      } else {
+        image = fh->get_record(rid, nullptr);
+      }
+      UpdateLogRecord log;
+      log.deserialize(buf.data());
+      log.undo(image->data);
+    }
+    // 删除和更新之前的记录，它的唯一键回滚时会重新插入
+    if (image != nullptr) {
+      for (auto& [index_name, index_meta] : tab.indexes) {
+        if (!index_meta.unique) {
+          continue;
+        }
+        std::string index_key(index_meta.key_len, '\0');
+        index_meta.get_key(image->data, rid, index_key.data());
+        index_key.resize(index_meta.col_tot_len);
+        if (!locked_keys->emplace(index_name, index_key).second) {
+          continue;
+        }
+        RmRecord key_record(index_key.data(), index_meta.col_tot_len);
+        auto gap = LockManager::point_gap(index_meta, key_record);
+        lock_manager->lock_exclusive_on_gap(txn, index_meta, gap, fh->GetFd());
+      }
+    }
+    images[key] = std::move(image);
+  }
+
+  auto* version_manager = transaction_manager_->get_version_manager();
+  if (version_manager == nullptr) {
+    return;
+  }
+  for (auto& [key, image] : images) {
+    auto& [fd, page_no, slot_no] = key;
+    version_manager->add_version(txn, fd, Rid{page_no, slot_no}, image.get());
+  }
+}
+
+/**
+ * @description: 后台回滚未完成的事务。回滚后的页面写回磁盘之后才写 ABORT
+ * 日志，再次崩溃时要么重新回滚，要么回滚的结果已经落盘；ABORT 日志落盘之后才
+ * 释放锁，新事务的修改不会被再次回滚覆盖
+ */
+void RecoveryManager::undo_losers() {
   // redo 从前往后 undo 从后往前
   // 用大根堆来维护
   std::priority_queue<lsn_t> lsn_heap;
@@ -312,113 +512,107 @@ void RecoveryManager::undo() {
     lsn_heap.emplace(lsn);
   }
 
+  std::vector<char> buf;
   lsn_t lsn;
   while (!lsn_heap.empty()) {
     lsn = lsn_heap.top();
     lsn_heap.pop();
-    int log_offset = lsn_mapping_[lsn];
-    disk_manager_->read_log(buffer_.buffer_, LOG_BUFFER_SIZE, log_offset);
+    read_log(lsn, &buf);
     auto& log_type =
-        *reinterpret_cast<const LogType*>(buffer_.buffer_ + OFFSET_LOG_TYPE);
+        *reinterpret_cast<const LogType*>(buf.data() + OFFSET_LOG_TYPE);
+    auto& log_tid =
+        *reinterpret_cast<const txn_id_t*>(buf.data() + OFFSET_LOG_TID);
+    // 索引操作用事务自己的对象
+    auto* txn = losers_.at(log_tid).get();
     switch (log_type) {
       case BEGIN: {
-        auto log = new BeginLogRecord;
-        log->deserialize(buffer_.buffer_);
-        lsn = log->prev_lsn_;
-        delete log;
+        BeginLogRecord log;
+        log.deserialize(buf.data());
+        lsn = log.prev_lsn_;
         break;
       }
       case COMMIT: {
-        auto log = new CommitLogRecord;
-        log->deserialize(buffer_.buffer_);
-        lsn = log->prev_lsn_;
-        delete log;
+        CommitLogRecord log;
+        log.deserialize(buf.data());
+        lsn = log.prev_lsn_;
         break;
       }
       case ABORT: {
-        auto log = new AbortLogRecord;
-        log->deserialize(buffer_.buffer_);
-        lsn = log->prev_lsn_;
-        delete log;
+        AbortLogRecord log;
+        log.deserialize(buf.data());
+        lsn = log.prev_lsn_;
         break;
       }
       case INSERT: {
-        auto log = new InsertLogRecord;
-        log->deserialize(buffer_.buffer_);
+        InsertLogRecord log;
+        log.deserialize(buf.data());
 
         // undo 记录
-        auto fh = sm_manager_->fhs_.at(log->table_name_).get();
-        fh->delete_record(log->rid_, nullptr);
+        auto& tab = sm_manager_->db_.get_table(log.table_id_);
+        auto fh = sm_manager_->fhs_.at(tab.name).get();
+        fh->delete_record(log.rid_, nullptr);
 
         // undo 索引
-        auto& indexes = sm_manager_->db_.get_table(log->table_name_).indexes;
+        auto& indexes = tab.indexes;
         for (auto& [index_name, index_meta] : indexes) {
-          char* key = new char[index_meta.col_tot_len];
+          char* key = new char[index_meta.key_len];
           auto& ih = sm_manager_->ihs_.at(index_name);
-          for (auto& [offset, col_meta] : index_meta.cols) {
-            memcpy(key + offset, log->insert_value_.data + col_meta.offset,
-                   col_meta.len);
-          }
-          ih->delete_entry(key, &transaction_);
+          index_meta.get_key(log.value_, log.rid_, key);
+          ih->delete_entry(key, txn);
           delete[] key;
         }
 
-        lsn = log->prev_lsn_;
-        delete log;
+        lsn = log.prev_lsn_;
         break;
       }
       case DELETE: {
-        auto log = new DeleteLogRecord;
-        log->deserialize(buffer_.buffer_);
+        DeleteLogRecord log;
+        log.deserialize(buf.data());
 
-        auto fh = sm_manager_->fhs_.at(log->table_name_).get();
-        fh->insert_record(log->rid_, log->delete_value_.data);
+        auto& tab = sm_manager_->db_.get_table(log.table_id_);
+        auto fh = sm_manager_->fhs_.at(tab.name).get();
+        fh->insert_record(log.rid_, const_cast<char*>(log.value_));
 
         // undo 索引
-        auto& indexes = sm_manager_->db_.get_table(log->table_name_).indexes;
+        auto& indexes = tab.indexes;
         for (auto& [index_name, index_meta] : indexes) {
-          char* key = new char[index_meta.col_tot_len];
+          char* key = new char[index_meta.key_len];
           auto& ih = sm_manager_->ihs_.at(index_name);
-          for (auto& [offset, col_meta] : index_meta.cols) {
-            memcpy(key + offset, log->delete_value_.data + col_meta.offset,
-                   col_meta.len);
-          }
-          ih->insert_entry(key, log->rid_, &transaction_);
+          index_meta.get_key(log.value_, log.rid_, key);
+          ih->insert_entry(key, log.rid_, txn);
           delete[] key;
         }
 
-        lsn = log->prev_lsn_;
-        delete log;
+        lsn = log.prev_lsn_;
         break;
       }
       case UPDATE: {
-        auto log = new UpdateLogRecord;
-        log->deserialize(buffer_.buffer_);
+        UpdateLogRecord log;
+        log.deserialize(buf.data());
 
-        // undo 记录
-        auto fh = sm_manager_->fhs_.at(log->table_name_).get();
-        fh->update_record(log->rid_, log->old_value_.data, nullptr);
+        // undo 记录，在堆上的记录上撤销修改的字节段得到旧记录
+        auto& tab = sm_manager_->db_.get_table(log.table_id_);
+        auto fh = sm_manager_->fhs_.at(tab.name).get();
+        auto update_record = fh->get_record(log.rid_, nullptr);
+        RmRecord old_record(*update_record);
+        log.undo(old_record.data);
+        fh->update_record(log.rid_, old_record.data, nullptr);
 
         // undo 索引
-        auto& indexes = sm_manager_->db_.get_table(log->table_name_).indexes;
+        auto& indexes = tab.indexes;
         for (auto& [index_name, index_meta] : indexes) {
-          char* old_key = new char[index_meta.col_tot_len];
-          char* new_key = new char[index_meta.col_tot_len];
+          char* old_key = new char[index_meta.key_len];
+          char* new_key = new char[index_meta.key_len];
           auto& ih = sm_manager_->ihs_.at(index_name);
-          for (auto& [offset, col_meta] : index_meta.cols) {
-            memcpy(old_key + offset, log->old_value_.data + col_meta.offset,
-                   col_meta.len);
-            memcpy(new_key + offset, log->update_value_.data + col_meta.offset,
-                   col_meta.len);
-          }
-          ih->delete_entry(new_key, &transaction_);
-          ih->insert_entry(old_key, log->rid_, &transaction_);
+          index_meta.get_key(old_record.data, log.rid_, old_key);
+          index_meta.get_key(update_record->data, log.rid_, new_key);
+          ih->delete_entry(new_key, txn);
+          ih->insert_entry(old_key, log.rid_, txn);
           delete[] old_key;
           delete[] new_key;
         }
 
-        lsn = log->prev_lsn_;
-        delete log;
+        lsn = log.prev_lsn_;
         break;
       }
       default:
@@ -430,29 +624,58 @@ void RecoveryManager::undo() {
     }
   }
 
-  // 重做索引
-  // if (!dirty_page_table_.empty() || !active_txn_.empty()) {
-  //     redo_indexes();
-  // }
+  // 回滚的修改没有日志，先写回磁盘
+  std::vector<std::pair<PageId, lsn_t> > dirty_pages;
+  buffer_pool_manager_->get_dirty_pages(&dirty_pages);
+  for (auto& [page_id, _] : dirty_pages) {
+    std::ignore = _;
+    buffer_pool_manager_->flush_page_if_dirty(page_id);
+  }
+  // 重做时可能新建了页面，文件头也要落盘
+  for (auto& [_, fh] : sm_manager_->fhs_) {
+    std::ignore = _;
+    sm_manager_->get_rm_manager()->flush_file_hdr(fh.get());
+  }
+  for (auto& [_, ih] : sm_manager_->ihs_) {
+    std::ignore = _;
+    ih->write_file_hdr();
+  }
+  lsn_t abort_lsn = INVALID_LSN;
+  for (auto& [txn_id, txn] : losers_) {
+    AbortLogRecord abort_log_record(txn_id);
+    abort_log_record.prev_lsn_ = txn->get_prev_lsn();
+    abort_lsn = log_manager_->add_log_to_buffer(&abort_log_record);
+  }
+  log_manager_->wait_for_flush(abort_lsn);
+
+  // 堆上的记录已经恢复，删除版本并释放锁
+  auto* lock_manager = transaction_manager_->get_lock_manager();
+  auto* version_manager = transaction_manager_->get_version_manager();
+  for (auto& [_, txn] : losers_) {
+    std::ignore = _;
+    if (version_manager != nullptr) {
+      version_manager->abort(txn.get());
+    }
+    auto&& lock_set = txn->get_lock_set();
+    for (auto& it : *lock_set) {
+      lock_manager->unlock(txn.get(), it);
+    }
+    lock_set->clear();
+    transaction_manager_->remove_recovering_txn(txn.get());
+    txn->set_state(TransactionState::ABORTED);
+  }
 }
 
 /**
  * @description: 重做每个表的索引
  */
 void RecoveryManager::redo_indexes() {
-  std::vector<std::string> col_names;
   auto* context = new Context(nullptr, nullptr, &transaction_);
   for (auto& [table_name, _] : sm_manager_->fhs_) {
     std::ignore = _;
     auto& table_meta = sm_manager_->db_.get_table(table_name);
     for (auto& [index_name, index_meta] : table_meta.indexes) {
-      for (auto& [_, col] : index_meta.cols) {
-        std::ignore = _;
-        col_names.emplace_back(col.name);
-      }
-      sm_manager_->redo_index(table_name, table_meta, col_names, index_name,
-                              context);
-      col_names.clear();
+      sm_manager_->redo_index(index_name, index_meta, context);
     }
   }
   delete context;
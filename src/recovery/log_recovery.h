@@ -10,7 +10,14 @@ See the Mulan PSL v2 for more details. */
 
 #pragma once
 
+#include <cstdint>
+#include <memory>
+#include <set>
+#include <string>
+#include <thread>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "log_manager.h"
 #include "storage/disk_manager.h"
@@ -38,15 +45,43 @@ class RecoveryManager {
         transaction_manager_(transaction_manager),
         transaction_(666) {}
 
+  ~RecoveryManager() { wait_for_undo(); }
+
   void analyze();
 
   void redo();
 
   void undo();
 
+  // 等待后台回滚结束
+  void wait_for_undo() {
+    if (undo_thread_.joinable()) {
+      undo_thread_.join();
+    }
+  }
+
   void redo_indexes();
 
  private:
+  // 页面在脏页表中的键，由表编号和页号拼成
+  static int64_t page_key(int table_id, page_id_t page_no) {
+    return (static_cast<int64_t>(table_id) << 32) |
+           static_cast<uint32_t>(page_no);
+  }
+
+  void read_log(lsn_t lsn, std::vector<char>* buf);
+
+  void clear_log_tail(lsn_t end_lsn);
+
+  bool need_redo(RmFileHandle* fh, page_id_t page_no, lsn_t lsn);
+
+  void redo_table(const std::vector<lsn_t>& lsns);
+
+  void lock_loser(Transaction* txn, lsn_t last_lsn,
+                  std::set<std::pair<std::string, std::string> >* locked_keys);
+
+  void undo_losers();
+
   LogBuffer buffer_;                         // 读入日志
   DiskManager* disk_manager_;                // 用来读写文件
   BufferPoolManager* buffer_pool_manager_;   // 对页面进行读写
@@ -55,10 +90,13 @@ class RecoveryManager {
   TransactionManager* transaction_manager_;  // 维护 next_txn_id_ 至最新
   /** Maintain active transactions and its corresponding latest lsn. */
   std::unordered_map<txn_id_t, lsn_t> active_txn_;
-  /** Mapping the log sequence number to log file offset for undos. */
-  std::unordered_map<lsn_t, int> lsn_mapping_;
-  /** DPT for redo. */
-  std::deque<lsn_t> dirty_page_table_;
+  /** DPT: page_key -> rec_lsn, the first log that may not be on disk. */
+  std::unordered_map<int64_t, lsn_t> dirty_page_table_;
+  /** Logs to redo in lsn order, filtered by the DPT and grouped by table. */
+  std::unordered_map<int, std::vector<lsn_t> > redo_streams_;
+  /** Loser transactions, holding their locks until undone in background. */
+  std::unordered_map<txn_id_t, std::unique_ptr<Transaction> > losers_;
+  std::thread undo_thread_;
   Transaction transaction_;
   bool is_need_redo_indexes{false};
 };
@@ -10,6 +10,7 @@ See the Mulan PSL v2 for more details. */
 
 #pragma once
 
+#include <cassert>
 #include <list>
 #include <mutex>
 #include <vector>
@@ -51,26 +52,33 @@ class LRUReplacer : public Replacer {
 class ClockReplacer : public Replacer {
  public:
   /**
-   * @description: 创建一个新的LRUReplacer
-   * @param {size_t} num_pages LRUReplacer最多需要存储的page数量
+   * @description: 创建一个新的ClockReplacer
+   * @param {size_t} num_pages 缓冲池实例的帧数，不能超过
+   * BUFFER_POOL_INSTANCE_SIZE
    */
-  explicit ClockReplacer() {}
+  explicit ClockReplacer(size_t num_pages = BUFFER_POOL_INSTANCE_SIZE)
+      : num_pages_(num_pages) {
+    assert(num_pages_ <= BUFFER_POOL_INSTANCE_SIZE);
+  }
 
   ~ClockReplacer() {}
 
   bool victim(frame_id_t* frame_id) override {
-    int steps = 0;
+    if (num_pages_ == 0) {
+      return false;
+    }
+    size_t steps = 0;
     do {
-      pointer_ = (pointer_ + 1) % BUFFER_POOL_INSTANCE_SIZE;
+      pointer_ = (pointer_ + 1) % num_pages_;
       if (pin_counter_[pointer_] == 0 && pin_[pointer_] == 0) {
-        *frame_id = pointer_;
+        *frame_id = static_cast<frame_id_t>(pointer_);
         return true;
       }
       if (pin_counter_[pointer_] == 0) {
         pin_[pointer_] = false;
       }
       ++steps;
-    } while (steps < 2 * BUFFER_POOL_INSTANCE_SIZE);
+    } while (steps < 2 * num_pages_);
     return false;
   }
 
@@ -83,10 +91,11 @@ class ClockReplacer : public Replacer {
 
   int get_pin_count(frame_id_t frame_id) { return pin_counter_[frame_id]; }
 
-  size_t Size() override { return BUFFER_POOL_INSTANCE_SIZE; }
+  size_t Size() override { return num_pages_; }
 
  private:
-  int pin_counter_[BUFFER_POOL_INSTANCE_SIZE];
-  bool pin_[BUFFER_POOL_INSTANCE_SIZE];
-  int pointer_ = 0;
+  size_t num_pages_;  // 只在前 num_pages_ 个帧中选择淘汰的帧
+  int pin_counter_[BUFFER_POOL_INSTANCE_SIZE] = {};
+  bool pin_[BUFFER_POOL_INSTANCE_SIZE] = {};
+  size_t pointer_ = 0;
 };
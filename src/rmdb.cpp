@@ -23,6 +23,7 @@ See the Mulan PSL v2 for more details. */
 #include <future>
 
 #include "analyze/analyze.h"
+#include "common/thread_pool.h"
 #include "errors.h"
 #include "fmt/core.h"
 #include "fmt/printf.h"
@@ -30,6 +31,7 @@ See the Mulan PSL v2 for more details. */
 #include "optimizer/plan.h"
 #include "optimizer/planner.h"
 #include "portal.h"
+#include "recovery/checkpoint_manager.h"
 #include "recovery/log_recovery.h"
 #include "spdlog/spdlog.h"
 
@@ -54,12 +56,17 @@ auto sm_manager =
     std::make_unique<SmManager>(disk_manager.get(), buffer_pool_manager.get(),
                                 rm_manager.get(), ix_manager.get());
 auto lock_manager = std::make_unique<LockManager>();
-auto txn_manager =
-    std::make_unique<TransactionManager>(lock_manager.get(), sm_manager.get());
+auto version_manager = std::make_unique<VersionManager>();
+auto txn_manager = std::make_unique<TransactionManager>(
+    lock_manager.get(), sm_manager.get(), version_manager.get());
 auto planner = std::make_unique<Planner>(sm_manager.get());
 auto optimizer = std::make_unique<Optimizer>(sm_manager.get(), planner.get());
-auto ql_manager = std::make_unique<QlManager>(sm_manager.get(),
-                                              txn_manager.get(), planner.get());
+auto checkpoint_manager = std::make_unique<CheckpointManager>(
+    buffer_pool_manager.get(), sm_manager.get(), log_manager.get(),
+    txn_manager.get());
+auto ql_manager =
+    std::make_unique<QlManager>(sm_manager.get(), txn_manager.get(),
+                                planner.get(), checkpoint_manager.get());
 auto recovery = std::make_unique<RecoveryManager>(
     disk_manager.get(), buffer_pool_manager.get(), sm_manager.get(),
     log_manager.get(), txn_manager.get());
@@ -68,9 +75,7 @@ auto analyze = std::make_unique<Analyze>(sm_manager.get());
 // pthread_mutex_t *buffer_mutex;
 pthread_mutex_t* sockfd_mutex;
 
-// 定义线程池大小
-// constexpr int MAX_THREAD_POOL_SIZE = 2;
-std::list<std::thread> load_thread_pool;
+// 提交到线程池但还没有完成的 load 任务
 std::deque<std::future<void> > futures;
 std::mutex pool_mutex;
 
@@ -113,6 +118,146 @@ void SetTransaction(txn_id_t* txn_id, Context* context) {
   }
 }
 
+/**
+ * @description: 在线程池上执行一条 SQL 语句，结果写入 data_send
+ * @return {Context*} 本条语句的上下文，发送结果后用于提交单条语句的事务
+ */
+Context* execute_sql(char* data_recv, yyscan_t scanner, txn_id_t* txn_id,
+                     char* data_send, int* offset_ptr) {
+  int& offset = *offset_ptr;
+  // 等待之前提交的 load 完成，等锁也可能阻塞线程池的线程
+  std::unique_lock pool_lock(pool_mutex, std::try_to_lock);
+  if (!pool_lock.owns_lock()) {
+    ThreadPool::BlockingScope scope;
+    pool_lock.lock();
+  }
+  for (auto& future : futures) {
+    ThreadPool::wait(future);
+  }
+  if (!futures.empty()) {
+    for (auto& [_, fh] : sm_manager->fhs_) {
+      std::ignore = _;
+      buffer_pool_manager->flush_all_pages(fh->GetFd());
+    }
+    for (auto& [_, ih] : sm_manager->ihs_) {
+      std::ignore = _;
+      buffer_pool_manager->flush_all_pages(ih->fd_);
+    }
+  }
+  futures.clear();
+  pool_lock.unlock();
+  memset(data_send, '\0', BUFFER_LENGTH);
+  offset = 0;
+
+  // 开启事务，初始化系统所需的上下文信息（包括事务对象指针、锁管理器指针、日志管理器指针、存放结果的buffer、记录结果长度的变量）
+  Context* context = new Context(lock_manager.get(), log_manager.get(),
+                                 nullptr, data_send, &offset);
+  context->version_mgr_ = version_manager.get();
+  SetTransaction(txn_id, context);
+
+  // 用于判断是否已经调用了 yy_delete_buffer 来删除 buf
+  bool finish_analyze = false;
+  // pthread_mutex_lock(buffer_mutex);
+  YY_BUFFER_STATE buf = yy_scan_string(data_recv, scanner);
+  if (yyparse(scanner) == 0) {
+    if (ast::parse_tree != nullptr) {
+      try {
+        // analyze and rewrite
+        // 查询计划生成
+        std::shared_ptr<Query> query =
+            analyze->do_analyze(std::move(ast::parse_tree));
+        yy_delete_buffer(buf, scanner);
+        finish_analyze = true;
+        // pthread_mutex_unlock(buffer_mutex);
+        // 单条 SELECT 语句是只读的隐式事务，走快照读，不加锁也不阻塞写事务
+        if (!context->txn_->get_txn_mode() &&
+            std::dynamic_pointer_cast<ast::SelectStmt>(query->parse)) {
+          txn_manager->begin_snapshot(context->txn_);
+        }
+        // 全表 count 走 fast_count
+        int count = -1;
+        if (query->agg_types.size() == 1 &&
+            query->agg_types[0] == AGG_COUNT && query->conds.empty()) {
+          count = fast_count_star(query->tables[0], context);
+        }
+        if (count >= 0) {
+          // 后续支持笛卡尔积 count，这里先简化只有单个表
+          auto& col_name = query->alias.empty() ? query->cols[0].col_name
+                                                : query->alias[0];
+          ql_manager->select_fast_count_star(count, col_name, context);
+        } else {
+          // 优化器
+          std::shared_ptr<Plan> plan = optimizer->plan_query(query, context);
+          // portal
+          std::shared_ptr<PortalStmt> portalStmt =
+              portal->start(plan, context);
+          portal->run(portalStmt, ql_manager.get(), txn_id, context);
+          portal->drop();
+        }
+      } catch (TransactionAbortException& e) {
+        // 事务需要回滚，需要把abort信息返回给客户端并写入output.txt文件中
+        std::string str = "abort\n";
+        memcpy(data_send, str.c_str(), str.length());
+        data_send[str.length()] = '\0';
+        offset = str.length();
+
+        // 回滚事务
+        txn_manager->abort(context->txn_, log_manager.get());
+#ifdef ENABLE_COUT
+        std::cout << e.GetInfo() << std::endl;
+#endif
+
+        if (planner->enable_output_file) {
+          std::fstream outfile;
+          outfile.open("output.txt", std::ios::out | std::ios::app);
+          outfile << str;
+          outfile.close();
+        }
+      } catch (RMDBError& e) {
+        // 遇到异常，需要打印failure到output.txt文件中，并发异常信息返回给客户端
+#ifdef ENABLE_COUT
+        std::cerr << e.what() << std::endl;
+#endif
+
+        memcpy(data_send, e.what(), e.get_msg_len());
+        data_send[e.get_msg_len()] = '\n';
+        data_send[e.get_msg_len() + 1] = '\0';
+        offset = e.get_msg_len() + 1;
+
+        // 将报错信息写入output.txt
+        if (planner->enable_output_file) {
+          std::fstream outfile;
+          outfile.open("output.txt", std::ios::out | std::ios::app);
+          outfile << "failure\n";
+          outfile.close();
+        }
+      }
+    }
+  } else {
+    // 遇到异常，需要打印failure到output.txt文件中，并发异常信息返回给客户端
+    // std::string str = "语法层解析错误";
+    // std::cerr << str << std::endl;
+
+    // memcpy(data_send, str.c_str(), str.size());
+    // data_send[str.size()] = '\n';
+    // data_send[str.size() + 1] = '\0';
+    // offset = str.size() + 1;
+
+    // 将报错信息写入output.txt
+    if (planner->enable_output_file) {
+      std::fstream outfile;
+      outfile.open("output.txt", std::ios::out | std::ios::app);
+      outfile << "failure\n";
+      outfile.close();
+    }
+  }
+  if (finish_analyze == false) {
+    yy_delete_buffer(buf, scanner);
+    // pthread_mutex_unlock(buffer_mutex);
+  }
+  return context;
+}
+
 void* client_handler(void* sock_fd) {
   int fd = *((int*)sock_fd);
   free(sock_fd);
@@ -192,8 +337,10 @@ void* client_handler(void* sock_fd) {
       // }
 
       // 将任务加入线程池
-      futures.emplace_back(std::async(std::launch::async, load_data,
-                                      std::move(path), std::move(table_name)));
+      pool_mutex.lock();
+      futures.emplace_back(ThreadPool::instance().submit(
+          load_data, std::move(path), std::move(table_name)));
+      pool_mutex.unlock();
 
       std::string s = "l\n";
       if (write(fd, s.c_str(), s.length()) == -1) {
@@ -202,125 +349,14 @@ void* client_handler(void* sock_fd) {
       continue;
     }
 
-    pool_mutex.lock();
-    for (auto& future : futures) {
-      future.get();
-    }
-    if (!futures.empty()) {
-      for (auto& [_, fh] : sm_manager->fhs_) {
-        std::ignore = _;
-        buffer_pool_manager->flush_all_pages(fh->GetFd());
-      }
-      for (auto& [_, ih] : sm_manager->ihs_) {
-        std::ignore = _;
-        buffer_pool_manager->flush_all_pages(ih->fd_);
-      }
-    }
-    futures.clear();
-    pool_mutex.unlock();
 #ifdef ENABLE_COUT
     spdlog::info("Read from client {}: {}", fd, data_recv);
 #endif
-    memset(data_send, '\0', BUFFER_LENGTH);
-    offset = 0;
-
-    // 开启事务，初始化系统所需的上下文信息（包括事务对象指针、锁管理器指针、日志管理器指针、存放结果的buffer、记录结果长度的变量）
-    Context* context = new Context(lock_manager.get(), log_manager.get(),
-                                   nullptr, data_send, &offset);
-    SetTransaction(&txn_id, context);
-
-    // 用于判断是否已经调用了 yy_delete_buffer 来删除 buf
-    bool finish_analyze = false;
-    // pthread_mutex_lock(buffer_mutex);
-    YY_BUFFER_STATE buf = yy_scan_string(data_recv, scanner);
-    if (yyparse(scanner) == 0) {
-      if (ast::parse_tree != nullptr) {
-        try {
-          // analyze and rewrite
-          // 查询计划生成
-          std::shared_ptr<Query> query =
-              analyze->do_analyze(std::move(ast::parse_tree));
-          yy_delete_buffer(buf, scanner);
-          finish_analyze = true;
-          // pthread_mutex_unlock(buffer_mutex);
-          // 全表 count 走 fast_count
-          if (query->agg_types.size() == 1 &&
-              query->agg_types[0] == AGG_COUNT && query->conds.empty()) {
-            // 后续支持笛卡尔积 count，这里先简化只有单个表
-            auto& col_name = query->alias.empty() ? query->cols[0].col_name
-                                                  : query->alias[0];
-            ql_manager->select_fast_count_star(
-                fast_count_star(query->tables[0], context), col_name, context);
-          } else {
-            // 优化器
-            std::shared_ptr<Plan> plan = optimizer->plan_query(query, context);
-            // portal
-            std::shared_ptr<PortalStmt> portalStmt =
-                portal->start(plan, context);
-            portal->run(portalStmt, ql_manager.get(), &txn_id, context);
-            portal->drop();
-          }
-        } catch (TransactionAbortException& e) {
-          // 事务需要回滚，需要把abort信息返回给客户端并写入output.txt文件中
-          std::string str = "abort\n";
-          memcpy(data_send, str.c_str(), str.length());
-          data_send[str.length()] = '\0';
-          offset = str.length();
-
-          // 回滚事务
-          txn_manager->abort(context->txn_, log_manager.get());
-#ifdef ENABLE_COUT
-          std::cout << e.GetInfo() << std::endl;
-#endif
-
-          if (planner->enable_output_file) {
-            std::fstream outfile;
-            outfile.open("output.txt", std::ios::out | std::ios::app);
-            outfile << str;
-            outfile.close();
-          }
-        } catch (RMDBError& e) {
-          // 遇到异常，需要打印failure到output.txt文件中，并发异常信息返回给客户端
-#ifdef ENABLE_COUT
-          std::cerr << e.what() << std::endl;
-#endif
-
-          memcpy(data_send, e.what(), e.get_msg_len());
-          data_send[e.get_msg_len()] = '\n';
-          data_send[e.get_msg_len() + 1] = '\0';
-          offset = e.get_msg_len() + 1;
-
-          // 将报错信息写入output.txt
-          if (planner->enable_output_file) {
-            std::fstream outfile;
-            outfile.open("output.txt", std::ios::out | std::ios::app);
-            outfile << "failure\n";
-            outfile.close();
-          }
-        }
-      }
-    } else {
-      // 遇到异常，需要打印failure到output.txt文件中，并发异常信息返回给客户端
-      // std::string str = "语法层解析错误";
-      // std::cerr << str << std::endl;
-
-      // memcpy(data_send, str.c_str(), str.size());
-      // data_send[str.size()] = '\n';
-      // data_send[str.size() + 1] = '\0';
-      // offset = str.size() + 1;
-
-      // 将报错信息写入output.txt
-      if (planner->enable_output_file) {
-        std::fstream outfile;
-        outfile.open("output.txt", std::ios::out | std::ios::app);
-        outfile << "failure\n";
-        outfile.close();
-      }
-    }
-    if (finish_analyze == false) {
-      yy_delete_buffer(buf, scanner);
-      // pthread_mutex_unlock(buffer_mutex);
-    }
+    // 连接线程只负责收发，语句在共享线程池上执行
+    Context* context = ThreadPool::instance()
+                           .submit(execute_sql, data_recv, scanner, &txn_id,
+                                   data_send, &offset)
+                           .get();
     // future TODO: 格式化 sql_handler.result, 传给客户端
     // send result with fixed format, use protobuf in the future
     if (send(fd, data_send, offset + 1, 0) == -1) {
@@ -328,10 +364,14 @@ void* client_handler(void* sock_fd) {
       break;
     }
     // 如果是单挑语句，需要按照一个完整的事务来执行，所以执行完当前语句后，自动提交事务
-    if (context->txn_->get_txn_mode() == false) {
-      txn_manager->commit(context->txn_, context->log_mgr_);
-    }
-    delete context;
+    ThreadPool::instance()
+        .submit([context] {
+          if (context->txn_->get_txn_mode() == false) {
+            txn_manager->commit(context->txn_, context->log_mgr_);
+          }
+          delete context;
+        })
+        .get();
   }
 
   // release memory
@@ -482,7 +522,9 @@ int main(int argc, char** argv) {
 #ifdef ENABLE_LOGGING
     recovery->analyze();
     recovery->redo();
+    // 未完成的事务重新加锁之后在后台回滚，不阻塞服务启动
     recovery->undo();
+    checkpoint_manager->start();
 #endif
 
     // 静态 map 预留空间
@@ -748,11 +790,10 @@ void load_data(std::string filename, std::string tabname) {
         // 正常索引载入用这个
         for (auto& [index_name, index] : tab_.indexes) {
           auto& ih = sm_manager->ihs_[index_name];
-          char* key = new char[index.col_tot_len];
-          for (auto& [index_offset, col_meta] : index.cols) {
-            memcpy(key + index_offset, cur + col_meta.offset, col_meta.len);
-          }
-          ih->insert_entry(key, {page_no, row % max_nums_}, txn);
+          char* key = new char[index.key_len];
+          Rid rid{page_no, row % max_nums_};
+          index.get_key(cur, rid, key);
+          ih->insert_entry(key, rid, txn);
           delete[] key;
         }
 
@@ -933,9 +974,12 @@ void load_data(std::string filename, std::string tabname) {
   delete[] data;
 }
 
+// 返回 -1 表示不能直接由页面上的记录数得到结果，需要走普通的查询计划
 int fast_count_star(std::string& tabname, Context* context) {
   auto& fh = sm_manager->fhs_[tabname];
-  context->lock_mgr_->lock_shared_on_table(context->txn_, fh->GetFd());
+  if (!context->txn_->is_snapshot_read()) {
+    context->lock_mgr_->lock_shared_on_table(context->txn_, fh->GetFd());
+  }
 
   int count = 0;
   auto first_page = RM_FIRST_RECORD_PAGE;
@@ -947,5 +991,10 @@ int fast_count_star(std::string& tabname, Context* context) {
     buffer_pool_manager->unpin_page(page_handle.page->get_page_id(), false);
   }
 
+  // 快照读时，数完之后没有任何版本链说明数到的记录都对快照可见，
+  // 否则要逐条判断可见性
+  if (context->txn_->is_snapshot_read() && !version_manager->empty()) {
+    return -1;
+  }
   return count;
 }
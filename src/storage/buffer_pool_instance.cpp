@@ -23,7 +23,8 @@ bool BufferPoolInstance::find_victim_page(frame_id_t* frame_id) {
 /**
  * @description: 更新页面数据,
  * 如果为脏页则需写入磁盘，再更新为新页面，更新page元数据(data, is_dirty,
- * page_id)和page table
+ * page_id)和page table。调用者要在 begin_replace 和读入新页面数据后的
+ * end_replace 之间调用，让不 pin 页面的乐观读察觉帧被换掉
  * @param {Page*} page 写回页指针
  * @param {PageId} new_page_id 新的page_id
  * @param {frame_id_t} new_frame_id 新的帧frame_id
@@ -46,7 +47,7 @@ void BufferPoolInstance::update_page(Page* page, PageId new_page_id,
     disk_manager_->write_page(page->get_page_id().fd,
                               page->get_page_id().page_no, page->get_data(),
                               PAGE_SIZE);
-    page->is_dirty_ = false;
+    page->clear_dirty();
   }
 
   page_table_.erase(page->get_page_id());
@@ -90,11 +91,13 @@ Page* BufferPoolInstance::fetch_page(PageId page_id) {
   if (it == page_table_.end()) {
     // ++cnt_vitcm;
     if (find_victim_page(&frame_id)) {
+      pages_[frame_id].begin_replace();
       update_page(&pages_[frame_id], page_id, frame_id);
       // lk.unlock();
       // auto startt = std::chrono::high_resolution_clock::now();  // 开始计时
       disk_manager_->read_page(page_id.fd, page_id.page_no,
                                pages_[frame_id].get_data(), PAGE_SIZE);
+      pages_[frame_id].end_replace();
       // auto end = std::chrono::high_resolution_clock::now();  // 结束计时
       // read_time += std::chrono::duration_cast<std::chrono::microseconds>(end
       // - startt).count();
@@ -186,10 +189,66 @@ bool BufferPoolInstance::flush_page(PageId page_id) {
 #endif
   disk_manager_->write_page(page.id_.fd, page.id_.page_no, page.data_,
                             PAGE_SIZE);
-  page.is_dirty_ = false;
+  page.clear_dirty();
   return true;
 }
 
+/**
+ * @description: 目标页是脏页时写回磁盘，检查点在后台逐个刷脏页时调用。
+ * 只在查页表和 pin 页面时持有 latch_，按 WAL 等待刷日志时不挡住其他页面的
+ * fetch；页面可能正在被修改，持有读锁拷贝出来再写
+ * @return {bool} 是否写回了磁盘
+ * @param {PageId} page_id 目标页的page_id
+ */
+bool BufferPoolInstance::flush_page_if_dirty(PageId page_id) {
+  Page* page;
+  {
+    std::lock_guard lock(latch_);
+    auto&& it = page_table_.find(page_id);
+    if (it == page_table_.end() || !pages_[it->second].is_dirty_) {
+      return false;
+    }
+    // pin 住，写回之前页面不会被换出
+    page = &pages_[it->second];
+    if (++page->pin_count_ == 1) {
+      replacer_->pin(it->second);
+    }
+  }
+
+  char data[PAGE_SIZE];
+  page->RLatch();
+  memcpy(data, page->get_data(), PAGE_SIZE);
+  lsn_t page_lsn = page->get_page_lsn();
+  // 之后的修改会重新设置脏页标记和 rec_lsn
+  page->clear_dirty();
+  page->RUnlatch();
+#ifdef ENABLE_LOGGING
+  if (log_manager_ != nullptr && page_lsn > log_manager_->get_persist_lsn()) {
+    log_manager_->flush_log_to_disk();
+  }
+#endif
+  disk_manager_->write_page(page_id.fd, page_id.page_no, data, PAGE_SIZE);
+  unpin_page(page_id, false);
+  return true;
+}
+
+/**
+ * @description: 获取缓冲池中所有的脏页及其 rec_lsn，没有日志的页面（如索引页）
+ * 的 rec_lsn 为 INVALID_LSN
+ * @param {vector<pair<PageId, lsn_t>>*} dirty_pages 传出脏页
+ */
+void BufferPoolInstance::get_dirty_pages(
+    std::vector<std::pair<PageId, lsn_t> >* dirty_pages) {
+  std::lock_guard lock(latch_);
+
+  for (auto& [page_id, frame_id] : page_table_) {
+    auto& page = pages_[frame_id];
+    if (page.is_dirty_) {
+      dirty_pages->emplace_back(page_id, page.get_rec_lsn());
+    }
+  }
+}
+
 /**
  * @description:
  * 创建一个新的page，即从磁盘中移动一个新建的空page到缓冲池某个位置。
@@ -207,8 +266,10 @@ Page* BufferPoolInstance::new_page(PageId* page_id) {
   frame_id_t frame_id = -1;
   if (find_victim_page(&frame_id)) {
     // page_id->page_no = disk_manager_->allocate_page(page_id->fd);
+    pages_[frame_id].begin_replace();
     update_page(&pages_[frame_id], *page_id, frame_id);
     pages_[frame_id].reset_memory();
+    pages_[frame_id].end_replace();
     // 不知道是从freelist还是replacer来的，都pin一下，待优化
     replacer_->pin(frame_id);
     pages_[frame_id].pin_count_ = 1;
@@ -249,14 +310,16 @@ bool BufferPoolInstance::delete_page(PageId page_id) {
 #endif
     disk_manager_->write_page(page.id_.fd, page.id_.page_no, page.data_,
                               PAGE_SIZE);
-    page.is_dirty_ = false;
+    page.clear_dirty();
   }
 
   // 记得把页框还回去
   free_list_.push_back(it->second);
   page_table_.erase(page.id_);
 
+  page.begin_replace();
   page.reset_memory();
+  page.end_replace();
   return true;
 }
 
@@ -278,7 +341,7 @@ void BufferPoolInstance::flush_all_pages(int fd) {
 #endif
       disk_manager_->write_page(page.id_.fd, page.id_.page_no, page.data_,
                                 PAGE_SIZE);
-      page.is_dirty_ = false;
+      page.clear_dirty();
     }
   }
 }
@@ -293,11 +356,9 @@ void BufferPoolInstance::flush_all_pages_for_checkpoint(int fd) {
   for (auto& [pageId, frameId] : page_table_) {
     if (pageId.fd == fd) {
       auto& page = pages_[frameId];
-      // 日志清空了，lsn 设置为初始状态
-      page.set_page_lsn(INVALID_LSN);
       disk_manager_->write_page(page.id_.fd, page.id_.page_no, page.data_,
                                 PAGE_SIZE);
-      page.is_dirty_ = false;
+      page.clear_dirty();
     }
   }
 }
@@ -313,10 +374,12 @@ void BufferPoolInstance::delete_all_pages(int fd) {
     if (it->first.fd == fd && it->second != INVALID_FRAME_ID) {
       // 清页面
       auto& page = pages_[it->second];
+      page.begin_replace();
       page.reset_memory();
-      page.is_dirty_ = false;
+      page.clear_dirty();
       page.pin_count_ = 0;
       page.id_.page_no = INVALID_PAGE_ID;
+      page.end_replace();
       // 记得把页框还回去
       free_list_.push_back(it->second);
       it = page_table_.erase(it);
@@ -6,6 +6,8 @@
 
 #include <list>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "disk_manager.h"
 #include "page.h"
@@ -42,7 +44,7 @@ class BufferPoolInstance {
         log_manager_(log_manager) {
     // 为buffer pool分配一块连续的内存空间
     pages_ = new Page[pool_size_];
-    replacer_ = new ClockReplacer();
+    replacer_ = new ClockReplacer(pool_size_);
     // 初始化时，所有的page都在free_list_中
     for (size_t i = 0; i < pool_size_; ++i) {
       free_list_.emplace_back(
@@ -69,6 +71,10 @@ class BufferPoolInstance {
 
   bool flush_page(PageId page_id);
 
+  bool flush_page_if_dirty(PageId page_id);
+
+  void get_dirty_pages(std::vector<std::pair<PageId, lsn_t> >* dirty_pages);
+
   Page* new_page(PageId* page_id);
 
   bool delete_page(PageId page_id);
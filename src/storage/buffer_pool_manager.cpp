@@ -31,6 +31,26 @@ bool BufferPoolManager::flush_page(PageId page_id) {
   return instances_[get_instance_no(page_id)]->flush_page(page_id);
 }
 
+/**
+ * @description: 目标页是脏页时写回磁盘
+ * @return {bool} 是否写回了磁盘
+ * @param {PageId} page_id 目标页的page_id
+ */
+bool BufferPoolManager::flush_page_if_dirty(PageId page_id) {
+  return instances_[get_instance_no(page_id)]->flush_page_if_dirty(page_id);
+}
+
+/**
+ * @description: 获取缓冲池中所有的脏页及其 rec_lsn
+ * @param {vector<pair<PageId, lsn_t>>*} dirty_pages 传出脏页
+ */
+void BufferPoolManager::get_dirty_pages(
+    std::vector<std::pair<PageId, lsn_t> >* dirty_pages) {
+  for (auto& instance : instances_) {
+    instance->get_dirty_pages(dirty_pages);
+  }
+}
+
 /**
  * @description:
  * 创建一个新的page，即从磁盘中移动一个新建的空page到缓冲池某个位置。
@@ -23,7 +23,8 @@ class LogManager;
 class BufferPoolManager {
  private:
   size_t pool_size_;  // buffer_pool中可容纳页面的个数，即帧的个数
-  BufferPoolInstance* instances_[BUFFER_POOL_INSTANCES]{};  // 缓冲池实例
+  // 缓冲池实例，帧数少于 BUFFER_POOL_INSTANCES 时只有一个实例
+  std::vector<BufferPoolInstance*> instances_;
   std::hash<PageId> hasher_;
   // Page *pages_; //
   // buffer_pool中的Page对象数组，在构造空间中申请内存空间，在析构函数中释放，大小为BUFFER_POOL_SIZE
@@ -43,8 +44,12 @@ class BufferPoolManager {
         log_manager_(log_manager) {
     // 共享lru
     // replacer_ = new LRUReplacer(pool_size_);
+    // 帧数不够每个实例分一个时只用一个实例，否则实例没有帧可以淘汰
+    std::size_t num_instances =
+        pool_size_ < BUFFER_POOL_INSTANCES ? 1 : BUFFER_POOL_INSTANCES;
+    instances_.resize(num_instances);
     for (auto& instance : instances_) {
-      instance = new BufferPoolInstance(pool_size / BUFFER_POOL_INSTANCES,
+      instance = new BufferPoolInstance(pool_size_ / num_instances,
                                         disk_manager_, log_manager_);
     }
   }
@@ -69,6 +74,10 @@ class BufferPoolManager {
 
   bool flush_page(PageId page_id);
 
+  bool flush_page_if_dirty(PageId page_id);
+
+  void get_dirty_pages(std::vector<std::pair<PageId, lsn_t> >* dirty_pages);
+
   Page* new_page(PageId* page_id);
 
   bool delete_page(PageId page_id);
@@ -104,6 +113,6 @@ class BufferPoolManager {
 
  private:
   inline std::size_t get_instance_no(const PageId& page_id) {
-    return hasher_(page_id) % BUFFER_POOL_INSTANCES;
+    return hasher_(page_id) % instances_.size();
   }
 };
@@ -1,294 +1,533 @@
-/* Copyright (c) 2023 Renmin University of China
-RMDB is licensed under Mulan PSL v2.
-You can use this software according to the terms and conditions of the Mulan PSL
-v2. You may obtain a copy of Mulan PSL v2 at:
-        http://license.coscl.org.cn/MulanPSL2
-THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
-EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
-MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
-See the Mulan PSL v2 for more details. */
-
-#include "storage/disk_manager.h"
-
-#include <assert.h>    // for assert
-#include <string.h>    // for memset
-#include <sys/stat.h>  // for stat
-#include <unistd.h>    // for lseek
-
-#include "defs.h"
-
-DiskManager::DiskManager() {
-  memset(fd2pageno_, 0,
-         MAX_FD * (sizeof(std::atomic<page_id_t>) / sizeof(char)));
-}
-
-/**
- * @description: 将数据写入文件的指定磁盘页面中
- * @param {int} fd 磁盘文件的文件句柄
- * @param {page_id_t} page_no 写入目标页面的page_id
- * @param {char} *offset 要写入磁盘的数据
- * @param {int} num_bytes 要写入磁盘的数据大小
- */
-void DiskManager::write_page(int fd, page_id_t page_no, const char* data,
-                             int num_bytes) {
-  // Todo:
-  // 1.lseek()定位到文件头，通过(fd,page_no)可以定位指定页面及其在磁盘文件中的偏移量
-  // 2.调用write()函数
-  // 注意write返回值与num_bytes不等时 throw
-  // InternalError("DiskManager::write_page Error");
-  off_t offset = page_no * PAGE_SIZE;
-
-  if (lseek(fd, offset, SEEK_SET) == -1) {
-    perror("DiskManager::write_page");
-    throw InternalError("DiskManager::write_page: lSeek Error");
-  }
-
-  if (write(fd, data, num_bytes) != num_bytes) {
-    throw InternalError("DiskManager::write_page: Write Error");
-  }
-}
-
-/**
- * @description: 读取文件中指定编号的页面中的部分数据到内存中
- * @param {int} fd 磁盘文件的文件句柄
- * @param {page_id_t} page_no 指定的页面编号
- * @param {char} *offset 读取的内容写入到offset中
- * @param {int} num_bytes 读取的数据量大小
- */
-void DiskManager::read_page(int fd, page_id_t page_no, char* data,
-                            int num_bytes) {
-  // Todo:
-  // 1.lseek()定位到文件头，通过(fd,page_no)可以定位指定页面及其在磁盘文件中的偏移量
-  // 2.调用read()函数
-  // 注意read返回值与num_bytes不等时，throw
-  // InternalError("DiskManager::read_page Error");
-  off_t offset = page_no * PAGE_SIZE;
-
-  if (lseek(fd, offset, SEEK_SET) == -1) {
-    perror("DiskManager::read_page");
-    throw InternalError("DiskManager::read_page: lSeek Error");
-  }
-
-  if (read(fd, data, num_bytes) != num_bytes) {
-    throw InternalError("DiskManager::read_page: Read Error");
-  }
-}
-
-/**
- * @description: 分配一个新的页号
- * @return {page_id_t} 分配的新页号
- * @param {int} fd 指定文件的文件句柄
- */
-page_id_t DiskManager::allocate_page(int fd) {
-  // 简单的自增分配策略，指定文件的页面编号加1
-  assert(fd >= 0 && fd < MAX_FD);
-  return fd2pageno_[fd]++;
-}
-
-void DiskManager::deallocate_page(__attribute__((unused)) page_id_t page_id) {}
-
-bool DiskManager::is_dir(const std::string& path) {
-  struct stat st;
-  return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
-}
-
-void DiskManager::create_dir(const std::string& path) {
-  // Create a subdirectory
-  std::string cmd = "mkdir " + path;
-  if (system(cmd.c_str()) < 0) {
-    // 创建一个名为path的目录
-    throw UnixError();
-  }
-}
-
-void DiskManager::destroy_dir(const std::string& path) {
-  std::string cmd = "rm -r " + path;
-  if (system(cmd.c_str()) < 0) {
-    throw UnixError();
-  }
-}
-
-/**
- * @description: 判断指定路径文件是否存在
- * @return {bool} 若指定路径文件存在则返回true
- * @param {string} &path 指定路径文件
- */
-bool DiskManager::is_file(const std::string& path) {
-  // 用struct stat获取文件信息
-  struct stat st;
-  return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
-}
-
-/**
- * @description: 用于创建指定路径文件
- * @return {*}
- * @param {string} &path
- */
-void DiskManager::create_file(const std::string& path) {
-  // Todo:
-  // 调用open()函数，使用O_CREAT模式
-  // 注意不能重复创建相同文件
-  if (is_file(path)) {
-    throw FileExistsError(path);
-  }
-
-  // 所有者可读写，组用户和其他用户可读
-  int fd = open(path.c_str(), O_CREAT | O_EXCL, 0644);
-  if (fd == -1) {
-    throw InternalError("DiskManager::create_file: Open Error");
-  }
-
-  if (close(fd) == -1) {
-    throw InternalError("DiskManager::create_file: Close Error");
-  }
-}
-
-/**
- * @description: 删除指定路径的文件
- * @param {string} &path 文件所在路径
- */
-void DiskManager::destroy_file(const std::string& path) {
-  // Todo:
-  // 调用unlink()函数
-  // 注意不能删除未关闭的文件
-  // 文件不存在
-  if (!is_file(path)) {
-    throw FileNotFoundError(path);
-  }
-
-  // 文件未关闭
-  if (path2fd_.count(path)) {
-    throw FileNotClosedError(path);
-  }
-
-  if (unlink(path.c_str()) == -1) {
-    throw InternalError("DiskManager::destroy_file: Unlink Error");
-  }
-}
-
-/**
- * @description: 打开指定路径文件
- * @return {int} 返回打开的文件的文件句柄
- * @param {string} &path 文件所在路径
- */
-int DiskManager::open_file(const std::string& path) {
-  // Todo:
-  // 调用open()函数，使用O_RDWR模式
-  // 注意不能重复打开相同文件，并且需要更新文件打开列表
-  if (!is_file(path)) {
-    throw FileNotFoundError(path);
-  }
-
-  // 注意不能重复打开相同文件
-  if (path2fd_.count(path)) {
-    throw FileNotClosedError(path);
-  }
-
-  int fd = open(path.c_str(), O_RDWR);
-  if (fd == -1) {
-    throw InternalError("DiskManager::open_file: Open Error");
-  }
-
-  path2fd_[path] = fd;
-  fd2path_[fd] = path;
-  return fd;
-}
-
-/**
- * @description:用于关闭指定路径文件
- * @param {int} fd 打开的文件的文件句柄
- */
-void DiskManager::close_file(int fd) {
-  // Todo:
-  // 调用close()函数
-  // 注意不能关闭未打开的文件，并且需要更新文件打开列表
-  if (fd2path_.count(fd) == 0) {
-    throw FileNotOpenError(fd);
-  }
-
-  path2fd_.erase(fd2path_[fd]);
-  fd2path_.erase(fd);
-
-  if (close(fd) == -1) {
-    throw InternalError("DiskManager::close_file: Close Error");
-  }
-}
-
-/**
- * @description: 获得文件的大小
- * @return {int} 文件的大小
- * @param {string} &file_name 文件名
- */
-int DiskManager::get_file_size(const std::string& file_name) {
-  struct stat stat_buf;
-  int rc = stat(file_name.c_str(), &stat_buf);
-  return rc == 0 ? stat_buf.st_size : -1;
-}
-
-/**
- * @description: 根据文件句柄获得文件名
- * @return {string} 文件句柄对应文件的文件名
- * @param {int} fd 文件句柄
- */
-std::string DiskManager::get_file_name(int fd) {
-  if (!fd2path_.count(fd)) {
-    throw FileNotOpenError(fd);
-  }
-  return fd2path_[fd];
-}
-
-/**
- * @description:  获得文件名对应的文件句柄
- * @return {int} 文件句柄
- * @param {string} &file_name 文件名
- */
-int DiskManager::get_file_fd(const std::string& file_name) {
-  if (!path2fd_.count(file_name)) {
-    return open_file(file_name);
-  }
-  return path2fd_[file_name];
-}
-
-/**
- * @description:  读取日志文件内容
- * @return {int} 返回读取的数据量，若为-1说明读取数据的起始位置超过了文件大小
- * @param {char} *log_data 读取内容到log_data中
- * @param {int} size 读取的数据量大小
- * @param {int} offset 读取的内容在文件中的位置
- */
-int DiskManager::read_log(char* log_data, int size, int offset) {
-  // read log file from the previous end
-  if (log_fd_ == -1) {
-    log_fd_ = open_file(LOG_FILE_NAME);
-  }
-  int file_size = get_file_size(LOG_FILE_NAME);
-  if (offset > file_size) {
-    return -1;
-  }
-
-  // 得到实际读取的 size
-  size = std::min(size, file_size - offset);
-  if (size == 0) return 0;
-  lseek(log_fd_, offset, SEEK_SET);
-  ssize_t bytes_read = read(log_fd_, log_data, size);
-  assert(bytes_read == size);
-  return bytes_read;
-}
-
-/**
- * @description: 写日志内容
- * @param {char} *log_data 要写入的日志内容
- * @param {int} size 要写入的内容大小
- */
-void DiskManager::write_log(char* log_data, int size) {
-  if (log_fd_ == -1) {
-    log_fd_ = open_file(LOG_FILE_NAME);
-  }
-
-  // write from the file_end
-  lseek(log_fd_, 0, SEEK_END);
-  ssize_t bytes_write = write(log_fd_, log_data, size);
-  if (bytes_write != size) {
-    throw UnixError();
-  }
-}
+/* Copyright (c) 2023 Renmin University of China
+RMDB is licensed under Mulan PSL v2.
+You can use this software according to the terms and conditions of the Mulan PSL
+v2. You may obtain a copy of Mulan PSL v2 at:
+        http://license.coscl.org.cn/MulanPSL2
+THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+See the Mulan PSL v2 for more details. */
+
+#include "storage/disk_manager.h"
+
+#include <assert.h>    // for assert
+#include <dirent.h>    // for opendir
+#include <string.h>    // for memset
+#include <sys/stat.h>  // for stat
+#include <unistd.h>    // for lseek
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <tuple>
+
+#include "defs.h"
+
+DiskManager::DiskManager() {
+  memset(fd2pageno_, 0,
+         MAX_FD * (sizeof(std::atomic<page_id_t>) / sizeof(char)));
+}
+
+DiskManager::~DiskManager() {
+  for (auto& [_, fd] : log_fds_) {
+    std::ignore = _;
+    close(fd);
+  }
+}
+
+/**
+ * @description: 将数据写入文件的指定磁盘页面中
+ * @param {int} fd 磁盘文件的文件句柄
+ * @param {page_id_t} page_no 写入目标页面的page_id
+ * @param {char} *offset 要写入磁盘的数据
+ * @param {int} num_bytes 要写入磁盘的数据大小
+ */
+void DiskManager::write_page(int fd, page_id_t page_no, const char* data,
+                             int num_bytes) {
+  // Todo:
+  // 1.lseek()定位到文件头，通过(fd,page_no)可以定位指定页面及其在磁盘文件中的偏移量
+  // 2.调用write()函数
+  // 注意write返回值与num_bytes不等时 throw
+  // InternalError("DiskManager::write_page Error");
+  off_t offset = page_no * PAGE_SIZE;
+
+  if (lseek(fd, offset, SEEK_SET) == -1) {
+    perror("DiskManager::write_page");
+    throw InternalError("DiskManager::write_page: lSeek Error");
+  }
+
+  if (write(fd, data, num_bytes) != num_bytes) {
+    throw InternalError("DiskManager::write_page: Write Error");
+  }
+}
+
+/**
+ * @description: 读取文件中指定编号的页面中的部分数据到内存中
+ * @param {int} fd 磁盘文件的文件句柄
+ * @param {page_id_t} page_no 指定的页面编号
+ * @param {char} *offset 读取的内容写入到offset中
+ * @param {int} num_bytes 读取的数据量大小
+ */
+void DiskManager::read_page(int fd, page_id_t page_no, char* data,
+                            int num_bytes) {
+  // Todo:
+  // 1.lseek()定位到文件头，通过(fd,page_no)可以定位指定页面及其在磁盘文件中的偏移量
+  // 2.调用read()函数
+  // 注意read返回值与num_bytes不等时，throw
+  // InternalError("DiskManager::read_page Error");
+  off_t offset = page_no * PAGE_SIZE;
+
+  if (lseek(fd, offset, SEEK_SET) == -1) {
+    perror("DiskManager::read_page");
+    throw InternalError("DiskManager::read_page: lSeek Error");
+  }
+
+  if (read(fd, data, num_bytes) != num_bytes) {
+    throw InternalError("DiskManager::read_page: Read Error");
+  }
+}
+
+/**
+ * @description: 分配一个新的页号
+ * @return {page_id_t} 分配的新页号
+ * @param {int} fd 指定文件的文件句柄
+ */
+page_id_t DiskManager::allocate_page(int fd) {
+  // 简单的自增分配策略，指定文件的页面编号加1
+  assert(fd >= 0 && fd < MAX_FD);
+  return fd2pageno_[fd]++;
+}
+
+void DiskManager::deallocate_page(__attribute__((unused)) page_id_t page_id) {}
+
+bool DiskManager::is_dir(const std::string& path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+void DiskManager::create_dir(const std::string& path) {
+  // Create a subdirectory
+  std::string cmd = "mkdir " + path;
+  if (system(cmd.c_str()) < 0) {
+    // 创建一个名为path的目录
+    throw UnixError();
+  }
+}
+
+void DiskManager::destroy_dir(const std::string& path) {
+  std::string cmd = "rm -r " + path;
+  if (system(cmd.c_str()) < 0) {
+    throw UnixError();
+  }
+}
+
+/**
+ * @description: 判断指定路径文件是否存在
+ * @return {bool} 若指定路径文件存在则返回true
+ * @param {string} &path 指定路径文件
+ */
+bool DiskManager::is_file(const std::string& path) {
+  // 用struct stat获取文件信息
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+/**
+ * @description: 用于创建指定路径文件
+ * @return {*}
+ * @param {string} &path
+ */
+void DiskManager::create_file(const std::string& path) {
+  // Todo:
+  // 调用open()函数，使用O_CREAT模式
+  // 注意不能重复创建相同文件
+  if (is_file(path)) {
+    throw FileExistsError(path);
+  }
+
+  // 所有者可读写，组用户和其他用户可读
+  int fd = open(path.c_str(), O_CREAT | O_EXCL, 0644);
+  if (fd == -1) {
+    throw InternalError("DiskManager::create_file: Open Error");
+  }
+
+  if (close(fd) == -1) {
+    throw InternalError("DiskManager::create_file: Close Error");
+  }
+}
+
+/**
+ * @description: 删除指定路径的文件
+ * @param {string} &path 文件所在路径
+ */
+void DiskManager::destroy_file(const std::string& path) {
+  // Todo:
+  // 调用unlink()函数
+  // 注意不能删除未关闭的文件
+  // 文件不存在
+  if (!is_file(path)) {
+    throw FileNotFoundError(path);
+  }
+
+  // 文件未关闭
+  if (path2fd_.count(path)) {
+    throw FileNotClosedError(path);
+  }
+
+  if (unlink(path.c_str()) == -1) {
+    throw InternalError("DiskManager::destroy_file: Unlink Error");
+  }
+}
+
+/**
+ * @description: 打开指定路径文件
+ * @return {int} 返回打开的文件的文件句柄
+ * @param {string} &path 文件所在路径
+ */
+int DiskManager::open_file(const std::string& path) {
+  // Todo:
+  // 调用open()函数，使用O_RDWR模式
+  // 注意不能重复打开相同文件，并且需要更新文件打开列表
+  if (!is_file(path)) {
+    throw FileNotFoundError(path);
+  }
+
+  // 注意不能重复打开相同文件
+  if (path2fd_.count(path)) {
+    throw FileNotClosedError(path);
+  }
+
+  int fd = open(path.c_str(), O_RDWR);
+  if (fd == -1) {
+    throw InternalError("DiskManager::open_file: Open Error");
+  }
+
+  path2fd_[path] = fd;
+  fd2path_[fd] = path;
+  return fd;
+}
+
+/**
+ * @description:用于关闭指定路径文件
+ * @param {int} fd 打开的文件的文件句柄
+ */
+void DiskManager::close_file(int fd) {
+  // Todo:
+  // 调用close()函数
+  // 注意不能关闭未打开的文件，并且需要更新文件打开列表
+  if (fd2path_.count(fd) == 0) {
+    throw FileNotOpenError(fd);
+  }
+
+  path2fd_.erase(fd2path_[fd]);
+  fd2path_.erase(fd);
+
+  if (close(fd) == -1) {
+    throw InternalError("DiskManager::close_file: Close Error");
+  }
+}
+
+/**
+ * @description: 获得文件的大小
+ * @return {int} 文件的大小
+ * @param {string} &file_name 文件名
+ */
+int DiskManager::get_file_size(const std::string& file_name) {
+  struct stat stat_buf;
+  int rc = stat(file_name.c_str(), &stat_buf);
+  return rc == 0 ? stat_buf.st_size : -1;
+}
+
+/**
+ * @description: 根据文件句柄获得文件名
+ * @return {string} 文件句柄对应文件的文件名
+ * @param {int} fd 文件句柄
+ */
+std::string DiskManager::get_file_name(int fd) {
+  if (!fd2path_.count(fd)) {
+    throw FileNotOpenError(fd);
+  }
+  return fd2path_[fd];
+}
+
+/**
+ * @description:  获得文件名对应的文件句柄
+ * @return {int} 文件句柄
+ * @param {string} &file_name 文件名
+ */
+int DiskManager::get_file_fd(const std::string& file_name) {
+  if (!path2fd_.count(file_name)) {
+    return open_file(file_name);
+  }
+  return path2fd_[file_name];
+}
+
+/**
+ * @description: 把目录项的变化（创建、改名、删除文件）持久化到磁盘
+ * @param {string} &path 目录的路径
+ */
+void DiskManager::sync_dir(const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY);
+  if (fd == -1) {
+    throw UnixError();
+  }
+  int rc = fsync(fd);
+  close(fd);
+  if (rc != 0) {
+    throw UnixError();
+  }
+}
+
+/**
+ * @description: 日志段的文件名，段号补零到定长，按文件名排序就是按段号排序
+ * @return {string} 日志段的文件名
+ * @param {int64_t} segment 段号
+ */
+std::string DiskManager::get_log_segment_name(int64_t segment) {
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), ".%012lld",
+           static_cast<long long>(segment));
+  return LOG_FILE_NAME + suffix;
+}
+
+/**
+ * @description: 当前目录下所有日志段的段号，包括回收之后等待重用的日志段
+ * @return {vector<int64_t>} 从小到大排列的段号
+ */
+std::vector<int64_t> DiskManager::get_log_segments() {
+  std::vector<int64_t> segments;
+  DIR* dir = opendir(".");
+  if (dir == nullptr) {
+    throw UnixError();
+  }
+  std::string prefix = LOG_FILE_NAME + ".";
+  while (auto* entry = readdir(dir)) {
+    std::string name = entry->d_name;
+    if (name.compare(0, prefix.size(), prefix) != 0 ||
+        name.size() == prefix.size()) {
+      continue;
+    }
+    // 创建到一半的临时文件等不是日志段
+    char* end;
+    long long segment = strtoll(name.c_str() + prefix.size(), &end, 10);
+    if (*end == '\0' && segment >= 0) {
+      segments.push_back(segment);
+    }
+  }
+  closedir(dir);
+  std::sort(segments.begin(), segments.end());
+  return segments;
+}
+
+/**
+ * @description: 打开日志段，调用者持有 log_latch_
+ * @return {int} 日志段的 fd，日志段不存在时为 -1
+ * @param {int64_t} segment 段号
+ */
+int DiskManager::open_log_segment(int64_t segment) {
+  auto it = log_fds_.find(segment);
+  if (it != log_fds_.end()) {
+    return it->second;
+  }
+  auto name = get_log_segment_name(segment);
+  int fd = open(name.c_str(), O_RDWR);
+  if (fd == -1 && errno == ENOENT) {
+    return -1;
+  }
+  if (fd == -1) {
+    throw UnixError();
+  }
+  log_fds_.emplace(segment, fd);
+  return fd;
+}
+
+/**
+ * @description: 新建一个写满 0 的日志段。先写临时文件再改名，崩溃后不会留下
+ * 不完整的日志段；改名之后同步目录，日志段和写入其中的日志一起持久化
+ * @param {int64_t} segment 段号
+ */
+void DiskManager::create_log_segment(int64_t segment) {
+  auto name = get_log_segment_name(segment);
+  auto tmp_name = name + ".tmp";
+  int fd = open(tmp_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    throw UnixError();
+  }
+  // 后台线程可能在进程退出、静态变量析构之后还在创建日志段，不用静态缓冲区
+  std::vector<char> zeros(1 << 20);
+  bool written = true;
+  for (int64_t offset = 0; written && offset < LOG_SEGMENT_SIZE;
+       offset += zeros.size()) {
+    written = write(fd, zeros.data(), zeros.size()) ==
+              static_cast<ssize_t>(zeros.size());
+  }
+  written = written && fsync(fd) == 0;
+  close(fd);
+  if (!written || rename(tmp_name.c_str(), name.c_str()) != 0) {
+    throw UnixError();
+  }
+  sync_dir(".");
+}
+
+/**
+ * @description: 从日志流中的 pos 开始读取日志，跨过日志段的边界时接着读下一个
+ * 日志段。日志段是预先写满的，读到的内容不一定是有效的日志，由调用者按 lsn 和
+ * 校验和判断
+ * @return {int} 返回读取的数据量，日志段不存在时读到的数据会变少
+ * @param {char} *log_data 读取内容到log_data中
+ * @param {int} size 读取的数据量大小
+ * @param {lsn_t} pos 读取的内容在日志流中的位置
+ */
+int DiskManager::read_log(char* log_data, int size, lsn_t pos) {
+  std::lock_guard lock(log_latch_);
+  int bytes_read = 0;
+  while (bytes_read < size) {
+    int64_t segment = pos >> LOG_SEGMENT_BITS;
+    int64_t offset = pos & (LOG_SEGMENT_SIZE - 1);
+    int len = static_cast<int>(
+        std::min<int64_t>(size - bytes_read, LOG_SEGMENT_SIZE - offset));
+    int fd = open_log_segment(segment);
+    if (fd == -1) {
+      break;
+    }
+    // pread 不移动文件偏移，后台回滚读日志时可以同时追加日志
+    ssize_t n = pread(fd, log_data + bytes_read, len, offset);
+    if (n <= 0) {
+      break;
+    }
+    bytes_read += n;
+    pos += n;
+    if (n < len) {
+      break;
+    }
+  }
+  return bytes_read;
+}
+
+/**
+ * @description: 把日志写到日志流中的 pos 处，需要时创建新的日志段
+ * @param {char} *log_data 要写入的日志内容
+ * @param {int} size 要写入的内容大小
+ * @param {lsn_t} pos 写入的位置
+ */
+void DiskManager::write_log(const char* log_data, int size, lsn_t pos) {
+  std::unique_lock lock(log_latch_);
+  while (size > 0) {
+    int64_t segment = pos >> LOG_SEGMENT_BITS;
+    int64_t offset = pos & (LOG_SEGMENT_SIZE - 1);
+    int len = static_cast<int>(
+        std::min<int64_t>(size, LOG_SEGMENT_SIZE - offset));
+    // 日志追上了预先创建的日志段，等它创建完，不能再创建一次
+    log_cv_.wait(lock, [&] { return preparing_log_segment_ != segment; });
+    int fd = open_log_segment(segment);
+    if (fd == -1) {
+      // 后台线程创建失败或者落后了，自己创建。写满和 fsync 时不持有
+      // log_latch_，读日志和其他日志段的刷盘不用等它
+      lock.unlock();
+      prepare_log_segment(segment);
+      lock.lock();
+      continue;
+    }
+    if (pwrite(fd, log_data, len, offset) != len) {
+      throw UnixError();
+    }
+    unsynced_log_segments_.insert(segment);
+    last_log_segment_ = std::max(last_log_segment_, segment);
+    log_data += len;
+    size -= len;
+    pos += len;
+  }
+}
+
+/**
+ * @description: 把已经写入的日志持久化到磁盘。日志段的空间是预先分配好的，
+ * 只需要同步数据
+ */
+void DiskManager::sync_log() {
+  std::lock_guard lock(log_latch_);
+  for (auto segment : unsynced_log_segments_) {
+    if (fdatasync(log_fds_.at(segment)) != 0) {
+      throw UnixError();
+    }
+  }
+  unsynced_log_segments_.clear();
+}
+
+/**
+ * @description: 回收 lsn 所在日志段之前的日志段。等待重用的日志段不足
+ * LOG_SPARE_SEGMENTS 个时，把回收的日志段改名为之后的段号，写到那里时直接覆盖，
+ * 不用再新建和写满；多余的日志段删除
+ * @param {lsn_t} lsn 恢复需要的最早一条日志
+ */
+void DiskManager::recycle_log(lsn_t lsn) {
+  int64_t keep = lsn >> LOG_SEGMENT_BITS;
+  // 持有 log_latch_ 列出日志段，期间不会有日志段被创建
+  std::lock_guard lock(log_latch_);
+  auto segments = get_log_segments();
+  // 正在写的日志段不回收
+  keep = std::min(keep, last_log_segment_);
+  if (segments.empty() || segments.front() >= keep) {
+    return;
+  }
+  // 不能改名成正在预先创建的段号
+  int64_t next = std::max(segments.back(), preparing_log_segment_) + 1;
+  auto spare = std::count_if(segments.begin(), segments.end(), [this](auto s) {
+    return s > last_log_segment_;
+  });
+  for (auto segment : segments) {
+    if (segment >= keep) {
+      break;
+    }
+    auto it = log_fds_.find(segment);
+    if (it != log_fds_.end()) {
+      close(it->second);
+      log_fds_.erase(it);
+    }
+    auto name = get_log_segment_name(segment);
+    int rc;
+    if (spare < LOG_SPARE_SEGMENTS) {
+      rc = rename(name.c_str(), get_log_segment_name(next++).c_str());
+      ++spare;
+    } else {
+      rc = unlink(name.c_str());
+    }
+    if (rc != 0) {
+      throw UnixError();
+    }
+  }
+  sync_dir(".");
+}
+
+/**
+ * @description: 预先创建日志段，由日志管理器的后台线程在日志写到它之前调用，
+ * 后台线程没有创建时写日志的线程也会调用。写满和 fsync 新文件时不持有
+ * log_latch_，不挡住提交的刷盘；同一时间只创建一个日志段，日志段已经存在
+ * （比如回收改名而来）时什么都不做
+ * @param {int64_t} segment 段号
+ */
+void DiskManager::prepare_log_segment(int64_t segment) {
+  auto name = get_log_segment_name(segment);
+  {
+    std::unique_lock lock(log_latch_);
+    log_cv_.wait(lock, [this] { return preparing_log_segment_ == -1; });
+    if (log_fds_.count(segment) != 0 || access(name.c_str(), F_OK) == 0) {
+      return;
+    }
+    preparing_log_segment_ = segment;
+  }
+  auto finish = [this] {
+    {
+      std::lock_guard lock(log_latch_);
+      preparing_log_segment_ = -1;
+    }
+    log_cv_.notify_all();
+  };
+  try {
+    create_log_segment(segment);
+  } catch (...) {
+    finish();
+    throw;
+  }
+  finish();
+}
@@ -1,106 +1,131 @@
-/* Copyright (c) 2023 Renmin University of China
-RMDB is licensed under Mulan PSL v2.
-You can use this software according to the terms and conditions of the Mulan PSL
-v2. You may obtain a copy of Mulan PSL v2 at:
-        http://license.coscl.org.cn/MulanPSL2
-THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
-EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
-MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
-See the Mulan PSL v2 for more details. */
-
-#pragma once
-
-#include <fcntl.h>
-#include <sys/stat.h>
-#include <unistd.h>
-
-#include <atomic>
-#include <fstream>
-#include <iostream>
-#include <string>
-#include <unordered_map>
-
-#include "common/config.h"
-#include "errors.h"
-
-/**
- * @description: DiskManager的作用主要是根据上层的需要对磁盘文件进行操作
- */
-class DiskManager {
- public:
-  explicit DiskManager();
-
-  ~DiskManager() = default;
-
-  void write_page(int fd, page_id_t page_no, const char* offset, int num_bytes);
-
-  void read_page(int fd, page_id_t page_no, char* offset, int num_bytes);
-
-  page_id_t allocate_page(int fd);
-
-  void deallocate_page(page_id_t page_id);
-
-  /*目录操作*/
-  bool is_dir(const std::string& path);
-
-  void create_dir(const std::string& path);
-
-  void destroy_dir(const std::string& path);
-
-  /*文件操作*/
-  bool is_file(const std::string& path);
-
-  void create_file(const std::string& path);
-
-  void destroy_file(const std::string& path);
-
-  int open_file(const std::string& path);
-
-  void close_file(int fd);
-
-  int get_file_size(const std::string& file_name);
-
-  std::string get_file_name(int fd);
-
-  int get_file_fd(const std::string& file_name);
-
-  /*日志操作*/
-  int read_log(char* log_data, int size, int offset);
-
-  void write_log(char* log_data, int size);
-
-  void SetLogFd(int log_fd) { log_fd_ = log_fd; }
-
-  int GetLogFd() { return log_fd_; }
-
-  /**
-   * @description: 设置文件已经分配的页面个数
-   * @param {int} fd 文件对应的文件句柄
-   * @param {int} start_page_no
-   * 已经分配的页面个数，即文件接下来从start_page_no开始分配页面编号
-   */
-  void set_fd2pageno(int fd, int start_page_no) {
-    fd2pageno_[fd] = start_page_no;
-  }
-
-  /**
-   * @description:
-   * 获得文件目前已分配的页面个数，即如果文件要分配一个新页面，需要从fd2pagenp_[fd]开始分配
-   * @return {page_id_t} 已分配的页面个数
-   * @param {int} fd 文件对应的句柄
-   */
-  page_id_t get_fd2pageno(int fd) { return fd2pageno_[fd]; }
-
-  static constexpr int MAX_FD = 8192;
-
- private:
-  // 文件打开列表，用于记录文件是否被打开
-  std::unordered_map<std::string, int>
-      path2fd_;  //<Page文件磁盘路径,Page fd>哈希表
-  std::unordered_map<int, std::string>
-      fd2path_;  //<Page fd,Page文件磁盘路径>哈希表
-
-  int log_fd_ = -1;  // WAL日志文件的文件句柄，默认为-1，代表未打开日志文件
-  std::atomic<page_id_t>
-      fd2pageno_[MAX_FD]{};  // 文件中已经分配的页面个数，初始值为0
-};
+/* Copyright (c) 2023 Renmin University of China
+RMDB is licensed under Mulan PSL v2.
+You can use this software according to the terms and conditions of the Mulan PSL
+v2. You may obtain a copy of Mulan PSL v2 at:
+        http://license.coscl.org.cn/MulanPSL2
+THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+See the Mulan PSL v2 for more details. */
+
+#pragma once
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "common/config.h"
+#include "errors.h"
+
+/**
+ * @description: DiskManager的作用主要是根据上层的需要对磁盘文件进行操作
+ */
+class DiskManager {
+ public:
+  explicit DiskManager();
+
+  ~DiskManager();
+
+  void write_page(int fd, page_id_t page_no, const char* offset, int num_bytes);
+
+  void read_page(int fd, page_id_t page_no, char* offset, int num_bytes);
+
+  page_id_t allocate_page(int fd);
+
+  void deallocate_page(page_id_t page_id);
+
+  /*目录操作*/
+  bool is_dir(const std::string& path);
+
+  void create_dir(const std::string& path);
+
+  void destroy_dir(const std::string& path);
+
+  /*文件操作*/
+  bool is_file(const std::string& path);
+
+  void create_file(const std::string& path);
+
+  void destroy_file(const std::string& path);
+
+  int open_file(const std::string& path);
+
+  void close_file(int fd);
+
+  int get_file_size(const std::string& file_name);
+
+  std::string get_file_name(int fd);
+
+  int get_file_fd(const std::string& file_name);
+
+  static void sync_dir(const std::string& path);
+
+  /*日志操作*/
+  int read_log(char* log_data, int size, lsn_t pos);
+
+  void write_log(const char* log_data, int size, lsn_t pos);
+
+  void sync_log();
+
+  void recycle_log(lsn_t lsn);
+
+  void prepare_log_segment(int64_t segment);
+
+  std::vector<int64_t> get_log_segments();
+
+  static std::string get_log_segment_name(int64_t segment);
+
+  /**
+   * @description: 设置文件已经分配的页面个数
+   * @param {int} fd 文件对应的文件句柄
+   * @param {int} start_page_no
+   * 已经分配的页面个数，即文件接下来从start_page_no开始分配页面编号
+   */
+  void set_fd2pageno(int fd, int start_page_no) {
+    fd2pageno_[fd] = start_page_no;
+  }
+
+  /**
+   * @description:
+   * 获得文件目前已分配的页面个数，即如果文件要分配一个新页面，需要从fd2pagenp_[fd]开始分配
+   * @return {page_id_t} 已分配的页面个数
+   * @param {int} fd 文件对应的句柄
+   */
+  page_id_t get_fd2pageno(int fd) { return fd2pageno_[fd]; }
+
+  static constexpr int MAX_FD = 8192;
+
+ private:
+  // 文件打开列表，用于记录文件是否被打开
+  std::unordered_map<std::string, int>
+      path2fd_;  //<Page文件磁盘路径,Page fd>哈希表
+  std::unordered_map<int, std::string>
+      fd2path_;  //<Page fd,Page文件磁盘路径>哈希表
+
+  int open_log_segment(int64_t segment);
+
+  void create_log_segment(int64_t segment);
+
+  // 日志分成 LOG_SEGMENT_SIZE 大小的日志段文件，创建时就写满，
+  // 写日志只覆盖已经分配的空间，fdatasync 不用更新文件的元数据
+  std::mutex log_latch_;                     // 保护日志段的状态
+  std::condition_variable log_cv_;           // 等待预先创建的日志段
+  std::map<int64_t, int> log_fds_;           // 打开的日志段：段号 -> fd
+  std::set<int64_t> unsynced_log_segments_;  // 写过、还没有持久化的日志段
+  int64_t last_log_segment_ = -1;            // 写过日志的最大段号
+  int64_t preparing_log_segment_ = -1;       // 正在预先创建的段号
+
+  std::atomic<page_id_t>
+      fd2pageno_[MAX_FD]{};  // 文件中已经分配的页面个数，初始值为0
+};
@@ -10,6 +10,7 @@ See the Mulan PSL v2 for more details. */
 
 #pragma once
 
+#include <atomic>
 #include <cstring>
 
 #include "common/config.h"
@@ -84,7 +85,7 @@ class Page {
 
   static constexpr size_t OFFSET_PAGE_START = 0;
   static constexpr size_t OFFSET_LSN = 0;
-  static constexpr size_t OFFSET_PAGE_HDR = 4;
+  static constexpr size_t OFFSET_PAGE_HDR = sizeof(lsn_t);
 
   inline lsn_t get_page_lsn() {
     return *reinterpret_cast<lsn_t*>(get_data() + OFFSET_LSN);
@@ -92,11 +93,30 @@ class Page {
 
   inline void set_page_lsn(lsn_t page_lsn) {
     memcpy(get_data() + OFFSET_LSN, &page_lsn, sizeof(lsn_t));
+    // 写回磁盘之后第一次修改的 lsn 就是页面的 rec_lsn
+    lsn_t invalid_lsn = INVALID_LSN;
+    rec_lsn_.compare_exchange_strong(invalid_lsn, page_lsn,
+                                     std::memory_order_relaxed);
   }
 
-  inline void WLatch() { rwlatch_.WLock(); }
+  // 页面写回磁盘之后第一条修改它的日志，检查点把它记到脏页表中
+  inline lsn_t get_rec_lsn() const {
+    return rec_lsn_.load(std::memory_order_relaxed);
+  }
 
-  inline void WUnlatch() { rwlatch_.WUnlock(); }
+  inline void WLatch() {
+    rwlatch_.WLock();
+    // 版本号变为奇数，之后对页面的修改不能重排到它前面
+    version_.store(version_.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+
+  inline void WUnlatch() {
+    version_.store(version_.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_release);
+    rwlatch_.WUnlock();
+  }
 
   inline void RLatch() { rwlatch_.RLock(); }
 
@@ -104,7 +124,41 @@ class Page {
 
   inline int get_pin_count() const { return pin_count_; }
 
+  /**
+   * 乐观读：不加读锁，先取版本号，读完页面后用 validate_version 校验，
+   * 期间有写者持有或释放过写锁则校验失败。版本号为奇数说明正被写，直接重试
+   */
+  inline uint64_t read_version() const {
+    return version_.load(std::memory_order_acquire);
+  }
+
+  inline bool validate_version(uint64_t version) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return version_.load(std::memory_order_relaxed) == version;
+  }
+
  private:
+  /**
+   * 帧换入其他页面或被清空时由 buffer pool 调用，和写锁一样让版本号变为奇数，
+   * 不 pin 页面的乐观读因此会校验失败。此时页面没有被 pin，不会有人持有写锁
+   */
+  void begin_replace() {
+    version_.store(version_.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+
+  void end_replace() {
+    version_.store(version_.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_release);
+  }
+
+  // 页面写回磁盘之后调用
+  void clear_dirty() {
+    is_dirty_ = false;
+    rec_lsn_.store(INVALID_LSN, std::memory_order_relaxed);
+  }
+
   void reset_memory() {
     // 将 data_ 的 PAGE_SIZE 个字节填充为 0
     memset(data_, OFFSET_PAGE_START, PAGE_SIZE);
@@ -123,9 +177,15 @@ class Page {
   /** 脏页判断 */
   bool is_dirty_ = false;
 
+  /** 页面写回磁盘之后第一条修改它的日志的 lsn，页面干净时为 INVALID_LSN */
+  std::atomic<lsn_t> rec_lsn_{INVALID_LSN};
+
   /** The pin count of this page. */
   int pin_count_ = 0;
 
   /** 页读写锁 */
   RWLatch rwlatch_;
+
+  /** 乐观读的版本号，每次加写锁和释放写锁各加一 */
+  std::atomic<uint64_t> version_{0};
 };
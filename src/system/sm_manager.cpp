@@ -14,7 +14,11 @@ See the Mulan PSL v2 for more details. */
 #include <unistd.h>
 
 #include <fstream>
+#include <numeric>
+#include <queue>
 
+#include "common/thread_pool.h"
+#include "execution/morsel_scheduler.h"
 #include "index/ix.h"
 #include "record/rm.h"
 #include "record_printer.h"
@@ -59,8 +63,7 @@ void SmManager::create_db(const std::string& db_name) {
 
   delete new_db;
 
-  // 创建日志文件
-  disk_manager_->create_file(LOG_FILE_NAME);
+  // 日志段在第一次写日志时创建
 
   // 回到根目录
   if (chdir("..") < 0) {
@@ -106,15 +109,19 @@ void SmManager::open_db(const std::string& db_name) {
   if (ifs.fail()) {
     throw UnixError();
   }
+  std::lock_guard lock(ddl_latch_);
   ifs >> db_;  // 注意：此处重载了操作符>>
 
   // 打开数据库中每个表的记录文件并读入
   for (auto& [table_name, tab_meta] : db_.tabs_) {
     fhs_[table_name] = rm_manager_->open_file(table_name);
     // 待索引完成后更新
-    for (auto& [index_name, _] : tab_meta.indexes) {
-      std::ignore = _;
-      ihs_[index_name] = ix_manager_->open_index(index_name);
+    for (auto& [index_name, index_meta] : tab_meta.indexes) {
+      if (index_meta.type == IndexType::HASH) {
+        ihs_[index_name] = ix_manager_->open_hash_index(index_name);
+      } else {
+        ihs_[index_name] = ix_manager_->open_index(index_name);
+      }
     }
   }
 }
@@ -136,6 +143,7 @@ void SmManager::close_db() {
     throw DatabaseNotOpenError(db_.name_);
   }
 
+  std::lock_guard lock(ddl_latch_);
   flush_meta();
   db_.name_.clear();
   db_.tabs_.clear();
@@ -196,14 +204,15 @@ void SmManager::show_indexs(std::string& table_name, Context* context) {
 
   std::ofstream outfile("output.txt", std::ios::out | std::ios::app);
   RecordPrinter printer(3);
-  std::vector<std::string> rec_str{table_name, "unique", ""};
-  std::string format = "| " + table_name + " | unique | (";
+  std::vector<std::string> rec_str{table_name, "", ""};
 
   std::ostringstream cols_stream;
   for (const auto& [_, index] : db_.tabs_[table_name].indexes) {
     std::ignore = _;
+    rec_str[1] = index.unique ? "unique" : "non-unique";
     cols_stream << "(" << index.cols[0].second.name;
-    outfile << format << index.cols[0].second.name;
+    outfile << "| " << table_name << " | " << rec_str[1] << " | ("
+            << index.cols[0].second.name;
     for (size_t i = 1; i < index.cols.size(); ++i) {
       cols_stream << "," << index.cols[i].second.name;
       outfile << "," << index.cols[i].second.name;
@@ -272,7 +281,8 @@ void SmManager::create_table(const std::string& tab_name,
       curr_offset;  // record_size就是col
                     // meta所占的大小（表的元数据也是以记录的形式进行存储的）
   rm_manager_->create_file(tab_name, record_size);
-  db_.tabs_[tab_name] = std::move(tab);
+  std::lock_guard lock(ddl_latch_);
+  db_.add_table(std::move(tab));
   // fhs_[tab_name] = rm_manager_->open_file(tab_name);
   fhs_.emplace(tab_name, rm_manager_->open_file(tab_name));
 
@@ -301,6 +311,7 @@ void SmManager::drop_table(const std::string& tab_name, Context* context) {
   //     fhs_[tab_name]->GetFd());
   // }
 
+  std::lock_guard lock(ddl_latch_);
   auto& tab_meta = db_.get_table(tab_name);
 
   // 先关闭再删除表文件
@@ -316,7 +327,7 @@ void SmManager::drop_table(const std::string& tab_name, Context* context) {
   }
 
   fhs_.erase(tab_name);
-  db_.tabs_.erase(tab_name);
+  db_.erase_table(tab_name);
 
   flush_meta();
 }
@@ -326,10 +337,14 @@ void SmManager::drop_table(const std::string& tab_name, Context* context) {
  * @param {string&} tab_name 表的名称
  * @param {vector<string>&} col_names 索引包含的字段名称
  * @param {Context*} context
+ * @param {bool} unique 是否唯一索引
+ * @param {vector<string>&} include_col_names INCLUDE 的字段名称
+ * @param {IndexType} index_type B+ 树或哈希索引
  */
-void SmManager::create_index(std::string& tab_name,
-                             std::vector<std::string>& col_names,
-                             Context* context) {
+void SmManager::create_index(
+    std::string& tab_name, std::vector<std::string>& col_names,
+    Context* context, bool unique,
+    const std::vector<std::string>& include_col_names, IndexType index_type) {
   auto&& ix_name = ix_manager_->get_index_name(tab_name, col_names);
   if (disk_manager_->is_file(ix_name)) {
     throw IndexExistsError(tab_name, col_names);
@@ -352,48 +367,209 @@ void SmManager::create_index(std::string& tab_name,
     col_metas.emplace_back(*table_meta.get_col(col_name));
     total_len += col_metas.back().len;
   }
-
-  // auto ix_name = std::move(ix_manager_->get_index_name(tab_name, col_names));
-  ix_manager_->create_index(ix_name, col_metas);
-  auto&& ih = ix_manager_->open_index(ix_name);
-  auto&& fh = fhs_[tab_name];
-
-  int offset = 0;
-  char* key = new char[total_len];
-  for (auto&& scan = std::make_unique<RmScan>(fh.get()); !scan->is_end();
-       scan->next()) {
-    auto&& rid = scan->rid();
-    auto&& record = fh->get_record(rid, context);
-    offset = 0;
-    for (auto& col_meta : col_metas) {
-      memcpy(key + offset, record->data + col_meta.offset, col_meta.len);
-      offset += col_meta.len;
-    }
-    // 插入B+树
-    if (ih->insert_entry(key, rid, context->txn_) == IX_NO_PAGE) {
-      // 释放内存
-      delete[] key;
-      // 重复了
-      ix_manager_->close_index(ih.get());
-      ix_manager_->destroy_index(ix_name);
-      // drop_index(tab_name, col_names, context);
-      throw NonUniqueIndexError(tab_name, col_names);
+  // 已经在索引字段或前面出现过的 INCLUDE 字段不重复存
+  std::vector<ColMeta> include_col_metas;
+  for (auto& col_name : include_col_names) {
+    auto& col_meta = *table_meta.get_col(col_name);
+    if (std::find(col_metas.begin(), col_metas.end(), col_meta) ==
+            col_metas.end() &&
+        std::find(include_col_metas.begin(), include_col_metas.end(),
+                  col_meta) == include_col_metas.end()) {
+      include_col_metas.emplace_back(col_meta);
     }
   }
-  // 释放内存
-  delete[] key;
 
+  IndexMeta index_meta(std::string(tab_name), total_len,
+                       static_cast<int>(col_names.size()),
+                       std::move(col_metas), unique,
+                       std::move(include_col_metas), index_type);
+  auto&& ih = build_index(ix_name, index_meta, context);
+
+  std::lock_guard lock(ddl_latch_);
   // 更新表元索引数据
-  table_meta.indexes.emplace(
-      ix_name,
-      IndexMeta(std::move(tab_name), total_len,
-                static_cast<int>(col_names.size()), std::move(col_metas)));
+  table_meta.indexes.emplace(ix_name, std::move(index_meta));
   // 插入索引句柄
   ihs_[std::move(ix_name)] = std::move(ih);
   // 持久化
   flush_meta();
 }
 
+/**
+ * @description: 创建索引文件，并把表中已有的记录批量建成B+树
+ * 各工作线程按 morsel 抽取部分页面中的 key 并在本地排序，多路归并后自底向上建树
+ * @param {string&} ix_name 索引文件名
+ * @param {IndexMeta&} index_meta 索引元数据
+ * @param {Context*} context
+ * @return {unique_ptr<IxIndex>} 打开的索引句柄
+ */
+std::unique_ptr<IxIndex> SmManager::build_index(const std::string& ix_name,
+                                                const IndexMeta& index_meta,
+                                                Context* context) {
+  if (index_meta.type == IndexType::HASH) {
+    return build_hash_index(ix_name, index_meta);
+  }
+  std::vector<ColMeta> entry_cols;
+  entry_cols.reserve(index_meta.entry_cols.size());
+  for (auto& [_, col_meta] : index_meta.entry_cols) {
+    std::ignore = _;
+    entry_cols.emplace_back(col_meta);
+  }
+  ix_manager_->create_index(ix_name, entry_cols);
+  auto ih = ix_manager_->open_index(ix_name);
+  auto* fh = fhs_[index_meta.tab_name].get();
+  const IxFileHdr& ix_hdr = *ih->file_hdr_;
+  const int key_len = index_meta.key_len;
+
+  // 每个工作线程的有序段：结点存储格式的 key、rid，以及排序后的下标
+  struct SortedRun {
+    std::vector<char> keys;
+    std::vector<Rid> rids;
+    std::vector<int> order;
+  };
+  auto key_at = [&](const SortedRun& run, int idx) {
+    return run.keys.data() + static_cast<std::size_t>(idx) * key_len;
+  };
+  int num_pages = fh->get_file_hdr().num_pages;
+  int degree = num_pages - RM_FIRST_RECORD_PAGE >= PARALLEL_SCAN_MIN_PAGES
+                   ? ThreadPool::instance().size()
+                   : 1;
+  std::vector<SortedRun> runs(degree);
+  MorselScheduler scheduler(RM_FIRST_RECORD_PAGE, num_pages, degree,
+                            MORSEL_PAGES);
+  std::mutex error_latch;
+  std::exception_ptr error;
+  auto extract = [&](int worker) {
+    try {
+      auto& run = runs[worker];
+      auto raw_key = std::make_unique<char[]>(key_len);
+      Morsel morsel;
+      while (scheduler.next(worker, &morsel)) {
+        for (RmScan scan(fh, morsel.start_page, morsel.end_page);
+             !scan.is_end(); scan.next()) {
+          auto rid = scan.rid();
+          index_meta.get_key(scan.get_data(), rid, raw_key.get());
+          const IxKey key(ix_hdr, raw_key.get());
+          run.keys.insert(run.keys.end(), key.data(), key.data() + key_len);
+          run.rids.emplace_back(rid);
+        }
+      }
+      run.order.resize(run.rids.size());
+      std::iota(run.order.begin(), run.order.end(), 0);
+      std::sort(run.order.begin(), run.order.end(), [&](int a, int b) {
+        return ix_compare_key(ix_hdr, key_at(run, a), key_at(run, b)) < 0;
+      });
+    } catch (...) {
+      std::lock_guard lock(error_latch);
+      if (error == nullptr) {
+        error = std::current_exception();
+      }
+    }
+  };
+  // 调用线程自己也承担一份
+  std::vector<std::future<void> > tasks;
+  tasks.reserve(degree - 1);
+  for (int i = 1; i < degree; ++i) {
+    tasks.emplace_back(ThreadPool::instance().submit(extract, i));
+  }
+  extract(0);
+  for (auto& task : tasks) {
+    ThreadPool::wait(task);
+  }
+  if (error != nullptr) {
+    ix_manager_->close_index(ih.get());
+    ix_manager_->destroy_index(ix_name);
+    std::rethrow_exception(error);
+  }
+
+  // 多路归并各有序段，唯一索引按索引字段查重（INCLUDE 字段不参与）
+  std::size_t num = 0;
+  for (auto& run : runs) {
+    num += run.rids.size();
+  }
+  std::vector<char> keys(num * key_len);
+  std::vector<Rid> rids(num);
+  // 堆中是 (段号, 段内位置)，key 最小的在堆顶
+  using Cursor = std::pair<int, int>;
+  auto greater = [&](const Cursor& a, const Cursor& b) {
+    auto& run_a = runs[a.first];
+    auto& run_b = runs[b.first];
+    return ix_compare_key(ix_hdr, key_at(run_a, run_a.order[a.second]),
+                          key_at(run_b, run_b.order[b.second])) > 0;
+  };
+  std::priority_queue<Cursor, std::vector<Cursor>, decltype(greater)> heap(
+      greater);
+  for (int i = 0; i < degree; ++i) {
+    if (!runs[i].rids.empty()) {
+      heap.emplace(i, 0);
+    }
+  }
+  for (std::size_t i = 0; i < num; ++i) {
+    auto [run_idx, pos] = heap.top();
+    heap.pop();
+    auto& run = runs[run_idx];
+    char* dest = keys.data() + i * key_len;
+    memcpy(dest, key_at(run, run.order[pos]), key_len);
+    rids[i] = run.rids[run.order[pos]];
+    if (index_meta.unique && i > 0 &&
+        memcmp(dest - key_len, dest, index_meta.col_tot_len) == 0) {
+      // 重复了
+      ix_manager_->close_index(ih.get());
+      ix_manager_->destroy_index(ix_name);
+      std::vector<std::string> col_names;
+      for (auto& [_, col_meta] : index_meta.cols) {
+        std::ignore = _;
+        col_names.emplace_back(col_meta.name);
+      }
+      throw NonUniqueIndexError(index_meta.tab_name, col_names);
+    }
+    if (pos + 1 < static_cast<int>(run.rids.size())) {
+      heap.emplace(run_idx, pos + 1);
+    }
+  }
+  runs.clear();
+
+  ih->bulk_load(keys.data(), rids.data(), static_cast<int>(num));
+  return ih;
+}
+
+/**
+ * @description: 创建哈希索引文件，并把表中已有的记录逐条插入
+ * @param {string&} ix_name 索引文件名
+ * @param {IndexMeta&} index_meta 索引元数据
+ * @return {unique_ptr<IxIndex>} 打开的索引句柄
+ */
+std::unique_ptr<IxIndex> SmManager::build_hash_index(
+    const std::string& ix_name, const IndexMeta& index_meta) {
+  std::vector<ColMeta> entry_cols;
+  entry_cols.reserve(index_meta.entry_cols.size());
+  for (auto& [_, col_meta] : index_meta.entry_cols) {
+    std::ignore = _;
+    entry_cols.emplace_back(col_meta);
+  }
+  ix_manager_->create_hash_index(ix_name, entry_cols, index_meta.col_tot_len);
+  auto ih = ix_manager_->open_hash_index(ix_name);
+  auto* fh = fhs_[index_meta.tab_name].get();
+  auto key = std::make_unique<char[]>(index_meta.key_len);
+  for (RmScan scan(fh); !scan.is_end(); scan.next()) {
+    auto rid = scan.rid();
+    index_meta.get_key(scan.get_data(), rid, key.get());
+    Rid dup_rid;
+    if (index_meta.unique && !ih->is_unique(key.get(), dup_rid, nullptr,
+                                            index_meta.col_tot_len)) {
+      ix_manager_->close_index(ih.get());
+      ix_manager_->destroy_index(ix_name);
+      std::vector<std::string> col_names;
+      for (auto& [_, col_meta] : index_meta.cols) {
+        std::ignore = _;
+        col_names.emplace_back(col_meta.name);
+      }
+      throw NonUniqueIndexError(index_meta.tab_name, col_names);
+    }
+    ih->insert_entry(key.get(), rid, nullptr);
+  }
+  return ih;
+}
+
 /**
  * @description: 删除索引
  * @param {string&} tab_name 表名称
@@ -416,6 +592,7 @@ void SmManager::drop_index(const std::string& tab_name,
   //     fhs_[tab_name]->GetFd());
   // }
 
+  std::lock_guard lock(ddl_latch_);
   ix_manager_->close_index(ihs_[ix_name].get());
   ix_manager_->destroy_index(ix_name);
   ihs_.erase(ix_name);
@@ -450,6 +627,7 @@ void SmManager::drop_index(const std::string& tab_name,
   //     fhs_[tab_name]->GetFd());
   // }
 
+  std::lock_guard lock(ddl_latch_);
   ix_manager_->close_index(ihs_[ix_name].get());
   ix_manager_->destroy_index(ix_name);
   ihs_.erase(ix_name);
@@ -460,54 +638,15 @@ void SmManager::drop_index(const std::string& tab_name,
 
 /**
  * @description: 仅用于恢复索引
- * @param {string&} tab_name 表名称
- * @param {vector<ColMeta>&} 索引包含的字段元数据
+ * @param {string&} index_name 索引文件名
+ * @param {IndexMeta&} index_meta 索引元数据
  * @param {Context*} context
  */
-void SmManager::redo_index(const std::string& tab_name, TabMeta& table_meta,
-                           const std::vector<std::string>& col_names,
-                           const std::string& index_name, Context* context) {
+void SmManager::redo_index(const std::string& index_name,
+                           const IndexMeta& index_meta, Context* context) {
+  std::lock_guard lock(ddl_latch_);
   ix_manager_->close_index(ihs_[index_name].get());
   ix_manager_->destroy_index(index_name);
-
-  std::vector<ColMeta> col_metas;
-  col_metas.reserve(col_names.size());
-  auto total_len = 0;
-  for (auto& col_name : col_names) {
-    col_metas.emplace_back(*table_meta.get_col(col_name));
-    total_len += col_metas.back().len;
-  }
-
-  // auto ix_name = std::move(ix_manager_->get_index_name(tab_name, col_names));
-  ix_manager_->create_index(index_name, col_metas);
-  auto&& ih = ix_manager_->open_index(index_name);
-  auto&& fh = fhs_[tab_name];
-
-  int offset = 0;
-  char* key = new char[total_len];
-  for (auto&& scan = std::make_unique<RmScan>(fh.get()); !scan->is_end();
-       scan->next()) {
-    auto&& rid = scan->rid();
-    auto&& record = fh->get_record(rid, context);
-    offset = 0;
-    for (auto& col_meta : col_metas) {
-      memcpy(key + offset, record->data + col_meta.offset, col_meta.len);
-      offset += col_meta.len;
-    }
-    // 插入B+树
-    if (ih->insert_entry(key, rid, context->txn_) == IX_NO_PAGE) {
-      // 释放内存
-      delete[] key;
-      // 重复了
-      ix_manager_->close_index(ih.get());
-      ix_manager_->destroy_index(index_name);
-      // drop_index(tab_name, col_names, context);
-      throw NonUniqueIndexError(tab_name, col_names);
-    }
-  }
-  // 释放内存
-  delete[] key;
-
   // 插入索引句柄
-  ihs_[index_name] = std::move(ih);
+  ihs_[index_name] = build_index(index_name, index_meta, context);
 }
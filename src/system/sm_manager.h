@@ -10,6 +10,8 @@ See the Mulan PSL v2 for more details. */
 
 #pragma once
 
+#include <mutex>
+
 #include "common/context.h"
 #include "index/ix.h"
 #include "record/rm_file_handle.h"
@@ -30,8 +32,10 @@ class SmManager {
   DbMeta db_;  // 当前打开的数据库的元数据
   std::unordered_map<std::string, std::unique_ptr<RmFileHandle> > fhs_;
   // file name -> record file handle, 当前数据库中每张表的数据文件
-  std::unordered_map<std::string, std::unique_ptr<IxIndexHandle> > ihs_;
+  std::unordered_map<std::string, std::unique_ptr<IxIndex> > ihs_;
   // file name -> index file handle, 当前数据库中每个索引的文件
+  // DDL 修改 db_、fhs_ 和 ihs_ 时持有，后台检查点遍历它们时也要持有
+  std::mutex ddl_latch_;
  private:
   DiskManager* disk_manager_;
   BufferPoolManager* buffer_pool_manager_;
@@ -80,7 +84,9 @@ class SmManager {
   void drop_table(const std::string& tab_name, Context* context);
 
   void create_index(std::string& tab_name, std::vector<std::string>& col_names,
-                    Context* context);
+                    Context* context, bool unique = true,
+                    const std::vector<std::string>& include_col_names = {},
+                    IndexType index_type = IndexType::BTREE);
 
   void drop_index(const std::string& tab_name,
                   const std::vector<std::string>& col_names, Context* context);
@@ -88,7 +94,14 @@ class SmManager {
   void drop_index(const std::string& tab_name,
                   const std::vector<ColMeta>& col_names, Context* context);
 
-  void redo_index(const std::string& tab_name, TabMeta& table_meta,
-                  const std::vector<std::string>& col_names,
-                  const std::string& index_name, Context* context);
+  void redo_index(const std::string& index_name, const IndexMeta& index_meta,
+                  Context* context);
+
+ private:
+  std::unique_ptr<IxIndex> build_index(const std::string& ix_name,
+                                       const IndexMeta& index_meta,
+                                       Context* context);
+
+  std::unique_ptr<IxIndex> build_hash_index(const std::string& ix_name,
+                                            const IndexMeta& index_meta);
 };
@@ -11,10 +11,12 @@ See the Mulan PSL v2 for more details. */
 #pragma once
 
 #include <algorithm>
+#include <cstring>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
+#include "defs.h"
 #include "errors.h"
 
 /* 字段元数据 */
@@ -41,6 +43,9 @@ struct ColMeta {
   }
 };
 
+// 索引的组织方式，哈希索引只能用于索引字段全部等值的查找
+enum class IndexType { BTREE = 0, HASH };
+
 /* 索引元数据 */
 struct IndexMeta {
   std::string tab_name;  // 索引所属表名称
@@ -49,54 +54,142 @@ struct IndexMeta {
   std::vector<std::pair<int, ColMeta> >
       cols;  // 索引包含的字段 在索引中的偏移量 -> 列元信息
   std::unordered_map<std::string, std::pair<int, ColMeta> > cols_map;
+  bool unique = true;  // 非唯一索引在索引字段后面追加 rid，B+ 树中的 key 仍唯一
+  std::vector<std::pair<int, ColMeta> >
+      include_cols;  // INCLUDE 的字段 在 key 中的偏移量 -> 列元信息，不参与查找
+  // B+ 树中 key 的全部字段：索引字段、rid（非唯一索引，拆成两个 int）、INCLUDE
+  // 字段，不持久化
+  std::vector<std::pair<int, ColMeta> > entry_cols;
+  int key_len = 0;  // B+ 树中 key 的长度，不持久化
+  IndexType type = IndexType::BTREE;
 
   IndexMeta() = default;
 
   IndexMeta(std::string&& tab_name_, int col_tot_len_, int col_num_,
-            std::vector<ColMeta>&& cols_)
+            std::vector<ColMeta>&& cols_, bool unique_ = true,
+            std::vector<ColMeta>&& include_cols_ = {},
+            IndexType type_ = IndexType::BTREE)
       : tab_name(std::move(tab_name_)),
         col_tot_len(col_tot_len_),
-        col_num(col_num_) {
-    int offset = 0;
-    for (auto& col : cols_) {
-      cols.emplace_back(offset, std::move(col));
-      offset += cols.back().second.len;
+        col_num(col_num_),
+        unique(unique_),
+        type(type_) {
+    init_layout(std::move(cols_), std::move(include_cols_));
+  }
+
+  /**
+   * @description: 由表中的一条记录生成 B+ 树中的 key
+   * @param {char*} record 记录
+   * @param {Rid&} rid 记录的位置，只有非唯一索引会用到
+   * @param {char*} key 长度为 key_len
+   */
+  void get_key(const char* record, const Rid& rid, char* key) const {
+    for (auto& [index_offset, col] : cols) {
+      memcpy(key + index_offset, record + col.offset, col.len);
     }
-    for (auto it = cols.begin(); it != cols.end(); ++it) {
-      cols_map.emplace(it->second.name, *it);
+    if (!unique) {
+      memcpy(key + col_tot_len, &rid, sizeof(Rid));
+    }
+    for (auto& [index_offset, col] : include_cols) {
+      memcpy(key + index_offset, record + col.offset, col.len);
+    }
+  }
+
+  /**
+   * @description: get_key 的逆过程，把 key 中存储的字段写回记录，用于不回表的
+   * 索引扫描
+   * @param {char*} key 长度为 key_len
+   * @param {char*} record 记录，不在索引中的字段保持不变
+   */
+  void get_record(const char* key, char* record) const {
+    for (auto& [index_offset, col] : cols) {
+      memcpy(record + col.offset, key + index_offset, col.len);
+    }
+    for (auto& [index_offset, col] : include_cols) {
+      memcpy(record + col.offset, key + index_offset, col.len);
+    }
+  }
+
+  // 字段是否存储在索引中，包括 INCLUDE 的字段
+  bool has_col(const std::string& col_name) const {
+    if (cols_map.count(col_name)) {
+      return true;
     }
+    return std::any_of(include_cols.begin(), include_cols.end(),
+                       [&](auto& col) { return col.second.name == col_name; });
   }
 
   friend std::ostream& operator<<(std::ostream& os, const IndexMeta& index) {
-    os << index.tab_name << " " << index.col_tot_len << " " << index.col_num;
+    os << index.tab_name << " " << index.col_tot_len << " " << index.col_num
+       << " " << index.unique << " " << index.include_cols.size() << " "
+       << static_cast<int>(index.type);
     for (auto& [_, col] : index.cols) {
       std::ignore = _;
       os << "\n" << col;
     }
+    for (auto& [_, col] : index.include_cols) {
+      std::ignore = _;
+      os << "\n" << col;
+    }
     return os;
   }
 
   friend std::istream& operator>>(std::istream& is, IndexMeta& index) {
-    is >> index.tab_name >> index.col_tot_len >> index.col_num;
-    int offset = 0;
-    int len = 0;
-    for (int i = 0; i < index.col_num; ++i) {
-      ColMeta col;
+    size_t include_num;
+    int type;
+    is >> index.tab_name >> index.col_tot_len >> index.col_num >>
+        index.unique >> include_num >> type;
+    index.type = static_cast<IndexType>(type);
+    std::vector<ColMeta> cols(index.col_num);
+    for (auto& col : cols) {
       is >> col;
-      len = col.len;
-      index.cols.emplace_back(offset, std::move(col));
-      offset += len;
     }
-    for (auto it = index.cols.begin(); it != index.cols.end(); ++it) {
-      index.cols_map.emplace(it->second.name, *it);
+    std::vector<ColMeta> include_cols(include_num);
+    for (auto& col : include_cols) {
+      is >> col;
     }
+    index.init_layout(std::move(cols), std::move(include_cols));
     return is;
   }
 
   // 重载相等运算符
   bool operator==(const IndexMeta& other) const {
     return tab_name == other.tab_name && col_tot_len == other.col_tot_len &&
-           col_num == other.col_num && cols == other.cols;
+           col_num == other.col_num && cols == other.cols &&
+           unique == other.unique && include_cols == other.include_cols &&
+           type == other.type;
+  }
+
+ private:
+  // 依次排列索引字段、rid 和 INCLUDE 字段，计算各自在 key 中的偏移量
+  void init_layout(std::vector<ColMeta>&& cols_,
+                   std::vector<ColMeta>&& include_cols_) {
+    cols.clear();
+    cols_map.clear();
+    include_cols.clear();
+    entry_cols.clear();
+    int offset = 0;
+    for (auto& col : cols_) {
+      cols.emplace_back(offset, std::move(col));
+      offset += cols.back().second.len;
+    }
+    for (auto it = cols.begin(); it != cols.end(); ++it) {
+      cols_map.emplace(it->second.name, *it);
+    }
+    entry_cols = cols;
+    if (!unique) {
+      for (const char* name : {"$page_no", "$slot_no"}) {
+        ColMeta col{tab_name, name, TYPE_INT, sizeof(int), 0};
+        entry_cols.emplace_back(offset, std::move(col));
+        offset += sizeof(int);
+      }
+    }
+    for (auto& col : include_cols_) {
+      include_cols.emplace_back(offset, std::move(col));
+      entry_cols.push_back(include_cols.back());
+      offset += include_cols.back().second.len;
+    }
+    key_len = offset;
   }
 };
 
@@ -108,6 +201,7 @@ struct hash<IndexMeta> {
     std::size_t hash = std::hash<std::string>{}(index.tab_name);
     hash ^= std::hash<int>{}(index.col_tot_len) << 1;
     hash ^= std::hash<int>{}(index.col_num) << 2;
+    hash ^= std::hash<bool>{}(index.unique) << 4;
     for (const auto& [_, col] : index.cols) {
       std::ignore = _;
       hash ^= std::hash<std::string>{}(col.name) << 3;
@@ -133,6 +227,7 @@ struct hash<std::vector<std::string> > {
 /* 表元数据 */
 struct TabMeta {
   std::string name;           // 表名称
+  int id = -1;                // 表的编号，日志中用它代替表名称
   std::vector<ColMeta> cols;  // 表包含的字段
   std::unordered_map<std::string, IndexMeta>
       indexes;  // 表上建立的索引 索引名 -> 索引元信息
@@ -190,7 +285,7 @@ struct TabMeta {
   }
 
   friend std::ostream& operator<<(std::ostream& os, const TabMeta& tab) {
-    os << tab.name << '\n' << tab.cols.size() << '\n';
+    os << tab.name << ' ' << tab.id << '\n' << tab.cols.size() << '\n';
     for (auto& col : tab.cols) {
       os << col << '\n';  // col是ColMeta类型，然后调用重载的ColMeta的操作符<<
     }
@@ -204,7 +299,7 @@ struct TabMeta {
 
   friend std::istream& operator>>(std::istream& is, TabMeta& tab) {
     size_t n;
-    is >> tab.name >> n;
+    is >> tab.name >> tab.id >> n;
     for (size_t i = 0; i < n; i++) {
       ColMeta col;
       is >> col;
@@ -220,9 +315,6 @@ struct TabMeta {
       is >> index_name;
       is >> index;
       tab.indexes.emplace(std::move(index_name), std::move(index));
-      // TODO 注意这里要清空
-      index.cols.clear();
-      index.cols_map.clear();
     }
     return is;
   }
@@ -238,6 +330,9 @@ class DbMeta {
  private:
   std::string name_;                               // 数据库名称
   std::unordered_map<std::string, TabMeta> tabs_;  // 数据库中包含的表
+  int next_tab_id_ = 0;  // 下一个新建表的编号，删除表后编号也不复用
+  // 表编号 -> 表名称，不持久化，加载元数据时重建
+  std::unordered_map<int, std::string> tab_names_;
 
  public:
   // DbMeta(std::string name) : name_(name) {}
@@ -249,6 +344,24 @@ class DbMeta {
 
   void SetTabMeta(const std::string& tab_name, const TabMeta& meta) {
     tabs_[tab_name] = meta;
+    tab_names_[meta.id] = tab_name;
+  }
+
+  /* 添加新建的表，为它分配表编号 */
+  TabMeta& add_table(TabMeta tab) {
+    tab.id = next_tab_id_++;
+    tab_names_[tab.id] = tab.name;
+    auto name = tab.name;
+    return tabs_[name] = std::move(tab);
+  }
+
+  /* 删除指定名称的表 */
+  void erase_table(const std::string& tab_name) {
+    auto pos = tabs_.find(tab_name);
+    if (pos != tabs_.end()) {
+      tab_names_.erase(pos->second.id);
+      tabs_.erase(pos);
+    }
   }
 
   /* 获取指定名称表的元数据 */
@@ -261,9 +374,19 @@ class DbMeta {
     return pos->second;
   }
 
+  /* 获取指定编号表的元数据 */
+  TabMeta& get_table(int tab_id) {
+    auto pos = tab_names_.find(tab_id);
+    if (pos == tab_names_.end()) {
+      throw TableNotFoundError("#" + std::to_string(tab_id));
+    }
+    return get_table(pos->second);
+  }
+
   // 重载操作符 <<
   friend std::ostream& operator<<(std::ostream& os, const DbMeta& db_meta) {
-    os << db_meta.name_ << '\n' << db_meta.tabs_.size() << '\n';
+    os << db_meta.name_ << '\n' << db_meta.next_tab_id_ << '\n'
+       << db_meta.tabs_.size() << '\n';
     for (auto& entry : db_meta.tabs_) {
       os << entry.second << '\n';
     }
@@ -272,10 +395,11 @@ class DbMeta {
 
   friend std::istream& operator>>(std::istream& is, DbMeta& db_meta) {
     size_t n;
-    is >> db_meta.name_ >> n;
+    is >> db_meta.name_ >> db_meta.next_tab_id_ >> n;
     for (size_t i = 0; i < n; i++) {
       TabMeta tab;
       is >> tab;
+      db_meta.tab_names_[tab.id] = tab.name;
       db_meta.tabs_[tab.name] = tab;
     }
     return is;
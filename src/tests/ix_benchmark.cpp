@@ -0,0 +1,107 @@
+/* Copyright (c) 2023 Renmin University of China
+RMDB is licensed under Mulan PSL v2.
+You can use this software according to the terms and conditions of the Mulan PSL
+v2. You may obtain a copy of Mulan PSL v2 at:
+        http://license.coscl.org.cn/MulanPSL2
+THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+See the Mulan PSL v2 for more details. */
+
+// B+ 树点查的微基准：先插入 num_keys 个 int 键，再用 num_threads
+// 个线程随机点查，输出每秒的查找次数
+// 用法：ix_benchmark [num_keys] [num_threads] [seconds]
+
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "index/ix.h"
+
+static const std::string BENCH_DB_NAME = "ix_benchmark_db";
+static const std::string BENCH_TAB_NAME = "t";
+
+int main(int argc, char** argv) {
+  int num_keys = argc > 1 ? std::atoi(argv[1]) : 1000000;
+  int num_threads = argc > 2 ? std::atoi(argv[2]) : 1;
+  double seconds = argc > 3 ? std::atof(argv[3]) : 3;
+
+  if (system(("rm -rf " + BENCH_DB_NAME).c_str()) != 0 ||
+      system(("mkdir " + BENCH_DB_NAME).c_str()) != 0 ||
+      chdir(BENCH_DB_NAME.c_str()) != 0) {
+    std::cerr << "failed to create " << BENCH_DB_NAME << std::endl;
+    return 1;
+  }
+
+  auto disk_manager = std::make_unique<DiskManager>();
+  auto buffer_pool_manager =
+      std::make_unique<BufferPoolManager>(BUFFER_POOL_SIZE, disk_manager.get());
+  auto ix_manager =
+      std::make_unique<IxManager>(disk_manager.get(), buffer_pool_manager.get());
+
+  ColMeta col;
+  col.tab_name = BENCH_TAB_NAME;
+  col.name = "k";
+  col.type = TYPE_INT;
+  col.len = sizeof(int);
+  col.offset = 0;
+  std::vector<ColMeta> cols{col};
+  ix_manager->create_index(ix_manager->get_index_name(BENCH_TAB_NAME, cols),
+                           cols);
+  auto ih = ix_manager->open_index(BENCH_TAB_NAME, cols);
+
+  Transaction txn(0);
+  for (int key = 0; key < num_keys; ++key) {
+    ih->insert_entry(reinterpret_cast<const char*>(&key), {key, key}, &txn);
+  }
+
+  std::atomic<bool> stop{false};
+  std::atomic<long> lookups{0};
+  std::atomic<long> misses{0};
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads);
+  for (int i = 0; i < num_threads; ++i) {
+    threads.emplace_back([&, i] {
+      std::mt19937 rng(i);
+      std::uniform_int_distribution<int> dist(0, num_keys - 1);
+      std::vector<Rid> result;
+      long n = 0;
+      while (!stop.load(std::memory_order_relaxed)) {
+        int key = dist(rng);
+        result.clear();
+        if (!ih->get_value(reinterpret_cast<const char*>(&key), &result,
+                           nullptr)) {
+          ++misses;
+        }
+        ++n;
+      }
+      lookups += n;
+    });
+  }
+  auto start = std::chrono::steady_clock::now();
+  std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+  stop = true;
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  double elapsed = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+
+  std::cout << "keys=" << num_keys << " threads=" << num_threads
+            << " lookups/s=" << static_cast<long>(lookups / elapsed)
+            << " misses=" << misses << std::endl;
+
+  ix_manager->close_index(ih.get());
+  if (chdir("..") == 0) {
+    std::ignore = system(("rm -rf " + BENCH_DB_NAME).c_str());
+  }
+  return misses == 0 ? 0 : 1;
+}
@@ -0,0 +1,280 @@
+/* Copyright (c) 2023 Renmin University of China
+RMDB is licensed under Mulan PSL v2.
+You can use this software according to the terms and conditions of the Mulan PSL
+v2. You may obtain a copy of Mulan PSL v2 at:
+        http://license.coscl.org.cn/MulanPSL2
+THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+See the Mulan PSL v2 for more details. */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "transaction/txn_defs.h"
+
+/**
+ * 一个索引上间隙锁的区间树，用来代替对所有间隙逐个调用 Gap::isCoincide。
+ * 间隙是每个索引字段上的范围，树里存它按字典序的外包区间 [lo, hi]：
+ * lo 依次拼接各字段的下界，遇到没有下界的字段就截断（截断的部分视为负无穷），
+ * hi 同理（截断的部分视为正无穷）。字段值编码成保序的字节串，与 ix_key.h 的
+ * NORMALIZED 格式相同，比较只需要 memcmp。边界的开闭被忽略，
+ * 所以两个间隙相交时外包区间一定相交，反之不一定，查出的候选还要再用
+ * isCoincide / isInGap 精确判断。
+ * 树是按 lo 排序的 treap，每个结点记录子树中最大的 hi，查询 O(log n + k)
+ */
+template <typename T>
+class GapIntervalTree {
+  struct Node {
+    std::string lo_;
+    std::string hi_;
+    const std::string* max_hi_;  // 子树中最大的 hi，指向子树中某个结点的 hi_
+    uint32_t priority_;
+    T* value_;
+    std::unique_ptr<Node> left_;
+    std::unique_ptr<Node> right_;
+  };
+
+ public:
+  explicit GapIntervalTree(const IndexMeta& index_meta) {
+    col_types_.reserve(index_meta.cols.size());
+    col_lens_.reserve(index_meta.cols.size());
+    for (auto& [_, col_meta] : index_meta.cols) {
+      std::ignore = _;
+      col_types_.push_back(col_meta.type);
+      col_lens_.push_back(col_meta.len);
+    }
+  }
+
+  void insert(const Gap& gap, T* value) {
+    auto node = std::make_unique<Node>();
+    node->lo_ = encode(gap, true);
+    node->hi_ = encode(gap, false);
+    node->max_hi_ = &node->hi_;
+    node->priority_ = next_priority();
+    node->value_ = value;
+    insert(root_, std::move(node));
+    ++size_;
+  }
+
+  void erase(const Gap& gap, T* value) {
+    if (erase(root_, encode(gap, true), value)) {
+      --size_;
+    }
+  }
+
+  /**
+   * @description: 按字典序从小到大访问外包区间与 gap 相交的间隙
+   * @return {bool} f 是否中途停止了访问
+   * @param {Gap&} gap 查询的间隙
+   * @param {F} f 访问函数，参数为插入时的 value，返回 false 时停止访问
+   */
+  template <typename F>
+  bool for_each_overlap(const Gap& gap, F&& f) const {
+    auto lo = encode(gap, true);
+    auto hi = encode(gap, false);
+    return !query(root_.get(), lo, hi, f);
+  }
+
+  std::size_t size() const { return size_; }
+
+  bool empty() const { return size_ == 0; }
+
+ private:
+  // 把间隙各字段的下界（is_lower）或上界编码后拼接起来，遇到没有界的字段截断
+  std::string encode(const Gap& gap, bool is_lower) const {
+    std::string key;
+    for (std::size_t i = 0;
+         i < col_types_.size() && i < gap.index_conds_.size(); ++i) {
+      auto& cond =
+          is_lower ? gap.index_conds_[i].first : gap.index_conds_[i].second;
+      auto& raw = cond.rhs_val.raw;
+      if (cond.op == OP_INVALID || raw == nullptr ||
+          cond.rhs_val.type != col_types_[i]) {
+        break;
+      }
+      switch (col_types_[i]) {
+        case TYPE_INT: {
+          uint32_t v;
+          memcpy(&v, raw->data, sizeof(v));
+          append_be32(&key, v ^ 0x80000000u);
+          break;
+        }
+        case TYPE_FLOAT: {
+          float f;
+          memcpy(&f, raw->data, sizeof(f));
+          if (f == 0) {
+            f = 0;
+          }
+          uint32_t v;
+          memcpy(&v, &f, sizeof(v));
+          append_be32(&key, (v & 0x80000000u) ? ~v : (v | 0x80000000u));
+          break;
+        }
+        default: {
+          // 定长编码，保证后面字段的位置对齐
+          int len = col_lens_[i];
+          key.append(raw->data, std::min(len, raw->size));
+          key.append(std::max(0, len - raw->size), '\0');
+          break;
+        }
+      }
+    }
+    return key;
+  }
+
+  static void append_be32(std::string* key, uint32_t v) {
+    char buf[4] = {static_cast<char>(v >> 24), static_cast<char>(v >> 16),
+                   static_cast<char>(v >> 8), static_cast<char>(v)};
+    key->append(buf, sizeof(buf));
+  }
+
+  // 下界 lo 不大于上界 hi，lo 截断部分为负无穷，hi 截断部分为正无穷，
+  // 所以公共部分相等时成立
+  static bool lo_le_hi(const std::string& lo, const std::string& hi) {
+    return memcmp(lo.data(), hi.data(), std::min(lo.size(), hi.size())) <= 0;
+  }
+
+  // 两个上界比较大小，公共部分相等时较短的更大
+  static bool hi_less(const std::string& a, const std::string& b) {
+    int cmp = memcmp(a.data(), b.data(), std::min(a.size(), b.size()));
+    if (cmp != 0) {
+      return cmp < 0;
+    }
+    return a.size() > b.size();
+  }
+
+  // 结点按 (lo, value) 排序，lo 相同的间隙也有确定的位置
+  static bool node_less(const std::string& lo, T* value, const Node& node) {
+    int cmp = lo.compare(node.lo_);
+    if (cmp != 0) {
+      return cmp < 0;
+    }
+    return std::less<T*>()(value, node.value_);
+  }
+
+  static void update(Node* node) {
+    node->max_hi_ = &node->hi_;
+    if (node->left_ != nullptr &&
+        hi_less(*node->max_hi_, *node->left_->max_hi_)) {
+      node->max_hi_ = node->left_->max_hi_;
+    }
+    if (node->right_ != nullptr &&
+        hi_less(*node->max_hi_, *node->right_->max_hi_)) {
+      node->max_hi_ = node->right_->max_hi_;
+    }
+  }
+
+  static void rotate_right(std::unique_ptr<Node>& root) {
+    auto left = std::move(root->left_);
+    root->left_ = std::move(left->right_);
+    update(root.get());
+    left->right_ = std::move(root);
+    root = std::move(left);
+    update(root.get());
+  }
+
+  static void rotate_left(std::unique_ptr<Node>& root) {
+    auto right = std::move(root->right_);
+    root->right_ = std::move(right->left_);
+    update(root.get());
+    right->left_ = std::move(root);
+    root = std::move(right);
+    update(root.get());
+  }
+
+  static void insert(std::unique_ptr<Node>& root, std::unique_ptr<Node> node) {
+    if (root == nullptr) {
+      root = std::move(node);
+      return;
+    }
+    if (node_less(node->lo_, node->value_, *root)) {
+      insert(root->left_, std::move(node));
+      if (root->left_->priority_ > root->priority_) {
+        rotate_right(root);
+        return;
+      }
+    } else {
+      insert(root->right_, std::move(node));
+      if (root->right_->priority_ > root->priority_) {
+        rotate_left(root);
+        return;
+      }
+    }
+    update(root.get());
+  }
+
+  static bool erase(std::unique_ptr<Node>& root, const std::string& lo,
+                    T* value) {
+    if (root == nullptr) {
+      return false;
+    }
+    bool erased;
+    if (root->value_ == value) {
+      // 把结点转到叶子上再删除
+      if (root->left_ == nullptr) {
+        root = std::move(root->right_);
+        return true;
+      }
+      if (root->right_ == nullptr) {
+        root = std::move(root->left_);
+        return true;
+      }
+      if (root->left_->priority_ > root->right_->priority_) {
+        rotate_right(root);
+        erased = erase(root->right_, lo, value);
+      } else {
+        rotate_left(root);
+        erased = erase(root->left_, lo, value);
+      }
+    } else if (node_less(lo, value, *root)) {
+      erased = erase(root->left_, lo, value);
+    } else {
+      erased = erase(root->right_, lo, value);
+    }
+    update(root.get());
+    return erased;
+  }
+
+  // 返回 false 表示 f 要求停止
+  template <typename F>
+  static bool query(const Node* node, const std::string& lo,
+                    const std::string& hi, F& f) {
+    // 子树中所有间隙的上界都小于查询的下界
+    if (node == nullptr || !lo_le_hi(lo, *node->max_hi_)) {
+      return true;
+    }
+    if (!query(node->left_.get(), lo, hi, f)) {
+      return false;
+    }
+    // 该结点和右子树的下界都大于查询的上界
+    if (!lo_le_hi(node->lo_, hi)) {
+      return true;
+    }
+    if (lo_le_hi(lo, node->hi_) && !f(node->value_)) {
+      return false;
+    }
+    return query(node->right_.get(), lo, hi, f);
+  }
+
+  uint32_t next_priority() {
+    seed_ ^= seed_ << 13;
+    seed_ ^= seed_ >> 17;
+    seed_ ^= seed_ << 5;
+    return seed_;
+  }
+
+  std::vector<ColType> col_types_;
+  std::vector<int> col_lens_;
+  std::unique_ptr<Node> root_;
+  std::size_t size_ = 0;
+  uint32_t seed_ = 2463534242u;
+};
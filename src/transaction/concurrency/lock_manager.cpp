@@ -32,6 +32,64 @@ static inline bool check_lock(Transaction* txn) {
   return true;
 }
 
+/**
+ * @description: 新建间隙上的加锁队列，并把间隙加入索引的区间树
+ * @return {pair<iterator, bool>} 加锁队列，以及是否是新建的
+ * @param {GapLockTable&} table 索引上的间隙锁表
+ * @param {LockDataId&} lock_data_id 间隙锁
+ */
+std::pair<
+    std::unordered_map<LockDataId, LockManager::LockRequestQueue>::iterator,
+    bool>
+LockManager::emplace_gap_queue(GapLockTable& table,
+                               const LockDataId& lock_data_id) {
+  auto res = table.queues_.emplace(std::piecewise_construct,
+                                   std::forward_as_tuple(lock_data_id),
+                                   std::forward_as_tuple());
+  if (res.second) {
+    table.tree_.insert(res.first->first.gap_, &*res.first);
+  }
+  return res;
+}
+
+/**
+ * @description: 在区间树中找出与 gap 相交、被其他事务持有，并且锁模式不低于
+ * mode 的间隙锁
+ * @return {LockRequestQueue*} 冲突的加锁队列，没有冲突时为空
+ * @param {GapLockTable&} table 索引上的间隙锁表
+ * @param {Gap&} gap 申请加锁的间隙
+ * @param {txn_id_t} txn_id 申请加锁的事务
+ * @param {GroupLockMode} mode 与申请冲突的最低锁模式
+ */
+LockManager::LockRequestQueue* LockManager::find_gap_conflict(
+    GapLockTable& table, const Gap& gap, txn_id_t txn_id, GroupLockMode mode) {
+  LockRequestQueue* conflict = nullptr;
+  table.tree_.for_each_overlap(gap, [&](GapLockEntry* entry) {
+    auto& [data_id, queue] = *entry;
+    if (queue.group_lock_mode_ < mode || !gap.isCoincide(data_id.gap_)) {
+      return true;
+    }
+    for (auto& req : queue.request_queue_) {
+      if (req.txn_id_ != txn_id && req.granted_) {
+        conflict = &queue;
+        return false;
+      }
+    }
+    return true;
+  });
+  return conflict;
+}
+
+// 唤醒与 gap 相交的间隙上等锁的事务
+void LockManager::notify_gap_waiters(GapLockTable& table, const Gap& gap) {
+  table.tree_.for_each_overlap(gap, [&gap](GapLockEntry* entry) {
+    if (gap.isCoincide(entry->first.gap_)) {
+      entry->second.cv_.notify_all();
+    }
+    return true;
+  });
+}
+
 /**
  * @description: 申请间隙锁
  * @return {bool} 加锁是否成功
@@ -42,26 +100,27 @@ static inline bool check_lock(Transaction* txn) {
  */
 bool LockManager::lock_shared_on_gap(Transaction* txn, IndexMeta& index_meta,
                                      Gap& gap, int tab_fd) {
-  std::lock_guard lock(latch_);
+  auto& shard = get_gap_shard(index_meta);
+  std::lock_guard lock(shard.latch_);
 
   if (!check_lock(txn)) {
     return false;
   }
 
   LockDataId lock_data_id(tab_fd, index_meta, gap, LockDataType::GAP);
-  auto&& it = gap_lock_table_.find(index_meta);
-  if (it == gap_lock_table_.end()) {
+  auto&& it = shard.gap_lock_table_.find(index_meta);
+  if (it == shard.gap_lock_table_.end()) {
     // 新建
-    it =
-        gap_lock_table_
-            .emplace(std::piecewise_construct,
-                     std::forward_as_tuple(index_meta), std::forward_as_tuple())
-            .first;
-    it->second.reserve(80);
+    it = shard.gap_lock_table_
+             .emplace(std::piecewise_construct,
+                      std::forward_as_tuple(index_meta),
+                      std::forward_as_tuple(index_meta))
+             .first;
+    it->second.queues_.reserve(80);
   }
 
-  if (it->second.find(lock_data_id) != it->second.end()) {
-    auto& lock_request_queue = it->second.at(lock_data_id);
+  if (it->second.queues_.count(lock_data_id) != 0) {
+    auto& lock_request_queue = it->second.queues_.at(lock_data_id);
     for (auto& lock_request : lock_request_queue.request_queue_) {
       // 如果锁请求队列上该事务已经有共享锁或更高级别的锁（X）了，加锁成功
       // 得到锁，S 或 X 且不存在间隙冲突 通过
@@ -83,7 +142,7 @@ bool LockManager::lock_shared_on_gap(Transaction* txn, IndexMeta& index_meta,
       lock_request_queue.oldest_txn_id_ = txn->get_transaction_id();
       lock_request_queue.request_queue_.emplace_back(txn->get_transaction_id(),
                                                      LockMode::SHARED);
-      std::unique_lock ul(latch_, std::adopt_lock);
+      std::unique_lock ul(shard.latch_, std::adopt_lock);
       auto cur = lock_request_queue.request_queue_.begin();
       // 通过条件：当前请求队列只有共享间隙锁且相交区间不存在 X 锁
       lock_request_queue.cv_.wait(ul, [&lock_request_queue, txn, &cur, &it,
@@ -99,24 +158,9 @@ bool LockManager::lock_shared_on_gap(Transaction* txn, IndexMeta& index_meta,
           }
         }
 
-        bool contain_X = false;
-        for (auto& [data_id, queue] : it->second) {
-          if (queue.group_lock_mode_ == GroupLockMode::X &&
-              lock_data_id.gap_.isCoincide(data_id.gap_)) {
-            bool is_only_txn = true;
-            for (auto& req : queue.request_queue_) {
-              if (req.txn_id_ != txn->get_transaction_id() && req.granted_) {
-                is_only_txn = false;
-                break;
-              }
-            }
-            if (!is_only_txn) {
-              contain_X = true;
-              break;
-            }
-          }
-        }
-        return !contain_X;
+        return find_gap_conflict(it->second, lock_data_id.gap_,
+                                 txn->get_transaction_id(),
+                                 GroupLockMode::X) == nullptr;
       });
       cur->granted_ = true;
       lock_request_queue.group_lock_mode_ = GroupLockMode::S;
@@ -127,39 +171,25 @@ bool LockManager::lock_shared_on_gap(Transaction* txn, IndexMeta& index_meta,
       return true;
     }
   } else {
-    bool contain_X = false;
-    for (auto& [data_id, queue] : it->second) {
-      if (queue.group_lock_mode_ == GroupLockMode::X &&
-          lock_data_id.gap_.isCoincide(data_id.gap_)) {
-        bool is_only_txn = true;
-        for (auto& req : queue.request_queue_) {
-          if (req.txn_id_ != txn->get_transaction_id() && req.granted_) {
-            is_only_txn = false;
-            break;
-          }
-        }
-        if (!is_only_txn) {
-          // wait-die 策略死锁预防，否则会死锁，而且题八会卡在幻读4测试点
-          if (txn->get_transaction_id() > queue.oldest_txn_id_) {
-            throw TransactionAbortException(txn->get_transaction_id(),
-                                            AbortReason::DEADLOCK_PREVENTION);
-          }
-          contain_X = true;
-          break;
-        }
-      }
+    auto* conflict = find_gap_conflict(it->second, lock_data_id.gap_,
+                                       txn->get_transaction_id(),
+                                       GroupLockMode::X);
+    // wait-die 策略死锁预防，否则会死锁，而且题八会卡在幻读4测试点
+    if (conflict != nullptr &&
+        txn->get_transaction_id() > conflict->oldest_txn_id_) {
+      throw TransactionAbortException(txn->get_transaction_id(),
+                                      AbortReason::DEADLOCK_PREVENTION);
     }
+    bool contain_X = conflict != nullptr;
 
-    it->second.emplace(std::piecewise_construct,
-                       std::forward_as_tuple(lock_data_id),
-                       std::forward_as_tuple());
+    emplace_gap_queue(it->second, lock_data_id);
 
     if (contain_X) {
-      auto& lock_request_queue = it->second.at(lock_data_id);
+      auto& lock_request_queue = it->second.queues_.at(lock_data_id);
       lock_request_queue.oldest_txn_id_ = txn->get_transaction_id();
       lock_request_queue.request_queue_.emplace_back(txn->get_transaction_id(),
                                                      LockMode::SHARED);
-      std::unique_lock ul(latch_, std::adopt_lock);
+      std::unique_lock ul(shard.latch_, std::adopt_lock);
       auto cur = lock_request_queue.request_queue_.begin();
       // 通过条件：当前请求队列只有共享间隙锁且相交区间不存在 X 锁
       lock_request_queue.cv_.wait(ul, [&lock_request_queue, txn, &cur, &it,
@@ -175,24 +205,9 @@ bool LockManager::lock_shared_on_gap(Transaction* txn, IndexMeta& index_meta,
           }
         }
 
-        bool contain_X = false;
-        for (auto& [data_id, queue] : it->second) {
-          if (queue.group_lock_mode_ == GroupLockMode::X &&
-              lock_data_id.gap_.isCoincide(data_id.gap_)) {
-            bool is_only_txn = true;
-            for (auto& req : queue.request_queue_) {
-              if (req.txn_id_ != txn->get_transaction_id() && req.granted_) {
-                is_only_txn = false;
-                break;
-              }
-            }
-            if (!is_only_txn) {
-              contain_X = true;
-              break;
-            }
-          }
-        }
-        return !contain_X;
+        return find_gap_conflict(it->second, lock_data_id.gap_,
+                                 txn->get_transaction_id(),
+                                 GroupLockMode::X) == nullptr;
       });
       cur->granted_ = true;
       lock_request_queue.group_lock_mode_ = GroupLockMode::S;
@@ -204,7 +219,7 @@ bool LockManager::lock_shared_on_gap(Transaction* txn, IndexMeta& index_meta,
     }
   }
 
-  auto& lock_request_queue = it->second.at(lock_data_id);
+  auto& lock_request_queue = it->second.queues_.at(lock_data_id);
 
   // 每次事务申请锁都要更新最老事务id
   if (txn->get_transaction_id() < lock_request_queue.oldest_txn_id_) {
@@ -232,53 +247,41 @@ bool LockManager::lock_shared_on_gap(Transaction* txn, IndexMeta& index_meta,
  */
 bool LockManager::lock_exclusive_on_gap(Transaction* txn, IndexMeta& index_meta,
                                         Gap& gap, int tab_fd) {
-  std::lock_guard lock(latch_);
+  auto& shard = get_gap_shard(index_meta);
+  std::lock_guard lock(shard.latch_);
 
   if (!check_lock(txn)) {
     return false;
   }
 
   LockDataId lock_data_id(tab_fd, index_meta, gap, LockDataType::GAP);
-  auto it = gap_lock_table_.find(index_meta);
-  if (it == gap_lock_table_.end()) {
+  auto it = shard.gap_lock_table_.find(index_meta);
+  if (it == shard.gap_lock_table_.end()) {
     // 新建
-    it =
-        gap_lock_table_
-            .emplace(std::piecewise_construct,
-                     std::forward_as_tuple(index_meta), std::forward_as_tuple())
-            .first;
-    it->second.reserve(80);
+    it = shard.gap_lock_table_
+             .emplace(std::piecewise_construct,
+                      std::forward_as_tuple(index_meta),
+                      std::forward_as_tuple(index_meta))
+             .first;
+    it->second.queues_.reserve(80);
   }
 
-  bool contain = false;
   // 检查索引上是否存在互斥的相交区间
   // 独占锁只要有区间相交就得等待
-  for (auto& [data_id, queue] : it->second) {
-    if (queue.group_lock_mode_ != GroupLockMode::NON_LOCK) {
-      // 注意参数里的 gap 已经被移动了，是 lock_data_id.gap_
-      if (lock_data_id.gap_.isCoincide(data_id.gap_)) {
-        bool is_only_txn = true;
-        for (auto& req : queue.request_queue_) {
-          if (req.txn_id_ != txn->get_transaction_id() && req.granted_) {
-            is_only_txn = false;
-            break;
-          }
-        }
-        if (!is_only_txn) {
-          // TODO 如果不过题八，不必回滚提高并发度
-          if (txn->get_transaction_id() > queue.oldest_txn_id_) {
-            throw TransactionAbortException(txn->get_transaction_id(),
-                                            AbortReason::DEADLOCK_PREVENTION);
-          }
-          contain = true;
-          break;
-        }
-      }
-    }
+  // 注意参数里的 gap 已经被移动了，是 lock_data_id.gap_
+  auto* conflict = find_gap_conflict(it->second, lock_data_id.gap_,
+                                     txn->get_transaction_id(),
+                                     GroupLockMode::S);
+  // TODO 如果不过题八，不必回滚提高并发度
+  if (conflict != nullptr &&
+      txn->get_transaction_id() > conflict->oldest_txn_id_) {
+    throw TransactionAbortException(txn->get_transaction_id(),
+                                    AbortReason::DEADLOCK_PREVENTION);
   }
+  bool contain = conflict != nullptr;
 
-  if (it->second.find(lock_data_id) != it->second.end()) {
-    auto& lock_request_queue = it->second.at(lock_data_id);
+  if (it->second.queues_.count(lock_data_id) != 0) {
+    auto& lock_request_queue = it->second.queues_.at(lock_data_id);
     for (auto& lock_request : lock_request_queue.request_queue_) {
       // 如果锁请求队列上该事务已经有共享锁或更高级别的锁（X）了，加锁成功
       if (lock_request.txn_id_ == txn->get_transaction_id()) {
@@ -313,7 +316,7 @@ bool LockManager::lock_exclusive_on_gap(Transaction* txn, IndexMeta& index_meta,
         // lock_request_queue.request_queue_.emplace_back(txn->get_transaction_id(),
         // LockMode::EXCLUSIVE);
 
-        std::unique_lock ul(latch_, std::adopt_lock);
+        std::unique_lock ul(shard.latch_, std::adopt_lock);
         auto cur = lock_request_queue.request_queue_.begin();
         // 通过条件：当前请求之前没有任何已授权的请求并且不存在相交区间
         lock_request_queue.cv_.wait(
@@ -329,26 +332,9 @@ bool LockManager::lock_exclusive_on_gap(Transaction* txn, IndexMeta& index_meta,
                 }
               }
 
-              bool contain = false;
-              for (auto& [data_id, queue] : it->second) {
-                if (queue.group_lock_mode_ != GroupLockMode::NON_LOCK) {
-                  if (lock_data_id.gap_.isCoincide(data_id.gap_)) {
-                    bool is_only_txn = true;
-                    for (auto& req : queue.request_queue_) {
-                      if (req.txn_id_ != txn->get_transaction_id() &&
-                          req.granted_) {
-                        is_only_txn = false;
-                        break;
-                      }
-                    }
-                    if (!is_only_txn) {
-                      contain = true;
-                      break;
-                    }
-                  }
-                }
-              }
-              return !contain;
+              return find_gap_conflict(it->second, lock_data_id.gap_,
+                                       txn->get_transaction_id(),
+                                       GroupLockMode::S) == nullptr;
             });
         cur->granted_ = true;
         lock_request_queue.group_lock_mode_ = GroupLockMode::X;
@@ -375,7 +361,7 @@ bool LockManager::lock_exclusive_on_gap(Transaction* txn, IndexMeta& index_meta,
       lock_request_queue.request_queue_.emplace_back(txn->get_transaction_id(),
                                                      LockMode::EXCLUSIVE);
 
-      std::unique_lock ul(latch_, std::adopt_lock);
+      std::unique_lock ul(shard.latch_, std::adopt_lock);
       auto cur = lock_request_queue.request_queue_.begin();
       // 通过条件：当前请求之前没有任何已授权的请求并且不存在相交区间
       // 后面没有通过的 S 锁
@@ -392,25 +378,9 @@ bool LockManager::lock_exclusive_on_gap(Transaction* txn, IndexMeta& index_meta,
           }
         }
 
-        bool contain = false;
-        for (auto& [data_id, queue] : it->second) {
-          if (queue.group_lock_mode_ != GroupLockMode::NON_LOCK) {
-            if (lock_data_id.gap_.isCoincide(data_id.gap_)) {
-              bool is_only_txn = true;
-              for (auto& req : queue.request_queue_) {
-                if (req.txn_id_ != txn->get_transaction_id() && req.granted_) {
-                  is_only_txn = false;
-                  break;
-                }
-              }
-              if (!is_only_txn) {
-                contain = true;
-                break;
-              }
-            }
-          }
-        }
-        return !contain;
+        return find_gap_conflict(it->second, lock_data_id.gap_,
+                                 txn->get_transaction_id(),
+                                 GroupLockMode::S) == nullptr;
       });
       cur->granted_ = true;
       lock_request_queue.group_lock_mode_ = GroupLockMode::X;
@@ -419,15 +389,13 @@ bool LockManager::lock_exclusive_on_gap(Transaction* txn, IndexMeta& index_meta,
       return true;
     }
   } else {
-    it->second.emplace(std::piecewise_construct,
-                       std::forward_as_tuple(lock_data_id),
-                       std::forward_as_tuple());
+    emplace_gap_queue(it->second, lock_data_id);
     if (contain) {
-      auto& lock_request_queue = it->second.at(lock_data_id);
+      auto& lock_request_queue = it->second.queues_.at(lock_data_id);
       lock_request_queue.oldest_txn_id_ = txn->get_transaction_id();
       lock_request_queue.request_queue_.emplace_back(txn->get_transaction_id(),
                                                      LockMode::EXCLUSIVE);
-      std::unique_lock ul(latch_, std::adopt_lock);
+      std::unique_lock ul(shard.latch_, std::adopt_lock);
       auto cur = lock_request_queue.request_queue_.begin();
       lock_request_queue.cv_.wait(ul, [&lock_request_queue, txn, &cur, &it,
                                        &lock_data_id]() {
@@ -442,25 +410,9 @@ bool LockManager::lock_exclusive_on_gap(Transaction* txn, IndexMeta& index_meta,
           }
         }
 
-        bool contain = false;
-        for (auto& [data_id, queue] : it->second) {
-          if (queue.group_lock_mode_ != GroupLockMode::NON_LOCK) {
-            if (lock_data_id.gap_.isCoincide(data_id.gap_)) {
-              bool is_only_txn = true;
-              for (auto& req : queue.request_queue_) {
-                if (req.txn_id_ != txn->get_transaction_id() && req.granted_) {
-                  is_only_txn = false;
-                  break;
-                }
-              }
-              if (!is_only_txn) {
-                contain = true;
-                break;
-              }
-            }
-          }
-        }
-        return !contain;
+        return find_gap_conflict(it->second, lock_data_id.gap_,
+                                 txn->get_transaction_id(),
+                                 GroupLockMode::S) == nullptr;
       });
       cur->granted_ = true;
       lock_request_queue.group_lock_mode_ = GroupLockMode::X;
@@ -470,7 +422,7 @@ bool LockManager::lock_exclusive_on_gap(Transaction* txn, IndexMeta& index_meta,
     }
   }
 
-  auto& lock_request_queue = it->second.at(lock_data_id);
+  auto& lock_request_queue = it->second.queues_.at(lock_data_id);
 
   // 每次事务申请锁都要更新最老事务id
   if (txn->get_transaction_id() < lock_request_queue.oldest_txn_id_) {
@@ -486,19 +438,13 @@ bool LockManager::lock_exclusive_on_gap(Transaction* txn, IndexMeta& index_meta,
   return true;
 }
 
-// insert 算子会调用，但是上行锁
 /**
- * @description: 申请间隙锁
- * @return {bool} 加锁是否成功
- * @param {Transaction*} txn 要申请锁的事务对象指针
- * @param {Rmcord&} rid 加锁的间隙下限记录
- * @param {Rmcord&} rid 加锁的间隙上限记录
- * @param {int} tab_fd
+ * @description: 只包含一个索引键的间隙，插入和恢复时用它检查或锁住单个键
+ * @return {Gap} 每个索引字段都等于 key 中对应值的间隙
+ * @param {IndexMeta&} index_meta 索引元数据
+ * @param {RmRecord&} key 按索引中的偏移量存放字段的键，至少 col_tot_len 长
  */
-bool LockManager::isSafeInGap(Transaction* txn, IndexMeta& index_meta,
-                              RmRecord& record, int tab_fd) {
-  std::unique_lock lock(latch_);
-
+Gap LockManager::point_gap(IndexMeta& index_meta, const RmRecord& key) {
   auto predicate_manager = PredicateManager(index_meta);
 
   // 手动写个 cond index_col = val
@@ -506,8 +452,7 @@ bool LockManager::isSafeInGap(Transaction* txn, IndexMeta& index_meta,
   int idx = 0;
   for (auto& [index_offset, col_meta] : index_meta.cols) {
     Value v;
-    v.raw =
-        std::make_shared<RmRecord>(record.data + col_meta.offset, col_meta.len);
+    v.raw = std::make_shared<RmRecord>(key.data + index_offset, col_meta.len);
     switch (col_meta.type) {
       case TYPE_INT: {
         v.set_int(*reinterpret_cast<int*>(v.raw->data));
@@ -531,34 +476,52 @@ bool LockManager::isSafeInGap(Transaction* txn, IndexMeta& index_meta,
   for (auto& cond : conds) {
     predicate_manager.addPredicate(cond.lhs_col.col_name, cond);
   }
+  return Gap(predicate_manager.getIndexConds());
+}
+
+// insert 算子会调用，但是上行锁
+/**
+ * @description: 申请间隙锁
+ * @return {bool} 加锁是否成功
+ * @param {Transaction*} txn 要申请锁的事务对象指针
+ * @param {Rmcord&} rid 加锁的间隙下限记录
+ * @param {Rmcord&} rid 加锁的间隙上限记录
+ * @param {int} tab_fd
+ */
+bool LockManager::isSafeInGap(Transaction* txn, IndexMeta& index_meta,
+                              RmRecord& record, int tab_fd) {
+  auto gap = point_gap(index_meta, record);
+  auto& shard = get_gap_shard(index_meta);
+  std::unique_lock lock(shard.latch_);
 
-  auto gap = Gap(predicate_manager.getIndexConds());
   LockDataId lock_data_id(tab_fd, index_meta, gap, LockDataType::GAP);
 
   while (true) {
     bool conflict_detected = false;
 
     // 检查1：查找索引是否存在
-    auto outer_it = gap_lock_table_.find(index_meta);
-    if (outer_it != gap_lock_table_.end()) {
-      auto& inner_map = outer_it->second;
-
-      // 检查2：遍历所有间隙锁
-      for (auto& [data_id, queue] : inner_map) {
-        // 跳过不相交的间隙
-        if (!data_id.gap_.isInGap(record)) continue;
-
-        // 检查是否有其他事务持有锁
-        bool other_holder = false;
-        for (auto& req : queue.request_queue_) {
-          if (req.txn_id_ != txn->get_transaction_id() && req.granted_) {
-            other_holder = true;
-            break;
-          }
-        }
-
-        if (!other_holder) continue;  // 无冲突继续
+    auto outer_it = shard.gap_lock_table_.find(index_meta);
+    if (outer_it != shard.gap_lock_table_.end()) {
+      // 检查2：在区间树中查找包含该记录的间隙锁
+      LockRequestQueue* conflict = nullptr;
+      outer_it->second.tree_.for_each_overlap(
+          lock_data_id.gap_, [&](GapLockEntry* entry) {
+            auto& [data_id, queue] = *entry;
+            // 跳过不相交的间隙
+            if (!data_id.gap_.isInGap(record)) return true;
+
+            // 检查是否有其他事务持有锁
+            for (auto& req : queue.request_queue_) {
+              if (req.txn_id_ != txn->get_transaction_id() && req.granted_) {
+                conflict = &queue;
+                return false;
+              }
+            }
+            return true;  // 无冲突继续
+          });
 
+      if (conflict != nullptr) {
+        auto& queue = *conflict;
         // Wait-die死锁预防
         if (txn->get_transaction_id() > queue.oldest_txn_id_) {
           throw TransactionAbortException(txn->get_transaction_id(),
@@ -582,16 +545,21 @@ bool LockManager::isSafeInGap(Transaction* txn, IndexMeta& index_meta,
 
         // 中止检查
         if (txn->get_state() == TransactionState::ABORTED) return false;
-
-        break;  // 退出当前检查循环
       }
     }
 
     // 存在冲突需要重新检查
     if (conflict_detected) continue;
 
-    // 获取或创建内层map (避免重复查找)
-    auto& inner_map = gap_lock_table_[index_meta];
+    // 获取或创建索引上的间隙锁表
+    if (outer_it == shard.gap_lock_table_.end()) {
+      outer_it = shard.gap_lock_table_
+                     .emplace(std::piecewise_construct,
+                              std::forward_as_tuple(index_meta),
+                              std::forward_as_tuple(index_meta))
+                     .first;
+    }
+    auto& inner_map = outer_it->second.queues_;
 
     // 检查3：目标间隙锁是否已存在
     if (auto it = inner_map.find(lock_data_id); it != inner_map.end()) {
@@ -613,9 +581,7 @@ bool LockManager::isSafeInGap(Transaction* txn, IndexMeta& index_meta,
 
     // ==== 安全创建新间隙锁 ====
     // 原子插入
-    auto [it, inserted] = inner_map.emplace(std::piecewise_construct,
-                                            std::forward_as_tuple(lock_data_id),
-                                            std::forward_as_tuple());
+    auto [it, inserted] = emplace_gap_queue(outer_it->second, lock_data_id);
 
     if (inserted) {
       LockRequestQueue& new_queue = it->second;
@@ -640,19 +606,20 @@ bool LockManager::isSafeInGap(Transaction* txn, IndexMeta& index_meta,
  * @param {Transaction*} txn 要申请锁的事务对象指针
  * @param {Rid&} rid 加锁的目标记录ID 记录所在的表的fd
  * @param {int} tab_fd
+ * @param {bool} no_wait 有冲突时直接回滚，不等待
  */
 bool LockManager::lock_shared_on_record(Transaction* txn, const Rid& rid,
-                                        int tab_fd) {
-  std::lock_guard lock(latch_);
+                                        int tab_fd, bool no_wait) {
+  LockDataId lock_data_id(tab_fd, rid, LockDataType::RECORD);
+  auto& shard = get_shard(lock_data_id);
+  std::lock_guard lock(shard.latch_);
 
   if (!check_lock(txn)) {
     return false;
   }
-
-  LockDataId lock_data_id(tab_fd, rid, LockDataType::RECORD);
-  auto&& it = lock_table_.find(lock_data_id);
-  if (it == lock_table_.end()) {
-    it = lock_table_
+  auto&& it = shard.lock_table_.find(lock_data_id);
+  if (it == shard.lock_table_.end()) {
+    it = shard.lock_table_
              .emplace(std::piecewise_construct,
                       std::forward_as_tuple(lock_data_id),
                       std::forward_as_tuple())
@@ -682,14 +649,15 @@ bool LockManager::lock_shared_on_record(Transaction* txn, const Rid& rid,
     if (lock_request_queue.group_lock_mode_ == GroupLockMode::X ||
         lock_request_queue.group_lock_mode_ == GroupLockMode::IX ||
         lock_request_queue.group_lock_mode_ == GroupLockMode::SIX) {
-      if (txn->get_transaction_id() > lock_request_queue.oldest_txn_id_) {
+      if (no_wait ||
+          txn->get_transaction_id() > lock_request_queue.oldest_txn_id_) {
         throw TransactionAbortException(txn->get_transaction_id(),
                                         AbortReason::DEADLOCK_PREVENTION);
       }
       lock_request_queue.oldest_txn_id_ = txn->get_transaction_id();
       lock_request_queue.request_queue_.emplace_back(txn->get_transaction_id(),
                                                      LockMode::SHARED);
-      std::unique_lock ul(latch_, std::adopt_lock);
+      std::unique_lock ul(shard.latch_, std::adopt_lock);
       auto cur = lock_request_queue.request_queue_.begin();
       lock_request_queue.cv_.wait(ul, [&lock_request_queue, txn, &cur]() {
         if (lock_request_queue.request_queue_.empty()) return true;
@@ -741,19 +709,20 @@ bool LockManager::lock_shared_on_record(Transaction* txn, const Rid& rid,
  * @param {Transaction*} txn 要申请锁的事务对象指针
  * @param {Rid&} rid 加锁的目标记录ID
  * @param {int} tab_fd 记录所在的表的fd
+ * @param {bool} no_wait 有冲突时直接回滚，不等待
  */
 bool LockManager::lock_exclusive_on_record(Transaction* txn, const Rid& rid,
-                                           int tab_fd) {
-  std::lock_guard lock(latch_);
+                                           int tab_fd, bool no_wait) {
+  LockDataId lock_data_id(tab_fd, rid, LockDataType::RECORD);
+  auto& shard = get_shard(lock_data_id);
+  std::lock_guard lock(shard.latch_);
 
   if (!check_lock(txn)) {
     return false;
   }
-
-  LockDataId lock_data_id(tab_fd, rid, LockDataType::RECORD);
-  auto&& it = lock_table_.find(lock_data_id);
-  if (it == lock_table_.end()) {
-    it = lock_table_
+  auto&& it = shard.lock_table_.find(lock_data_id);
+  if (it == shard.lock_table_.end()) {
+    it = shard.lock_table_
              .emplace(std::piecewise_construct,
                       std::forward_as_tuple(lock_data_id),
                       std::forward_as_tuple())
@@ -780,35 +749,32 @@ bool LockManager::lock_exclusive_on_record(Transaction* txn, const Rid& rid,
         // 整个队列的时间戳不一定严格降序，需比较其中最老的事务id，用一个
         // oldest_txn_id_
         // 变量来维护，且等待队列中的处于等待的当前事务不可能还会申请其他锁了（阻塞）
-        // 无论有没有得到锁都要先进入等待队列，得到锁后 granted_ 置真
-        if (txn->get_transaction_id() > lock_request_queue.oldest_txn_id_) {
+        if (no_wait ||
+            txn->get_transaction_id() > lock_request_queue.oldest_txn_id_) {
           // Younger transaction requests the lock, abort the current
           // transaction
           throw TransactionAbortException(txn->get_transaction_id(),
                                           AbortReason::DEADLOCK_PREVENTION);
         }
 
+        // 锁升级：原地把 S 请求改成未授权的 X 请求，等其他持有者全部释放
+        lock_request.granted_ = false;
+        lock_request.lock_mode_ = LockMode::EXCLUSIVE;
+        --lock_request_queue.shared_lock_num_;
+
         lock_request_queue.oldest_txn_id_ = txn->get_transaction_id();
-        lock_request_queue.request_queue_.emplace_back(
-            txn->get_transaction_id(), LockMode::EXCLUSIVE);
-        std::unique_lock ul(latch_, std::adopt_lock);
-        auto cur = lock_request_queue.request_queue_.begin();
-        // 通过条件：当前请求之前没有任何已授权的请求
-        lock_request_queue.cv_.wait(ul, [&lock_request_queue, txn, &cur]() {
-          for (auto it = lock_request_queue.request_queue_.begin();
-               it != lock_request_queue.request_queue_.end(); ++it) {
-            if (it->txn_id_ != txn->get_transaction_id()) {
-              if (it->granted_) {
-                return false;
-              }
-            } else {
-              cur = it;
-              break;
+        std::unique_lock ul(shard.latch_, std::adopt_lock);
+        // 通过条件：队列中没有其他已授权的请求
+        lock_request_queue.cv_.wait(ul, [&lock_request_queue, txn]() {
+          for (auto& request : lock_request_queue.request_queue_) {
+            if (request.txn_id_ != txn->get_transaction_id() &&
+                request.granted_) {
+              return false;
             }
           }
           return true;
         });
-        cur->granted_ = true;
+        lock_request.granted_ = true;
         lock_request_queue.group_lock_mode_ = GroupLockMode::X;
         txn->get_lock_set()->emplace(lock_data_id);
         ul.release();
@@ -818,7 +784,8 @@ bool LockManager::lock_exclusive_on_record(Transaction* txn, const Rid& rid,
 
     // 如果其他事务有其他锁，加锁失败（no-wait）
     if (lock_request_queue.group_lock_mode_ != GroupLockMode::NON_LOCK) {
-      if (txn->get_transaction_id() > lock_request_queue.oldest_txn_id_) {
+      if (no_wait ||
+          txn->get_transaction_id() > lock_request_queue.oldest_txn_id_) {
         // Younger transaction requests the lock, abort the current transaction
         throw TransactionAbortException(txn->get_transaction_id(),
                                         AbortReason::DEADLOCK_PREVENTION);
@@ -827,9 +794,9 @@ bool LockManager::lock_exclusive_on_record(Transaction* txn, const Rid& rid,
       lock_request_queue.oldest_txn_id_ = txn->get_transaction_id();
       lock_request_queue.request_queue_.emplace_back(txn->get_transaction_id(),
                                                      LockMode::EXCLUSIVE);
-      std::unique_lock ul(latch_, std::adopt_lock);
+      std::unique_lock ul(shard.latch_, std::adopt_lock);
       auto cur = lock_request_queue.request_queue_.begin();
-      // 通过条件：当前请求之前没有任何已授权的请求
+      // 通过条件：没有其他已授权的请求（后来的 S 请求可能先被授权）
       lock_request_queue.cv_.wait(ul, [&lock_request_queue, txn, &cur]() {
         for (auto it = lock_request_queue.request_queue_.begin();
              it != lock_request_queue.request_queue_.end(); ++it) {
@@ -839,7 +806,6 @@ bool LockManager::lock_exclusive_on_record(Transaction* txn, const Rid& rid,
             }
           } else {
             cur = it;
-            break;
           }
         }
         return true;
@@ -875,16 +841,16 @@ bool LockManager::lock_exclusive_on_record(Transaction* txn, const Rid& rid,
  * @param {int} tab_fd 目标表的fd
  */
 bool LockManager::lock_shared_on_table(Transaction* txn, int tab_fd) {
-  std::lock_guard lock(latch_);
+  LockDataId lock_data_id(tab_fd, LockDataType::TABLE);
+  auto& shard = get_shard(lock_data_id);
+  std::lock_guard lock(shard.latch_);
 
   if (!check_lock(txn)) {
     return false;
   }
-
-  LockDataId lock_data_id(tab_fd, LockDataType::TABLE);
-  auto&& it = lock_table_.find(lock_data_id);
-  if (it == lock_table_.end()) {
-    it = lock_table_
+  auto&& it = shard.lock_table_.find(lock_data_id);
+  if (it == shard.lock_table_.end()) {
+    it = shard.lock_table_
              .emplace(std::piecewise_construct,
                       std::forward_as_tuple(lock_data_id),
                       std::forward_as_tuple())
@@ -921,7 +887,7 @@ bool LockManager::lock_shared_on_table(Transaction* txn, int tab_fd) {
       lock_request_queue.oldest_txn_id_ = txn->get_transaction_id();
       lock_request_queue.request_queue_.emplace_back(txn->get_transaction_id(),
                                                      LockMode::SHARED);
-      std::unique_lock ul(latch_, std::adopt_lock);
+      std::unique_lock ul(shard.latch_, std::adopt_lock);
       auto cur = lock_request_queue.request_queue_.begin();
       lock_request_queue.cv_.wait(ul, [&lock_request_queue, txn, &cur]() {
         for (auto it = lock_request_queue.request_queue_.begin();
@@ -978,17 +944,17 @@ bool LockManager::lock_shared_on_table(Transaction* txn, int tab_fd) {
  * @param {int} tab_fd 目标表的fd
  */
 bool LockManager::lock_exclusive_on_table(Transaction* txn, int tab_fd) {
-  std::lock_guard lock(latch_);
+  LockDataId lock_data_id(tab_fd, LockDataType::TABLE);
+  auto& shard = get_shard(lock_data_id);
+  std::lock_guard lock(shard.latch_);
 
   if (!check_lock(txn)) {
     return false;
   }
 
-  LockDataId lock_data_id(tab_fd, LockDataType::TABLE);
-
-  auto it = lock_table_.find(lock_data_id);
-  if (it == lock_table_.end()) {
-    it = lock_table_
+  auto it = shard.lock_table_.find(lock_data_id);
+  if (it == shard.lock_table_.end()) {
+    it = shard.lock_table_
              .emplace(std::piecewise_construct,
                       std::forward_as_tuple(lock_data_id),
                       std::forward_as_tuple())
@@ -1027,7 +993,7 @@ bool LockManager::lock_exclusive_on_table(Transaction* txn, int tab_fd) {
         lock_request_queue.oldest_txn_id_ = txn->get_transaction_id();
         // lock_request_queue.request_queue_.emplace_back(txn->get_transaction_id(),
         // LockMode::EXCLUSIVE);
-        std::unique_lock ul(latch_, std::adopt_lock);
+        std::unique_lock ul(shard.latch_, std::adopt_lock);
         auto cur = lock_request_queue.request_queue_.begin();
         // 当前请求前面没有任何已授权的请求
         lock_request_queue.cv_.wait(ul, [&lock_request_queue, txn, &cur]() {
@@ -1066,7 +1032,7 @@ bool LockManager::lock_exclusive_on_table(Transaction* txn, int tab_fd) {
       lock_request_queue.oldest_txn_id_ = txn->get_transaction_id();
       lock_request_queue.request_queue_.emplace_back(txn->get_transaction_id(),
                                                      LockMode::EXCLUSIVE);
-      std::unique_lock ul(latch_, std::adopt_lock);
+      std::unique_lock ul(shard.latch_, std::adopt_lock);
       auto cur = lock_request_queue.request_queue_.begin();
       // 当前请求前面没有任何已授权的请求
       lock_request_queue.cv_.wait(ul, [&lock_request_queue, txn, &cur]() {
@@ -1113,16 +1079,16 @@ bool LockManager::lock_exclusive_on_table(Transaction* txn, int tab_fd) {
  * @param {int} tab_fd 目标表的fd
  */
 bool LockManager::lock_IS_on_table(Transaction* txn, int tab_fd) {
-  std::lock_guard lock(latch_);
+  LockDataId lock_data_id(tab_fd, LockDataType::TABLE);
+  auto& shard = get_shard(lock_data_id);
+  std::lock_guard lock(shard.latch_);
 
   if (!check_lock(txn)) {
     return false;
   }
-
-  LockDataId lock_data_id(tab_fd, LockDataType::TABLE);
-  auto&& it = lock_table_.find(lock_data_id);
-  if (it == lock_table_.end()) {
-    it = lock_table_
+  auto&& it = shard.lock_table_.find(lock_data_id);
+  if (it == shard.lock_table_.end()) {
+    it = shard.lock_table_
              .emplace(std::piecewise_construct,
                       std::forward_as_tuple(lock_data_id),
                       std::forward_as_tuple())
@@ -1150,7 +1116,7 @@ bool LockManager::lock_IS_on_table(Transaction* txn, int tab_fd) {
     lock_request_queue.oldest_txn_id_ = txn->get_transaction_id();
     lock_request_queue.request_queue_.emplace_back(txn->get_transaction_id(),
                                                    LockMode::INTENTION_SHARED);
-    std::unique_lock<std::mutex> ul(latch_, std::adopt_lock);
+    std::unique_lock<std::mutex> ul(shard.latch_, std::adopt_lock);
     auto&& cur = lock_request_queue.request_queue_.begin();
     // 当前请求前面没有任何已授权的请求
     lock_request_queue.cv_.wait(ul, [&lock_request_queue, txn, &cur]() {
@@ -1203,12 +1169,12 @@ bool LockManager::lock_IS_on_table(Transaction* txn, int tab_fd) {
  * @param {int} tab_fd 目标表的fd
  */
 bool LockManager::lock_IX_on_table(Transaction* txn, int tab_fd) {
-  std::lock_guard lock(latch_);
-
   LockDataId lock_data_id(tab_fd, LockDataType::TABLE);
-  auto&& it = lock_table_.find(lock_data_id);
-  if (it == lock_table_.end()) {
-    it = lock_table_
+  auto& shard = get_shard(lock_data_id);
+  std::lock_guard lock(shard.latch_);
+  auto&& it = shard.lock_table_.find(lock_data_id);
+  if (it == shard.lock_table_.end()) {
+    it = shard.lock_table_
              .emplace(std::piecewise_construct,
                       std::forward_as_tuple(lock_data_id),
                       std::forward_as_tuple())
@@ -1252,7 +1218,7 @@ bool LockManager::lock_IX_on_table(Transaction* txn, int tab_fd) {
       lock_request_queue.oldest_txn_id_ = txn->get_transaction_id();
       lock_request_queue.request_queue_.emplace_back(
           txn->get_transaction_id(), LockMode::INTENTION_EXCLUSIVE);
-      std::unique_lock<std::mutex> ul(latch_, std::adopt_lock);
+      std::unique_lock<std::mutex> ul(shard.latch_, std::adopt_lock);
       auto&& cur = lock_request_queue.request_queue_.begin();
       // 当前请求前面没有任何已授权的请求
       lock_request_queue.cv_.wait(ul, [&lock_request_queue, txn, &cur]() {
@@ -1298,7 +1264,7 @@ bool LockManager::lock_IX_on_table(Transaction* txn, int tab_fd) {
     lock_request_queue.oldest_txn_id_ = txn->get_transaction_id();
     lock_request_queue.request_queue_.emplace_back(
         txn->get_transaction_id(), LockMode::INTENTION_EXCLUSIVE);
-    std::unique_lock<std::mutex> ul(latch_, std::adopt_lock);
+    std::unique_lock<std::mutex> ul(shard.latch_, std::adopt_lock);
     auto&& cur = lock_request_queue.request_queue_.begin();
     // 当前请求前面没有任何已授权的请求
     lock_request_queue.cv_.wait(ul, [&lock_request_queue, txn, &cur]() {
@@ -1351,7 +1317,10 @@ bool LockManager::lock_IX_on_table(Transaction* txn, int tab_fd) {
  * @param {LockDataId} lock_data_id 要释放的锁ID
  */
 bool LockManager::unlock(Transaction* txn, const LockDataId& lock_data_id) {
-  std::lock_guard lock(latch_);
+  auto& shard = lock_data_id.type_ == LockDataType::GAP
+                    ? get_gap_shard(lock_data_id.index_meta_)
+                    : get_shard(lock_data_id);
+  std::lock_guard lock(shard.latch_);
 
   auto& txn_state = txn->get_state();
   // 事务结束，不能再解锁
@@ -1365,22 +1334,20 @@ bool LockManager::unlock(Transaction* txn, const LockDataId& lock_data_id) {
   }
 
   std::unordered_map<LockDataId, LockRequestQueue>::iterator it;
-  std::unordered_map<
-      IndexMeta, std::unordered_map<LockDataId, LockRequestQueue> >::iterator
-      ii;
+  std::unordered_map<IndexMeta, GapLockTable>::iterator ii;
 
   if (lock_data_id.type_ == LockDataType::GAP) {
-    ii = gap_lock_table_.find(lock_data_id.index_meta_);
-    if (ii == gap_lock_table_.end()) {
+    ii = shard.gap_lock_table_.find(lock_data_id.index_meta_);
+    if (ii == shard.gap_lock_table_.end()) {
       return true;
     }
-    it = ii->second.find(lock_data_id);
-    if (it == ii->second.end()) {
+    it = ii->second.queues_.find(lock_data_id);
+    if (it == ii->second.queues_.end()) {
       return true;
     }
   } else {
-    it = lock_table_.find(lock_data_id);
-    if (it == lock_table_.end()) {
+    it = shard.lock_table_.find(lock_data_id);
+    if (it == shard.lock_table_.end()) {
       return true;
     }
   }
@@ -1428,14 +1395,11 @@ bool LockManager::unlock(Transaction* txn, const LockDataId& lock_data_id) {
 
     if (lock_data_id.type_ == LockDataType::GAP) {
       // 相交的间隙锁也得唤醒
-      for (auto& [data_id, queue] : ii->second) {
-        if (lock_data_id.gap_.isCoincide(data_id.gap_)) {
-          queue.cv_.notify_all();
-        }
-      }
-      ii->second.erase(it);
+      notify_gap_waiters(ii->second, lock_data_id.gap_);
+      ii->second.tree_.erase(it->first.gap_, &*it);
+      ii->second.queues_.erase(it);
     } else {
-      lock_table_.erase(it);
+      shard.lock_table_.erase(it);
     }
 
     return true;
@@ -1460,11 +1424,7 @@ bool LockManager::unlock(Transaction* txn, const LockDataId& lock_data_id) {
 
   if (lock_data_id.type_ == LockDataType::GAP) {
     // 相交的锁表也得唤醒
-    for (auto& [data_id, queue] : ii->second) {
-      if (lock_data_id.gap_.isCoincide(data_id.gap_)) {
-        queue.cv_.notify_all();
-      }
-    }
+    notify_gap_waiters(ii->second, lock_data_id.gap_);
   }
   return true;
 }
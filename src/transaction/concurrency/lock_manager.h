@@ -11,8 +11,11 @@ See the Mulan PSL v2 for more details. */
 #pragma once
 
 #include <condition_variable>
+#include <cstdint>
 #include <mutex>
 
+#include "common/thread_pool.h"
+#include "transaction/concurrency/gap_interval_tree.h"
 #include "transaction/transaction.h"
 
 static const std::string GroupLockModeStr[10] = {"NON_LOCK", "IS",  "IX",
@@ -44,11 +47,31 @@ class LockManager {
     bool granted_;        // 该事务是否已经被赋予锁
   };
 
+  /* 等锁的条件变量，真正需要等待时声明线程池阻塞，让线程池补充线程执行其他任务 */
+  class LockWaitCondition {
+   public:
+    template <typename Lock, typename Predicate>
+    void wait(Lock& lock, Predicate pred) {
+      if (pred()) {
+        return;
+      }
+      ThreadPool::BlockingScope scope;
+      cv_.wait(lock, pred);
+    }
+
+    void notify_one() { cv_.notify_one(); }
+
+    void notify_all() { cv_.notify_all(); }
+
+   private:
+    std::condition_variable cv_;
+  };
+
   /* 数据项上的加锁队列 */
   class LockRequestQueue {
    public:
     std::list<LockRequest> request_queue_;  // 加锁队列
-    std::condition_variable
+    LockWaitCondition
         cv_;  // 条件变量，用于唤醒正在等待加锁的申请，在no-wait策略下无需使用
     GroupLockMode group_lock_mode_ =
         GroupLockMode::NON_LOCK;  // 加锁队列的锁模式
@@ -59,10 +82,32 @@ class LockManager {
         INT32_MAX;  // 维护等待队列中最老（时间戳最小）的事务id
   };
 
+  using GapLockEntry = std::pair<const LockDataId, LockRequestQueue>;
+
+  /* 一个索引上的间隙锁，区间树用来查找相交的间隙，与加锁队列同时增删 */
+  struct GapLockTable {
+    explicit GapLockTable(const IndexMeta& index_meta) : tree_(index_meta) {}
+
+    std::unordered_map<LockDataId, LockRequestQueue> queues_;
+    GapIntervalTree<GapLockEntry> tree_;
+  };
+
+  /**
+   * 锁表的一个分片，行锁和表锁按 LockDataId 分片，间隙锁按索引分片
+   * （同一个索引上的间隙锁要互相检查是否相交）。分片独占缓存行，
+   * 不同分片上的加锁解锁互不干扰
+   */
+  struct alignas(64) LockTableShard {
+    std::mutex latch_;  // 用于该分片的并发
+    std::unordered_map<LockDataId, LockRequestQueue> lock_table_;
+    std::unordered_map<IndexMeta, GapLockTable> gap_lock_table_;
+  };
+
  public:
   LockManager() {
-    lock_table_.reserve(200);
-    gap_lock_table_.reserve(10);
+    for (auto& shard : shards_) {
+      shard.lock_table_.reserve(16);
+    }
   }
 
   ~LockManager() = default;
@@ -76,9 +121,14 @@ class LockManager {
   bool isSafeInGap(Transaction* txn, IndexMeta& index_meta, RmRecord& record,
                    int tab_fd);
 
-  bool lock_shared_on_record(Transaction* txn, const Rid& rid, int tab_fd);
+  static Gap point_gap(IndexMeta& index_meta, const RmRecord& key);
+
+  // no_wait 为真时不等待，有冲突直接回滚，用于持有页面 latch 时加锁
+  bool lock_shared_on_record(Transaction* txn, const Rid& rid, int tab_fd,
+                             bool no_wait = false);
 
-  bool lock_exclusive_on_record(Transaction* txn, const Rid& rid, int tab_fd);
+  bool lock_exclusive_on_record(Transaction* txn, const Rid& rid, int tab_fd,
+                                bool no_wait = false);
 
   bool lock_shared_on_table(Transaction* txn, int tab_fd);
 
@@ -91,9 +141,29 @@ class LockManager {
   bool unlock(Transaction* txn, const LockDataId& lock_data_id);
 
  private:
-  std::mutex latch_;  // 用于锁表的并发
-  std::unordered_map<LockDataId, LockRequestQueue> lock_table_;  // 全局锁表
-  std::unordered_map<IndexMeta,
-                     std::unordered_map<LockDataId, LockRequestQueue> >
-      gap_lock_table_;  // 全局间隙锁表
+  static std::pair<std::unordered_map<LockDataId, LockRequestQueue>::iterator,
+                   bool>
+  emplace_gap_queue(GapLockTable& table, const LockDataId& lock_data_id);
+
+  static LockRequestQueue* find_gap_conflict(GapLockTable& table,
+                                             const Gap& gap, txn_id_t txn_id,
+                                             GroupLockMode mode);
+
+  static void notify_gap_waiters(GapLockTable& table, const Gap& gap);
+
+  // 取哈希值的高位，rid 之类低位规律性强的值也能均匀分散
+  static std::size_t shard_of(std::size_t hash) {
+    return (static_cast<std::uint64_t>(hash) * 0x9E3779B97F4A7C15ULL) >>
+           (64 - LOCK_TABLE_SHARD_BITS);
+  }
+
+  LockTableShard& get_shard(const LockDataId& lock_data_id) {
+    return shards_[shard_of(std::hash<LockDataId>()(lock_data_id))];
+  }
+
+  LockTableShard& get_gap_shard(const IndexMeta& index_meta) {
+    return shards_[shard_of(std::hash<IndexMeta>()(index_meta))];
+  }
+
+  LockTableShard shards_[LOCK_TABLE_SHARDS];  // 分片的全局锁表
 };
@@ -0,0 +1,181 @@
+/* Copyright (c) 2023 Renmin University of China
+RMDB is licensed under Mulan PSL v2.
+You can use this software according to the terms and conditions of the Mulan PSL
+v2. You may obtain a copy of Mulan PSL v2 at:
+        http://license.coscl.org.cn/MulanPSL2
+THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+See the Mulan PSL v2 for more details. */
+
+#include "version_manager.h"
+
+/**
+ * @description: 把记录修改前的内容挂到版本链上，必须在修改堆上的记录之前调用，
+ * 调用者持有这条记录的 X 锁
+ * @param {Transaction*} txn 修改记录的事务
+ * @param {int} fd 表的 fd
+ * @param {Rid&} rid 被修改的记录
+ * @param {RmRecord*} record 修改前的记录，插入时为空
+ */
+void VersionManager::add_version(Transaction* txn, int fd, const Rid& rid,
+                                 const RmRecord* record) {
+  VersionKey key{fd, rid};
+  auto& shard = get_shard(key);
+  {
+    std::lock_guard lock(shard.latch_);
+    auto [it, inserted] = shard.chains_.try_emplace(key);
+    if (inserted) {
+      ++num_chains_;
+    }
+    it->second.push_back(
+        {txn->get_transaction_id(), INVALID_TIMESTAMP,
+         record == nullptr ? nullptr : std::make_unique<RmRecord>(*record)});
+  }
+  txn->get_version_set()->emplace_back(fd, rid);
+}
+
+/**
+ * @description: 给事务留下的版本打上提交时间戳，之后读时间戳不小于 commit_ts
+ * 的快照能看到事务的修改
+ * @param {Transaction*} txn 提交的事务
+ * @param {timestamp_t} commit_ts 提交时间戳
+ */
+void VersionManager::commit(Transaction* txn, timestamp_t commit_ts) {
+  auto txn_id = txn->get_transaction_id();
+  auto&& version_set = txn->get_version_set();
+  for (auto& [fd, rid] : *version_set) {
+    VersionKey key{fd, rid};
+    auto& shard = get_shard(key);
+    std::lock_guard lock(shard.latch_);
+    auto it = shard.chains_.find(key);
+    if (it == shard.chains_.end()) {
+      continue;
+    }
+    // 事务持有 X 锁直到提交，它的版本都在链尾
+    for (auto v = it->second.rbegin();
+         v != it->second.rend() && v->txn_id_ == txn_id; ++v) {
+      v->commit_ts_ = commit_ts;
+    }
+  }
+  version_set->clear();
+}
+
+/**
+ * @description: 回滚后删除事务留下的版本，此时堆上的记录已经恢复成修改前的内容
+ * @param {Transaction*} txn 回滚的事务
+ */
+void VersionManager::abort(Transaction* txn) {
+  auto txn_id = txn->get_transaction_id();
+  auto&& version_set = txn->get_version_set();
+  for (auto& [fd, rid] : *version_set) {
+    VersionKey key{fd, rid};
+    auto& shard = get_shard(key);
+    std::lock_guard lock(shard.latch_);
+    auto it = shard.chains_.find(key);
+    if (it == shard.chains_.end()) {
+      continue;
+    }
+    auto& chain = it->second;
+    while (!chain.empty() && chain.back().txn_id_ == txn_id &&
+           chain.back().commit_ts_ == INVALID_TIMESTAMP) {
+      chain.pop_back();
+    }
+    if (chain.empty()) {
+      shard.chains_.erase(it);
+      --num_chains_;
+    }
+  }
+  version_set->clear();
+}
+
+/**
+ * @description: 找出记录对读时间戳可见的版本。调用者先读堆上的记录，再调用
+ * 本函数。写事务先挂版本再改堆，读到的未提交修改一定能在链上找到修改前的内容
+ * @return {bool} 记录是否有版本链，没有时堆上的记录就是可见版本
+ * @param {int} fd 表的 fd
+ * @param {Rid&} rid 记录的位置
+ * @param {timestamp_t} read_ts 快照的读时间戳
+ * @param {unique_ptr<RmRecord>*} record 传入堆上读到的记录（不存在时为空），
+ * 传出可见版本，不可见时为空
+ */
+bool VersionManager::get_visible(int fd, const Rid& rid, timestamp_t read_ts,
+                                 std::unique_ptr<RmRecord>* record) {
+  if (empty()) {
+    return false;
+  }
+  VersionKey key{fd, rid};
+  auto& shard = get_shard(key);
+  std::lock_guard lock(shard.latch_);
+  auto it = shard.chains_.find(key);
+  if (it == shard.chains_.end()) {
+    return false;
+  }
+  // 从新到旧回退，直到遇到快照之前提交的版本，之后的修改对快照都不可见
+  const UndoVersion* undo = nullptr;
+  for (auto v = it->second.rbegin(); v != it->second.rend(); ++v) {
+    if (v->commit_ts_ != INVALID_TIMESTAMP && v->commit_ts_ <= read_ts) {
+      break;
+    }
+    undo = &*v;
+  }
+  if (undo != nullptr) {
+    *record = undo->record_ == nullptr
+                  ? nullptr
+                  : std::make_unique<RmRecord>(*undo->record_);
+  }
+  return true;
+}
+
+/**
+ * @description: 表上所有有版本链的记录。扫描完堆之后用它补上已经被删除或者被
+ * 修改得不满足谓词、但对快照仍然可见的记录
+ * @return {vector<Rid>} 有版本链的记录
+ * @param {int} fd 表的 fd
+ */
+std::vector<Rid> VersionManager::get_chained_rids(int fd) {
+  std::vector<Rid> rids;
+  if (empty()) {
+    return rids;
+  }
+  for (auto& shard : shards_) {
+    std::lock_guard lock(shard.latch_);
+    for (auto& [key, _] : shard.chains_) {
+      std::ignore = _;
+      if (key.fd_ == fd) {
+        rids.push_back(key.rid_);
+      }
+    }
+  }
+  return rids;
+}
+
+/**
+ * @description: 回收旧版本。提交时间戳不大于 horizon 的版本对所有活跃快照
+ * 都已经可见，它和比它更旧的版本不会再被用到
+ * @param {timestamp_t} horizon 活跃快照中最小的读时间戳
+ */
+void VersionManager::gc(timestamp_t horizon) {
+  for (auto& shard : shards_) {
+    std::lock_guard lock(shard.latch_);
+    for (auto it = shard.chains_.begin(); it != shard.chains_.end();) {
+      auto& chain = it->second;
+      auto last = chain.rend();
+      for (auto v = chain.rbegin(); v != chain.rend(); ++v) {
+        if (v->commit_ts_ != INVALID_TIMESTAMP && v->commit_ts_ <= horizon) {
+          last = v;
+          break;
+        }
+      }
+      if (last != chain.rend()) {
+        chain.erase(chain.begin(), last.base());
+      }
+      if (chain.empty()) {
+        it = shard.chains_.erase(it);
+        --num_chains_;
+      } else {
+        ++it;
+      }
+    }
+  }
+}
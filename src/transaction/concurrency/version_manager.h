@@ -0,0 +1,97 @@
+/* Copyright (c) 2023 Renmin University of China
+RMDB is licensed under Mulan PSL v2.
+You can use this software according to the terms and conditions of the Mulan PSL
+v2. You may obtain a copy of Mulan PSL v2 at:
+        http://license.coscl.org.cn/MulanPSL2
+THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+See the Mulan PSL v2 for more details. */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "transaction/transaction.h"
+
+/**
+ * 多版本存储：堆上只保存记录的最新版本，旧版本以 undo 链的形式保存在内存中。
+ * 写事务在修改记录之前把修改前的内容挂到这条记录的版本链上，提交时给自己的
+ * 版本打上提交时间戳。快照读不加锁，先读堆上的记录，再沿版本链回退到
+ * 读时间戳可见的版本
+ */
+class VersionManager {
+  /* 版本链上的一个版本：事务修改记录之前的内容 */
+  struct UndoVersion {
+    txn_id_t txn_id_;        // 修改记录的事务
+    timestamp_t commit_ts_;  // 事务的提交时间戳，未提交时为 INVALID_TIMESTAMP
+    std::unique_ptr<RmRecord> record_;  // 修改前的记录，插入之前为空
+  };
+
+  /* 版本链以表的 fd 和 rid 为键 */
+  struct VersionKey {
+    int fd_;
+    Rid rid_;
+
+    bool operator==(const VersionKey& other) const {
+      return fd_ == other.fd_ && rid_ == other.rid_;
+    }
+  };
+
+  struct VersionKeyHash {
+    std::size_t operator()(const VersionKey& key) const {
+      return (static_cast<std::size_t>(key.fd_) << 48) ^
+             (static_cast<std::size_t>(key.rid_.page_no) << 16) ^
+             static_cast<std::size_t>(key.rid_.slot_no);
+    }
+  };
+
+  /* 版本链表的一个分片，链上旧版本在前，新版本在后 */
+  struct alignas(64) VersionShard {
+    std::mutex latch_;  // 用于该分片的并发
+    std::unordered_map<VersionKey, std::vector<UndoVersion>, VersionKeyHash>
+        chains_;
+  };
+
+ public:
+  VersionManager() = default;
+
+  ~VersionManager() = default;
+
+  void add_version(Transaction* txn, int fd, const Rid& rid,
+                   const RmRecord* record);
+
+  void commit(Transaction* txn, timestamp_t commit_ts);
+
+  void abort(Transaction* txn);
+
+  bool get_visible(int fd, const Rid& rid, timestamp_t read_ts,
+                   std::unique_ptr<RmRecord>* record);
+
+  std::vector<Rid> get_chained_rids(int fd);
+
+  void gc(timestamp_t horizon);
+
+  // 没有任何版本链时快照读可以直接使用堆上的记录
+  bool empty() const { return num_chains_.load() == 0; }
+
+  std::size_t get_num_chains() const { return num_chains_.load(); }
+
+ private:
+  // 取哈希值的高位，与锁表的分片方式相同
+  static std::size_t shard_of(std::size_t hash) {
+    return (static_cast<std::uint64_t>(hash) * 0x9E3779B97F4A7C15ULL) >>
+           (64 - VERSION_TABLE_SHARD_BITS);
+  }
+
+  VersionShard& get_shard(const VersionKey& key) {
+    return shards_[shard_of(VersionKeyHash()(key))];
+  }
+
+  VersionShard shards_[VERSION_TABLE_SHARDS];
+  std::atomic<std::size_t> num_chains_{0};  // 所有分片上版本链的数量
+};
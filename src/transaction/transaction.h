@@ -17,6 +17,7 @@ See the Mulan PSL v2 for more details. */
 #include <thread>
 #include <unordered_set>
 
+#include "storage/page_guard.h"
 #include "txn_defs.h"
 
 class Transaction {
@@ -28,8 +29,9 @@ class Transaction {
         txn_id_(txn_id) {
     write_set_ = std::make_shared<std::deque<WriteRecord*> >();
     lock_set_ = std::make_shared<std::unordered_set<LockDataId> >();
-    index_latch_page_set_ = std::make_shared<std::deque<Page*> >();
+    index_latch_page_set_ = std::make_shared<std::deque<WritePageGuard> >();
     index_deleted_page_set_ = std::make_shared<std::deque<Page*> >();
+    version_set_ = std::make_shared<std::deque<std::pair<int, Rid> > >();
     prev_lsn_ = INVALID_LSN;
     thread_id_ = std::this_thread::get_id();
   }
@@ -46,6 +48,11 @@ class Transaction {
   inline void set_start_ts(timestamp_t start_ts) { start_ts_ = start_ts; }
   inline timestamp_t get_start_ts() { return start_ts_; }
 
+  inline void set_read_ts(timestamp_t read_ts) { read_ts_ = read_ts; }
+  inline timestamp_t get_read_ts() { return read_ts_; }
+  // 快照读事务不加锁，只读 read_ts 时已经提交的版本
+  inline bool is_snapshot_read() { return read_ts_ != INVALID_TIMESTAMP; }
+
   inline IsolationLevel get_isolation_level() { return isolation_level_; }
 
   inline TransactionState& get_state() { return state_; }
@@ -54,6 +61,9 @@ class Transaction {
   inline lsn_t get_prev_lsn() { return prev_lsn_; }
   inline void set_prev_lsn(lsn_t prev_lsn) { prev_lsn_ = prev_lsn; }
 
+  inline lsn_t get_first_lsn() { return first_lsn_; }
+  inline void set_first_lsn(lsn_t first_lsn) { first_lsn_ = first_lsn; }
+
   inline std::shared_ptr<std::deque<WriteRecord*> > get_write_set() {
     return write_set_;
   }
@@ -68,32 +78,41 @@ class Transaction {
     index_deleted_page_set_->push_back(page);
   }
 
-  inline std::shared_ptr<std::deque<Page*> > get_index_latch_page_set() {
+  inline std::shared_ptr<std::deque<WritePageGuard> >
+  get_index_latch_page_set() {
     return index_latch_page_set_;
   }
-  inline void append_index_latch_page_set(Page* page) {
-    index_latch_page_set_->push_back(page);
+  inline void append_index_latch_page_set(WritePageGuard guard) {
+    index_latch_page_set_->push_back(std::move(guard));
   }
 
   inline std::shared_ptr<std::unordered_set<LockDataId> > get_lock_set() {
     return lock_set_;
   }
 
+  inline std::shared_ptr<std::deque<std::pair<int, Rid> > > get_version_set() {
+    return version_set_;
+  }
+
  private:
   bool txn_mode_;  // 用于标识当前事务为显式事务还是单条SQL语句的隐式事务
   TransactionState state_;          // 事务状态
   IsolationLevel isolation_level_;  // 事务的隔离级别，默认隔离级别为可串行化
   std::thread::id thread_id_;       // 当前事务对应的线程id
   lsn_t prev_lsn_;   // 当前事务执行的最后一条操作对应的lsn，用于系统故障恢复
+  lsn_t first_lsn_{INVALID_LSN};  // 事务的 begin 日志，之后的日志段不能回收
   txn_id_t txn_id_;  // 事务的ID，唯一标识符
   timestamp_t start_ts_;  // 事务的开始时间戳
+  timestamp_t read_ts_{INVALID_TIMESTAMP};  // 快照读的时间戳
 
   std::shared_ptr<std::deque<WriteRecord*> >
       write_set_;  // 事务包含的所有写操作
   std::shared_ptr<std::unordered_set<LockDataId> >
       lock_set_;  // 事务申请的所有锁
-  std::shared_ptr<std::deque<Page*> >
+  std::shared_ptr<std::deque<WritePageGuard> >
       index_latch_page_set_;  // 维护事务执行过程中加锁的索引页面
   std::shared_ptr<std::deque<Page*> >
       index_deleted_page_set_;  // 维护事务执行过程中删除的索引页面
+  std::shared_ptr<std::deque<std::pair<int, Rid> > >
+      version_set_;  // 事务在版本链上留下的版本，(fd, rid)
 };
@@ -35,15 +35,15 @@ Transaction* TransactionManager::begin(Transaction* txn,
     txn = new Transaction(next_txn_id_++);
   }
   txn->set_start_ts(next_timestamp_++);
-  latch_.lock();
+  // 在 latch_ 下写 begin 日志，检查点的活跃事务表要么没有这个事务，
+  // 要么带着它的 begin 日志
+  std::lock_guard lock(latch_);
   txn_map.emplace(txn->get_transaction_id(), txn);
-  latch_.unlock();
 #ifdef ENABLE_LOGGING
-  auto* begin_log_record = new BeginLogRecord(txn->get_transaction_id());
-  begin_log_record->prev_lsn_ = txn->get_prev_lsn();
-  // TODO 日志管理
-  txn->set_prev_lsn(log_manager->add_log_to_buffer(begin_log_record));
-  delete begin_log_record;
+  BeginLogRecord begin_log_record(txn->get_transaction_id());
+  begin_log_record.prev_lsn_ = txn->get_prev_lsn();
+  txn->set_prev_lsn(log_manager->add_log_to_buffer(&begin_log_record));
+  txn->set_first_lsn(txn->get_prev_lsn());
 #endif
   return txn;
 }
@@ -63,9 +63,29 @@ void TransactionManager::commit(Transaction* txn, LogManager* log_manager) {
   // std::lock_guard lock(latch_);
 
   // 释放写集指针
-  for (auto& it : *txn->get_write_set()) {
+  auto&& write_set = txn->get_write_set();
+  bool has_writes = !write_set->empty();
+  for (auto& it : *write_set) {
     delete it;
   }
+  write_set->clear();
+
+  // 在释放锁之前给版本打上提交时间戳
+  if (version_manager_ != nullptr && !txn->get_version_set()->empty()) {
+    std::lock_guard lock(commit_latch_);
+    auto commit_ts = next_timestamp_++;
+    version_manager_->commit(txn, commit_ts);
+    last_commit_ts_.store(commit_ts);
+  }
+  end_snapshot(txn);
+
+#ifdef ENABLE_LOGGING
+  // commit 日志在释放锁之前写入缓冲区，读到本事务修改的事务的 commit 日志
+  // 一定在它之后，释放锁之后再等刷盘不会让它们先于本事务持久化
+  CommitLogRecord commit_log_record(txn->get_transaction_id());
+  commit_log_record.prev_lsn_ = txn->get_prev_lsn();
+  txn->set_prev_lsn(log_manager->add_log_to_buffer(&commit_log_record));
+#endif
 
   // 释放所有锁
   auto&& lock_set = txn->get_lock_set();
@@ -73,13 +93,12 @@ void TransactionManager::commit(Transaction* txn, LogManager* log_manager) {
     lock_manager_->unlock(txn, it);
   }
   lock_set->clear();
+
 #ifdef ENABLE_LOGGING
-  auto* commit_log_record = new CommitLogRecord(txn->get_transaction_id());
-  commit_log_record->prev_lsn_ = txn->get_prev_lsn();
-  // TODO 日志管理
-  txn->set_prev_lsn(log_manager->add_log_to_buffer(commit_log_record));
-  // log_manager->flush_log_to_disk();
-  delete commit_log_record;
+  // 组提交：等日志写线程把 commit 日志持久化后才返回，只读事务不用等
+  if (has_writes) {
+    log_manager->wait_for_flush(txn->get_prev_lsn());
+  }
 #endif
   txn->set_state(TransactionState::COMMITTED);
 }
@@ -114,11 +133,8 @@ void TransactionManager::abort(Transaction* txn, LogManager* log_manager) {
         fh->delete_record(rid, context);
         // 删除索引
         for (auto& [index_name, index_meta] : table_meta.indexes) {
-          char* key = new char[index_meta.col_tot_len];
-          for (auto& [index_offset, col_meta] : index_meta.cols) {
-            memcpy(key + index_offset, record.data + col_meta.offset,
-                   col_meta.len);
-          }
+          char* key = new char[index_meta.key_len];
+          index_meta.get_key(record.data, rid, key);
           auto ih = sm_manager_->ihs_[index_name].get();
           ih->rw_latch_.WLock();
           ih->delete_entry(key, txn);
@@ -127,11 +143,10 @@ void TransactionManager::abort(Transaction* txn, LogManager* log_manager) {
         }
 #ifdef ENABLE_LOGGING
         // 生成删除日志
-        auto* delete_log_record = new DeleteLogRecord(txn->get_transaction_id(),
-                                                      record, rid, table_name);
-        delete_log_record->prev_lsn_ = txn->get_prev_lsn();
-        txn->set_prev_lsn(log_manager->add_log_to_buffer(delete_log_record));
-        delete delete_log_record;
+        DeleteLogRecord delete_log_record(txn->get_transaction_id(), record,
+                                          rid, table_meta.id);
+        delete_log_record.prev_lsn_ = txn->get_prev_lsn();
+        txn->set_prev_lsn(log_manager->add_log_to_buffer(&delete_log_record));
 #endif
         break;
       }
@@ -141,11 +156,8 @@ void TransactionManager::abort(Transaction* txn, LogManager* log_manager) {
         fh->insert_record(rid, record.data);
         // 插入索引
         for (auto& [index_name, index_meta] : table_meta.indexes) {
-          char* key = new char[index_meta.col_tot_len];
-          for (auto& [index_offset, col_meta] : index_meta.cols) {
-            memcpy(key + index_offset, record.data + col_meta.offset,
-                   col_meta.len);
-          }
+          char* key = new char[index_meta.key_len];
+          index_meta.get_key(record.data, rid, key);
           auto ih = sm_manager_->ihs_[index_name].get();
           ih->rw_latch_.WLock();
           ih->insert_entry(key, rid, txn);
@@ -154,11 +166,10 @@ void TransactionManager::abort(Transaction* txn, LogManager* log_manager) {
         }
 #ifdef ENABLE_LOGGING
         // 生成插入日志
-        auto* insert_log_record = new InsertLogRecord(txn->get_transaction_id(),
-                                                      record, rid, table_name);
-        insert_log_record->prev_lsn_ = txn->get_prev_lsn();
-        txn->set_prev_lsn(log_manager->add_log_to_buffer(insert_log_record));
-        delete insert_log_record;
+        InsertLogRecord insert_log_record(txn->get_transaction_id(), record,
+                                          rid, table_meta.id);
+        insert_log_record.prev_lsn_ = txn->get_prev_lsn();
+        txn->set_prev_lsn(log_manager->add_log_to_buffer(&insert_log_record));
 #endif
         break;
       }
@@ -170,14 +181,10 @@ void TransactionManager::abort(Transaction* txn, LogManager* log_manager) {
         // 删除新索引，插入旧索引
         if (write_record->is_set_index_key()) {
           for (auto& [index_name, index_meta] : table_meta.indexes) {
-            char* old_key = new char[index_meta.col_tot_len];
-            char* new_key = new char[index_meta.col_tot_len];
-            for (auto& [index_offset, col_meta] : index_meta.cols) {
-              memcpy(old_key + index_offset, old_record.data + col_meta.offset,
-                     col_meta.len);
-              memcpy(new_key + index_offset, new_record.data + col_meta.offset,
-                     col_meta.len);
-            }
+            char* old_key = new char[index_meta.key_len];
+            char* new_key = new char[index_meta.key_len];
+            index_meta.get_key(old_record.data, rid, old_key);
+            index_meta.get_key(new_record.data, rid, new_key);
             auto ih = sm_manager_->ihs_[index_name].get();
             ih->rw_latch_.WLock();
             ih->delete_entry(new_key, txn);
@@ -189,11 +196,11 @@ void TransactionManager::abort(Transaction* txn, LogManager* log_manager) {
         }
 #ifdef ENABLE_LOGGING
         // 生成插入日志
-        auto* update_log_record = new UpdateLogRecord(
-            txn->get_transaction_id(), new_record, old_record, rid, table_name);
-        update_log_record->prev_lsn_ = txn->get_prev_lsn();
-        txn->set_prev_lsn(log_manager->add_log_to_buffer(update_log_record));
-        delete update_log_record;
+        UpdateLogRecord update_log_record(txn->get_transaction_id(),
+                                          new_record, old_record, rid,
+                                          table_meta.id);
+        update_log_record.prev_lsn_ = txn->get_prev_lsn();
+        txn->set_prev_lsn(log_manager->add_log_to_buffer(&update_log_record));
 #endif
         break;
       }
@@ -204,6 +211,11 @@ void TransactionManager::abort(Transaction* txn, LogManager* log_manager) {
   }
   delete context;
   write_set->clear();
+  // 堆上的记录已经恢复，再删除事务留下的版本
+  if (version_manager_ != nullptr) {
+    version_manager_->abort(txn);
+  }
+  end_snapshot(txn);
 
   // 释放所有锁
   auto&& lock_set = txn->get_lock_set();
@@ -212,12 +224,93 @@ void TransactionManager::abort(Transaction* txn, LogManager* log_manager) {
   }
   lock_set->clear();
 #ifdef ENABLE_LOGGING
-  auto* abort_log_record = new AbortLogRecord(txn->get_transaction_id());
-  abort_log_record->prev_lsn_ = txn->get_prev_lsn();
+  AbortLogRecord abort_log_record(txn->get_transaction_id());
+  abort_log_record.prev_lsn_ = txn->get_prev_lsn();
   // TODO 日志管理
-  txn->set_prev_lsn(log_manager->add_log_to_buffer(abort_log_record));
+  txn->set_prev_lsn(log_manager->add_log_to_buffer(&abort_log_record));
   // log_manager->flush_log_to_disk();
-  delete abort_log_record;
 #endif
   txn->set_state(TransactionState::ABORTED);
 }
+
+/**
+ * @description: 为只读事务开启快照，读时间戳取最后一个提交的写事务的提交时间戳
+ * @param {Transaction*} txn 只读事务
+ */
+void TransactionManager::begin_snapshot(Transaction* txn) {
+  if (version_manager_ == nullptr || txn->is_snapshot_read()) {
+    return;
+  }
+  // 和 get_gc_horizon 互斥，读时间戳登记之前不会有它需要的版本被回收
+  std::lock_guard lock(snapshot_latch_);
+  txn->set_read_ts(last_commit_ts_.load());
+  active_read_ts_.insert(txn->get_read_ts());
+}
+
+/**
+ * @description: 事务结束时注销它的快照
+ * @param {Transaction*} txn 结束的事务
+ */
+void TransactionManager::end_snapshot(Transaction* txn) {
+  if (!txn->is_snapshot_read()) {
+    return;
+  }
+  std::lock_guard lock(snapshot_latch_);
+  active_read_ts_.erase(active_read_ts_.find(txn->get_read_ts()));
+  txn->set_read_ts(INVALID_TIMESTAMP);
+}
+
+/**
+ * @description: 旧版本的回收边界，提交时间戳不大于它的版本对所有快照都可见
+ * @return {timestamp_t} 活跃快照中最小的读时间戳，没有活跃快照时为最后的
+ * 提交时间戳
+ */
+timestamp_t TransactionManager::get_gc_horizon() {
+  std::lock_guard lock(snapshot_latch_);
+  if (active_read_ts_.empty()) {
+    return last_commit_ts_.load();
+  }
+  return *active_read_ts_.begin();
+}
+
+// 后台线程，每隔 VERSION_GC_INTERVAL_MS 回收一次旧版本
+void TransactionManager::run_version_gc() {
+  std::unique_lock lock(snapshot_latch_);
+  while (!stop_gc_) {
+    gc_cv_.wait_for(lock, std::chrono::milliseconds(VERSION_GC_INTERVAL_MS),
+                    [this] { return stop_gc_; });
+    if (stop_gc_ || version_manager_->empty()) {
+      continue;
+    }
+    lock.unlock();
+    version_manager_->gc(get_gc_horizon());
+    lock.lock();
+  }
+}
+
+/**
+ * @description: 检查点用的活跃事务表。事务的最后一条日志在读取时可能还在推进，
+ * 恢复时从最早的 begin 日志开始的分析会修正
+ * @return {vector<CheckpointActiveTxn>} 写过日志的活跃事务及其首尾两条日志
+ */
+std::vector<CheckpointActiveTxn> TransactionManager::get_active_transactions() {
+  std::vector<CheckpointActiveTxn> active_txns;
+  auto add = [&active_txns](Transaction* txn) {
+    auto state = txn->get_state();
+    if (state != TransactionState::COMMITTED &&
+        state != TransactionState::ABORTED &&
+        txn->get_prev_lsn() != INVALID_LSN) {
+      active_txns.push_back({txn->get_transaction_id(), txn->get_first_lsn(),
+                             txn->get_prev_lsn()});
+    }
+  };
+  std::lock_guard lock(latch_);
+  for (auto& [_, txn] : txn_map) {
+    std::ignore = _;
+    add(txn);
+  }
+  for (auto* txn : recovering_txns_) {
+    add(txn);
+  }
+  return active_txns;
+}
@@ -11,9 +11,14 @@ See the Mulan PSL v2 for more details. */
 #pragma once
 
 #include <atomic>
+#include <condition_variable>
+#include <set>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include "concurrency/lock_manager.h"
+#include "concurrency/version_manager.h"
 #include "recovery/log_manager.h"
 #include "system/sm_manager.h"
 #include "transaction.h"
@@ -25,13 +30,27 @@ class TransactionManager {
  public:
   explicit TransactionManager(
       LockManager* lock_manager, SmManager* sm_manager,
+      VersionManager* version_manager = nullptr,
       ConcurrencyMode concurrency_mode = ConcurrencyMode::TWO_PHASE_LOCKING) {
     sm_manager_ = sm_manager;
     lock_manager_ = lock_manager;
+    version_manager_ = version_manager;
     concurrency_mode_ = concurrency_mode;
+    if (version_manager_ != nullptr) {
+      gc_thread_ = std::thread(&TransactionManager::run_version_gc, this);
+    }
   }
 
-  ~TransactionManager() = default;
+  ~TransactionManager() {
+    if (gc_thread_.joinable()) {
+      {
+        std::lock_guard lock(snapshot_latch_);
+        stop_gc_ = true;
+      }
+      gc_cv_.notify_all();
+      gc_thread_.join();
+    }
+  }
 
   // 初始化静态成员函数
   static void Initialize(size_t initial_capacity) {
@@ -45,6 +64,23 @@ class TransactionManager {
 
   void abort(Transaction* txn, LogManager* log_manager);
 
+  void begin_snapshot(Transaction* txn);
+
+  timestamp_t get_gc_horizon();
+
+  std::vector<CheckpointActiveTxn> get_active_transactions();
+
+  // 重启后在后台回滚的事务不在 txn_map 中，检查点同样要把它们算作活跃事务
+  void add_recovering_txn(Transaction* txn) {
+    std::lock_guard lock(latch_);
+    recovering_txns_.insert(txn);
+  }
+
+  void remove_recovering_txn(Transaction* txn) {
+    std::lock_guard lock(latch_);
+    recovering_txns_.erase(txn);
+  }
+
   ConcurrencyMode get_concurrency_mode() { return concurrency_mode_; }
 
   void set_concurrency_mode(ConcurrencyMode concurrency_mode) {
@@ -53,6 +89,8 @@ class TransactionManager {
 
   LockManager* get_lock_manager() { return lock_manager_; }
 
+  VersionManager* get_version_manager() { return version_manager_; }
+
   /**
    * @description: 获取事务ID为txn_id的事务对象
    * @return {Transaction*} 事务对象的指针
@@ -96,6 +134,23 @@ class TransactionManager {
   std::atomic<txn_id_t> next_txn_id_{0};        // 用于分发事务ID
   std::atomic<timestamp_t> next_timestamp_{0};  // 用于分发事务时间戳
   std::mutex latch_;                            // 用于txn_map的并发
+  std::set<Transaction*> recovering_txns_;      // 由 latch_ 保护
   SmManager* sm_manager_;
   LockManager* lock_manager_;
+  VersionManager* version_manager_;
+
+  void end_snapshot(Transaction* txn);
+
+  void run_version_gc();
+
+  // 提交时间戳在 commit_latch_ 下分配，事务的版本全部打上时间戳之后才推进
+  // last_commit_ts_，快照不会看到提交了一半的事务
+  std::mutex commit_latch_;
+  std::atomic<timestamp_t> last_commit_ts_{0};  // 最后一个提交的写事务
+  // 活跃快照的读时间戳，其中最小的决定哪些旧版本可以回收
+  std::mutex snapshot_latch_;
+  std::multiset<timestamp_t> active_read_ts_;
+  std::condition_variable gc_cv_;
+  bool stop_gc_{false};
+  std::thread gc_thread_;  // 后台回收旧版本的线程
 };
@@ -10,9 +10,14 @@ See the Mulan PSL v2 for more details. */
 
 #undef NDEBUG
 
+// 要在 #define private public 之前包含，否则其中的声明前后访问权限不一致
+#include <sstream>
+
 #define private public
 
 #include "record/rm.h"
+#include "recovery/checkpoint_manager.h"
+#include "recovery/log_recovery.h"
 #include "storage/buffer_pool_manager.h"
 
 #undef private
@@ -24,17 +29,34 @@ See the Mulan PSL v2 for more details. */
 #include <cstring>
 #include <ctime>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <numeric>
 #include <random>
 #include <set>
+#include <sstream>
 #include <string>
 #include <thread>  // NOLINT
 #include <unordered_map>
 #include <vector>
 
+#include "execution/executor_aggregate.h"
+#include "execution/executor_delete.h"
+#include "execution/executor_insert.h"
+#include "execution/executor_parallel_seq_scan.h"
+#include "execution/executor_seq_scan.h"
+#include "execution/executor_update.h"
 #include "gtest/gtest.h"
+#include "index/ix_key.h"
+#include "index/ix_manager.h"
+#include "recovery/log_manager.h"
 #include "replacer/lru_replacer.h"
 #include "storage/disk_manager.h"
+#include "system/sm_meta.h"
+#include "transaction/concurrency/gap_interval_tree.h"
+#include "transaction/concurrency/lock_manager.h"
+#include "transaction/concurrency/version_manager.h"
+#include "transaction/transaction_manager.h"
 
 const std::string TEST_DB_NAME =
     "BufferPoolManagerTest_db";                         // 以数据库名作为根目录
@@ -147,6 +169,24 @@ void check_equal(
     num_records++;
   }
   assert(num_records == mock.size());
+  // Test RM scan with pushed-down filter: 前 4 字节作为 int 且 >= 0
+  RmScanFilter filter;
+  int zero = 0;
+  filter.add(0, sizeof(int), TYPE_INT, OP_GE, (char*)&zero);
+  size_t num_filtered = 0;
+  for (RmScan scan(file_handle, &filter); !scan.is_end(); scan.next()) {
+    int val;
+    memcpy(&val, mock.at(scan.rid()).c_str(), sizeof(int));
+    assert(val >= 0);
+    num_filtered++;
+  }
+  size_t num_expected =
+      std::count_if(mock.begin(), mock.end(), [](auto& entry) {
+        int val;
+        memcpy(&val, entry.second.c_str(), sizeof(int));
+        return val >= 0;
+      });
+  assert(num_filtered == num_expected);
 }
 
 // std::cout can call this, for example: std::cout << rid
@@ -753,3 +793,2323 @@ TEST(RecordManagerTest, SimpleTest) {
   rm_manager->close_file(file_handle.get());
   rm_manager->destroy_file(filename);
 }
+
+TEST(RecordManagerTest, LockedFreeSlotTest) {
+  auto buffer_pool_manager =
+      std::make_unique<BufferPoolManager>(BUFFER_POOL_SIZE, disk_manager.get());
+  auto rm_manager = std::make_unique<RmManager>(disk_manager.get(),
+                                                buffer_pool_manager.get());
+  std::string filename = "locked_slot.txt";
+  if (disk_manager->is_file(filename)) {
+    disk_manager->destroy_file(filename);
+  }
+  rm_manager->create_file(filename, 8);
+  auto file_handle = rm_manager->open_file(filename);
+  int fd = file_handle->GetFd();
+  int num_slots = file_handle->file_hdr_.num_records_per_page;
+  char buf[8] = {};
+  for (int i = 0; i < num_slots; ++i) {
+    file_handle->insert_record(buf, nullptr);
+  }
+
+  // 删除第 1 页的两条记录，未提交的删除事务还持有其中一条的 X 锁
+  LockManager lock_manager;
+  Transaction deleter(1);
+  lock_manager.lock_exclusive_on_record(&deleter, {1, 3}, fd);
+  file_handle->delete_record({1, 3}, nullptr);
+  file_handle->delete_record({1, 5}, nullptr);
+
+  // 插入跳过被锁住的槽位，而不是回滚
+  Transaction inserter(2);
+  Context context(&lock_manager, nullptr, &inserter);
+  EXPECT_EQ(file_handle->insert_record(buf, &context), (Rid{1, 5}));
+  // 页面上只剩被锁住的槽位，插入到新页面上
+  EXPECT_EQ(file_handle->insert_record(buf, &context), (Rid{2, 0}));
+
+  // 删除事务结束之后，新页面插满就接着用第 1 页的空闲槽位
+  lock_manager.unlock(&deleter,
+                      LockDataId(fd, Rid{1, 3}, LockDataType::RECORD));
+  for (int i = 1; i < num_slots; ++i) {
+    EXPECT_EQ(file_handle->insert_record(buf, &context), (Rid{2, i}));
+  }
+  EXPECT_EQ(file_handle->insert_record(buf, &context), (Rid{1, 3}));
+  EXPECT_EQ(file_handle->file_hdr_.first_free_page_no, RM_NO_PAGE);
+
+  rm_manager->close_file(file_handle.get());
+  rm_manager->destroy_file(filename);
+}
+
+TEST(RecordManagerTest, ScanFilterTest) {
+  BufferPoolManager buffer_pool(TEST_BUFFER_POOL_SIZE, disk_manager.get());
+  RmManager rm_manager(disk_manager.get(), &buffer_pool);
+  std::string filename = "scan_filter.txt";
+  if (disk_manager->is_file(filename)) {
+    disk_manager->destroy_file(filename);
+  }
+  // 记录为 (int a, float b, char c[8])
+  struct Row {
+    int a;
+    float b;
+    char c[8];
+  };
+  rm_manager.create_file(filename, sizeof(Row));
+  auto file_handle = rm_manager.open_file(filename);
+  std::vector<Row> rows;
+  for (int i = 0; i < 5000; ++i) {
+    Row row{i, static_cast<float>(i % 1000) - 0.5f, {}};
+    snprintf(row.c, sizeof(row.c), "s%d", i % 10);
+    rows.push_back(row);
+    file_handle->insert_record(reinterpret_cast<char*>(&row), nullptr);
+  }
+  // 删除一部分记录，空槽位不能被过滤条件读到
+  for (int slot = 0; slot < 100; slot += 2) {
+    Rid rid{1, slot};
+    auto record = file_handle->get_record(rid, nullptr);
+    rows[reinterpret_cast<Row*>(record->data)->a].a = -1;
+    file_handle->delete_record(rid, nullptr);
+  }
+
+  // a >= 100 and b < 500.0 and c != "s3" and a in (各个 7 的倍数)
+  RmScanFilter filter;
+  int lower = 100;
+  float upper = 500.0f;
+  char excluded[8] = "s3";
+  filter.add(offsetof(Row, a), sizeof(int), TYPE_INT, OP_GE,
+             reinterpret_cast<char*>(&lower));
+  filter.add(offsetof(Row, b), sizeof(float), TYPE_FLOAT, OP_LT,
+             reinterpret_cast<char*>(&upper));
+  filter.add(offsetof(Row, c), sizeof(Row::c), TYPE_STRING, OP_NE, excluded);
+  std::vector<int> multiples;
+  std::vector<const char*> values;
+  for (int i = 0; i < 5000; i += 7) {
+    multiples.push_back(i);
+  }
+  for (auto& value : multiples) {
+    values.push_back(reinterpret_cast<char*>(&value));
+  }
+  filter.add_in(offsetof(Row, a), sizeof(int), TYPE_INT, values);
+
+  std::multiset<int> expected;
+  for (auto& row : rows) {
+    if (row.a >= 100 && row.b < 500.0f && strcmp(row.c, "s3") != 0 &&
+        row.a % 7 == 0) {
+      expected.insert(row.a);
+    }
+  }
+  std::multiset<int> actual;
+  for (RmScan scan(file_handle.get(), &filter); !scan.is_end(); scan.next()) {
+    actual.insert(reinterpret_cast<Row*>(scan.get_data())->a);
+  }
+  EXPECT_FALSE(expected.empty());
+  EXPECT_EQ(actual, expected);
+
+  // 值的类型和列不一致时不下推，由算子自己求值
+  ColMeta col{filename, "b", TYPE_FLOAT, sizeof(float), offsetof(Row, b)};
+  Condition cond;
+  cond.op = OP_LT;
+  cond.is_rhs_val = true;
+  cond.is_sub_query = false;
+  cond.rhs_val.set_int(500);
+  cond.rhs_val.init_raw(sizeof(int));
+  RmScanFilter unused;
+  EXPECT_FALSE(push_down_cond(cond, col, &unused));
+  EXPECT_TRUE(unused.empty());
+
+  rm_manager.close_file(file_handle.get());
+  rm_manager.destroy_file(filename);
+}
+
+TEST(IxKeyTest, NormalizedKeyTest) {
+  std::mt19937 rng(0);
+  // (int, float) 的联合索引，编码后 memcmp 的结果应与逐列比较一致
+  IxFileHdr file_hdr;
+  file_hdr.col_num_ = 2;
+  file_hdr.col_types_ = {TYPE_INT, TYPE_FLOAT};
+  file_hdr.col_lens_ = {sizeof(int), sizeof(float)};
+  file_hdr.col_tot_len_ = sizeof(int) + sizeof(float);
+  file_hdr.init_key_kind();
+  EXPECT_EQ(file_hdr.key_kind_, IxKeyKind::NORMALIZED);
+
+  std::uniform_int_distribution<int> int_dist(-100, 100);
+  std::uniform_real_distribution<float> float_dist(-1e6, 1e6);
+  auto make_key = [&](char* key) {
+    int i = int_dist(rng);
+    float f = rng() % 4 == 0 ? -0.0f : float_dist(rng);
+    memcpy(key, &i, sizeof(int));
+    memcpy(key + sizeof(int), &f, sizeof(float));
+  };
+  auto compare = [](const char* a, const char* b) {
+    int ia, ib;
+    float fa, fb;
+    memcpy(&ia, a, sizeof(int));
+    memcpy(&ib, b, sizeof(int));
+    memcpy(&fa, a + sizeof(int), sizeof(float));
+    memcpy(&fb, b + sizeof(int), sizeof(float));
+    if (ia != ib) {
+      return ia < ib ? -1 : 1;
+    }
+    return (fa > fb) - (fa < fb);
+  };
+  for (int round = 0; round < 10000; round++) {
+    char a[8], b[8], a_enc[8], b_enc[8], a_dec[8];
+    make_key(a);
+    make_key(b);
+    ix_encode_key(file_hdr, a, a_enc);
+    ix_encode_key(file_hdr, b, b_enc);
+    int expected = compare(a, b);
+    int actual = ix_compare_key(file_hdr, a_enc, b_enc);
+    EXPECT_EQ((expected > 0) - (expected < 0), (actual > 0) - (actual < 0));
+    ix_decode_key(file_hdr, a_enc, a_dec);
+    EXPECT_EQ(compare(a, a_dec), 0);
+  }
+
+  // 单列 int 的结点内查找与 std::lower_bound / std::upper_bound 一致
+  for (int n = 0; n < 300; n++) {
+    std::vector<int> keys(n);
+    for (auto& key : keys) {
+      key = int_dist(rng);
+    }
+    std::sort(keys.begin(), keys.end());
+    for (int target = -102; target <= 102; target++) {
+      int lower = std::lower_bound(keys.begin(), keys.end(), target) -
+                  keys.begin();
+      int upper = std::upper_bound(keys.begin(), keys.end(), target) -
+                  keys.begin();
+      EXPECT_EQ(ix_int_search<false>(keys.data(), 0, n, target), lower);
+      EXPECT_EQ(ix_int_search<true>(keys.data(), 0, n, target), upper);
+    }
+  }
+}
+
+TEST(IxKeyTest, CommonPrefixTest) {
+  std::mt19937 rng(0);
+  // 与逐字节比较的结果一致，覆盖按 8 字节比较的各个位置
+  for (int round = 0; round < 10000; round++) {
+    int len = rng() % 40;
+    std::string a(len, 'x');
+    for (auto& c : a) {
+      c = static_cast<char>(rng() % 2);
+    }
+    std::string b = a;
+    if (len > 0 && rng() % 2 == 0) {
+      b[rng() % len] ^= 0x10;
+    }
+    int expected = 0;
+    while (expected < len && a[expected] == b[expected]) {
+      ++expected;
+    }
+    EXPECT_EQ(ix_common_prefix(a.data(), b.data(), len), expected);
+  }
+}
+
+TEST(IndexMetaTest, KeyLayoutTest) {
+  ColMeta a{"t", "a", TYPE_INT, sizeof(int), 0};
+  ColMeta b{"t", "b", TYPE_STRING, 8, 4};
+  ColMeta c{"t", "c", TYPE_FLOAT, sizeof(float), 12};
+  // key = a | rid | c | b
+  IndexMeta index("t", sizeof(int), 1, {a}, false, {c, b});
+  ASSERT_EQ(index.key_len, 4 + 8 + 4 + 8);
+  ASSERT_EQ(index.entry_cols.size(), 5);
+  EXPECT_EQ(index.include_cols[0].first, 12);
+  EXPECT_EQ(index.include_cols[1].first, 16);
+  EXPECT_TRUE(index.has_col("b"));
+  EXPECT_FALSE(index.has_col("d"));
+
+  char record[16];
+  int a_val = -3;
+  float c_val = 1.5;
+  memcpy(record, &a_val, sizeof(int));
+  memcpy(record + 4, "abcdefgh", 8);
+  memcpy(record + 12, &c_val, sizeof(float));
+  Rid rid{7, 9};
+  char key[24];
+  index.get_key(record, rid, key);
+  EXPECT_EQ(memcmp(key, &a_val, sizeof(int)), 0);
+  EXPECT_EQ(memcmp(key + 4, &rid, sizeof(Rid)), 0);
+  EXPECT_EQ(memcmp(key + 12, &c_val, sizeof(float)), 0);
+  EXPECT_EQ(memcmp(key + 16, "abcdefgh", 8), 0);
+
+  // 序列化之后布局不变
+  std::stringstream ss;
+  ss << index;
+  IndexMeta loaded;
+  ss >> loaded;
+  EXPECT_EQ(loaded, index);
+  EXPECT_EQ(loaded.key_len, index.key_len);
+  EXPECT_EQ(loaded.entry_cols.size(), index.entry_cols.size());
+
+  // 由 key 还原索引中的字段
+  char restored[16]{};
+  index.get_record(key, restored);
+  EXPECT_EQ(memcmp(restored, record, sizeof(record)), 0);
+}
+
+/**
+ * 建一个空的 int 键 B+ 树索引，索引列为 tab_name.k
+ */
+std::unique_ptr<IxIndexHandle> create_int_btree(IxManager* ix_manager,
+                                                const std::string& tab_name) {
+  std::vector<ColMeta> cols{{tab_name, "k", TYPE_INT, sizeof(int), 0}};
+  if (ix_manager->exists(tab_name, cols)) {
+    ix_manager->destroy_index(tab_name, cols);
+  }
+  ix_manager->create_index(ix_manager->get_index_name(tab_name, cols), cols);
+  return ix_manager->open_index(tab_name, cols);
+}
+
+TEST(IxBTreeTest, ConcurrentReadWriteTest) {
+  auto disk_manager = std::make_unique<DiskManager>();
+  auto buffer_pool_manager =
+      std::make_unique<BufferPoolManager>(BUFFER_POOL_SIZE, disk_manager.get());
+  IxManager ix_manager(disk_manager.get(), buffer_pool_manager.get());
+  auto ih = create_int_btree(&ix_manager, "btree_ccur");
+
+  // 偶数 key 一直在树中，写线程反复插入、删除各自的奇数 key，造成分裂和合并
+  constexpr int num_keys = 20000;
+  constexpr int num_writers = 2;
+  constexpr int num_readers = 2;
+  constexpr int num_rounds = 3;
+  Transaction load_txn(0);
+  for (int key = 0; key < num_keys; key += 2) {
+    ASSERT_NE(ih->insert_entry(reinterpret_cast<const char*>(&key),
+                               {key, key}, &load_txn),
+              IX_NO_PAGE);
+  }
+
+  std::atomic<bool> stop{false};
+  std::atomic<int> errors{0};
+  std::vector<std::thread> writers;
+  for (int i = 0; i < num_writers; ++i) {
+    writers.emplace_back([&, i] {
+      Transaction txn(i + 1);
+      for (int round = 0; round < num_rounds; ++round) {
+        for (int key = 2 * i + 1; key < num_keys; key += 2 * num_writers) {
+          if (ih->insert_entry(reinterpret_cast<const char*>(&key), {key, key},
+                               &txn) == IX_NO_PAGE) {
+            ++errors;
+          }
+        }
+        // 最后一轮只删除一半
+        for (int key = 2 * i + 1; key < num_keys; key += 2 * num_writers) {
+          if ((round < num_rounds - 1 || key % 4 == 1) &&
+              !ih->delete_entry(reinterpret_cast<const char*>(&key), &txn)) {
+            ++errors;
+          }
+        }
+      }
+    });
+  }
+  std::vector<std::thread> readers;
+  for (int i = 0; i < num_readers; ++i) {
+    readers.emplace_back([&, i] {
+      std::mt19937 rng(i);
+      std::uniform_int_distribution<int> dist(0, num_keys - 1);
+      std::vector<Rid> result;
+      while (!stop.load(std::memory_order_relaxed)) {
+        int key = dist(rng);
+        result.clear();
+        bool is_found = ih->get_value(reinterpret_cast<const char*>(&key),
+                                      &result, nullptr);
+        if ((key % 2 == 0 && !is_found) ||
+            (is_found && !(result[0] == Rid{key, key}))) {
+          ++errors;
+        }
+      }
+    });
+  }
+  for (auto& writer : writers) {
+    writer.join();
+  }
+  stop = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  EXPECT_EQ(errors, 0);
+
+  for (int key = 0; key < num_keys; ++key) {
+    std::vector<Rid> result;
+    bool is_found =
+        ih->get_value(reinterpret_cast<const char*>(&key), &result, nullptr);
+    ASSERT_EQ(is_found, key % 4 != 1) << key;
+    if (is_found) {
+      EXPECT_EQ(result[0], (Rid{key, key}));
+    }
+  }
+  ix_manager.close_index(ih.get());
+  ix_manager.destroy_index("btree_ccur", std::vector<std::string>{"k"});
+}
+
+TEST(IxBTreeTest, ConcurrentRootChangeTest) {
+  auto disk_manager = std::make_unique<DiskManager>();
+  auto buffer_pool_manager =
+      std::make_unique<BufferPoolManager>(BUFFER_POOL_SIZE, disk_manager.get());
+  IxManager ix_manager(disk_manager.get(), buffer_pool_manager.get());
+  auto ih = create_int_btree(&ix_manager, "btree_root");
+
+  // 每一轮从空树插满再删空，根会反复分裂和收缩
+  constexpr int num_keys = 5000;
+  constexpr int num_writers = 4;
+  constexpr int num_rounds = 5;
+  std::atomic<int> errors{0};
+  std::vector<std::thread> writers;
+  for (int i = 0; i < num_writers; ++i) {
+    writers.emplace_back([&, i] {
+      Transaction txn(i + 1);
+      std::vector<Rid> result;
+      for (int round = 0; round < num_rounds; ++round) {
+        for (int key = i; key < num_keys; key += num_writers) {
+          if (ih->insert_entry(reinterpret_cast<const char*>(&key), {key, key},
+                               &txn) == IX_NO_PAGE) {
+            ++errors;
+          }
+        }
+        for (int key = i; key < num_keys; key += num_writers) {
+          result.clear();
+          if (!ih->get_value(reinterpret_cast<const char*>(&key), &result,
+                             nullptr) ||
+              !ih->delete_entry(reinterpret_cast<const char*>(&key), &txn)) {
+            ++errors;
+          }
+        }
+      }
+    });
+  }
+  for (auto& writer : writers) {
+    writer.join();
+  }
+  EXPECT_EQ(errors, 0);
+  for (int key = 0; key < num_keys; ++key) {
+    std::vector<Rid> result;
+    ASSERT_FALSE(
+        ih->get_value(reinterpret_cast<const char*>(&key), &result, nullptr));
+  }
+  ix_manager.close_index(ih.get());
+  ix_manager.destroy_index("btree_root", std::vector<std::string>{"k"});
+}
+
+TEST(IxBTreeTest, PrefixCompressedSplitMergeTest) {
+  auto disk_manager = std::make_unique<DiskManager>();
+  auto buffer_pool_manager =
+      std::make_unique<BufferPoolManager>(BUFFER_POOL_SIZE, disk_manager.get());
+  IxManager ix_manager(disk_manager.get(), buffer_pool_manager.get());
+  constexpr int key_len = 32;
+  std::vector<ColMeta> cols{{"btree_prefix", "s", TYPE_STRING, key_len, 0}};
+  if (ix_manager.exists("btree_prefix", cols)) {
+    ix_manager.destroy_index("btree_prefix", cols);
+  }
+  ix_manager.create_index(ix_manager.get_index_name("btree_prefix", cols),
+                          cols);
+  auto ih = ix_manager.open_index("btree_prefix", cols);
+
+  // 叶子中的 key 有很长的公共前缀，short_key 与它们只有 "customer-" 相同，
+  // 插入到第一个叶子时要缩短前缀并重排结点
+  auto make_key = [](const char* format, int i) {
+    std::string key(key_len, '\0');
+    snprintf(key.data(), key.size(), format, i);
+    return key;
+  };
+  auto long_key = [&](int i) { return make_key("customer-account-%08d", i); };
+  auto short_key = [&](int i) { return make_key("customer-%08d", i); };
+  // key 到 rid 的 page_no
+  std::map<std::string, int> expected;
+
+  // 按叶子链表顺序检查所有 key 有序且与 expected 相同，返回前缀压缩的叶子数
+  auto check_leaves = [&]() {
+    int compressed = 0;
+    auto it = expected.begin();
+    char key[key_len];
+    for (page_id_t page_no = ih->file_hdr_->first_leaf_;;) {
+      auto leaf = ih->fetch_node_read(page_no);
+      EXPECT_LE(leaf->get_size(), leaf->get_max_size());
+      if (leaf->prefix_len > 0) {
+        ++compressed;
+        EXPECT_GT(leaf->get_max_size(), ih->file_hdr_->btree_order_ + 1);
+      }
+      for (int i = 0; i < leaf->get_size(); ++i, ++it) {
+        if (it == expected.end()) {
+          ADD_FAILURE() << "extra key in leaf " << page_no;
+          return compressed;
+        }
+        leaf->copy_key(i, key);
+        EXPECT_EQ(std::string(key, key_len), it->first);
+        EXPECT_EQ(leaf->get_rid(i)->page_no, it->second);
+      }
+      if (page_no == ih->file_hdr_->last_leaf_) {
+        break;
+      }
+      page_no = leaf->get_next_leaf();
+    }
+    EXPECT_TRUE(it == expected.end());
+    return compressed;
+  };
+
+  constexpr int num_keys = 20000;
+  std::vector<int> order(num_keys);
+  for (int i = 0; i < num_keys; ++i) {
+    order[i] = i;
+  }
+  std::shuffle(order.begin(), order.end(), std::mt19937(0));
+  Transaction txn(0);
+  for (int i : order) {
+    auto key = long_key(i);
+    ASSERT_NE(ih->insert_entry(key.data(), {i, 0}, &txn), IX_NO_PAGE);
+    expected[key] = i;
+  }
+  EXPECT_GT(check_leaves(), 0);
+
+  for (int i = 0; i < num_keys / 10; ++i) {
+    auto key = short_key(i);
+    ASSERT_NE(ih->insert_entry(key.data(), {num_keys + i, 0}, &txn),
+              IX_NO_PAGE);
+    expected[key] = num_keys + i;
+  }
+  check_leaves();
+
+  // 删掉大部分 key，前缀不同的叶子互相合并、重分配
+  for (int i : order) {
+    if (i % 10 != 0) {
+      auto key = long_key(i);
+      ASSERT_TRUE(ih->delete_entry(key.data(), &txn));
+      expected.erase(key);
+    }
+  }
+  for (int i = 0; i < num_keys / 10; i += 2) {
+    auto key = short_key(i);
+    ASSERT_TRUE(ih->delete_entry(key.data(), &txn));
+    expected.erase(key);
+  }
+  check_leaves();
+
+  // 分裂、合并以及向上更新祖先之后没有遗留的 pin。文件头不经过缓冲池
+  for (page_id_t page_no = IX_LEAF_HEADER_PAGE;
+       page_no < ih->file_hdr_->num_pages_; ++page_no) {
+    auto* page = buffer_pool_manager->fetch_page({ih->fd_, page_no});
+    EXPECT_EQ(page->get_pin_count(), 1) << page_no;
+    buffer_pool_manager->unpin_page(page->get_page_id(), false);
+  }
+
+  ix_manager.close_index(ih.get());
+  ih = ix_manager.open_index("btree_prefix", cols);
+  check_leaves();
+  for (int i = 0; i < num_keys; ++i) {
+    for (auto& key : {long_key(i), short_key(i)}) {
+      std::vector<Rid> result;
+      bool is_found = ih->get_value(key.data(), &result, nullptr);
+      auto it = expected.find(key);
+      ASSERT_EQ(is_found, it != expected.end()) << key;
+      if (is_found) {
+        EXPECT_EQ(result[0].page_no, it->second);
+      }
+    }
+  }
+  ix_manager.close_index(ih.get());
+  ix_manager.destroy_index("btree_prefix", cols);
+}
+
+TEST(IxBTreeTest, BulkLoadTest) {
+  const std::string db_name = "BulkLoadTest_db";
+  std::string tab_name = "t";
+  BufferPoolManager buffer_pool(TEST_BUFFER_POOL_SIZE, disk_manager.get());
+  RmManager rm_manager(disk_manager.get(), &buffer_pool);
+  IxManager ix_manager(disk_manager.get(), &buffer_pool);
+  SmManager sm_manager(disk_manager.get(), &buffer_pool, &rm_manager,
+                       &ix_manager);
+  if (sm_manager.is_dir(db_name)) {
+    sm_manager.drop_db(db_name);
+  }
+  sm_manager.create_db(db_name);
+  sm_manager.open_db(db_name);
+  sm_manager.create_table(tab_name, {{"a", TYPE_INT, 4}, {"b", TYPE_INT, 4}},
+                          nullptr);
+  auto fh = sm_manager.fhs_.at(tab_name).get();
+  // a 打乱顺序插入，各有序段都要排序后再归并；b 有重复
+  constexpr int num_records = 30000;
+  std::vector<int> order(num_records);
+  std::iota(order.begin(), order.end(), 0);
+  std::shuffle(order.begin(), order.end(), std::mt19937(0));
+  std::vector<Rid> rids(num_records);
+  for (int a : order) {
+    int record[2] = {a, a % 100};
+    rids[a] = fh->insert_record(reinterpret_cast<char*>(record), nullptr);
+  }
+
+  // 唯一索引上有重复的 key，建索引失败且不留下索引文件
+  std::vector<std::string> dup_cols{"b"};
+  EXPECT_THROW(sm_manager.create_index(tab_name, dup_cols, nullptr),
+               NonUniqueIndexError);
+  EXPECT_FALSE(ix_manager.exists(tab_name, dup_cols));
+
+  std::vector<std::string> index_cols{"a"};
+  sm_manager.create_index(tab_name, index_cols, nullptr);
+  auto& tab = sm_manager.db_.get_table(tab_name);
+  auto& index_meta = tab.indexes.begin()->second;
+  auto* ih = dynamic_cast<IxIndexHandle*>(
+      sm_manager.ihs_.at(tab.indexes.begin()->first).get());
+  ASSERT_NE(ih, nullptr);
+  auto make_key = [&](int a) {
+    int record[2] = {a, 0};
+    std::vector<char> key(index_meta.key_len);
+    index_meta.get_key(reinterpret_cast<char*>(record), {}, key.data());
+    return key;
+  };
+
+  // 按叶子链表顺序 a 从小到大，除根以外每个结点都不少于半满
+  auto check_leaves = [&](int num_keys) {
+    int expected_a = 0;
+    for (page_id_t page_no = ih->file_hdr_->first_leaf_;;) {
+      auto leaf = ih->fetch_node_read(page_no);
+      EXPECT_LE(leaf->get_size(), leaf->get_max_size());
+      if (ih->file_hdr_->root_page_ != page_no) {
+        EXPECT_GE(leaf->get_size(), leaf->get_min_size());
+      }
+      for (int i = 0; i < leaf->get_size(); ++i, ++expected_a) {
+        auto rid = *leaf->get_rid(i);
+        EXPECT_EQ(*reinterpret_cast<int*>(fh->get_record(rid, nullptr)->data),
+                  expected_a);
+      }
+      if (page_no == ih->file_hdr_->last_leaf_) {
+        break;
+      }
+      page_no = leaf->get_next_leaf();
+    }
+    EXPECT_EQ(expected_a, num_keys);
+  };
+  check_leaves(num_records);
+  for (int a = 0; a < num_records; ++a) {
+    std::vector<Rid> result;
+    ASSERT_TRUE(ih->get_value(make_key(a).data(), &result, nullptr)) << a;
+    EXPECT_EQ(result[0], rids[a]);
+  }
+
+  // 建好的树上继续插入，分裂后的结点仍然有序、半满
+  Transaction txn(0);
+  constexpr int num_appended = 2000;
+  for (int a = num_records; a < num_records + num_appended; ++a) {
+    int record[2] = {a, a % 100};
+    auto rid = fh->insert_record(reinterpret_cast<char*>(record), nullptr);
+    ASSERT_NE(ih->insert_entry(make_key(a).data(), rid, &txn), IX_NO_PAGE);
+  }
+  check_leaves(num_records + num_appended);
+
+  sm_manager.close_db();
+  sm_manager.drop_db(db_name);
+}
+
+TEST(IxBTreeTest, FrameReplacedReadTest) {
+  // 缓冲池放不下整棵树，乐观读记下的帧会不断被换成其他页面
+  constexpr size_t pool_size = BUFFER_POOL_INSTANCES * 16;
+  auto disk_manager = std::make_unique<DiskManager>();
+  auto buffer_pool_manager =
+      std::make_unique<BufferPoolManager>(pool_size, disk_manager.get());
+  IxManager ix_manager(disk_manager.get(), buffer_pool_manager.get());
+  auto ih = create_int_btree(&ix_manager, "btree_replace");
+
+  constexpr int num_keys = 100000;
+  Transaction txn(0);
+  for (int key = 0; key < num_keys; ++key) {
+    ASSERT_NE(ih->insert_entry(reinterpret_cast<const char*>(&key), {key, key},
+                               &txn),
+              IX_NO_PAGE);
+  }
+  ASSERT_GT(ih->file_hdr_->num_pages_, static_cast<int>(pool_size));
+
+  std::vector<int> keys(num_keys);
+  for (int key = 0; key < num_keys; ++key) {
+    keys[key] = key;
+  }
+  std::shuffle(keys.begin(), keys.end(), std::mt19937(0));
+  for (int round = 0; round < 2; ++round) {
+    for (int key : keys) {
+      std::vector<Rid> result;
+      bool is_found =
+          ih->get_value(reinterpret_cast<const char*>(&key), &result, nullptr);
+      ASSERT_EQ(is_found, round == 0 || key % 2 == 1) << key;
+      if (is_found) {
+        ASSERT_EQ(result[0], (Rid{key, key}));
+      }
+    }
+    // 删除偶数 key 后再读一遍，合并结点会释放页面
+    for (int key = 0; round == 0 && key < num_keys; key += 2) {
+      ASSERT_TRUE(ih->delete_entry(reinterpret_cast<const char*>(&key), &txn));
+    }
+  }
+  ix_manager.close_index(ih.get());
+  ix_manager.destroy_index("btree_replace", std::vector<std::string>{"k"});
+}
+
+TEST(IxHashTest, InsertDeleteTest) {
+  auto disk_manager = std::make_unique<DiskManager>();
+  auto buffer_pool_manager =
+      std::make_unique<BufferPoolManager>(BUFFER_POOL_SIZE, disk_manager.get());
+  IxManager ix_manager(disk_manager.get(), buffer_pool_manager.get());
+
+  // 非唯一索引：key = a | rid，只对 a 做哈希
+  ColMeta a{"hash_t", "a", TYPE_INT, sizeof(int), 0};
+  IndexMeta index("hash_t", sizeof(int), 1, {a}, false, {},
+                  IndexType::HASH);
+  std::stringstream ss;
+  ss << index;
+  IndexMeta loaded;
+  ss >> loaded;
+  ASSERT_EQ(loaded, index);
+  ASSERT_EQ(loaded.type, IndexType::HASH);
+
+  std::vector<ColMeta> entry_cols;
+  for (auto& [_, col] : index.entry_cols) {
+    entry_cols.emplace_back(col);
+  }
+  std::string ix_name = ix_manager.get_index_name("hash_t", {a});
+  if (disk_manager->is_file(ix_name)) {
+    disk_manager->destroy_file(ix_name);
+  }
+  ix_manager.create_hash_index(ix_name, entry_cols, index.col_tot_len);
+  auto ih = ix_manager.open_hash_index(ix_name);
+
+  // 少数热点值有大量重复，既会分裂桶也会挂溢出页
+  constexpr int num_keys = 2000;
+  constexpr int num_rows = 20000;
+  auto key_of = [&](int row) { return row % 7 == 0 ? 0 : row % num_keys; };
+  char key[12];
+  for (int row = 0; row < num_rows; ++row) {
+    int value = key_of(row);
+    Rid rid{row, 0};
+    index.get_key(reinterpret_cast<char*>(&value), rid, key);
+    ASSERT_NE(ih->insert_entry(key, rid, nullptr), IX_NO_PAGE);
+    ASSERT_EQ(ih->insert_entry(key, rid, nullptr), IX_NO_PAGE);
+  }
+  EXPECT_GT(ih->get_global_depth(), 0);
+  for (int row = 0; row < num_rows; row += 2) {
+    int value = key_of(row);
+    index.get_key(reinterpret_cast<char*>(&value), {row, 0}, key);
+    ASSERT_TRUE(ih->delete_entry(key, nullptr));
+    ASSERT_FALSE(ih->delete_entry(key, nullptr));
+  }
+
+  ix_manager.close_index(ih.get());
+  ih = ix_manager.open_hash_index(ix_name);
+  std::vector<int> expected(num_keys);
+  for (int row = 1; row < num_rows; row += 2) {
+    ++expected[key_of(row)];
+  }
+  for (int value = 0; value < num_keys; ++value) {
+    std::vector<Rid> rids;
+    index.get_key(reinterpret_cast<char*>(&value), {}, key);
+    ih->get_value(key, &rids, nullptr);
+    ASSERT_EQ(static_cast<int>(rids.size()), expected[value]);
+    for (auto& rid : rids) {
+      EXPECT_EQ(key_of(rid.page_no), value);
+      EXPECT_EQ(rid.page_no % 2, 1);
+    }
+  }
+  ix_manager.close_index(ih.get());
+  ix_manager.destroy_index(ix_name);
+}
+
+TEST(LockManagerTest, ShardedRecordLockTest) {
+  auto lock_manager = std::make_unique<LockManager>();
+  constexpr int num_threads = 8;
+  constexpr int num_rounds = 200;
+  constexpr int tab_fd = 3;
+  std::atomic<int> holders[4]{};
+  std::atomic<bool> failed{false};
+
+  // 每个事务对表加 IX 锁，再对四行之一加 X 锁；同一行不能同时有两个持有者
+  auto worker = [&](int id) {
+    for (int round = 0; round < num_rounds; ++round) {
+      Transaction txn(round * num_threads + id);
+      int row = (id + round) % 4;
+      try {
+        lock_manager->lock_IX_on_table(&txn, tab_fd);
+        lock_manager->lock_exclusive_on_record(&txn, {row, 0}, tab_fd);
+        if (holders[row].fetch_add(1) != 0) {
+          failed = true;
+        }
+        holders[row].fetch_sub(1);
+      } catch (TransactionAbortException&) {
+        // wait-die 回滚，直接释放已拿到的锁
+      }
+      for (auto& lock_data_id : *txn.get_lock_set()) {
+        lock_manager->unlock(&txn, lock_data_id);
+      }
+    }
+  };
+  std::vector<std::thread> threads;
+  for (int i = 0; i < num_threads; ++i) {
+    threads.emplace_back(worker, i);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_FALSE(failed);
+
+  // 全部释放后，新事务可以直接拿到表级 X 锁
+  Transaction txn(num_threads * num_rounds);
+  EXPECT_TRUE(lock_manager->lock_exclusive_on_table(&txn, tab_fd));
+  lock_manager->unlock(&txn, LockDataId(tab_fd, LockDataType::TABLE));
+}
+
+TEST(LockManagerTest, RecordLockUpgradeTest) {
+  auto lock_manager = std::make_unique<LockManager>();
+  constexpr int tab_fd = 3;
+  Rid rid{1, 0};
+  Transaction older(1);
+  Transaction younger(2);
+  ASSERT_TRUE(lock_manager->lock_shared_on_record(&older, rid, tab_fd));
+  ASSERT_TRUE(lock_manager->lock_shared_on_record(&younger, rid, tab_fd));
+
+  // 两个事务都持有 S 锁时升级：年轻的回滚，年老的等年轻的释放
+  EXPECT_THROW(lock_manager->lock_exclusive_on_record(&younger, rid, tab_fd),
+               TransactionAbortException);
+  std::atomic<bool> upgraded{false};
+  std::thread upgrader([&] {
+    lock_manager->lock_exclusive_on_record(&older, rid, tab_fd);
+    upgraded = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_FALSE(upgraded);
+  lock_manager->unlock(&younger, LockDataId(tab_fd, rid, LockDataType::RECORD));
+  upgrader.join();
+  EXPECT_TRUE(upgraded);
+
+  // 持有 X 锁后，其他事务不等待的加锁直接回滚，即使它更年老
+  Transaction oldest(0);
+  EXPECT_THROW(lock_manager->lock_shared_on_record(&oldest, rid, tab_fd, true),
+               TransactionAbortException);
+  lock_manager->unlock(&older, LockDataId(tab_fd, rid, LockDataType::RECORD));
+  EXPECT_TRUE(lock_manager->lock_shared_on_record(&oldest, rid, tab_fd, true));
+}
+
+TEST(LockManagerTest, GapIntervalTreeTest) {
+  ColMeta a{"t", "a", TYPE_INT, sizeof(int), 0};
+  ColMeta b{"t", "b", TYPE_INT, sizeof(int), 4};
+  IndexMeta index("t", 2 * sizeof(int), 2, {a, b});
+  std::mt19937 rng(42);
+  auto make_cond = [&](int offset, CompOp op, int val) {
+    CondOp cond(offset);
+    cond.op = op;
+    cond.rhs_val.set_int(val);
+    cond.rhs_val.init_raw(sizeof(int));
+    return cond;
+  };
+  // 每个字段随机取等值、闭区间、开区间、单边或者没有条件
+  auto random_gap = [&]() {
+    std::vector<std::pair<CondOp, CondOp> > conds;
+    for (int offset : {0, 4}) {
+      int lo = static_cast<int>(rng() % 100) - 50;
+      int hi = lo + static_cast<int>(rng() % 20);
+      auto& [left, right] = conds.emplace_back(CondOp(offset), CondOp(offset));
+      switch (rng() % 5) {
+        case 0:
+          left = make_cond(offset, OP_EQ, lo);
+          right = make_cond(offset, OP_EQ, lo);
+          break;
+        case 1:
+          left = make_cond(offset, OP_GE, lo);
+          right = make_cond(offset, OP_LE, hi);
+          break;
+        case 2:
+          left = make_cond(offset, OP_GT, lo);
+          right = make_cond(offset, OP_LT, hi);
+          break;
+        case 3:
+          left = make_cond(offset, OP_GE, lo);
+          break;
+        default:
+          right = make_cond(offset, OP_LT, hi);
+          break;
+      }
+    }
+    return Gap(conds);
+  };
+
+  constexpr int num_gaps = 500;
+  std::vector<Gap> gaps;
+  std::vector<int> ids(num_gaps);
+  GapIntervalTree<int> tree(index);
+  for (int i = 0; i < num_gaps; ++i) {
+    gaps.push_back(random_gap());
+    ids[i] = i;
+    tree.insert(gaps[i], &ids[i]);
+  }
+  std::vector<bool> erased(num_gaps, false);
+  // 区间树查出的候选再精确判断，结果要与逐个比较相同
+  auto check = [&]() {
+    for (int q = 0; q < 100; ++q) {
+      auto query = random_gap();
+      std::set<int> expected;
+      for (int i = 0; i < num_gaps; ++i) {
+        if (!erased[i] && query.isCoincide(gaps[i])) {
+          expected.insert(i);
+        }
+      }
+      std::set<int> actual;
+      tree.for_each_overlap(query, [&](int* id) {
+        if (query.isCoincide(gaps[*id])) {
+          EXPECT_TRUE(actual.insert(*id).second);
+        }
+        return true;
+      });
+      ASSERT_EQ(actual, expected);
+    }
+  };
+  check();
+  for (int i = 0; i < num_gaps; i += 2) {
+    tree.erase(gaps[i], &ids[i]);
+    erased[i] = true;
+  }
+  EXPECT_EQ(tree.size(), num_gaps / 2);
+  check();
+
+  // 返回 false 时停止访问
+  int visited = 0;
+  EXPECT_TRUE(tree.for_each_overlap(Gap(), [&](int*) {
+    ++visited;
+    return false;
+  }));
+  EXPECT_EQ(visited, 1);
+}
+
+TEST(VersionManagerTest, VisibilityTest) {
+  auto version_manager = std::make_unique<VersionManager>();
+  constexpr int tab_fd = 3;
+  constexpr int record_size = 4;
+  Rid rid{1, 0};
+  RmRecord a(record_size, const_cast<char*>("aaa"));
+  RmRecord b(record_size, const_cast<char*>("bbb"));
+  // 传入堆上的当前记录，返回读时间戳可见的版本
+  auto read = [&](const RmRecord* current, timestamp_t read_ts) {
+    std::unique_ptr<RmRecord> record;
+    if (current != nullptr) {
+      record = std::make_unique<RmRecord>(*current);
+    }
+    EXPECT_TRUE(version_manager->get_visible(tab_fd, rid, read_ts, &record));
+    return record == nullptr ? std::string() : std::string(record->data);
+  };
+
+  // 插入 a，提交前对任何快照都不可见
+  Transaction inserter(1);
+  version_manager->add_version(&inserter, tab_fd, rid, nullptr);
+  EXPECT_EQ(read(&a, 10), "");
+  version_manager->commit(&inserter, 5);
+  EXPECT_EQ(read(&a, 4), "");
+  EXPECT_EQ(read(&a, 5), "aaa");
+
+  // 更新成 b，时间戳 7 之前的快照仍然读到 a
+  Transaction updater(2);
+  version_manager->add_version(&updater, tab_fd, rid, &a);
+  EXPECT_EQ(read(&b, 10), "aaa");
+  version_manager->commit(&updater, 7);
+  EXPECT_EQ(read(&b, 6), "aaa");
+  EXPECT_EQ(read(&b, 7), "bbb");
+
+  // 删除后回滚，版本链恢复原状
+  Transaction deleter(3);
+  version_manager->add_version(&deleter, tab_fd, rid, &b);
+  EXPECT_EQ(read(nullptr, 10), "bbb");
+  version_manager->abort(&deleter);
+  EXPECT_EQ(read(&b, 10), "bbb");
+  EXPECT_EQ(read(&b, 4), "");
+  EXPECT_EQ(version_manager->get_chained_rids(tab_fd).size(), 1);
+  EXPECT_TRUE(version_manager->get_chained_rids(tab_fd + 1).empty());
+
+  // 回收对快照 6 已经可见的版本，之后的快照不会比 6 更早
+  version_manager->gc(6);
+  EXPECT_EQ(read(&b, 6), "aaa");
+  EXPECT_EQ(read(&b, 7), "bbb");
+  version_manager->gc(7);
+  EXPECT_TRUE(version_manager->empty());
+  std::unique_ptr<RmRecord> record;
+  EXPECT_FALSE(version_manager->get_visible(tab_fd, rid, 6, &record));
+}
+
+// 删除当前目录下的日志段，调用者已经析构了打开日志段的 DiskManager
+void remove_log_segments() {
+  for (auto segment : disk_manager->get_log_segments()) {
+    disk_manager->destroy_file(DiskManager::get_log_segment_name(segment));
+  }
+}
+
+/**
+ * @description: 从 pos 开始依次读出日志，直到第一条无效的日志
+ * @return {int} 有效日志的条数
+ * @param {DiskManager*} log_disk_manager 读日志段用的 DiskManager
+ * @param {lsn_t} pos 第一条日志的 lsn
+ * @param {F} f 对每条日志调用 f(lsn, log_data)
+ */
+template <typename F>
+int for_each_log(DiskManager* log_disk_manager, lsn_t pos, F&& f) {
+  std::vector<char> buf(LOG_BUFFER_SIZE);
+  int num_logs = 0;
+  while (true) {
+    int read_bytes =
+        log_disk_manager->read_log(buf.data(), LOG_BUFFER_SIZE, pos);
+    int offset = 0;
+    while (offset + LOG_HEADER_SIZE <= read_bytes) {
+      LogRecord header;
+      header.deserialize(buf.data() + offset);
+      uint32_t checksum;
+      memcpy(&checksum, buf.data() + offset + OFFSET_LOG_CHECKSUM,
+             sizeof(uint32_t));
+      if (header.lsn_ != pos + offset ||
+          header.log_tot_len_ < LOG_HEADER_SIZE ||
+          header.log_tot_len_ > static_cast<uint32_t>(read_bytes - offset)) {
+        break;
+      }
+      if (checksum != log_checksum(buf.data() + offset, header.log_tot_len_)) {
+        return num_logs;
+      }
+      f(header.lsn_, buf.data() + offset);
+      ++num_logs;
+      offset += header.log_tot_len_;
+    }
+    if (offset == 0) {
+      return num_logs;
+    }
+    pos += offset;
+  }
+}
+
+TEST(LogManagerTest, GroupCommitTest) {
+  remove_log_segments();
+  constexpr int num_threads = 8;
+  constexpr int num_commits = 100;
+  {
+    DiskManager log_disk_manager;
+    LogManager log_manager(&log_disk_manager);
+    // 多个线程并发提交，每次提交返回时自己的 commit 日志已经持久化
+    std::vector<std::thread> threads;
+    for (int i = 0; i < num_threads; ++i) {
+      threads.emplace_back([&, i] {
+        for (int j = 0; j < num_commits; ++j) {
+          CommitLogRecord commit_log_record(i * num_commits + j);
+          auto lsn = log_manager.add_log_to_buffer(&commit_log_record);
+          log_manager.wait_for_flush(lsn);
+          EXPECT_GE(log_manager.get_persist_lsn(), lsn);
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    // lsn 是日志在日志流中的位置
+    EXPECT_EQ(log_manager.get_persist_lsn(),
+              (num_threads * num_commits - 1) * LOG_HEADER_SIZE);
+  }
+  // 日志段预先写满，大小不随日志增长；写第 0 段时已经预先创建了第 1 段
+  EXPECT_EQ(disk_manager->get_log_segments(), (std::vector<int64_t>{0, 1}));
+  EXPECT_EQ(disk_manager->get_file_size(DiskManager::get_log_segment_name(0)),
+            LOG_SEGMENT_SIZE);
+  {
+    DiskManager log_disk_manager;
+    EXPECT_EQ(for_each_log(&log_disk_manager, 0, [](lsn_t, const char*) {}),
+              num_threads * num_commits);
+  }
+  remove_log_segments();
+}
+
+TEST(LogManagerTest, ParallelAppendTest) {
+  remove_log_segments();
+  constexpr int num_threads = 8;
+  constexpr int num_records = 2000;
+  lsn_t last_lsn;
+  {
+    DiskManager log_disk_manager;
+    LogManager log_manager(&log_disk_manager);
+    // 日志总量是环形缓冲区的十几倍，写日志的线程会等待空间并帮忙刷盘，
+    // 也会跨过日志段的边界
+    std::vector<std::thread> threads;
+    for (int i = 0; i < num_threads; ++i) {
+      threads.emplace_back([&, i] {
+        std::mt19937 rng(i);
+        for (int j = 0; j < num_records; ++j) {
+          RmRecord record(1 + static_cast<int>(rng() % 3000));
+          memset(record.data, 'a' + j % 26, record.size);
+          Rid rid{i, j};
+          InsertLogRecord insert_log_record(i, record, rid, 0);
+          log_manager.add_log_to_buffer(&insert_log_record);
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    log_manager.flush_log_to_disk();
+    last_lsn = log_manager.get_persist_lsn();
+  }
+  EXPECT_GT(disk_manager->get_log_segments().size(), 1);
+
+  // 日志按 lsn 顺序连续存放，每条都完整，同一个线程的日志保持先后顺序
+  {
+    std::vector<int> next(num_threads, 0);
+    lsn_t lsn = INVALID_LSN;
+    DiskManager log_disk_manager;
+    int num_logs = for_each_log(
+        &log_disk_manager, 0, [&](lsn_t log_lsn, const char* log_data) {
+          InsertLogRecord insert_log_record;
+          insert_log_record.deserialize(log_data);
+          lsn = log_lsn;
+          auto& rid = insert_log_record.rid_;
+          ASSERT_EQ(rid.slot_no, next[rid.page_no]++);
+          auto* value = insert_log_record.value_;
+          auto size = insert_log_record.value_size_;
+          ASSERT_EQ(std::count(value, value + size, 'a' + rid.slot_no % 26),
+                    size);
+        });
+    EXPECT_EQ(num_logs, num_threads * num_records);
+    EXPECT_EQ(lsn, last_lsn);
+  }
+  remove_log_segments();
+}
+
+TEST(LogManagerTest, RecycleTest) {
+  remove_log_segments();
+  RmRecord record(3000);
+  memset(record.data, 'a', record.size);
+  // 写日志直到进入第 segment 段，返回最后一条日志的 lsn。
+  // 后台线程预先创建下一个日志段，等它创建好，日志段的个数才是确定的
+  auto append_until = [&record](LogManager* log_manager, int64_t segment) {
+    for (int j = 0;; ++j) {
+      InsertLogRecord insert_log_record(0, record, Rid{0, j}, 0);
+      auto lsn = log_manager->add_log_to_buffer(&insert_log_record);
+      if (lsn >> LOG_SEGMENT_BITS >= segment) {
+        log_manager->flush_log_to_disk();
+        auto next = DiskManager::get_log_segment_name(segment + 1);
+        while (access(next.c_str(), F_OK) != 0) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return lsn;
+      }
+    }
+  };
+  {
+    DiskManager log_disk_manager;
+    LogManager log_manager(&log_disk_manager);
+    auto lsn = append_until(&log_manager, 2);
+    EXPECT_EQ(disk_manager->get_log_segments(),
+              (std::vector<int64_t>{0, 1, 2, 3}));
+    // 回收的日志段改名为之后的段号等待重用
+    log_manager.recycle_log(lsn);
+    EXPECT_EQ(disk_manager->get_log_segments(),
+              (std::vector<int64_t>{2, 3, 4, 5}));
+    // 写到重用的日志段时直接覆盖，不再新建日志段
+    lsn = append_until(&log_manager, 4);
+    EXPECT_EQ(disk_manager->get_log_segments(),
+              (std::vector<int64_t>{2, 3, 4, 5}));
+    // 重用的日志段中残留的旧日志不会被当成有效的日志
+    DiskManager read_disk_manager;
+    EXPECT_EQ(for_each_log(&read_disk_manager, lsn, [](lsn_t, const char*) {}),
+              1);
+
+    lsn = append_until(&log_manager, 7);
+    // 等待重用的日志段已经够多，多出来的日志段直接删除
+    log_manager.recycle_log(lsn);
+    EXPECT_EQ(disk_manager->get_log_segments(),
+              (std::vector<int64_t>{7, 8, 9, 10, 11}));
+  }
+  remove_log_segments();
+}
+
+TEST(LogManagerTest, UpdateLogRecordTest) {
+  std::mt19937 rng(0);
+  constexpr int record_size = 1000;
+  for (int round = 0; round < 100; ++round) {
+    RmRecord old_record(record_size);
+    for (int i = 0; i < record_size; ++i) {
+      old_record.data[i] = static_cast<char>(rng());
+    }
+    // 随机修改几个字段，其中有的字段改成和原来相同的值
+    RmRecord new_record(old_record);
+    int num_changes = static_cast<int>(rng() % 8);
+    for (int i = 0; i < num_changes; ++i) {
+      int offset = static_cast<int>(rng() % record_size);
+      int len =
+          std::min(1 + static_cast<int>(rng() % 16), record_size - offset);
+      for (int j = offset; j < offset + len; ++j) {
+        new_record.data[j] = rng() % 4 == 0 ? old_record.data[j]
+                                            : static_cast<char>(rng());
+      }
+    }
+    Rid rid{round, round + 1};
+    UpdateLogRecord update_log_record(round, old_record, new_record, rid, 7);
+    // 日志只记下修改的字节段，比新旧两条完整记录短得多
+    EXPECT_LT(update_log_record.log_tot_len_,
+              LOG_HEADER_SIZE + 2 * record_size / 4);
+    std::vector<char> buf(update_log_record.log_tot_len_);
+    update_log_record.serialize(buf.data());
+
+    UpdateLogRecord log;
+    log.deserialize(buf.data());
+    EXPECT_EQ(log.log_tot_len_, update_log_record.log_tot_len_);
+    EXPECT_EQ(log.log_tid_, round);
+    EXPECT_EQ(log.table_id_, 7);
+    EXPECT_EQ(log.rid_, rid);
+    EXPECT_EQ(log.value_size_, record_size);
+    RmRecord record(old_record);
+    log.redo(record.data);
+    EXPECT_EQ(memcmp(record.data, new_record.data, record_size), 0);
+    // 重做是幂等的
+    log.redo(record.data);
+    EXPECT_EQ(memcmp(record.data, new_record.data, record_size), 0);
+    log.undo(record.data);
+    EXPECT_EQ(memcmp(record.data, old_record.data, record_size), 0);
+  }
+}
+
+TEST(LogManagerTest, EndCheckpointLogRecordTest) {
+  std::vector<CheckpointActiveTxn> active_txns;
+  std::vector<CheckpointDirtyPage> dirty_pages;
+  for (int i = 0; i < 10; ++i) {
+    active_txns.push_back({i, 30 + i, 100 + i});
+    dirty_pages.push_back({i % 3, i, 50 + i});
+  }
+  EndCheckpointLogRecord end_log(42, active_txns, dirty_pages);
+  end_log.lsn_ = 200;
+  std::vector<char> buf(end_log.log_tot_len_);
+  end_log.serialize(buf.data());
+
+  EndCheckpointLogRecord log;
+  log.deserialize(buf.data());
+  EXPECT_EQ(log.log_type_, END_CHECKPOINT);
+  EXPECT_EQ(log.lsn_, 200);
+  EXPECT_EQ(log.log_tot_len_, end_log.log_tot_len_);
+  EXPECT_EQ(log.begin_lsn_, 42);
+  ASSERT_EQ(log.active_txns_.size(), active_txns.size());
+  ASSERT_EQ(log.dirty_pages_.size(), dirty_pages.size());
+  for (std::size_t i = 0; i < active_txns.size(); ++i) {
+    EXPECT_EQ(log.active_txns_[i].txn_id, active_txns[i].txn_id);
+    EXPECT_EQ(log.active_txns_[i].first_lsn, active_txns[i].first_lsn);
+    EXPECT_EQ(log.active_txns_[i].last_lsn, active_txns[i].last_lsn);
+    EXPECT_EQ(log.dirty_pages_[i].table_id, dirty_pages[i].table_id);
+    EXPECT_EQ(log.dirty_pages_[i].page_no, dirty_pages[i].page_no);
+    EXPECT_EQ(log.dirty_pages_[i].rec_lsn, dirty_pages[i].rec_lsn);
+  }
+  // 恢复需要的最早一条日志是最早的活跃事务的 begin 日志
+  EXPECT_EQ(log.min_lsn(), 30);
+}
+
+TEST(CheckpointTest, FullyDirtyPoolTest) {
+  remove_log_segments();
+  lsn_t txn_lsn;
+  lsn_t begin_lsn;
+  {
+    DiskManager log_disk_manager;
+    LogManager log_manager(&log_disk_manager);
+    CheckpointManager checkpoint_manager(nullptr, nullptr, &log_manager,
+                                         nullptr);
+    BeginLogRecord begin_log_record(1);
+    txn_lsn = log_manager.add_log_to_buffer(&begin_log_record);
+    BeginCheckpointLogRecord begin_checkpoint_log_record;
+    begin_lsn = log_manager.add_log_to_buffer(&begin_checkpoint_log_record);
+    // 缓冲池全是脏页，脏页表比一条日志能放下的还大
+    std::vector<CheckpointDirtyPage> dirty_pages;
+    for (int i = 0; i < BUFFER_POOL_SIZE; ++i) {
+      dirty_pages.push_back({i % 4, i / 4, begin_lsn + i % 2});
+    }
+    checkpoint_manager.end_checkpoint(begin_lsn, {{1, txn_lsn, txn_lsn}},
+                                      dirty_pages);
+    // 检查点之后的日志
+    CommitLogRecord commit_log_record(1);
+    log_manager.wait_for_flush(
+        log_manager.add_log_to_buffer(&commit_log_record));
+  }
+
+  // 结束记录拆成了多条，每条都能一次读入
+  {
+    DiskManager log_disk_manager;
+    int num_end_logs = 0;
+    for_each_log(&log_disk_manager, 0, [&](lsn_t, const char* log_data) {
+      LogRecord header;
+      header.deserialize(log_data);
+      if (header.log_type_ == END_CHECKPOINT) {
+        EXPECT_LE(header.log_tot_len_, LOG_BUFFER_SIZE);
+        ++num_end_logs;
+      }
+    });
+    EXPECT_GT(num_end_logs, 1);
+  }
+
+  // 恢复时读入所有结束记录，检查点之后提交的事务不是失败者
+  {
+    DiskManager log_disk_manager;
+    LogManager log_manager(&log_disk_manager);
+    LockManager lock_manager;
+    TransactionManager transaction_manager(&lock_manager, nullptr);
+    RecoveryManager recovery_manager(&log_disk_manager, nullptr, nullptr,
+                                     &log_manager, &transaction_manager);
+    recovery_manager.analyze();
+    EXPECT_EQ(recovery_manager.dirty_page_table_.size(), BUFFER_POOL_SIZE);
+    for (auto& [_, rec_lsn] : recovery_manager.dirty_page_table_) {
+      std::ignore = _;
+      EXPECT_GE(rec_lsn, begin_lsn);
+    }
+    EXPECT_TRUE(recovery_manager.active_txn_.empty());
+  }
+  disk_manager->destroy_file(MASTER_RECORD_NAME);
+  remove_log_segments();
+}
+
+TEST(ThreadPoolTest, SubmitTest) {
+  ThreadPool pool(4);
+  std::vector<std::future<int> > futures;
+  for (int i = 0; i < 1000; ++i) {
+    futures.emplace_back(pool.submit([](int x) { return x * x; }, i));
+  }
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_EQ(futures[i].get(), i * i);
+  }
+
+  // 任务中的异常在 future.get() 时重新抛出
+  auto failed = pool.submit([] { throw InternalError("task failed"); });
+  EXPECT_THROW(failed.get(), InternalError);
+
+  // 池内线程提交的子任务可以被其他线程窃取，父任务在阻塞区域内等待子任务
+  auto parent = pool.submit([&pool] {
+    EXPECT_TRUE(ThreadPool::in_pool());
+    std::vector<std::future<int> > children;
+    for (int i = 0; i < 64; ++i) {
+      children.emplace_back(pool.submit([i] { return i; }));
+    }
+    int sum = 0;
+    for (auto& child : children) {
+      sum += ThreadPool::wait(child);
+    }
+    return sum;
+  });
+  EXPECT_EQ(parent.get(), 64 * 63 / 2);
+  EXPECT_FALSE(ThreadPool::in_pool());
+}
+
+TEST(ThreadPoolTest, BlockingScopeTest) {
+  // 所有线程都在阻塞区域内等待一个还在队列中的任务，线程池要启动补偿线程
+  // 执行它，否则会一直等下去
+  constexpr int num_threads = 2;
+  ThreadPool pool(num_threads);
+  std::mutex latch;
+  std::condition_variable cv;
+  bool released = false;
+  int blocked = 0;
+  std::vector<std::future<void> > waiters;
+  for (int i = 0; i < num_threads; ++i) {
+    waiters.emplace_back(pool.submit([&] {
+      ThreadPool::BlockingScope scope;
+      std::unique_lock lock(latch);
+      ++blocked;
+      cv.notify_all();
+      cv.wait(lock, [&] { return released; });
+    }));
+  }
+  {
+    std::unique_lock lock(latch);
+    cv.wait(lock, [&] { return blocked == num_threads; });
+  }
+  auto releaser = pool.submit([&] {
+    std::lock_guard lock(latch);
+    released = true;
+    cv.notify_all();
+  });
+  ASSERT_EQ(releaser.wait_for(std::chrono::seconds(10)),
+            std::future_status::ready);
+  for (auto& waiter : waiters) {
+    ASSERT_EQ(waiter.wait_for(std::chrono::seconds(10)),
+              std::future_status::ready);
+    waiter.get();
+  }
+}
+
+TEST(ParallelSeqScanTest, SnapshotReadTest) {
+  const std::string db_name = "ParallelSeqScanTest_db";
+  const std::string tab_name = "t";
+  // 不用前面测试留下脏页的缓冲池
+  BufferPoolManager buffer_pool(TEST_BUFFER_POOL_SIZE, disk_manager.get());
+  RmManager rm_manager(disk_manager.get(), &buffer_pool);
+  IxManager ix_manager(disk_manager.get(), &buffer_pool);
+  SmManager sm_manager(disk_manager.get(), &buffer_pool, &rm_manager,
+                       &ix_manager);
+  if (sm_manager.is_dir(db_name)) {
+    sm_manager.drop_db(db_name);
+  }
+  sm_manager.create_db(db_name);
+  sm_manager.open_db(db_name);
+  sm_manager.create_table(tab_name, {{"a", TYPE_INT, 4}, {"b", TYPE_INT, 4}},
+                          nullptr);
+  auto fh = sm_manager.fhs_.at(tab_name).get();
+
+  // 多个 morsel 的数据，(a, b) = (i, i % 100)
+  constexpr int num_records = 20 * MORSEL_PAGES * 400;
+  std::vector<Rid> rids;
+  for (int i = 0; i < num_records; ++i) {
+    int record[2] = {i, i % 100};
+    rids.push_back(fh->insert_record(reinterpret_cast<char*>(record), nullptr));
+  }
+
+  // 未提交的写事务：插入满足条件的记录，删除一部分记录，
+  // 把一部分记录改得不满足条件
+  LockManager lock_manager;
+  VersionManager version_manager;
+  Transaction writer(1);
+  Context write_context(&lock_manager, nullptr, &writer);
+  write_context.version_mgr_ = &version_manager;
+  for (int i = 0; i < 1000; ++i) {
+    int record[2] = {num_records + i, 0};
+    fh->insert_record(reinterpret_cast<char*>(record), &write_context);
+  }
+  for (int i = 0; i < num_records; i += 3) {
+    auto old_record = fh->get_record(rids[i], nullptr);
+    version_manager.add_version(&writer, fh->GetFd(), rids[i],
+                                old_record.get());
+    if (i % 2 == 0) {
+      fh->delete_record(rids[i], nullptr);
+    } else {
+      int record[2] = {i, 1000};
+      fh->update_record(rids[i], reinterpret_cast<char*>(record), nullptr);
+    }
+  }
+
+  // 快照读到的是写事务之前的数据
+  Transaction reader(2);
+  reader.set_read_ts(1);
+  Context read_context(&lock_manager, nullptr, &reader);
+  read_context.version_mgr_ = &version_manager;
+  Condition cond;
+  cond.agg_type = AGG_COL;
+  cond.lhs_col = {tab_name, "b"};
+  cond.op = OP_LT;
+  cond.is_rhs_val = true;
+  cond.is_sub_query = false;
+  cond.rhs_val.set_int(50);
+  cond.rhs_val.init_raw(sizeof(int));
+  std::multiset<int> expected;
+  for (int i = 0; i < num_records; ++i) {
+    if (i % 100 < 50) {
+      expected.insert(i);
+    }
+  }
+
+  // 串行扫描
+  std::multiset<int> serial;
+  SeqScanExecutor seq_scan(&sm_manager, tab_name, {cond}, &read_context);
+  for (seq_scan.beginTuple(); !seq_scan.is_end(); seq_scan.nextTuple()) {
+    serial.insert(*reinterpret_cast<int*>(seq_scan.Next()->data));
+  }
+  EXPECT_EQ(serial, expected);
+
+  // 并行扫描，exchange 模式和 parallel_for_each 各扫两遍
+  ParallelSeqScanExecutor parallel_scan(&sm_manager, tab_name, {cond},
+                                        &read_context);
+  for (int round = 0; round < 2; ++round) {
+    std::multiset<int> exchanged;
+    for (parallel_scan.beginTuple(); !parallel_scan.is_end();
+         parallel_scan.nextTuple()) {
+      exchanged.insert(*reinterpret_cast<int*>(parallel_scan.Next()->data));
+    }
+    EXPECT_EQ(exchanged, expected);
+
+    std::mutex latch;
+    std::multiset<int> consumed;
+    parallel_scan.parallel_for_each([&](int, const char* data) {
+      std::lock_guard lock(latch);
+      consumed.insert(*reinterpret_cast<const int*>(data));
+    });
+    EXPECT_EQ(consumed, expected);
+  }
+
+  version_manager.abort(&writer);
+  sm_manager.close_db();
+  sm_manager.drop_db(db_name);
+}
+
+TEST(ProjectionTest, ScanProjectionTest) {
+  const std::string db_name = "ProjectionTest_db";
+  const std::string tab_name = "t";
+  BufferPoolManager buffer_pool(TEST_BUFFER_POOL_SIZE, disk_manager.get());
+  RmManager rm_manager(disk_manager.get(), &buffer_pool);
+  IxManager ix_manager(disk_manager.get(), &buffer_pool);
+  SmManager sm_manager(disk_manager.get(), &buffer_pool, &rm_manager,
+                       &ix_manager);
+  if (sm_manager.is_dir(db_name)) {
+    sm_manager.drop_db(db_name);
+  }
+  sm_manager.create_db(db_name);
+  sm_manager.open_db(db_name);
+  // 记录为 (int a, char b[8], int c, float d)
+  struct Row {
+    int a;
+    char b[8];
+    int c;
+    float d;
+  };
+  sm_manager.create_table(tab_name,
+                          {{"a", TYPE_INT, 4},
+                           {"b", TYPE_STRING, 8},
+                           {"c", TYPE_INT, 4},
+                           {"d", TYPE_FLOAT, 4}},
+                          nullptr);
+  auto fh = sm_manager.fhs_.at(tab_name).get();
+  constexpr int num_records = 2000;
+  for (int i = 0; i < num_records; ++i) {
+    Row row{i, {}, -i, i * 0.5f};
+    snprintf(row.b, sizeof(row.b), "b%d", i % 3);
+    fh->insert_record(reinterpret_cast<char*>(&row), nullptr);
+  }
+
+  // 只输出 a, c, d，c 和 d 在表中相邻，合并成一次拷贝
+  auto& tab = sm_manager.db_.get_table(tab_name);
+  ScanProjection projection(tab, {"d", "a", "c"});
+  ASSERT_FALSE(projection.empty());
+  ASSERT_EQ(projection.len(), 12u);
+  std::vector<std::pair<std::string, int> > layout;
+  for (auto& col : projection.cols()) {
+    layout.emplace_back(col.name, col.offset);
+  }
+  EXPECT_EQ(layout, (std::vector<std::pair<std::string, int> >{
+                        {"a", 0}, {"c", 4}, {"d", 8}}));
+  // 引用了全部列时不投影
+  EXPECT_TRUE(ScanProjection(tab, {"a", "b", "c", "d"}).empty());
+
+  // where b = 'b1'，谓词引用的列不输出也能求值
+  Condition cond;
+  cond.agg_type = AGG_COL;
+  cond.lhs_col = {tab_name, "b"};
+  cond.op = OP_EQ;
+  cond.is_rhs_val = true;
+  cond.is_sub_query = false;
+  cond.rhs_val.set_str("b1");
+  cond.rhs_val.init_raw(8);
+  std::multiset<int> expected;
+  for (int i = 0; i < num_records; ++i) {
+    if (i % 3 == 1) {
+      expected.insert(i);
+    }
+  }
+  auto check_tuple = [](const char* data) {
+    int a = *reinterpret_cast<const int*>(data);
+    EXPECT_EQ(*reinterpret_cast<const int*>(data + 4), -a);
+    EXPECT_EQ(*reinterpret_cast<const float*>(data + 8), a * 0.5f);
+    return a;
+  };
+
+  LockManager lock_manager;
+  Transaction txn(1);
+  Context context(&lock_manager, nullptr, &txn);
+  std::vector<std::string> proj_cols{"a", "c", "d"};
+  SeqScanExecutor seq_scan(&sm_manager, tab_name, {cond}, &context, false,
+                           proj_cols);
+  EXPECT_EQ(seq_scan.tupleLen(), 12u);
+  std::multiset<int> serial;
+  for (seq_scan.beginTuple(); !seq_scan.is_end(); seq_scan.nextTuple()) {
+    auto record = seq_scan.Next();
+    ASSERT_EQ(record->size, 12);
+    serial.insert(check_tuple(record->data));
+  }
+  EXPECT_EQ(serial, expected);
+
+  ParallelSeqScanExecutor parallel_scan(&sm_manager, tab_name, {cond},
+                                        &context, proj_cols);
+  EXPECT_EQ(parallel_scan.tupleLen(), 12u);
+  std::multiset<int> parallel;
+  for (parallel_scan.beginTuple(); !parallel_scan.is_end();
+       parallel_scan.nextTuple()) {
+    parallel.insert(check_tuple(parallel_scan.Next()->data));
+  }
+  EXPECT_EQ(parallel, expected);
+
+  sm_manager.close_db();
+  sm_manager.drop_db(db_name);
+}
+
+TEST(AggregateTest, ParallelAggregateTest) {
+  // 分组结果：count(*), sum(v), min(w), max(w)
+  struct Group {
+    int count = 0;
+    int sum = 0;
+    int min = INT32_MAX;
+    int max = INT32_MIN;
+  };
+  // 每组的元组数相同，组号越大 sum(v) 越大
+  constexpr int num_groups = 37;
+  constexpr int num_records = num_groups * 540;
+  auto make_record = [](int i, int* record) {
+    record[0] = i % num_groups;
+    record[1] = i;
+    record[2] = i * 7919 % 1000;
+  };
+  std::map<int, Group> expected;
+  for (int i = 0; i < num_records; ++i) {
+    int record[3];
+    make_record(i, record);
+    auto& group = expected[record[0]];
+    ++group.count;
+    group.sum += record[1];
+    group.min = std::min(group.min, record[2]);
+    group.max = std::max(group.max, record[2]);
+  }
+
+  // 多张线程局部表各自预聚合一部分元组，再按分区合并到第 0 张
+  ColMeta g{"t", "g", TYPE_INT, sizeof(int), 0};
+  AggregateLayout layout;
+  layout.add_key_col(g);
+  int count_slot = layout.add_slot({AGG_COUNT, TYPE_INT, 0, sizeof(int)});
+  int sum_slot = layout.add_slot({AGG_SUM, TYPE_INT, 4, sizeof(int)});
+  int min_slot = layout.add_slot({AGG_MIN, TYPE_INT, 8, sizeof(int)});
+  int max_slot = layout.add_slot({AGG_MAX, TYPE_INT, 8, sizeof(int)});
+  // count(col) 和 count(*) 共用一个槽
+  ASSERT_EQ(layout.add_slot({AGG_COUNT, TYPE_INT, 0, sizeof(int)}),
+            count_slot);
+  constexpr int num_locals = 4;
+  std::vector<std::unique_ptr<PartitionedAggregateTable> > locals;
+  for (int i = 0; i < num_locals; ++i) {
+    locals.emplace_back(std::make_unique<PartitionedAggregateTable>(&layout));
+  }
+  for (int i = 0; i < num_records; ++i) {
+    int record[3];
+    make_record(i, record);
+    locals[i % num_locals]->consume(reinterpret_cast<char*>(record));
+  }
+  for (int part = 0; part < AGG_PARTITIONS; ++part) {
+    for (int i = 1; i < num_locals; ++i) {
+      locals[0]->partition(part).merge(locals[i]->partition(part));
+    }
+  }
+  ASSERT_EQ(locals[0]->size(), expected.size());
+  auto acc_int = [&](const char* acc, int slot) {
+    return *reinterpret_cast<const int*>(acc + layout.slot(slot).acc_offset);
+  };
+  for (int part = 0; part < AGG_PARTITIONS; ++part) {
+    auto& table = locals[0]->partition(part);
+    for (std::size_t i = 0; i < table.capacity(); ++i) {
+      if (!table.occupied(i)) {
+        continue;
+      }
+      int key = *reinterpret_cast<const int*>(table.key_at(i));
+      auto& group = expected.at(key);
+      EXPECT_EQ(acc_int(table.acc_at(i), count_slot), group.count);
+      EXPECT_EQ(acc_int(table.acc_at(i), sum_slot), group.sum);
+      EXPECT_EQ(acc_int(table.acc_at(i), min_slot), group.min);
+      EXPECT_EQ(acc_int(table.acc_at(i), max_slot), group.max);
+    }
+  }
+
+  // 聚合算子：子算子为串行扫描时按批分发给线程池，为并行扫描时由扫描线程预聚合
+  const std::string db_name = "AggregateTest_db";
+  const std::string tab_name = "t";
+  BufferPoolManager buffer_pool(TEST_BUFFER_POOL_SIZE, disk_manager.get());
+  RmManager rm_manager(disk_manager.get(), &buffer_pool);
+  IxManager ix_manager(disk_manager.get(), &buffer_pool);
+  SmManager sm_manager(disk_manager.get(), &buffer_pool, &rm_manager,
+                       &ix_manager);
+  if (sm_manager.is_dir(db_name)) {
+    sm_manager.drop_db(db_name);
+  }
+  sm_manager.create_db(db_name);
+  sm_manager.open_db(db_name);
+  sm_manager.create_table(tab_name,
+                          {{"g", TYPE_INT, 4},
+                           {"v", TYPE_INT, 4},
+                           {"w", TYPE_INT, 4},
+                           {"x", TYPE_INT, 4}},
+                          nullptr);
+  auto fh = sm_manager.fhs_.at(tab_name).get();
+  for (int i = 0; i < num_records; ++i) {
+    int record[4];
+    make_record(i, record);
+    record[3] = -i;  // 不被查询引用，串行扫描可以投影掉
+    fh->insert_record(reinterpret_cast<char*>(record), nullptr);
+  }
+
+  LockManager lock_manager;
+  VersionManager version_manager;
+  Transaction reader(1);
+  reader.set_read_ts(1);
+  Context context(&lock_manager, nullptr, &reader);
+  context.version_mgr_ = &version_manager;
+  // 加锁读的串行扫描，元组直接在页面上投影
+  Transaction locker(2);
+  Context lock_context(&lock_manager, nullptr, &locker);
+
+  // select g, count(*), sum(v), min(w), max(w) from t group by g
+  // having sum(v) > 第 0 组的和，第 0 组的和最小，被过滤掉
+  std::vector<TabCol> sel_cols{{tab_name, "g"}, {}, {tab_name, "v"},
+                               {tab_name, "w"}, {tab_name, "w"}};
+  std::vector<AggType> agg_types{AGG_COL, AGG_COUNT, AGG_SUM, AGG_MIN,
+                                 AGG_MAX};
+  Condition having;
+  having.agg_type = AGG_SUM;
+  having.lhs_col = {tab_name, "v"};
+  having.op = OP_GT;
+  having.is_rhs_val = true;
+  having.is_sub_query = false;
+  having.rhs_val.set_int(expected.at(0).sum);
+  having.rhs_val.init_raw(sizeof(int));
+  expected.erase(0);
+
+  // 依次为快照读的串行扫描、加锁读并投影的串行扫描、并行扫描
+  for (int mode = 0; mode < 3; ++mode) {
+    std::unique_ptr<AbstractExecutor> scan;
+    if (mode == 0) {
+      scan = std::make_unique<SeqScanExecutor>(
+          &sm_manager, tab_name, std::vector<Condition>{}, &context);
+    } else if (mode == 1) {
+      scan = std::make_unique<SeqScanExecutor>(
+          &sm_manager, tab_name, std::vector<Condition>{}, &lock_context,
+          false, std::vector<std::string>{"g", "v", "w"});
+    } else {
+      scan = std::make_unique<ParallelSeqScanExecutor>(
+          &sm_manager, tab_name, std::vector<Condition>{}, &context);
+    }
+    AggregateExecutor aggregate(std::move(scan), sel_cols, agg_types,
+                                {{tab_name, "g"}}, {having}, &context);
+    // 执行两遍，第二遍要清空上一遍的结果
+    for (int round = 0; round < 2; ++round) {
+      std::map<int, Group> result;
+      for (aggregate.beginTuple(); !aggregate.is_end(); aggregate.nextTuple()) {
+        int row[5];
+        memcpy(row, aggregate.Next()->data, sizeof(row));
+        ASSERT_EQ(result.count(row[0]), 0u);
+        result[row[0]] = {row[1], row[2], row[3], row[4]};
+      }
+      ASSERT_EQ(result.size(), expected.size());
+      for (auto& [key, group] : expected) {
+        auto& actual = result.at(key);
+        EXPECT_EQ(actual.count, group.count) << key;
+        EXPECT_EQ(actual.sum, group.sum) << key;
+        EXPECT_EQ(actual.min, group.min) << key;
+        EXPECT_EQ(actual.max, group.max) << key;
+      }
+    }
+  }
+
+  sm_manager.close_db();
+  sm_manager.drop_db(db_name);
+}
+
+TEST(IndexBatchTest, UpdateDeleteTest) {
+  const std::string db_name = "IndexBatchTest_db";
+  std::string tab_name = "t";
+  BufferPoolManager buffer_pool(TEST_BUFFER_POOL_SIZE, disk_manager.get());
+  RmManager rm_manager(disk_manager.get(), &buffer_pool);
+  IxManager ix_manager(disk_manager.get(), &buffer_pool);
+  SmManager sm_manager(disk_manager.get(), &buffer_pool, &rm_manager,
+                       &ix_manager);
+  if (sm_manager.is_dir(db_name)) {
+    sm_manager.drop_db(db_name);
+  }
+  sm_manager.create_db(db_name);
+  sm_manager.open_db(db_name);
+  sm_manager.create_table(tab_name, {{"a", TYPE_INT, 4}, {"b", TYPE_INT, 4}},
+                          nullptr);
+  // a 上是唯一索引，b 上是非唯一索引
+  std::vector<std::string> unique_cols{"a"};
+  std::vector<std::string> non_unique_cols{"b"};
+  sm_manager.create_index(tab_name, unique_cols, nullptr);
+  sm_manager.create_index(tab_name, non_unique_cols, nullptr, false);
+  auto& tab = sm_manager.db_.get_table(tab_name);
+  auto fh = sm_manager.fhs_.at(tab_name).get();
+  constexpr int num_records = 3000;
+  std::vector<Rid> rids;
+  Transaction loader(0);
+  for (int i = 0; i < num_records; ++i) {
+    int record[2] = {i, i % 50};
+    auto rid = fh->insert_record(reinterpret_cast<char*>(record), nullptr);
+    rids.emplace_back(rid);
+    for (auto& [ix_name, index] : tab.indexes) {
+      std::vector<char> key(index.key_len);
+      index.get_key(reinterpret_cast<char*>(record), rid, key.data());
+      sm_manager.ihs_.at(ix_name)->insert_entry(key.data(), rid, &loader);
+    }
+  }
+  // 每个索引上都能按记录修改后的值找到它，按修改前的值找不到
+  auto check_indexes = [&](const std::vector<bool>& is_deleted) {
+    for (int i = 0; i < num_records; ++i) {
+      int current[2] = {i + 1, i % 50 + 1000};
+      int old[2] = {i, i % 50};
+      for (auto& [ix_name, index] : tab.indexes) {
+        auto* ih = sm_manager.ihs_.at(ix_name).get();
+        std::vector<char> key(index.key_len);
+        std::vector<Rid> result;
+        index.get_key(reinterpret_cast<char*>(current), rids[i], key.data());
+        ASSERT_EQ(ih->get_value(key.data(), &result, nullptr), !is_deleted[i])
+            << ix_name << " " << i;
+        if (!is_deleted[i]) {
+          EXPECT_EQ(result[0], rids[i]);
+        }
+        // 唯一索引上的旧值可能被前一条记录占用
+        index.get_key(reinterpret_cast<char*>(old), rids[i], key.data());
+        result.clear();
+        EXPECT_FALSE(ih->get_value(key.data(), &result, nullptr) &&
+                     result[0] == rids[i])
+            << ix_name << " " << i;
+      }
+    }
+  };
+
+  DiskManager log_disk_manager;
+  LogManager log_manager(&log_disk_manager);
+  LockManager lock_manager;
+  Transaction txn(1);
+  Context context(&lock_manager, &log_manager, &txn);
+  auto make_value = [](int v) {
+    Value value;
+    value.set_int(v);
+    value.init_raw(sizeof(int));
+    return value;
+  };
+
+  // update t set a = a + 1, b = b + 1000，从 a 最大的记录开始修改，
+  // 每条记录的新 a 都是前面修改过的记录在本语句中删除的 key
+  std::vector<SetClause> set_clauses{{{tab_name, "a"}, make_value(1), true},
+                                     {{tab_name, "b"}, make_value(1000), true}};
+  UpdateExecutor update(&sm_manager, tab_name, set_clauses,
+                        {rids.rbegin(), rids.rend()}, true, &context);
+  update.Next();
+  check_indexes(std::vector<bool>(num_records, false));
+
+  // 两条记录改成同一个 a，第二条与本语句前面插入的 key 冲突
+  std::vector<SetClause> conflict{{{tab_name, "a"}, make_value(0), false}};
+  UpdateExecutor conflict_update(&sm_manager, tab_name, conflict,
+                                 {rids[0], rids[1]}, true, &context);
+  EXPECT_THROW(conflict_update.Next(), NonUniqueIndexError);
+  // 语句失败后由事务回滚，这里直接恢复已经改掉的第一条记录
+  int record[2] = {1, 1000};
+  fh->update_record(rids[0], reinterpret_cast<char*>(record), nullptr);
+
+  // 删除偶数行
+  std::vector<Rid> deleted;
+  std::vector<bool> is_deleted(num_records, false);
+  for (int i = 0; i < num_records; i += 2) {
+    deleted.emplace_back(rids[i]);
+    is_deleted[i] = true;
+  }
+  DeleteExecutor delete_executor(&sm_manager, tab_name, deleted, &context);
+  delete_executor.Next();
+  check_indexes(is_deleted);
+
+  // 与提交时一样释放写集
+  for (auto* write_record : *txn.get_write_set()) {
+    delete write_record;
+  }
+  sm_manager.close_db();
+  sm_manager.drop_db(db_name);
+}
+
+TEST(RecoveryTest, LoserUniqueKeyLockTest) {
+  const std::string db_name = "RecoveryTest_db";
+  std::string tab_name = "t";
+  BufferPoolManager buffer_pool(TEST_BUFFER_POOL_SIZE, disk_manager.get());
+  RmManager rm_manager(disk_manager.get(), &buffer_pool);
+  IxManager ix_manager(disk_manager.get(), &buffer_pool);
+  SmManager sm_manager(disk_manager.get(), &buffer_pool, &rm_manager,
+                       &ix_manager);
+  if (sm_manager.is_dir(db_name)) {
+    sm_manager.drop_db(db_name);
+  }
+  sm_manager.create_db(db_name);
+  sm_manager.open_db(db_name);
+  sm_manager.create_table(tab_name, {{"a", TYPE_INT, 4}, {"b", TYPE_INT, 4}},
+                          nullptr);
+  std::vector<std::string> index_cols{"a"};
+  sm_manager.create_index(tab_name, index_cols, nullptr);
+  auto& tab = sm_manager.db_.get_table(tab_name);
+  auto& index_meta = tab.indexes.begin()->second;
+  auto fh = sm_manager.fhs_.at(tab_name).get();
+  auto make_record = [](int a, int b) {
+    RmRecord record(2 * sizeof(int));
+    memcpy(record.data, &a, sizeof(int));
+    memcpy(record.data + sizeof(int), &b, sizeof(int));
+    return record;
+  };
+
+  {
+    DiskManager log_disk_manager;
+    LogManager log_manager(&log_disk_manager);
+    LockManager lock_manager;
+    TransactionManager transaction_manager(&lock_manager, &sm_manager);
+    RecoveryManager recovery_manager(&log_disk_manager, &buffer_pool,
+                                     &sm_manager, &log_manager,
+                                     &transaction_manager);
+    // 崩溃前没有提交的事务 1 删除了 a = 1，把 a = 2 改成了 a = 3
+    auto deleted = make_record(1, 0);
+    auto original = make_record(2, 0);
+    auto updated = make_record(3, 0);
+    auto rid = fh->insert_record(updated.data, nullptr);
+    BeginLogRecord begin_log_record(1);
+    lsn_t lsn = log_manager.add_log_to_buffer(&begin_log_record);
+    DeleteLogRecord delete_log_record(1, deleted, Rid{1, 1}, tab.id);
+    delete_log_record.prev_lsn_ = lsn;
+    lsn = log_manager.add_log_to_buffer(&delete_log_record);
+    UpdateLogRecord update_log_record(1, original, updated, rid, tab.id);
+    update_log_record.prev_lsn_ = lsn;
+    lsn = log_manager.add_log_to_buffer(&update_log_record);
+    log_manager.flush_log_to_disk();
+
+    Transaction loser(1);
+    std::set<std::pair<std::string, std::string> > locked_keys;
+    recovery_manager.lock_loser(&loser, lsn, &locked_keys);
+    EXPECT_EQ(locked_keys.size(), 2);
+
+    // 重启后的新事务不能插入回滚时要恢复的唯一键
+    Transaction txn(2);
+    auto is_safe = [&](int a) {
+      RmRecord key(index_meta.col_tot_len);
+      memcpy(key.data, &a, sizeof(int));
+      try {
+        return lock_manager.isSafeInGap(&txn, index_meta, key, fh->GetFd());
+      } catch (TransactionAbortException&) {
+        return false;
+      }
+    };
+    EXPECT_FALSE(is_safe(1));
+    EXPECT_FALSE(is_safe(2));
+    EXPECT_TRUE(is_safe(4));
+    // 回滚结束、释放锁之后就可以插入
+    for (auto& lock_data_id : *loser.get_lock_set()) {
+      lock_manager.unlock(&loser, lock_data_id);
+    }
+    EXPECT_TRUE(is_safe(1));
+    EXPECT_TRUE(is_safe(2));
+  }
+  sm_manager.close_db();
+  sm_manager.drop_db(db_name);
+}
+
+TEST(RecoveryTest, CheckpointCrashRecoveryTest) {
+  const std::string db_name = "CheckpointRecoveryTest_db";
+  std::string tab_name = "t";
+  std::vector<std::string> index_cols{"a"};
+  constexpr int num_records = 2000;
+
+  // 可见的记录 a -> rid，以及崩溃恢复后应该看到的 a -> b
+  std::map<int, Rid> rids;
+  std::map<int, int> expected;
+  // 只由失败者写入的 key，恢复后不能在索引中找到
+  std::vector<int> loser_keys;
+
+  // 崩溃：缓冲池中的脏页不写回，直接关闭文件
+  auto crash = [](SmManager* sm_manager) {
+    for (auto& [_, fh] : sm_manager->fhs_) {
+      std::ignore = _;
+      disk_manager->close_file(fh->GetFd());
+    }
+    for (auto& [_, ih] : sm_manager->ihs_) {
+      std::ignore = _;
+      disk_manager->close_file(ih->fd_);
+    }
+    sm_manager->fhs_.clear();
+    sm_manager->ihs_.clear();
+    sm_manager->db_.name_.clear();
+    sm_manager->db_.tabs_.clear();
+    ASSERT_EQ(chdir(".."), 0);
+  };
+
+  // 崩溃之前：事务 1 插入并提交；事务 2 在第一个检查点前后修改、删除、
+  // 插入并提交；事务 3 在第二个检查点前后修改、删除、插入，没有提交
+  {
+    BufferPoolManager buffer_pool(TEST_BUFFER_POOL_SIZE, disk_manager.get());
+    RmManager rm_manager(disk_manager.get(), &buffer_pool);
+    IxManager ix_manager(disk_manager.get(), &buffer_pool);
+    SmManager sm_manager(disk_manager.get(), &buffer_pool, &rm_manager,
+                         &ix_manager);
+    if (sm_manager.is_dir(db_name)) {
+      sm_manager.drop_db(db_name);
+    }
+    sm_manager.create_db(db_name);
+    sm_manager.open_db(db_name);
+    sm_manager.create_table(tab_name, {{"a", TYPE_INT, 4}, {"b", TYPE_INT, 4}},
+                            nullptr);
+    sm_manager.create_index(tab_name, index_cols, nullptr);
+    sm_manager.flush_meta();
+
+    DiskManager log_disk_manager;
+    LogManager log_manager(&log_disk_manager);
+    LockManager lock_manager;
+    VersionManager version_manager;
+    TransactionManager transaction_manager(&lock_manager, &sm_manager,
+                                           &version_manager);
+    CheckpointManager checkpoint_manager(&buffer_pool, &sm_manager,
+                                         &log_manager, &transaction_manager);
+
+    Transaction txns[3] = {Transaction(1), Transaction(2), Transaction(3)};
+    std::vector<std::unique_ptr<Context> > contexts;
+    for (auto& txn : txns) {
+      contexts.emplace_back(
+          std::make_unique<Context>(&lock_manager, &log_manager, &txn));
+      contexts.back()->version_mgr_ = &version_manager;
+    }
+    auto insert = [&](Context* context, int a, int b) {
+      std::vector<Value> values(2);
+      values[0].set_int(a);
+      values[1].set_int(b);
+      InsertExecutor executor(&sm_manager, tab_name, values, context);
+      executor.Next();
+      rids[a] = executor.rid();
+    };
+    // 把满足 pred 的可见记录的 col 加上 delta，a 是索引列
+    auto update = [&](Context* context, const std::string& col, int delta,
+                      auto pred) {
+      std::vector<Rid> targets;
+      std::map<int, Rid> updated;
+      for (auto it = rids.begin(); it != rids.end();) {
+        if (pred(it->first)) {
+          targets.push_back(it->second);
+          if (col == "a") {
+            updated[it->first + delta] = it->second;
+            it = rids.erase(it);
+            continue;
+          }
+        }
+        ++it;
+      }
+      Value value;
+      value.set_int(delta);
+      value.init_raw(sizeof(int));
+      UpdateExecutor executor(&sm_manager, tab_name,
+                              {SetClause({tab_name, col}, value, true)},
+                              targets, col == "a", context);
+      executor.Next();
+      rids.merge(updated);
+    };
+    auto remove = [&](Context* context, auto pred) {
+      std::vector<Rid> targets;
+      for (auto it = rids.begin(); it != rids.end();) {
+        if (pred(it->first)) {
+          targets.push_back(it->second);
+          it = rids.erase(it);
+        } else {
+          ++it;
+        }
+      }
+      DeleteExecutor executor(&sm_manager, tab_name, targets, context);
+      executor.Next();
+    };
+
+    transaction_manager.begin(&txns[0], &log_manager);
+    for (int a = 0; a < num_records; ++a) {
+      insert(contexts[0].get(), a, a);
+    }
+    transaction_manager.commit(&txns[0], &log_manager);
+
+    transaction_manager.begin(&txns[1], &log_manager);
+    update(contexts[1].get(), "b", 1000000, [](int a) { return a % 5 == 0; });
+    checkpoint_manager.checkpoint();
+    remove(contexts[1].get(), [](int a) { return a % 7 == 0; });
+    for (int a = num_records; a < num_records + 200; ++a) {
+      insert(contexts[1].get(), a, a);
+    }
+    transaction_manager.commit(&txns[1], &log_manager);
+    for (auto& [a, _] : rids) {
+      std::ignore = _;
+      expected[a] = a < num_records && a % 5 == 0 ? a + 1000000 : a;
+    }
+
+    transaction_manager.begin(&txns[2], &log_manager);
+    for (int a = 2 * num_records; a < 2 * num_records + 200; ++a) {
+      insert(contexts[2].get(), a, a);
+      loser_keys.push_back(a);
+    }
+    update(contexts[2].get(), "b", 7, [](int a) { return a % 3 == 0; });
+    update(contexts[2].get(), "a", 10 * num_records,
+           [](int a) { return a < num_records && a % 11 == 0; });
+    remove(contexts[2].get(), [](int a) { return a % 13 == 0; });
+    // 第二个检查点把失败者修改过的页面写回磁盘，恢复时要回滚磁盘上的修改
+    checkpoint_manager.checkpoint();
+    for (int a = 3 * num_records; a < 3 * num_records + 100; ++a) {
+      insert(contexts[2].get(), a, a);
+      loser_keys.push_back(a);
+    }
+    remove(contexts[2].get(), [](int a) { return a % 17 == 1; });
+    update(contexts[2].get(), "b", 5, [](int a) { return a % 19 == 2; });
+    log_manager.flush_log_to_disk();
+    for (auto& [a, _] : rids) {
+      std::ignore = _;
+      if (a >= 10 * num_records) {
+        loser_keys.push_back(a);
+      }
+    }
+
+    crash(&sm_manager);
+    for (auto& txn : txns) {
+      TransactionManager::txn_map.erase(txn.get_transaction_id());
+    }
+  }
+
+  // 恢复之后只能看到提交的事务的修改，唯一索引与表一致
+  auto check = [&](SmManager* sm_manager) {
+    auto fh = sm_manager->fhs_.at(tab_name).get();
+    std::map<int, int> actual;
+    std::map<int, Rid> actual_rids;
+    for (RmScan scan(fh); !scan.is_end(); scan.next()) {
+      auto record = fh->get_record(scan.rid(), nullptr);
+      int a = *reinterpret_cast<int*>(record->data);
+      EXPECT_EQ(actual.count(a), 0u) << a;
+      actual[a] = *reinterpret_cast<int*>(record->data + sizeof(int));
+      actual_rids[a] = scan.rid();
+    }
+    EXPECT_EQ(actual, expected);
+
+    auto& ih = sm_manager->ihs_.at(
+        sm_manager->get_ix_manager()->get_index_name(tab_name, index_cols));
+    for (auto& [a, rid] : actual_rids) {
+      std::vector<Rid> result;
+      ASSERT_TRUE(ih->get_value(reinterpret_cast<const char*>(&a), &result,
+                                nullptr))
+          << a;
+      EXPECT_EQ(result[0], rid) << a;
+    }
+    for (int a : loser_keys) {
+      std::vector<Rid> result;
+      EXPECT_FALSE(ih->get_value(reinterpret_cast<const char*>(&a), &result,
+                                 nullptr))
+          << a;
+    }
+  };
+
+  // 第一次恢复之后马上再崩溃一次，第二次恢复不能重复回滚
+  for (int restart = 0; restart < 2; ++restart) {
+    BufferPoolManager buffer_pool(TEST_BUFFER_POOL_SIZE, disk_manager.get());
+    RmManager rm_manager(disk_manager.get(), &buffer_pool);
+    IxManager ix_manager(disk_manager.get(), &buffer_pool);
+    SmManager sm_manager(disk_manager.get(), &buffer_pool, &rm_manager,
+                         &ix_manager);
+    sm_manager.open_db(db_name);
+    DiskManager log_disk_manager;
+    LogManager log_manager(&log_disk_manager);
+    LockManager lock_manager;
+    VersionManager version_manager;
+    TransactionManager transaction_manager(&lock_manager, &sm_manager,
+                                           &version_manager);
+    RecoveryManager recovery_manager(&log_disk_manager, &buffer_pool,
+                                     &sm_manager, &log_manager,
+                                     &transaction_manager);
+    recovery_manager.analyze();
+    recovery_manager.redo();
+    recovery_manager.undo();
+    recovery_manager.wait_for_undo();
+    check(&sm_manager);
+    if (restart == 0) {
+      crash(&sm_manager);
+    } else {
+      sm_manager.close_db();
+    }
+  }
+  // 正常关闭之后不需要恢复
+  {
+    BufferPoolManager buffer_pool(TEST_BUFFER_POOL_SIZE, disk_manager.get());
+    RmManager rm_manager(disk_manager.get(), &buffer_pool);
+    IxManager ix_manager(disk_manager.get(), &buffer_pool);
+    SmManager sm_manager(disk_manager.get(), &buffer_pool, &rm_manager,
+                         &ix_manager);
+    sm_manager.open_db(db_name);
+    check(&sm_manager);
+    sm_manager.close_db();
+    sm_manager.drop_db(db_name);
+  }
+}
+
+TEST(RecoveryTest, ParallelRedoBackgroundUndoTest) {
+  const std::string db_name = "ParallelRedoTest_db";
+  const std::vector<std::string> tab_names{"t0", "t1", "t2"};
+  constexpr int num_records = 500;
+  constexpr txn_id_t loser_id = 2;
+  // 每张表中 a -> rid
+  std::vector<std::map<int, Rid> > rids(tab_names.size());
+
+  // 崩溃之前：事务 1 在三张表中插入并提交；事务 2 修改 t0、删除 t1、
+  // 插入 t2，没有提交。缓冲池中的脏页不写回
+  {
+    BufferPoolManager buffer_pool(TEST_BUFFER_POOL_SIZE, disk_manager.get());
+    RmManager rm_manager(disk_manager.get(), &buffer_pool);
+    IxManager ix_manager(disk_manager.get(), &buffer_pool);
+    SmManager sm_manager(disk_manager.get(), &buffer_pool, &rm_manager,
+                         &ix_manager);
+    if (sm_manager.is_dir(db_name)) {
+      sm_manager.drop_db(db_name);
+    }
+    sm_manager.create_db(db_name);
+    sm_manager.open_db(db_name);
+    for (auto tab_name : tab_names) {
+      std::vector<std::string> index_cols{"a"};
+      sm_manager.create_table(tab_name,
+                              {{"a", TYPE_INT, 4}, {"b", TYPE_INT, 4}},
+                              nullptr);
+      sm_manager.create_index(tab_name, index_cols, nullptr);
+    }
+    sm_manager.flush_meta();
+
+    DiskManager log_disk_manager;
+    LogManager log_manager(&log_disk_manager);
+    LockManager lock_manager;
+    VersionManager version_manager;
+    TransactionManager transaction_manager(&lock_manager, &sm_manager,
+                                           &version_manager);
+    Transaction winner(1);
+    Transaction loser(loser_id);
+    Context winner_context(&lock_manager, &log_manager, &winner);
+    Context loser_context(&lock_manager, &log_manager, &loser);
+    winner_context.version_mgr_ = &version_manager;
+    loser_context.version_mgr_ = &version_manager;
+    auto insert = [&](Context* context, int tab, int a) {
+      std::vector<Value> values(2);
+      values[0].set_int(a);
+      values[1].set_int(a);
+      InsertExecutor executor(&sm_manager, tab_names[tab], values, context);
+      executor.Next();
+      rids[tab][a] = executor.rid();
+    };
+
+    transaction_manager.begin(&winner, &log_manager);
+    for (int tab = 0; tab < static_cast<int>(tab_names.size()); ++tab) {
+      for (int a = 0; a < num_records; ++a) {
+        insert(&winner_context, tab, a);
+      }
+    }
+    transaction_manager.commit(&winner, &log_manager);
+
+    transaction_manager.begin(&loser, &log_manager);
+    std::vector<Rid> updated;
+    std::vector<Rid> deleted;
+    for (int a = 0; a < num_records; ++a) {
+      if (a % 2 == 0) {
+        updated.push_back(rids[0][a]);
+      }
+      if (a % 3 == 0) {
+        deleted.push_back(rids[1][a]);
+      }
+    }
+    Value delta;
+    delta.set_int(1000);
+    delta.init_raw(sizeof(int));
+    UpdateExecutor update(&sm_manager, tab_names[0],
+                          {SetClause({tab_names[0], "b"}, delta, true)},
+                          updated, false, &loser_context);
+    update.Next();
+    DeleteExecutor remove(&sm_manager, tab_names[1], deleted, &loser_context);
+    remove.Next();
+    for (int a = num_records; a < num_records + 100; ++a) {
+      insert(&loser_context, 2, a);
+    }
+    log_manager.flush_log_to_disk();
+
+    for (auto& [_, fh] : sm_manager.fhs_) {
+      std::ignore = _;
+      disk_manager->close_file(fh->GetFd());
+    }
+    for (auto& [_, ih] : sm_manager.ihs_) {
+      std::ignore = _;
+      disk_manager->close_file(ih->fd_);
+    }
+    sm_manager.fhs_.clear();
+    sm_manager.ihs_.clear();
+    sm_manager.db_.name_.clear();
+    sm_manager.db_.tabs_.clear();
+    ASSERT_EQ(chdir(".."), 0);
+    for (auto* write_record : *loser.get_write_set()) {
+      delete write_record;
+    }
+    TransactionManager::txn_map.erase(winner.get_transaction_id());
+    TransactionManager::txn_map.erase(loser.get_transaction_id());
+  }
+
+  BufferPoolManager buffer_pool(TEST_BUFFER_POOL_SIZE, disk_manager.get());
+  RmManager rm_manager(disk_manager.get(), &buffer_pool);
+  IxManager ix_manager(disk_manager.get(), &buffer_pool);
+  SmManager sm_manager(disk_manager.get(), &buffer_pool, &rm_manager,
+                       &ix_manager);
+  sm_manager.open_db(db_name);
+  DiskManager log_disk_manager;
+  LogManager log_manager(&log_disk_manager);
+  LockManager lock_manager;
+  VersionManager version_manager;
+  TransactionManager transaction_manager(&lock_manager, &sm_manager,
+                                         &version_manager);
+  RecoveryManager recovery_manager(&log_disk_manager, &buffer_pool,
+                                   &sm_manager, &log_manager,
+                                   &transaction_manager);
+  std::vector<RmFileHandle*> fhs;
+  for (auto& tab_name : tab_names) {
+    fhs.push_back(sm_manager.fhs_.at(tab_name).get());
+  }
+
+  // 每张表一个重做流
+  recovery_manager.analyze();
+  EXPECT_EQ(recovery_manager.redo_streams_.size(), tab_names.size());
+  recovery_manager.redo();
+
+  // 失败者最后插入的记录所在的页面被占住，后台回滚停在第一条日志上
+  auto* blocked_page = buffer_pool.fetch_page(
+      {fhs[2]->GetFd(), rids[2].at(num_records + 99).page_no});
+  blocked_page->WLatch();
+  recovery_manager.undo();
+
+  // 回滚还没有做，但失败者的锁已经加好：新事务与它冲突时回滚而不是等待
+  Rid updated_rid = rids[0].at(0);
+  Rid untouched_rid = rids[0].at(1);
+  EXPECT_EQ(*reinterpret_cast<int*>(
+                fhs[0]->get_record(updated_rid, nullptr)->data + sizeof(int)),
+            1000);
+  Transaction young(loser_id + 100);
+  EXPECT_THROW(lock_manager.lock_exclusive_on_record(&young, updated_rid,
+                                                     fhs[0]->GetFd()),
+               TransactionAbortException);
+  EXPECT_TRUE(lock_manager.lock_exclusive_on_record(&young, untouched_rid,
+                                                    fhs[0]->GetFd()));
+  for (auto& lock_data_id : *young.get_lock_set()) {
+    lock_manager.unlock(&young, lock_data_id);
+  }
+  // 快照读看到失败者修改和删除之前的记录，看不到它插入的记录。
+  // 传入堆上的当前记录，t2 的页面被占住，直接构造
+  auto read = [&](int tab, const Rid& rid,
+                  std::unique_ptr<RmRecord> current) {
+    EXPECT_TRUE(version_manager.get_visible(fhs[tab]->GetFd(), rid,
+                                            INT32_MAX, &current));
+    return current;
+  };
+  auto before_update =
+      read(0, updated_rid, fhs[0]->get_record(updated_rid, nullptr));
+  ASSERT_NE(before_update, nullptr);
+  EXPECT_EQ(*reinterpret_cast<int*>(before_update->data + sizeof(int)), 0);
+  auto before_delete = read(1, rids[1].at(3), nullptr);
+  ASSERT_NE(before_delete, nullptr);
+  EXPECT_EQ(*reinterpret_cast<int*>(before_delete->data), 3);
+  int inserted[2] = {num_records, num_records};
+  EXPECT_EQ(read(2, rids[2].at(num_records),
+                 std::make_unique<RmRecord>(sizeof(inserted),
+                                            reinterpret_cast<char*>(inserted))),
+            nullptr);
+
+  blocked_page->WUnlatch();
+  buffer_pool.unpin_page(blocked_page->get_page_id(), false);
+  recovery_manager.wait_for_undo();
+
+  // 回滚结束后三张表和它们的索引都回到事务 1 提交后的状态，锁已经释放
+  for (int tab = 0; tab < static_cast<int>(tab_names.size()); ++tab) {
+    std::map<int, Rid> actual;
+    for (RmScan scan(fhs[tab]); !scan.is_end(); scan.next()) {
+      auto record = fhs[tab]->get_record(scan.rid(), nullptr);
+      int a = *reinterpret_cast<int*>(record->data);
+      EXPECT_EQ(*reinterpret_cast<int*>(record->data + sizeof(int)), a);
+      actual[a] = scan.rid();
+    }
+    ASSERT_EQ(actual.size(), static_cast<size_t>(num_records)) << tab;
+    auto& ih = sm_manager.ihs_.at(ix_manager.get_index_name(
+        tab_names[tab], std::vector<std::string>{"a"}));
+    for (auto& [a, rid] : actual) {
+      std::vector<Rid> result;
+      ASSERT_TRUE(
+          ih->get_value(reinterpret_cast<const char*>(&a), &result, nullptr))
+          << tab << " " << a;
+      EXPECT_EQ(result[0], rid);
+    }
+    int inserted = num_records;
+    std::vector<Rid> result;
+    EXPECT_FALSE(ih->get_value(reinterpret_cast<const char*>(&inserted),
+                               &result, nullptr));
+  }
+  Transaction later(loser_id + 101);
+  EXPECT_TRUE(lock_manager.lock_exclusive_on_record(&later, updated_rid,
+                                                    fhs[0]->GetFd()));
+  for (auto& lock_data_id : *later.get_lock_set()) {
+    lock_manager.unlock(&later, lock_data_id);
+  }
+
+  sm_manager.close_db();
+  sm_manager.drop_db(db_name);
+}